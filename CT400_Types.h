@@ -1,4 +1,8 @@
+#if defined (_MSC_VER) || defined (__BORLANDC__)
 typedef __int32 int32_t;
 typedef unsigned __int32 uint32_t;
 typedef __int64 int64_t;
-typedef unsigned __int64 uint64_t;
\ No newline at end of file
+typedef unsigned __int64 uint64_t;
+#else
+#include <stdint.h>
+#endif
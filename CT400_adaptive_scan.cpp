@@ -0,0 +1,291 @@
+//------------------------------------------------------------------------------
+// CT400_adaptive_scan.cpp
+//
+// Survey, region search and fine sweeps. The regions come from the sync
+// arrays of the survey (a 1 pm sample step at 100 nm/s whatever the survey
+// resolution), and only the resampled survey arrays are kept for the merged
+// spectrum, so a run holds the fine points of the regions and a few hundred
+// survey points rather than a fine sweep of the whole range.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_adaptive_scan.h"
+#include "CT400_device.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds(Clock::time_point tFrom, Clock::time_point tTo)
+{
+	return std::chrono::duration<double>(tTo - tFrom).count();
+}
+
+// Points of a resampled sweep of the range, as the DLL rounds them
+int32_t resampledPoints(double dMin, double dMax, uint32_t uiResolution)
+{
+	return (int32_t)std::floor((dMax - dMin) * 1000.0 / uiResolution + 1e-6) + 1;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultAdaptiveSettings(
+rAdaptiveSettings *pSettings)
+{
+	if (pSettings == nullptr)
+		return -1;
+	std::memset(pSettings, 0, sizeof(*pSettings));
+	pSettings->iCoarseSpeed = 100;
+	pSettings->uiCoarseResolution = 250;
+	pSettings->iFineSpeed = 10;
+	pSettings->uiFineResolution = 1;
+	pSettings->dWindowFwhm = 5.0;
+	pSettings->dMargin = 0.05;
+	pSettings->dSweepOverhead = 1.0;
+	return CT400_DefaultResonanceSettings(&pSettings->resonance);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_AdaptiveScan(uint64_t uiHandle,
+const rScanConfig *pConfig, const rAdaptiveSettings *pSettings,
+double dWavelength[], double dBlock[], int32_t iArraySize,
+rAdaptiveSegment pSegments[], int32_t iMaxSegments, rAdaptiveReport *pReport)
+{
+	if (pConfig == nullptr || iArraySize < 0 || iMaxSegments < 0
+		|| (iArraySize > 0 && (dWavelength == nullptr || dBlock == nullptr))
+		|| (iMaxSegments > 0 && pSegments == nullptr))
+		return -1;
+	rAdaptiveSettings settings;
+	if (pSettings)
+		settings = *pSettings;
+	else
+		CT400_DefaultAdaptiveSettings(&settings);
+
+	ct400::AdaptiveScan scan(uiHandle, *pConfig, settings);
+	ct400::AdaptiveSpectrum spectrum;
+	int32_t iPoints = scan.run(spectrum);
+	if (iPoints < 0)
+		return -1;
+	const size_t uiCopy = std::min<size_t>(iPoints, iArraySize);
+	std::copy(spectrum.data.wavelength(), spectrum.data.wavelength() + uiCopy, dWavelength);
+	for (size_t d = 0; d < spectrum.data.detectors().size(); d++)
+		std::copy(spectrum.data.row(d), spectrum.data.row(d) + uiCopy, dBlock + d * iArraySize);
+	std::copy(spectrum.segments.begin(),
+		spectrum.segments.begin() + std::min<size_t>(spectrum.segments.size(), iMaxSegments), pSegments);
+	if (pReport)
+		*pReport = spectrum.report;
+	return iPoints;
+}
+
+}
+
+
+namespace ct400
+{
+
+RegionFinder resonanceRegions(const rAdaptiveSettings &settings)
+{
+	auto analyser = std::make_shared<ResonanceAnalyser>();
+	auto found = std::make_shared<std::vector<rResonance> >();
+	return [settings, analyser, found](const ScanBuffer &survey, std::vector<Region> &regions) {
+		// DE_5 is a voltage, not a spectrum
+		std::vector<rDetector> detectors;
+		std::vector<const double *> rows;
+		for (size_t d = 0; d < survey.detectors().size(); d++)
+			if (survey.detectors()[d] != DE_5) {
+				detectors.push_back(survey.detectors()[d]);
+				rows.push_back(survey.row(d));
+			}
+		if (analyser->analyse(survey.wavelength(), detectors.data(), rows.data(), rows.size(), survey.points(),
+			settings.resonance, *found) < 0)
+			return;
+		for (const rResonance &r : *found) {
+			double dHalf = settings.dWindowFwhm * r.dFwhm + settings.dMargin;
+			regions.push_back(Region{ r.dWavelength - dHalf, r.dWavelength + dHalf });
+		}
+	};
+}
+
+AdaptiveScan::AdaptiveScan(uint64_t uiHandle, const rScanConfig &config, const rAdaptiveSettings &settings,
+	RegionFinder finder)
+	: m_device(Device::forHandle(uiHandle)), m_config(config), m_settings(settings),
+	m_finder(finder ? std::move(finder) : resonanceRegions(settings)), m_detectors(enabledDetectors(config))
+{
+}
+
+int32_t AdaptiveScan::sweep(const rScanConfig &config, ScanBuffer *pSync, ScanBuffer &resampled,
+	double &dSeconds)
+{
+	return m_device->call([&](uint64_t uiHandle) -> int32_t {
+		// only the range, speed and resolution change between the sweeps
+		Clock::time_point tStart = Clock::now();
+		if (m_device->configCache().apply(uiHandle, config) < 0) {
+			m_strError = "Scan configuration failed";
+			return -1;
+		}
+		if (CT400_ScanStart(uiHandle) != 0) {
+			m_device->configCache().invalidate();
+			m_strError = "CT400_ScanStart failed";
+			return -1;
+		}
+		char tcError[1024];
+		tcError[0] = '\0';
+		if (CT400_ScanWaitEnd(uiHandle, tcError) != 0) {
+			m_device->configCache().invalidate();
+			m_strError = tcError;
+			return -1;
+		}
+		dSeconds = seconds(tStart, Clock::now());
+		if ((pSync && pSync->fetchSync(uiHandle, m_detectors) < 0)
+			|| resampled.fetchResampled(uiHandle, m_detectors) < 0) {
+			m_strError = "Sweep retrieval failed";
+			return -1;
+		}
+		return 0;
+	});
+}
+
+void AdaptiveScan::mergeRegions()
+{
+	std::vector<Region> regions;
+	for (const Region &r : m_regions) {
+		Region clipped = { std::max(r.dMin, m_config.dMinWavelength), std::min(r.dMax, m_config.dMaxWavelength) };
+		if (clipped.dMax > clipped.dMin)
+			regions.push_back(clipped);
+	}
+	std::sort(regions.begin(), regions.end(), [](const Region &a, const Region &b) { return a.dMin < b.dMin; });
+
+	// a gap swept in less than the overhead of another sweep is swept through
+	const double dGap = m_settings.iFineSpeed * m_settings.dSweepOverhead;
+	m_regions.clear();
+	for (const Region &r : regions) {
+		if (!m_regions.empty() && r.dMin - m_regions.back().dMax <= dGap)
+			m_regions.back().dMax = std::max(m_regions.back().dMax, r.dMax);
+		else
+			m_regions.push_back(r);
+	}
+}
+
+int32_t AdaptiveScan::run(AdaptiveSpectrum &out)
+{
+	m_strError.clear();
+	out.segments.clear();
+	std::memset(&out.report, 0, sizeof(out.report));
+	if (m_settings.iCoarseSpeed <= 0 || m_settings.iFineSpeed <= 0 || m_settings.uiCoarseResolution == 0
+		|| m_settings.uiFineResolution == 0 || !(m_config.dMaxWavelength > m_config.dMinWavelength)) {
+		m_strError = "Invalid adaptive scan settings";
+		return -1;
+	}
+	// m_config is applied again however the sweeps end
+	struct Restore
+	{
+		AdaptiveScan &scan;
+		~Restore()
+		{
+			scan.m_device->call([this](uint64_t uiHandle) {
+				return scan.m_device->configCache().apply(uiHandle, scan.m_config);
+			});
+		}
+	} restore{ *this };
+
+	rScanConfig survey = m_config;
+	survey.iSpeed = m_settings.iCoarseSpeed;
+	survey.uiResolution = m_settings.uiCoarseResolution;
+	double dSurveyTime = 0.0;
+	if (sweep(survey, &m_survey, m_coarse, dSurveyTime) != 0)
+		return -1;
+	// per sweep overhead, measured as the time beyond the sweep itself
+	double dOverhead = dSurveyTime - (survey.dMaxWavelength - survey.dMinWavelength) / survey.iSpeed;
+
+	m_regions.clear();
+	m_finder(m_survey, m_regions);
+	mergeRegions();
+
+	double dFineTime = 0.0;
+	if (m_fine.size() < m_regions.size())
+		m_fine.resize(m_regions.size());
+	for (size_t i = 0; i < m_regions.size(); i++) {
+		rScanConfig fine = m_config;
+		fine.iSpeed = m_settings.iFineSpeed;
+		fine.uiResolution = m_settings.uiFineResolution;
+		fine.dMinWavelength = m_regions[i].dMin;
+		fine.dMaxWavelength = m_regions[i].dMax;
+		double dSeconds = 0.0;
+		if (sweep(fine, nullptr, m_fine[i], dSeconds) != 0)
+			return -1;
+		dFineTime += dSeconds;
+		dOverhead += dSeconds - (fine.dMaxWavelength - fine.dMinWavelength) / fine.iSpeed;
+	}
+	dOverhead = std::max(dOverhead / (double)(m_regions.size() + 1), 0.0);
+
+	// survey points outside the regions, fine points inside
+	const double *pdCoarse = m_coarse.wavelength();
+	const size_t uiCoarse = m_coarse.points();
+	size_t uiPoints = 0, j = 0;
+	for (size_t i = 0; i < m_regions.size(); i++) {
+		for (; j < uiCoarse && pdCoarse[j] < m_regions[i].dMin; j++)
+			uiPoints++;
+		for (; j < uiCoarse && pdCoarse[j] <= m_regions[i].dMax; j++)
+			;
+		uiPoints += m_fine[i].points();
+	}
+	uiPoints += uiCoarse - j;
+
+	const size_t uiDetectors = m_detectors.size();
+	out.data.resize(uiDetectors, uiPoints);
+	out.data.setDetectors(m_detectors);
+	size_t uiOut = 0;
+	auto append = [&](const ScanBuffer &from, size_t uiFirst, size_t uiCount, int32_t iSweep, int32_t iSpeed,
+		uint32_t uiResolution) {
+		if (uiCount == 0)
+			return;
+		std::copy(from.wavelength() + uiFirst, from.wavelength() + uiFirst + uiCount, out.data.wavelength() + uiOut);
+		for (size_t d = 0; d < uiDetectors; d++)
+			std::copy(from.row(d) + uiFirst, from.row(d) + uiFirst + uiCount, out.data.row(d) + uiOut);
+		rAdaptiveSegment segment;
+		std::memset(&segment, 0, sizeof(segment));
+		segment.dMinWavelength = from.wavelength()[uiFirst];
+		segment.dMaxWavelength = from.wavelength()[uiFirst + uiCount - 1];
+		segment.iFirst = (int32_t)uiOut;
+		segment.iPoints = (int32_t)uiCount;
+		segment.iSweep = iSweep;
+		segment.iSpeed = iSpeed;
+		segment.uiResolution = uiResolution;
+		out.segments.push_back(segment);
+		uiOut += uiCount;
+	};
+	j = 0;
+	for (size_t i = 0; i < m_regions.size(); i++) {
+		size_t uiFirst = j;
+		while (j < uiCoarse && pdCoarse[j] < m_regions[i].dMin)
+			j++;
+		append(m_coarse, uiFirst, j - uiFirst, 0, survey.iSpeed, survey.uiResolution);
+		while (j < uiCoarse && pdCoarse[j] <= m_regions[i].dMax)
+			j++;
+		append(m_fine[i], 0, m_fine[i].points(), (int32_t)i + 1, m_settings.iFineSpeed, m_settings.uiFineResolution);
+	}
+	append(m_coarse, j, uiCoarse - j, 0, survey.iSpeed, survey.uiResolution);
+
+	rAdaptiveReport &report = out.report;
+	report.iRegions = (int32_t)m_regions.size();
+	report.iSegments = (int32_t)out.segments.size();
+	report.iPoints = (int32_t)uiPoints;
+	report.iFullPoints = resampledPoints(m_config.dMinWavelength, m_config.dMaxWavelength,
+		m_settings.uiFineResolution);
+	report.dSurveyTime = dSurveyTime;
+	report.dFineTime = dFineTime;
+	report.dFullTime = (m_config.dMaxWavelength - m_config.dMinWavelength) / m_settings.iFineSpeed + dOverhead;
+	report.dTimeSaved = report.dFullTime - dSurveyTime - dFineTime;
+	return (int32_t)uiPoints;
+}
+
+} // namespace ct400
@@ -0,0 +1,185 @@
+/******************************************************************************/
+/* Header file for CT400_adaptive_scan.cpp                                    */
+/*                                                                            */
+/* Two-pass scans: a fast coarse survey of the whole range, then fine sweeps  */
+/* over the regions of interest only, merged into one non-uniform spectrum.   */
+/******************************************************************************/
+
+#ifndef CT400_ADAPTIVE_SCAN_H
+#define CT400_ADAPTIVE_SCAN_H
+
+#include "CT400_config.h"
+#include "CT400_resonance.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef struct
+  {
+	int32_t iCoarseSpeed;           // nm/s, survey of the whole range
+	uint32_t uiCoarseResolution;    // pm
+	int32_t iFineSpeed;             // nm/s, sweeps over the regions
+	uint32_t uiFineResolution;      // pm
+	double dWindowFwhm;             // region half width, in FWHM of the resonance
+	double dMargin;                 // nm added either side of each region
+	double dSweepOverhead;          // s per sweep besides the sweep itself
+	rResonanceSettings resonance;   // regions searched around these resonances
+  } rAdaptiveSettings;
+
+  // Provenance of a range of the merged arrays
+  typedef struct
+  {
+	double dMinWavelength;          // nm, first and last point of the segment
+	double dMaxWavelength;
+	int32_t iFirst;                 // index of the first point
+	int32_t iPoints;
+	int32_t iSweep;                 // 0 for the survey, then 1.. per fine sweep
+	int32_t iSpeed;                 // nm/s
+	uint32_t uiResolution;          // pm
+	int32_t iReserved;
+  } rAdaptiveSegment;
+
+  typedef struct
+  {
+	int32_t iRegions;               // fine sweeps, after merging close regions
+	int32_t iSegments;
+	int32_t iPoints;                // in the merged arrays
+	int32_t iFullPoints;            // of one fine sweep over the whole range
+	double dSurveyTime;             // s, measured
+	double dFineTime;               // s, measured, all fine sweeps
+	double dFullTime;               // s, estimated for one fine sweep over the whole range
+	double dTimeSaved;              // dFullTime - dSurveyTime - dFineTime
+  } rAdaptiveReport;
+
+//------------------------------ CT400_DefaultAdaptiveSettings -----------------
+// Function CT400_DefaultAdaptiveSettings
+//
+//  Purpose: Survey at 100 nm/s and 250 pm, fine sweeps at 10 nm/s and 1 pm
+//           over +/- 5 FWHM + 50 pm around the dips of
+//           CT400_DefaultResonanceSettings, 1 s overhead per sweep
+//
+//  Parameters: IN/OUT pSettings: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultAdaptiveSettings(
+rAdaptiveSettings *pSettings);
+
+//------------------------------ CT400_AdaptiveScan ----------------------------
+// Function CT400_AdaptiveScan
+//
+//  Purpose: Surveys the range of pConfig, finds the resonances of every
+//           enabled detector in the survey and sweeps the regions around
+//           them again at the fine speed and resolution. Outside the regions
+//           the merged arrays hold the survey points. pConfig is applied
+//           again once done, also after a failed sweep.
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN pConfig: laser, power, range and detectors (its speed and
+//                          resolution are replaced by those of pSettings)
+//              IN pSettings: adaptive settings, or NULL for the defaults
+//              IN/OUT dWavelength: pointer over an initialized array of
+//                                  iArraySize values
+//              IN/OUT dBlock: pointer over an initialized array of
+//                             iArraySize values per enabled detector (DE_1,
+//                             then DE_2 to DE_5 when enabled)
+//              IN iArraySize: size of one block row
+//              IN/OUT pSegments: pointer over an initialized array of
+//                                iMaxSegments values, or NULL
+//              IN iMaxSegments: size of the array
+//              IN/OUT pReport: pointer over a variable, or NULL
+//  Returns:  number of points of the merged arrays (only the first
+//            iArraySize are written), -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_AdaptiveScan(uint64_t uiHandle,
+const rScanConfig *pConfig, const rAdaptiveSettings *pSettings,
+double dWavelength[], double dBlock[], int32_t iArraySize,
+rAdaptiveSegment pSegments[], int32_t iMaxSegments, rAdaptiveReport *pReport);
+
+#ifdef __cplusplus
+}
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ct400
+{
+
+class Device;
+
+// Wavelength range to sweep again, nm
+struct Region
+{
+	double dMin;
+	double dMax;
+};
+
+// Fills regions from the survey: the valid sync arrays of the coarse sweep.
+// Their density is set by the sweep speed and the sample rate, not by the
+// resolution, so narrow features show up even between survey grid points.
+typedef std::function<void(const ScanBuffer &survey, std::vector<Region> &regions)> RegionFinder;
+
+// Regions of +/- (dWindowFwhm * FWHM + dMargin) around the resonances found
+// with settings.resonance
+RegionFinder resonanceRegions(const rAdaptiveSettings &settings);
+
+struct AdaptiveSpectrum
+{
+	ScanBuffer data;                // merged, non-uniform wavelength axis
+	std::vector<rAdaptiveSegment> segments;
+	rAdaptiveReport report;
+};
+
+//------------------------------ AdaptiveScan ----------------------------------
+// Class AdaptiveScan
+//
+//  Purpose: Runs the survey and the fine sweeps on one handle, holding its
+//           Device lock for each sweep. Regions closer than the distance
+//           swept during dSweepOverhead at the fine speed are merged, since
+//           sweeping the gap costs less than starting another sweep. The
+//           report compares the time taken with one fine sweep of the whole
+//           range, using the overhead measured on the sweeps just made, so
+//           the speeds, resolutions and margins can be tuned against it.
+//------------------------------------------------------------------------------
+class AdaptiveScan
+{
+public:
+	// finder = nullptr: resonanceRegions(settings)
+	AdaptiveScan(uint64_t uiHandle, const rScanConfig &config, const rAdaptiveSettings &settings,
+		RegionFinder finder = nullptr);
+
+	// Returns the number of points of out.data, -1 otherwise (see error())
+	int32_t run(AdaptiveSpectrum &out);
+
+	const std::string &error() const { return m_strError; }
+	// Regions swept at the fine resolution by the last run()
+	const std::vector<Region> &regions() const { return m_regions; }
+
+private:
+	// Applies config, sweeps and retrieves the resampled arrays (and the
+	// sync arrays if pSync). Returns 0 if success, -1 otherwise
+	int32_t sweep(const rScanConfig &config, ScanBuffer *pSync, ScanBuffer &resampled, double &dSeconds);
+	void mergeRegions();
+
+	std::shared_ptr<Device> m_device;
+	rScanConfig m_config;
+	rAdaptiveSettings m_settings;
+	RegionFinder m_finder;
+	std::vector<rDetector> m_detectors;
+	std::string m_strError;
+
+	ScanBuffer m_survey;            // sync arrays of the coarse sweep
+	ScanBuffer m_coarse;            // its resampled arrays
+	std::vector<ScanBuffer> m_fine; // resampled arrays of each fine sweep
+	std::vector<Region> m_regions;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
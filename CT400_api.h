@@ -0,0 +1,133 @@
+/******************************************************************************/
+/* Every function of CT400_lib.h as one list, for code that wraps them all    */
+/* (e.g. the metrics shim, CT400_metrics_shim.cpp).                           */
+/*                                                                            */
+/* CT400_API_LIST(X) expands X(ret, name, params, args, handle, kind) once   */
+/* per function:                                                              */
+/*   ret     return type                                                     */
+/*   name    function name                                                    */
+/*   params  parenthesised parameter list, as declared in CT400_lib.h        */
+/*   args    parenthesised argument list forwarding params                   */
+/*   handle  handle the call applies to (0 for CT400_Init)                   */
+/*   kind    how the result reports a failure (rCallResult)                  */
+/******************************************************************************/
+
+#ifndef CT400_API_H
+#define CT400_API_H
+
+#include "CT400_lib.h"
+
+  typedef enum
+  {
+	CR_HANDLE = 0,                  // a handle, 0 on failure
+	CR_STATUS,                      // 0 on success, an error code otherwise
+	CR_COUNT,                       // a count or value, negative on failure
+	CR_CONNECTED                    // 1 if connected
+  } rCallResult;
+
+#define CT400_API_LIST(X) \
+	X(uint64_t, CT400_Init, (int32_t *iError), (iError), 0, CR_HANDLE) \
+	X(int32_t, CT400_CheckConnected, (uint64_t uiHandle), (uiHandle), uiHandle, CR_CONNECTED) \
+	X(int32_t, CT400_GetNbInputs, (uint64_t uiHandle), (uiHandle), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_GetNbDetectors, (uint64_t uiHandle), (uiHandle), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_GetCT400Type, (uint64_t uiHandle), (uiHandle), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_SetLaser, (uint64_t uiHandle, rLaserInput eLaser, rEnable eEnable, int32_t iGPIBAdress, \
+		rLaserSource eLaserType, double dMinWavelength, double dMaxWavelength, int32_t Speed), \
+		(uiHandle, eLaser, eEnable, iGPIBAdress, eLaserType, dMinWavelength, dMaxWavelength, Speed), \
+		uiHandle, CR_STATUS) \
+	X(int32_t, CT400_SetSamplingResolution, (uint64_t uiHandle, uint32_t uiResolution), \
+		(uiHandle, uiResolution), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_SetScan, (uint64_t uiHandle, double dLaserPower, double dMinWavelength, double dMaxWavelength), \
+		(uiHandle, dLaserPower, dMinWavelength, dMaxWavelength), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_SetDetectorArray, (uint64_t uiHandle, rEnable eDect2, rEnable eDect3, rEnable eDect4, \
+		rEnable eExt), (uiHandle, eDect2, eDect3, eDect4, eExt), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_SetBNC, (uint64_t uiHandle, rEnable eEnable, double dAlpha, double dBeta, rUnit eUnit), \
+		(uiHandle, eEnable, dAlpha, dBeta, eUnit), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_SetExternalSynchronization, (uint64_t uiHandle, rEnable eEnable), \
+		(uiHandle, eEnable), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_SetExternalSynchronizationIN, (uint64_t uiHandle, rEnable eEnable), \
+		(uiHandle, eEnable), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_ScanStart, (uint64_t uiHandle), (uiHandle), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_ScanStop, (uint64_t uiHandle), (uiHandle), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_ScanWaitEnd, (uint64_t uiHandle, char tcError[1024]), (uiHandle, tcError), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_GetNbDataPoints, (uint64_t uiHandle, int32_t *iDataPoints, int32_t *iDiscardPoints), \
+		(uiHandle, iDataPoints, iDiscardPoints), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_GetNbDataPointsResampled, (uint64_t uiHandle), (uiHandle), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_GetNbLinesDetected, (uint64_t uiHandle), (uiHandle), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_ScanGetLinesDetectionArray, (uint64_t uiHandle, double dArray[], int32_t iArraySize), \
+		(uiHandle, dArray, iArraySize), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_ScanGetWavelengthSyncArray, (uint64_t uiHandle, double dArray[], int32_t iArraySize), \
+		(uiHandle, dArray, iArraySize), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_ScanGetWavelengthResampledArray, (uint64_t uiHandle, double dArray[], int32_t iArraySize), \
+		(uiHandle, dArray, iArraySize), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_ScanGetPowerSyncArray, (uint64_t uiHandle, double dArray[], int32_t iArraySize), \
+		(uiHandle, dArray, iArraySize), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_ScanGetPowerResampledArray, (uint64_t uiHandle, double dArray[], int32_t iArraySize), \
+		(uiHandle, dArray, iArraySize), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_ScanGetDetectorArray, (uint64_t uiHandle, rDetector eDetector, double dArray[], \
+		int32_t iArraySize), (uiHandle, eDetector, dArray, iArraySize), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_ScanGetDetectorResampledArray, (uint64_t uiHandle, rDetector eDetector, double dArray[], \
+		int32_t iArraySize), (uiHandle, eDetector, dArray, iArraySize), uiHandle, CR_COUNT) \
+	X(int32_t, CT400_ScanSaveWavelengthSyncFile, (uint64_t uiHandle, char *pcPath), (uiHandle, pcPath), \
+		uiHandle, CR_STATUS) \
+	X(int32_t, CT400_ScanSaveWavelengthResampledFile, (uint64_t uiHandle, char *pcPath), (uiHandle, pcPath), \
+		uiHandle, CR_STATUS) \
+	X(int32_t, CT400_ScanSavePowerSyncFile, (uint64_t uiHandle, char *pcPath), (uiHandle, pcPath), \
+		uiHandle, CR_STATUS) \
+	X(int32_t, CT400_ScanSavePowerResampledFile, (uint64_t uiHandle, char *pcPath), (uiHandle, pcPath), \
+		uiHandle, CR_STATUS) \
+	X(int32_t, CT400_ScanSaveDetectorFile, (uint64_t uiHandle, rDetector eDetector, char *pcPath), \
+		(uiHandle, eDetector, pcPath), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_ScanSaveDetectorResampledFile, (uint64_t uiHandle, rDetector eDetector, char *pcPath), \
+		(uiHandle, eDetector, pcPath), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_UpdateCalibration, (uint64_t uiHandle, rDetector eDetector), (uiHandle, eDetector), \
+		uiHandle, CR_STATUS) \
+	X(int32_t, CT400_ResetCalibration, (uint64_t uiHandle), (uiHandle), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_SwitchInput, (uint64_t uiHandle, rLaserInput eLaser), (uiHandle, eLaser), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_ReadPowerDetectors, (uint64_t uiHandle, double *Pout, double *P1, double *P2, double *P3, \
+		double *P4, double *Vext), (uiHandle, Pout, P1, P2, P3, P4, Vext), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_CmdLaser, (uint64_t uiHandle, rLaserInput eLaser, rEnable eEnable, double dWavelength, \
+		double dPower), (uiHandle, eLaser, eEnable, dWavelength, dPower), uiHandle, CR_STATUS) \
+	X(int32_t, CT400_Close, (uint64_t uiHandle), (uiHandle), uiHandle, CR_STATUS)
+
+#ifdef __cplusplus
+
+#include <cstddef>
+
+namespace ct400
+{
+
+#define CT400_API_ENUM(ret, name, params, args, handle, kind) API_##name,
+enum ApiFunction
+{
+	CT400_API_LIST(CT400_API_ENUM)
+	NB_API_FUNCTIONS
+};
+#undef CT400_API_ENUM
+
+inline const char *apiName(size_t uiFunction)
+{
+#define CT400_API_NAME(ret, name, params, args, handle, kind) #name,
+	static const char *const NAMES[] = { CT400_API_LIST(CT400_API_NAME) };
+#undef CT400_API_NAME
+	return uiFunction < NB_API_FUNCTIONS ? NAMES[uiFunction] : nullptr;
+}
+
+// Whether a result of the given kind reports a failure
+inline bool callFailed(rCallResult eKind, int64_t iResult)
+{
+	switch (eKind) {
+	case CR_HANDLE: return iResult == 0;
+	case CR_STATUS: return iResult != 0;
+	case CR_COUNT: return iResult < 0;
+	case CR_CONNECTED: return iResult != 1;
+	}
+	return false;
+}
+
+} // namespace ct400
+
+#endif
+
+
+#endif
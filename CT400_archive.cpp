@@ -0,0 +1,1058 @@
+//------------------------------------------------------------------------------
+// CT400_archive.cpp
+//
+// Searching a pile of text exports for "a resonance near 1550.2 nm deeper
+// than 20 dB" means parsing and analysing every sweep again. The archive
+// analyses each sweep once, at ingest, and keeps its resonances in a table
+// with a sorted index per feature, so such a query reads the index pages of
+// the narrowest of its ranges and the features those pages point to.
+//
+// Directory layout:
+//   sweeps.swp    sweep data (CT400_sweep_file.h), wavelength and detectors
+//   sweeps.dat    rArchiveSweep records
+//   features.dat  rArchiveFeature records, with the resonance settings
+//   index.dat     per key: Entry pairs sorted by key, then the first key of
+//                 each leaf (LEAF_ENTRIES pairs, one page)
+// A sweep is ingested by appending its data, its features and then its
+// sweep record; the counts in the table headers are written last, so after
+// a crash open() finds the last complete sweep. The index is only replaced
+// (write then rename) by merge(), and an index covering features that are
+// not in the table is dropped and rebuilt.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_archive.h"
+#include "CT400_thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+
+namespace ct400
+{
+
+static_assert(sizeof(rArchiveSweep) == 240, "rArchiveSweep layout");
+static_assert(sizeof(rArchiveFeature) == 96, "rArchiveFeature layout");
+
+namespace
+{
+
+const char SWEEPS_MAGIC[8] = { 'C', 'T', '4', 'S', 'W', 'E', 'E', 'P' };
+const char FEATURES_MAGIC[8] = { 'C', 'T', '4', 'F', 'E', 'A', 'T', '\0' };
+const char INDEX_MAGIC[8] = { 'C', 'T', '4', 'I', 'N', 'D', 'E', 'X' };
+const uint32_t ARCHIVE_VERSION = 1;
+const size_t PAGE = 4096;
+const double INF = std::numeric_limits<double>::infinity();
+
+struct TableHeader
+{
+	char tcMagic[8];
+	uint32_t uiVersion;
+	uint32_t uiRecordSize;
+	uint64_t uiCount;
+	rResonanceSettings settings;            // features.dat
+};
+
+struct IndexHeader
+{
+	char tcMagic[8];
+	uint32_t uiVersion;
+	uint32_t uiKeys;
+	uint64_t uiFeatures;                    // features 0 to uiFeatures - 1 are indexed
+	uint64_t uiCount[SpectralArchive::KEYS];        // pairs (NaN keys are left out)
+	uint64_t uiOffset[SpectralArchive::KEYS];       // of the pairs
+	uint64_t uiFenceOffset[SpectralArchive::KEYS];
+};
+
+size_t alignTo(size_t uiValue, size_t uiAlign)
+{
+	return (uiValue + uiAlign - 1) / uiAlign * uiAlign;
+}
+
+int64_t nowMicroseconds()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Largest float <= d and smallest float >= d
+float floatBelow(double d)
+{
+	float f = (float)d;
+	return (double)f > d ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+float floatAbove(double d)
+{
+	float f = (float)d;
+	return (double)f < d ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+bool bounded(double dLo, double dHi)
+{
+	return dLo != -INF || dHi != INF;
+}
+
+// An unbounded range also takes NaN
+bool inRange(double d, double dLo, double dHi)
+{
+	return !bounded(dLo, dHi) || (d >= dLo && d <= dHi);
+}
+
+// One value per line, as written by CT400_ScanSave*File
+bool readValues(const std::string &strPath, std::vector<double> &values)
+{
+	values.clear();
+	FILE *pFile = std::fopen(strPath.c_str(), "rb");
+	if (pFile == nullptr)
+		return false;
+	std::string text;
+	char tcBuffer[65536];
+	size_t uiRead;
+	while ((uiRead = std::fread(tcBuffer, 1, sizeof(tcBuffer), pFile)) > 0)
+		text.append(tcBuffer, uiRead);
+	const bool bError = std::ferror(pFile) != 0;
+	std::fclose(pFile);
+	if (bError)
+		return false;
+	const char *pc = text.c_str();
+	for (;;) {
+		char *pcEnd;
+		double d = std::strtod(pc, &pcEnd);
+		if (pcEnd == pc)
+			break;
+		values.push_back(d);
+		pc = pcEnd;
+	}
+	// anything left but blanks is not an export
+	while (*pc == ' ' || *pc == '\t' || *pc == '\r' || *pc == '\n')
+		pc++;
+	return *pc == '\0';
+}
+
+int64_t modificationTime(const std::string &strPath)
+{
+	namespace fs = std::filesystem;
+	std::error_code ec;
+	fs::file_time_type time = fs::last_write_time(strPath, ec);
+	if (ec)
+		return 0;
+	// file_time_type has no portable epoch in C++17: go through now()
+	auto system = std::chrono::system_clock::now()
+		+ std::chrono::duration_cast<std::chrono::system_clock::duration>(time - fs::file_time_type::clock::now());
+	return std::chrono::duration_cast<std::chrono::microseconds>(system.time_since_epoch()).count();
+}
+
+} // namespace
+
+
+//------------------------------ SpectralArchive -------------------------------
+
+struct SpectralArchive::Prepared
+{
+	rScanConfig config;
+	int64_t iTimestamp = 0;
+	std::string strLabel;
+	const double *pdWavelength = nullptr;
+	std::vector<rDetector> detectors;
+	std::vector<const double *> rows;
+	size_t uiPoints = 0;
+	std::vector<double> storage;            // wavelength and rows read from files
+	std::vector<rResonance> resonances;
+	bool bValid = false;
+};
+
+int32_t SpectralArchive::Table::open(const std::string &strPath, size_t uiRecord, const char *pcMagic)
+{
+	uiRecordSize = uiRecord;
+	std::error_code ec;
+	if (std::filesystem::exists(strPath, ec)) {
+		if (file.open(strPath) != 0 || file.size() < PAGE)
+			return -1;
+		const TableHeader *pHeader = reinterpret_cast<const TableHeader *>(file.data());
+		if (std::memcmp(pHeader->tcMagic, pcMagic, sizeof(pHeader->tcMagic)) != 0
+			|| pHeader->uiVersion != ARCHIVE_VERSION || pHeader->uiRecordSize != uiRecord) {
+			file.close();
+			return -1;
+		}
+		// a file cut short keeps its whole records; open() drops the sweeps
+		// left incomplete
+		uiCount = (size_t)std::min<uint64_t>(pHeader->uiCount, (file.size() - PAGE) / uiRecord);
+		return 0;
+	}
+	if (file.create(strPath, PAGE + 1024 * uiRecord) != 0)
+		return -1;
+	TableHeader *pHeader = reinterpret_cast<TableHeader *>(file.data());
+	std::memcpy(pHeader->tcMagic, pcMagic, sizeof(pHeader->tcMagic));
+	pHeader->uiVersion = ARCHIVE_VERSION;
+	pHeader->uiRecordSize = (uint32_t)uiRecord;
+	pHeader->uiCount = 0;
+	uiCount = 0;
+	return 0;
+}
+
+int32_t SpectralArchive::Table::reserve(size_t uiRecords)
+{
+	const size_t uiNeeded = PAGE + uiRecords * uiRecordSize;
+	if (uiNeeded <= file.size())
+		return 0;
+	return file.resize(std::max(uiNeeded, file.size() * 2));
+}
+
+uint8_t *SpectralArchive::Table::record(size_t i) const
+{
+	return file.data() + PAGE + i * uiRecordSize;
+}
+
+void SpectralArchive::Table::close()
+{
+	if (file.data()) {
+		reinterpret_cast<TableHeader *>(file.data())->uiCount = uiCount;
+		file.resize(PAGE + uiCount * uiRecordSize);
+	}
+	file.close();
+	uiCount = 0;
+}
+
+int32_t SpectralArchive::open(const std::string &strDirectory, const rResonanceSettings *pSettings)
+{
+	close();
+	namespace fs = std::filesystem;
+	std::error_code ec;
+	fs::create_directories(strDirectory, ec);
+	if (!fs::is_directory(strDirectory, ec))
+		return -1;
+	const fs::path directory(strDirectory);
+	std::unique_lock<std::shared_mutex> lock(m_mtx);
+	m_strDirectory = strDirectory;
+	if (m_sweeps.open((directory / "sweeps.dat").string(), sizeof(rArchiveSweep), SWEEPS_MAGIC) != 0
+		|| m_features.open((directory / "features.dat").string(), sizeof(rArchiveFeature), FEATURES_MAGIC) != 0
+		|| m_writer.open((directory / "sweeps.swp").string()) != 0) {
+		m_sweeps.close();
+		m_features.close();
+		m_writer.close();
+		return -1;
+	}
+
+	TableHeader *pHeader = reinterpret_cast<TableHeader *>(m_features.header());
+	if (m_sweeps.uiCount == 0 && m_features.uiCount == 0) {
+		if (pSettings)
+			pHeader->settings = *pSettings;
+		else
+			CT400_DefaultResonanceSettings(&pHeader->settings);
+	}
+	m_settings = pHeader->settings;
+
+	// a sweep is complete once its record and the records before it are
+	while (m_sweeps.uiCount > 0) {
+		const rArchiveSweep *pLast = reinterpret_cast<const rArchiveSweep *>(m_sweeps.record(m_sweeps.uiCount - 1));
+		if (pLast->uiRecord < m_writer.records()
+			&& pLast->uiFirstFeature + pLast->iFeatures <= m_features.uiCount) {
+			m_features.uiCount = (size_t)(pLast->uiFirstFeature + pLast->iFeatures);
+			break;
+		}
+		m_sweeps.uiCount--;
+	}
+	if (m_sweeps.uiCount == 0)
+		m_features.uiCount = 0;
+	storeCounts();
+
+	m_bOpen = true;
+	if (openIndex() != 0)
+		m_index.close();
+	loadDelta();
+	// merges at once if the index was lost
+	sortDelta();
+	m_analyser.reset(new ResonanceAnalyser());
+	return 0;
+}
+
+void SpectralArchive::close()
+{
+	std::unique_lock<std::shared_mutex> lock(m_mtx);
+	if (!m_bOpen)
+		return;
+	if (m_uiIndexed < m_features.uiCount)
+		merge();
+	storeCounts();
+	m_sweeps.close();
+	m_features.close();
+	m_writer.close();
+	{
+		std::lock_guard<std::mutex> lockReader(m_mtxReader);
+		m_reader.close();
+	}
+	m_index.close();
+	m_uiIndexed = 0;
+	for (size_t k = 0; k < KEYS; k++) {
+		m_fences[k] = Span<const float>();
+		m_delta[k].clear();
+		m_uiSortedDelta[k] = 0;
+	}
+	m_analyser.reset();
+	m_bOpen = false;
+}
+
+int32_t SpectralArchive::flush(bool bSync)
+{
+	std::unique_lock<std::shared_mutex> lock(m_mtx);
+	if (!m_bOpen)
+		return -1;
+	int32_t iStatus = 0;
+	if (m_uiIndexed < m_features.uiCount && merge() != 0)
+		iStatus = -1;
+	storeCounts();
+	if (m_writer.flush(bSync) != 0 || m_sweeps.file.flush(bSync) != 0 || m_features.file.flush(bSync) != 0)
+		iStatus = -1;
+	return iStatus;
+}
+
+void SpectralArchive::storeCounts()
+{
+	reinterpret_cast<TableHeader *>(m_features.header())->uiCount = m_features.uiCount;
+	reinterpret_cast<TableHeader *>(m_sweeps.header())->uiCount = m_sweeps.uiCount;
+}
+
+size_t SpectralArchive::sweeps() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mtx);
+	return m_sweeps.uiCount;
+}
+
+size_t SpectralArchive::features() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mtx);
+	return m_features.uiCount;
+}
+
+size_t SpectralArchive::indexed() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mtx);
+	return m_uiIndexed;
+}
+
+rResonanceSettings SpectralArchive::settings() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mtx);
+	return m_settings;
+}
+
+int32_t SpectralArchive::sweep(uint64_t uiSweep, rArchiveSweep &sweep) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mtx);
+	if (uiSweep >= m_sweeps.uiCount)
+		return -1;
+	std::memcpy(&sweep, m_sweeps.record((size_t)uiSweep), sizeof(sweep));
+	return 0;
+}
+
+int32_t SpectralArchive::feature(uint64_t uiFeature, rArchiveFeature &feature) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mtx);
+	if (uiFeature >= m_features.uiCount)
+		return -1;
+	std::memcpy(&feature, m_features.record((size_t)uiFeature), sizeof(feature));
+	return 0;
+}
+
+int64_t SpectralArchive::readSweep(uint64_t uiSweep, std::vector<double> &wavelength, std::vector<double> &block)
+{
+	rArchiveSweep info;
+	if (sweep(uiSweep, info) != 0)
+		return -1;
+	std::unique_lock<std::mutex> lockReader(m_mtxReader);
+	if (info.uiRecord >= m_reader.size()) {
+		// maps the records written since the reader was opened (m_mtx is
+		// never taken with m_mtxReader held)
+		lockReader.unlock();
+		{
+			std::unique_lock<std::shared_mutex> lock(m_mtx);
+			if (m_writer.flush() != 0)
+				return -1;
+		}
+		lockReader.lock();
+		const std::string strPath = (std::filesystem::path(m_strDirectory) / "sweeps.swp").string();
+		if (info.uiRecord >= m_reader.size() && m_reader.open(strPath) != 0)
+			return -1;
+		if (info.uiRecord >= m_reader.size())
+			return -1;
+	}
+	if (m_reader.read((size_t)info.uiRecord, COL_WAVELENGTH, wavelength) != info.iPoints)
+		return -1;
+	block.resize((size_t)info.iNbDetectors * info.iPoints);
+	std::vector<double> row;
+	for (int32_t d = 0; d < info.iNbDetectors; d++) {
+		if (m_reader.read((size_t)info.uiRecord, info.eDetectors[d], row) != info.iPoints)
+			return -1;
+		std::copy(row.begin(), row.end(), block.begin() + (size_t)d * info.iPoints);
+	}
+	return info.iPoints;
+}
+
+float SpectralArchive::key(const rArchiveFeature &feature, size_t uiKey)
+{
+	switch (uiKey) {
+	case KEY_WAVELENGTH: return (float)feature.dWavelength;
+	case KEY_EXTINCTION: return (float)feature.dExtinction;
+	case KEY_FWHM: return (float)feature.dFwhm;
+	default: return (float)feature.dQ;
+	}
+}
+
+void SpectralArchive::analyse(Prepared &prepared, const rResonanceSettings &settings,
+	ResonanceAnalyser &analyser) const
+{
+	prepared.bValid = analyser.analyse(prepared.pdWavelength, prepared.detectors.data(), prepared.rows.data(),
+		prepared.detectors.size(), prepared.uiPoints, settings, prepared.resonances) >= 0;
+}
+
+int64_t SpectralArchive::commit(const Prepared &prepared)
+{
+	const size_t uiFirst = m_features.uiCount;
+	const size_t uiFound = prepared.resonances.size();
+	if (!m_bOpen || !prepared.bValid || uiFirst + uiFound > std::numeric_limits<uint32_t>::max())
+		return -1;
+
+	SweepInfo info;
+	info.config = prepared.config;
+	info.iDataPoints = (int32_t)prepared.uiPoints;
+	info.iTimestamp = prepared.iTimestamp;
+	std::vector<SweepColumnData> columns(1, SweepColumnData{ COL_WAVELENGTH, prepared.pdWavelength });
+	for (size_t d = 0; d < prepared.detectors.size(); d++)
+		columns.push_back(SweepColumnData{ prepared.detectors[d], prepared.rows[d] });
+	const int64_t iRecord = m_writer.append(info, columns, prepared.uiPoints, SAMPLE_F64, ENCODING_XOR_RLE);
+	if (iRecord < 0 || m_features.reserve(uiFirst + uiFound) != 0 || m_sweeps.reserve(m_sweeps.uiCount + 1) != 0)
+		return -1;
+
+	const uint64_t uiSweep = m_sweeps.uiCount;
+	for (size_t i = 0; i < uiFound; i++) {
+		const rResonance &resonance = prepared.resonances[i];
+		const bool bFit = resonance.iFitIterations > 0;
+		rArchiveFeature feature;
+		std::memset(&feature, 0, sizeof(feature));
+		feature.uiSweep = uiSweep;
+		feature.iTimestamp = prepared.iTimestamp;
+		feature.eInput = prepared.config.eInput;
+		feature.eDetector = resonance.eDetector;
+		feature.iKind = resonance.iKind;
+		feature.uiResolution = prepared.config.uiResolution;
+		feature.dMinWavelength = prepared.config.dMinWavelength;
+		feature.dMaxWavelength = prepared.config.dMaxWavelength;
+		feature.dWavelength = bFit ? resonance.dFitWavelength : resonance.dWavelength;
+		feature.dExtinction = bFit ? resonance.dFitExtinction : resonance.dExtinction;
+		feature.dFwhm = bFit ? resonance.dFitFwhm : resonance.dFwhm;
+		feature.dQ = bFit ? resonance.dFitQ : resonance.dQ;
+		feature.dBaseline = resonance.dBaseline;
+		feature.dFsr = resonance.dFsr;
+		std::memcpy(m_features.record(uiFirst + i), &feature, sizeof(feature));
+		for (size_t k = 0; k < KEYS; k++) {
+			const float fKey = key(feature, k);
+			if (fKey == fKey)
+				m_delta[k].push_back(Entry{ fKey, (uint32_t)(uiFirst + i) });
+		}
+	}
+
+	rArchiveSweep record;
+	std::memset(&record, 0, sizeof(record));
+	record.uiSweep = uiSweep;
+	record.uiRecord = (uint64_t)iRecord;
+	record.iTimestamp = prepared.iTimestamp;
+	record.uiFirstFeature = uiFirst;
+	record.iFeatures = (int32_t)uiFound;
+	record.iPoints = (int32_t)prepared.uiPoints;
+	record.iNbDetectors = (int32_t)prepared.detectors.size();
+	for (size_t d = 0; d < prepared.detectors.size(); d++)
+		record.eDetectors[d] = prepared.detectors[d];
+	record.config = prepared.config;
+	std::memcpy(record.tcLabel, prepared.strLabel.c_str(),
+		std::min(prepared.strLabel.size(), sizeof(record.tcLabel) - 1));
+	std::memcpy(m_sweeps.record((size_t)uiSweep), &record, sizeof(record));
+
+	m_features.uiCount = uiFirst + uiFound;
+	m_sweeps.uiCount++;
+	storeCounts();
+	return (int64_t)uiSweep;
+}
+
+void SpectralArchive::loadDelta()
+{
+	auto less = [](const Entry &a, const Entry &b) { return a.fKey < b.fKey; };
+	for (size_t k = 0; k < KEYS; k++)
+		m_delta[k].clear();
+	for (size_t i = m_uiIndexed; i < m_features.uiCount; i++) {
+		const rArchiveFeature &feature = *reinterpret_cast<const rArchiveFeature *>(m_features.record(i));
+		for (size_t k = 0; k < KEYS; k++) {
+			const float fKey = key(feature, k);
+			if (fKey == fKey)
+				m_delta[k].push_back(Entry{ fKey, (uint32_t)i });
+		}
+	}
+	for (size_t k = 0; k < KEYS; k++) {
+		std::sort(m_delta[k].begin(), m_delta[k].end(), less);
+		m_uiSortedDelta[k] = m_delta[k].size();
+	}
+}
+
+void SpectralArchive::sortDelta()
+{
+	auto less = [](const Entry &a, const Entry &b) { return a.fKey < b.fKey; };
+	for (size_t k = 0; k < KEYS; k++) {
+		std::vector<Entry> &delta = m_delta[k];
+		std::sort(delta.begin() + m_uiSortedDelta[k], delta.end(), less);
+		std::inplace_merge(delta.begin(), delta.begin() + m_uiSortedDelta[k], delta.end(), less);
+		m_uiSortedDelta[k] = delta.size();
+	}
+	if (m_features.uiCount - m_uiIndexed >= std::max(MIN_MERGE, m_uiIndexed / 8))
+		merge();
+}
+
+const SpectralArchive::Entry *SpectralArchive::indexEntries(size_t uiKey) const
+{
+	const IndexHeader *pHeader = reinterpret_cast<const IndexHeader *>(m_index.data());
+	return reinterpret_cast<const Entry *>(m_index.data() + pHeader->uiOffset[uiKey]);
+}
+
+int32_t SpectralArchive::openIndex()
+{
+	m_uiIndexed = 0;
+	for (size_t k = 0; k < KEYS; k++)
+		m_fences[k] = Span<const float>();
+	const std::string strPath = (std::filesystem::path(m_strDirectory) / "index.dat").string();
+	std::error_code ec;
+	if (!std::filesystem::exists(strPath, ec))
+		return 0;
+	if (m_index.open(strPath) != 0 || m_index.size() < PAGE)
+		return -1;
+	const IndexHeader *pHeader = reinterpret_cast<const IndexHeader *>(m_index.data());
+	if (std::memcmp(pHeader->tcMagic, INDEX_MAGIC, sizeof(pHeader->tcMagic)) != 0
+		|| pHeader->uiVersion != ARCHIVE_VERSION || pHeader->uiKeys != KEYS
+		|| pHeader->uiFeatures > m_features.uiCount)
+		return -1;
+	for (size_t k = 0; k < KEYS; k++) {
+		const uint64_t uiFences = (pHeader->uiCount[k] + LEAF_ENTRIES - 1) / LEAF_ENTRIES;
+		if (pHeader->uiOffset[k] + pHeader->uiCount[k] * sizeof(Entry) > m_index.size()
+			|| pHeader->uiFenceOffset[k] + uiFences * sizeof(float) > m_index.size())
+			return -1;
+	}
+	for (size_t k = 0; k < KEYS; k++) {
+		const uint64_t uiFences = (pHeader->uiCount[k] + LEAF_ENTRIES - 1) / LEAF_ENTRIES;
+		m_fences[k] = Span<const float>(reinterpret_cast<const float *>(m_index.data() + pHeader->uiFenceOffset[k]),
+			(size_t)uiFences);
+	}
+	m_uiIndexed = (size_t)pHeader->uiFeatures;
+	return 0;
+}
+
+int32_t SpectralArchive::merge()
+{
+	namespace fs = std::filesystem;
+	const fs::path directory(m_strDirectory);
+	const std::string strTemp = (directory / "index.tmp").string();
+	const std::string strPath = (directory / "index.dat").string();
+
+	IndexHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.tcMagic, INDEX_MAGIC, sizeof(header.tcMagic));
+	header.uiVersion = ARCHIVE_VERSION;
+	header.uiKeys = KEYS;
+	header.uiFeatures = m_features.uiCount;
+	uint64_t uiOffset = PAGE;
+	for (size_t k = 0; k < KEYS; k++) {
+		const uint64_t uiOld = m_uiIndexed ? reinterpret_cast<const IndexHeader *>(m_index.data())->uiCount[k] : 0;
+		header.uiCount[k] = uiOld + m_delta[k].size();
+		header.uiOffset[k] = uiOffset;
+		header.uiFenceOffset[k] = alignTo(uiOffset + header.uiCount[k] * sizeof(Entry), PAGE);
+		const uint64_t uiFences = (header.uiCount[k] + LEAF_ENTRIES - 1) / LEAF_ENTRIES;
+		uiOffset = alignTo(header.uiFenceOffset[k] + uiFences * sizeof(float), PAGE);
+	}
+
+	FILE *pFile = std::fopen(strTemp.c_str(), "wb");
+	if (pFile == nullptr)
+		return -1;
+	std::vector<uint8_t> page(PAGE, 0);
+	std::memcpy(page.data(), &header, sizeof(header));
+	bool bOk = std::fwrite(page.data(), PAGE, 1, pFile) == 1;
+
+	// merges the old pairs with the new ones, a leaf at a time
+	std::vector<Entry> leaf;
+	std::vector<float> fences;
+	uint64_t uiWritten = PAGE;
+	auto pad = [&](uint64_t uiTo) {
+		std::fill(page.begin(), page.end(), 0);
+		while (bOk && uiWritten < uiTo) {
+			const size_t uiBytes = (size_t)std::min<uint64_t>(PAGE, uiTo - uiWritten);
+			bOk = std::fwrite(page.data(), uiBytes, 1, pFile) == 1;
+			uiWritten += uiBytes;
+		}
+	};
+	for (size_t k = 0; k < KEYS && bOk; k++) {
+		const Entry *pOld = m_uiIndexed ? indexEntries(k) : nullptr;
+		const size_t uiOld = (size_t)(header.uiCount[k] - m_delta[k].size());
+		const std::vector<Entry> &delta = m_delta[k];
+		size_t i = 0, j = 0;
+		fences.clear();
+		while (bOk && (i < uiOld || j < delta.size())) {
+			leaf.clear();
+			while (leaf.size() < LEAF_ENTRIES && (i < uiOld || j < delta.size())) {
+				if (j == delta.size() || (i < uiOld && !(delta[j].fKey < pOld[i].fKey)))
+					leaf.push_back(pOld[i++]);
+				else
+					leaf.push_back(delta[j++]);
+			}
+			fences.push_back(leaf[0].fKey);
+			bOk = std::fwrite(leaf.data(), sizeof(Entry), leaf.size(), pFile) == leaf.size();
+			uiWritten += leaf.size() * sizeof(Entry);
+		}
+		pad(header.uiFenceOffset[k]);
+		if (bOk && !fences.empty()) {
+			bOk = std::fwrite(fences.data(), sizeof(float), fences.size(), pFile) == fences.size();
+			uiWritten += fences.size() * sizeof(float);
+		}
+		pad(k + 1 < KEYS ? header.uiOffset[k + 1] : alignTo(uiWritten, PAGE));
+	}
+	bOk = std::fclose(pFile) == 0 && bOk;
+	if (!bOk) {
+		std::remove(strTemp.c_str());
+		return -1;
+	}
+
+	// the old mapping goes first: Windows cannot replace a mapped file
+	m_index.close();
+	std::error_code ec;
+	fs::rename(strTemp, strPath, ec);
+	if (ec || openIndex() != 0) {
+		// back to what index.dat holds (the old index if the rename failed,
+		// none if it cannot be mapped), the other features in the delta
+		std::remove(strTemp.c_str());
+		if (openIndex() != 0)
+			m_index.close();
+		loadDelta();
+		return -1;
+	}
+	for (size_t k = 0; k < KEYS; k++) {
+		m_delta[k].clear();
+		m_uiSortedDelta[k] = 0;
+	}
+	return 0;
+}
+
+void SpectralArchive::indexRange(size_t uiKey, float fLo, float fHi, size_t &uiBegin, size_t &uiEnd) const
+{
+	uiBegin = uiEnd = 0;
+	if (m_uiIndexed == 0)
+		return;
+	const Entry *pEntries = indexEntries(uiKey);
+	const size_t uiCount = (size_t)reinterpret_cast<const IndexHeader *>(m_index.data())->uiCount[uiKey];
+	const Span<const float> &fences = m_fences[uiKey];
+	auto less = [](const Entry &entry, float fKey) { return entry.fKey < fKey; };
+	auto greater = [](float fKey, const Entry &entry) { return fKey < entry.fKey; };
+
+	// first key >= fLo: in the leaf before the first fence >= fLo, or first
+	// of the next leaf
+	size_t j = std::lower_bound(fences.begin(), fences.end(), fLo) - fences.begin();
+	if (j > 0) {
+		const Entry *pLeaf = pEntries + (j - 1) * LEAF_ENTRIES;
+		const Entry *pLeafEnd = pEntries + std::min(uiCount, j * LEAF_ENTRIES);
+		uiBegin = std::lower_bound(pLeaf, pLeafEnd, fLo, less) - pEntries;
+	}
+	// first key > fHi: likewise with the first fence > fHi
+	j = std::upper_bound(fences.begin(), fences.end(), fHi) - fences.begin();
+	if (j > 0) {
+		const Entry *pLeaf = pEntries + (j - 1) * LEAF_ENTRIES;
+		const Entry *pLeafEnd = pEntries + std::min(uiCount, j * LEAF_ENTRIES);
+		uiEnd = std::upper_bound(pLeaf, pLeafEnd, fHi, greater) - pEntries;
+	}
+	uiEnd = std::max(uiBegin, uiEnd);
+}
+
+int64_t SpectralArchive::query(const rArchiveQuery &query, std::vector<uint64_t> &features) const
+{
+	features.clear();
+	std::shared_lock<std::shared_mutex> lock(m_mtx);
+	if (!m_bOpen)
+		return -1;
+	const double dLo[KEYS] = { query.dMinWavelength, query.dMinExtinction, query.dMinFwhm, query.dMinQ };
+	const double dHi[KEYS] = { query.dMaxWavelength, query.dMaxExtinction, query.dMaxFwhm, query.dMaxQ };
+	for (size_t k = 0; k < KEYS; k++)
+		if (dLo[k] != dLo[k] || dHi[k] != dHi[k] || dLo[k] > dHi[k])
+			return dLo[k] > dHi[k] ? 0 : -1;
+	if (query.iMinTimestamp > query.iMaxTimestamp)
+		return 0;
+
+	auto matches = [&](const rArchiveFeature &feature) {
+		for (size_t k = 0; k < KEYS; k++) {
+			const double d = k == KEY_WAVELENGTH ? feature.dWavelength : k == KEY_EXTINCTION ? feature.dExtinction
+				: k == KEY_FWHM ? feature.dFwhm : feature.dQ;
+			if (!inRange(d, dLo[k], dHi[k]))
+				return false;
+		}
+		return feature.iTimestamp >= query.iMinTimestamp && feature.iTimestamp <= query.iMaxTimestamp
+			&& (query.eInput == 0 || feature.eInput == query.eInput)
+			&& (query.eDetector == 0 || feature.eDetector == query.eDetector)
+			&& (query.iKinds == 0 || (feature.iKind & query.iKinds) != 0);
+	};
+	auto check = [&](size_t uiFeature) {
+		if (matches(*reinterpret_cast<const rArchiveFeature *>(m_features.record(uiFeature))))
+			features.push_back(uiFeature);
+	};
+
+	// the range with the fewest pairs drives the search
+	size_t uiBest = KEYS, uiBestCount = 0;
+	size_t uiBegin[KEYS], uiEnd[KEYS], uiDeltaBegin[KEYS], uiDeltaEnd[KEYS];
+	for (size_t k = 0; k < KEYS; k++) {
+		if (!bounded(dLo[k], dHi[k]))
+			continue;
+		const float fLo = floatBelow(dLo[k]), fHi = floatAbove(dHi[k]);
+		indexRange(k, fLo, fHi, uiBegin[k], uiEnd[k]);
+		const std::vector<Entry> &delta = m_delta[k];
+		uiDeltaBegin[k] = std::lower_bound(delta.begin(), delta.end(), fLo,
+			[](const Entry &entry, float fKey) { return entry.fKey < fKey; }) - delta.begin();
+		uiDeltaEnd[k] = std::upper_bound(delta.begin() + uiDeltaBegin[k], delta.end(), fHi,
+			[](float fKey, const Entry &entry) { return fKey < entry.fKey; }) - delta.begin();
+		const size_t uiCount = uiEnd[k] - uiBegin[k] + uiDeltaEnd[k] - uiDeltaBegin[k];
+		if (uiBest == KEYS || uiCount < uiBestCount) {
+			uiBest = k;
+			uiBestCount = uiCount;
+		}
+	}
+
+	if (uiBest == KEYS) {
+		for (size_t i = 0; i < m_features.uiCount; i++)
+			check(i);
+		return (int64_t)features.size();
+	}
+	if (uiEnd[uiBest] > uiBegin[uiBest]) {
+		const Entry *pEntries = indexEntries(uiBest);
+		for (size_t i = uiBegin[uiBest]; i < uiEnd[uiBest]; i++)
+			check(pEntries[i].uiFeature);
+	}
+	const std::vector<Entry> &delta = m_delta[uiBest];
+	for (size_t i = uiDeltaBegin[uiBest]; i < uiDeltaEnd[uiBest]; i++)
+		check(delta[i].uiFeature);
+	std::sort(features.begin(), features.end());
+	return (int64_t)features.size();
+}
+
+int64_t SpectralArchive::ingest(const rScanConfig &config, int64_t iTimestamp, const std::string &strLabel,
+	const double *pdWavelength, const rDetector *peDetectors, const double *const *ppdRows, size_t uiDetectors,
+	size_t uiPoints)
+{
+	if (pdWavelength == nullptr || uiDetectors == 0 || uiDetectors > 5 || uiPoints == 0)
+		return -1;
+	Prepared prepared;
+	prepared.config = config;
+	prepared.iTimestamp = iTimestamp ? iTimestamp : nowMicroseconds();
+	prepared.strLabel = strLabel;
+	prepared.pdWavelength = pdWavelength;
+	prepared.detectors.assign(peDetectors, peDetectors + uiDetectors);
+	prepared.rows.assign(ppdRows, ppdRows + uiDetectors);
+	prepared.uiPoints = uiPoints;
+	{
+		std::lock_guard<std::mutex> lockAnalyser(m_mtxAnalyser);
+		if (!m_analyser)
+			return -1;
+		analyse(prepared, settings(), *m_analyser);
+	}
+	std::unique_lock<std::shared_mutex> lock(m_mtx);
+	const int64_t iSweep = commit(prepared);
+	sortDelta();
+	return iSweep;
+}
+
+int64_t SpectralArchive::ingestFiles(const std::string &strManifest, const rScanConfig &config, size_t uiThreads,
+	size_t *puiFailed)
+{
+	struct Line
+	{
+		std::string strWavelength;
+		std::vector<std::pair<rDetector, std::string> > detectors;
+	};
+	std::ifstream manifest(strManifest);
+	if (!manifest)
+		return -1;
+	std::vector<Line> lines;
+	size_t uiFailed = 0;
+	std::string strLine;
+	while (std::getline(manifest, strLine)) {
+		if (!strLine.empty() && strLine.back() == '\r')
+			strLine.pop_back();
+		if (strLine.empty() || strLine[0] == '#')
+			continue;
+		std::vector<std::string> fields;
+		size_t uiStart = 0, uiTab;
+		while ((uiTab = strLine.find('\t', uiStart)) != std::string::npos) {
+			fields.push_back(strLine.substr(uiStart, uiTab - uiStart));
+			uiStart = uiTab + 1;
+		}
+		fields.push_back(strLine.substr(uiStart));
+		Line line;
+		line.strWavelength = fields[0];
+		bool bOk = fields.size() >= 3 && fields.size() % 2 == 1 && fields.size() <= 11;
+		for (size_t f = 1; bOk && f + 1 < fields.size(); f += 2) {
+			const int iDetector = std::atoi(fields[f].c_str());
+			bOk = iDetector >= DE_1 && iDetector <= DE_5;
+			line.detectors.push_back(std::make_pair((rDetector)iDetector, fields[f + 1]));
+		}
+		if (bOk)
+			lines.push_back(std::move(line));
+		else
+			uiFailed++;
+	}
+
+	if (uiThreads == 0)
+		uiThreads = std::max(1u, std::thread::hardware_concurrency());
+	// the calling thread works too
+	ThreadPool pool(std::max<size_t>(1, uiThreads - 1));
+	const rResonanceSettings analysis = settings();
+	std::mutex mtxAnalysers;
+	std::vector<std::unique_ptr<ResonanceAnalyser> > analysers;
+
+	auto load = [&](const Line &line, Prepared &prepared) {
+		std::vector<double> wavelength;
+		std::vector<std::vector<double> > rows(line.detectors.size());
+		if (!readValues(line.strWavelength, wavelength))
+			return;
+		size_t uiPoints = wavelength.size();
+		for (size_t d = 0; d < rows.size(); d++) {
+			if (!readValues(line.detectors[d].second, rows[d]))
+				return;
+			uiPoints = std::min(uiPoints, rows[d].size());
+		}
+		if (uiPoints < 2)
+			return;
+		prepared.uiPoints = uiPoints;
+		prepared.storage.resize((rows.size() + 1) * uiPoints);
+		std::copy(wavelength.begin(), wavelength.begin() + uiPoints, prepared.storage.begin());
+		prepared.pdWavelength = prepared.storage.data();
+		for (size_t d = 0; d < rows.size(); d++) {
+			double *pdRow = prepared.storage.data() + (d + 1) * uiPoints;
+			std::copy(rows[d].begin(), rows[d].begin() + uiPoints, pdRow);
+			prepared.detectors.push_back(line.detectors[d].first);
+			prepared.rows.push_back(pdRow);
+		}
+
+		prepared.config = config;
+		prepared.config.dMinWavelength = wavelength[0];
+		prepared.config.dMaxWavelength = wavelength[uiPoints - 1];
+		const double dStep = (wavelength[uiPoints - 1] - wavelength[0]) / (uiPoints - 1);
+		prepared.config.uiResolution = (uint32_t)std::max(1.0, std::round(dStep * 1000.0));
+		rEnable *peEnables[4] = { &prepared.config.eDect2, &prepared.config.eDect3, &prepared.config.eDect4,
+			&prepared.config.eExt };
+		for (size_t e = 0; e < 4; e++)
+			*peEnables[e] = std::find(prepared.detectors.begin(), prepared.detectors.end(), (rDetector)(DE_2 + e))
+				!= prepared.detectors.end() ? ENABLE : DISABLE;
+		const std::string &strFirst = line.detectors[0].second;
+		prepared.iTimestamp = modificationTime(strFirst);
+		if (prepared.iTimestamp == 0)
+			prepared.iTimestamp = nowMicroseconds();
+		prepared.strLabel = std::filesystem::path(strFirst).stem().string();
+
+		std::unique_ptr<ResonanceAnalyser> analyser;
+		{
+			std::lock_guard<std::mutex> lock(mtxAnalysers);
+			if (!analysers.empty()) {
+				analyser = std::move(analysers.back());
+				analysers.pop_back();
+			}
+		}
+		if (!analyser)
+			analyser.reset(new ResonanceAnalyser(1));
+		analyse(prepared, analysis, *analyser);
+		std::lock_guard<std::mutex> lock(mtxAnalysers);
+		analysers.push_back(std::move(analyser));
+	};
+
+	// batches bound the sweeps held in memory; each is stored in order
+	const size_t uiBatch = 4 * uiThreads;
+	int64_t iIngested = 0;
+	for (size_t uiFirst = 0; uiFirst < lines.size(); uiFirst += uiBatch) {
+		const size_t uiCount = std::min(uiBatch, lines.size() - uiFirst);
+		std::vector<Prepared> prepared(uiCount);
+		pool.parallelFor(uiCount, [&](size_t i) { load(lines[uiFirst + i], prepared[i]); });
+		std::unique_lock<std::shared_mutex> lock(m_mtx);
+		if (!m_bOpen)
+			return -1;
+		for (size_t i = 0; i < uiCount; i++) {
+			if (commit(prepared[i]) >= 0)
+				iIngested++;
+			else
+				uiFailed++;
+		}
+		sortDelta();
+	}
+	if (puiFailed)
+		*puiFailed = uiFailed;
+	return iIngested;
+}
+
+} // namespace ct400
+
+
+
+namespace
+{
+
+std::mutex g_mtx;
+std::map<uint64_t, std::shared_ptr<ct400::SpectralArchive> > g_archives;
+uint64_t g_uiNextArchive = 1;
+
+std::shared_ptr<ct400::SpectralArchive> findArchive(uint64_t uiArchive)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	auto it = g_archives.find(uiArchive);
+	return it == g_archives.end() ? nullptr : it->second;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC uint64_t __stdcall CT400_ArchiveOpen(const char *pcDirectory,
+const rResonanceSettings *pSettings)
+{
+	if (pcDirectory == nullptr)
+		return 0;
+	auto archive = std::make_shared<ct400::SpectralArchive>();
+	if (archive->open(pcDirectory, pSettings) != 0)
+		return 0;
+	std::lock_guard<std::mutex> lock(g_mtx);
+	uint64_t uiArchive = g_uiNextArchive++;
+	g_archives[uiArchive] = archive;
+	return uiArchive;
+}
+
+_EXT_DECLSPEC int64_t __stdcall CT400_ArchiveIngest(uint64_t uiArchive,
+const rScanConfig *pConfig, int64_t iTimestamp, const char *pcLabel,
+const double dWavelength[], const rDetector eDetectors[], int32_t iNbDetectors,
+const double dBlock[], int32_t iArraySize)
+{
+	auto archive = findArchive(uiArchive);
+	if (!archive || pConfig == nullptr || eDetectors == nullptr || dBlock == nullptr || iNbDetectors <= 0
+		|| iArraySize <= 0)
+		return -1;
+	std::vector<const double *> rows(iNbDetectors);
+	for (int32_t d = 0; d < iNbDetectors; d++)
+		rows[d] = dBlock + (size_t)d * iArraySize;
+	return archive->ingest(*pConfig, iTimestamp, pcLabel ? pcLabel : "", dWavelength, eDetectors, rows.data(),
+		(size_t)iNbDetectors, (size_t)iArraySize);
+}
+
+_EXT_DECLSPEC int64_t __stdcall CT400_ArchiveIngestFiles(uint64_t uiArchive,
+const char *pcManifest, const rScanConfig *pConfig, int32_t iThreads,
+int32_t *piFailed)
+{
+	auto archive = findArchive(uiArchive);
+	if (!archive || pcManifest == nullptr || iThreads < 0)
+		return -1;
+	rScanConfig config;
+	if (pConfig)
+		config = *pConfig;
+	else
+		CT400_DefaultScanConfig(&config);
+	size_t uiFailed = 0;
+	int64_t iIngested = archive->ingestFiles(pcManifest, config, (size_t)iThreads, &uiFailed);
+	if (piFailed)
+		*piFailed = (int32_t)uiFailed;
+	return iIngested;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultArchiveQuery(rArchiveQuery *pQuery)
+{
+	if (pQuery == nullptr)
+		return -1;
+	std::memset(pQuery, 0, sizeof(*pQuery));
+	pQuery->dMinWavelength = pQuery->dMinExtinction = pQuery->dMinFwhm = pQuery->dMinQ = -ct400::INF;
+	pQuery->dMaxWavelength = pQuery->dMaxExtinction = pQuery->dMaxFwhm = pQuery->dMaxQ = ct400::INF;
+	pQuery->iMinTimestamp = std::numeric_limits<int64_t>::min();
+	pQuery->iMaxTimestamp = std::numeric_limits<int64_t>::max();
+	pQuery->iKinds = RK_BOTH;
+	return 0;
+}
+
+_EXT_DECLSPEC int64_t __stdcall CT400_ArchiveQuery(uint64_t uiArchive,
+const rArchiveQuery *pQuery, rArchiveFeature pFeatures[], uint64_t uiFeatures[],
+int32_t iMaxFeatures)
+{
+	auto archive = findArchive(uiArchive);
+	if (!archive || pQuery == nullptr || iMaxFeatures < 0)
+		return -1;
+	std::vector<uint64_t> found;
+	const int64_t iFound = archive->query(*pQuery, found);
+	for (size_t i = 0; iFound > 0 && i < std::min(found.size(), (size_t)iMaxFeatures); i++) {
+		if (pFeatures)
+			archive->feature(found[i], pFeatures[i]);
+		if (uiFeatures)
+			uiFeatures[i] = found[i];
+	}
+	return iFound;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ArchiveGetSweep(uint64_t uiArchive,
+uint64_t uiSweep, rArchiveSweep *pSweep, double dWavelength[], double dBlock[],
+int32_t iArraySize)
+{
+	auto archive = findArchive(uiArchive);
+	rArchiveSweep sweep;
+	if (!archive || iArraySize < 0 || archive->sweep(uiSweep, sweep) != 0)
+		return -1;
+	if (pSweep)
+		*pSweep = sweep;
+	const int32_t iPoints = std::min(sweep.iPoints, iArraySize);
+	if (dWavelength == nullptr && dBlock == nullptr)
+		return iPoints;
+	std::vector<double> wavelength, block;
+	if (archive->readSweep(uiSweep, wavelength, block) < 0)
+		return -1;
+	if (dWavelength)
+		std::copy(wavelength.begin(), wavelength.begin() + iPoints, dWavelength);
+	for (int32_t d = 0; dBlock && d < sweep.iNbDetectors; d++)
+		std::copy(block.begin() + (size_t)d * sweep.iPoints, block.begin() + (size_t)d * sweep.iPoints + iPoints,
+			dBlock + (size_t)d * iArraySize);
+	return iPoints;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ArchiveGetInfo(uint64_t uiArchive,
+rArchiveInfo *pInfo)
+{
+	auto archive = findArchive(uiArchive);
+	if (!archive || pInfo == nullptr)
+		return -1;
+	std::memset(pInfo, 0, sizeof(*pInfo));
+	pInfo->iSweeps = (int64_t)archive->sweeps();
+	pInfo->iFeatures = (int64_t)archive->features();
+	pInfo->iIndexed = (int64_t)archive->indexed();
+	pInfo->settings = archive->settings();
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ArchiveFlush(uint64_t uiArchive)
+{
+	auto archive = findArchive(uiArchive);
+	return archive ? archive->flush() : -1;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ArchiveClose(uint64_t uiArchive)
+{
+	std::shared_ptr<ct400::SpectralArchive> archive;
+	{
+		std::lock_guard<std::mutex> lock(g_mtx);
+		auto it = g_archives.find(uiArchive);
+		if (it == g_archives.end())
+			return -1;
+		archive = it->second;
+		g_archives.erase(it);
+	}
+	archive->close();
+	return 0;
+}
+
+}
@@ -0,0 +1,386 @@
+/******************************************************************************/
+/* Header file for CT400_archive.cpp                                          */
+/*                                                                            */
+/* Spectral archive: sweeps stored with their scan configuration, the         */
+/* resonances found in them at ingest time, and a B+-tree index per feature   */
+/* (wavelength, extinction, FWHM, Q) so that a query over millions of sweeps  */
+/* reads a few pages instead of every sweep. Existing text exports are bulk   */
+/* ingested in parallel.                                                      */
+/******************************************************************************/
+
+#ifndef CT400_ARCHIVE_H
+#define CT400_ARCHIVE_H
+
+#include "CT400_config.h"
+#include "CT400_resonance.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Sweep of the archive (fixed layout, 240 bytes)
+  typedef struct
+  {
+	uint64_t uiSweep;               // 0 for the first sweep ingested
+	uint64_t uiRecord;              // of the sweep data in sweeps.swp
+	int64_t iTimestamp;             // us since 1970
+	uint64_t uiFirstFeature;        // resonances found are features uiFirstFeature...
+	int32_t iFeatures;              // ... to uiFirstFeature + iFeatures - 1
+	int32_t iPoints;                // of each row
+	int32_t iNbDetectors;           // rows stored
+	int32_t eDetectors[5];          // rDetector of each row
+	rScanConfig config;             // range, resolution, input... of the sweep
+	char tcLabel[64];               // device, source file...
+  } rArchiveSweep;
+
+  // Resonance of a sweep, with the settings of the sweep it was found in
+  // (fixed layout, 96 bytes)
+  typedef struct
+  {
+	uint64_t uiSweep;
+	int64_t iTimestamp;             // of the sweep
+	int32_t eInput;                 // rLaserInput of the sweep
+	int32_t eDetector;              // rDetector
+	int32_t iKind;                  // RK_DIP or RK_PEAK
+	uint32_t uiResolution;          // pm, of the sweep
+	double dMinWavelength;          // nm, range of the sweep
+	double dMaxWavelength;
+	double dWavelength;             // nm (Lorentzian fit if it converged)
+	double dExtinction;             // dB
+	double dFwhm;                   // nm
+	double dQ;
+	double dBaseline;               // dB
+	double dFsr;                    // nm, NaN for the last resonance of its kind
+  } rArchiveFeature;
+
+  // Inclusive ranges, all of which a feature must be in
+  typedef struct
+  {
+	double dMinWavelength;          // nm
+	double dMaxWavelength;
+	double dMinExtinction;          // dB
+	double dMaxExtinction;
+	double dMinFwhm;                // nm
+	double dMaxFwhm;
+	double dMinQ;
+	double dMaxQ;
+	int64_t iMinTimestamp;          // us since 1970
+	int64_t iMaxTimestamp;
+	int32_t eInput;                 // 0 for any
+	int32_t eDetector;              // 0 for any
+	int32_t iKinds;                 // rResonanceKind
+	int32_t iReserved;
+  } rArchiveQuery;
+
+  typedef struct
+  {
+	int64_t iSweeps;
+	int64_t iFeatures;
+	int64_t iIndexed;               // features in the index file, the others are searched in memory
+	int64_t iReserved;
+	rResonanceSettings settings;    // used at ingest
+  } rArchiveInfo;
+
+//------------------------------ CT400_ArchiveOpen -----------------------------
+// Function CT400_ArchiveOpen
+//
+//  Purpose: Opens the archive held in a directory, creating it if needed.
+//           One process at a time may open an archive.
+//
+//  Parameters: IN pcDirectory: directory of the archive
+//              IN pSettings: resonance detection used at ingest by a new
+//                            archive, or NULL for CT400_DefaultResonanceSettings
+//                            (an existing archive keeps its own)
+//  Returns:  uiArchive for use in the other CT400_Archive functions,
+//            0 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC uint64_t __stdcall CT400_ArchiveOpen(const char *pcDirectory,
+const rResonanceSettings *pSettings);
+
+//------------------------------ CT400_ArchiveIngest ---------------------------
+// Function CT400_ArchiveIngest
+//
+//  Purpose: Stores a sweep, finds its resonances and indexes them
+//
+//  Parameters: IN uiArchive: from CT400_ArchiveOpen
+//              IN pConfig: configuration of the sweep
+//              IN iTimestamp: us since 1970, 0 for now
+//              IN pcLabel: device or other label (63 characters kept), or
+//                          NULL
+//              IN dWavelength: wavelength axis, iArraySize values
+//              IN eDetectors: detector of each block row
+//              IN iNbDetectors: rows of dBlock (1 to 5)
+//              IN dBlock: iNbDetectors rows of iArraySize values (dB)
+//              IN iArraySize: points of the sweep
+//  Returns:  number of the sweep in the archive, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int64_t __stdcall CT400_ArchiveIngest(uint64_t uiArchive,
+const rScanConfig *pConfig, int64_t iTimestamp, const char *pcLabel,
+const double dWavelength[], const rDetector eDetectors[], int32_t iNbDetectors,
+const double dBlock[], int32_t iArraySize);
+
+//------------------------------ CT400_ArchiveIngestFiles ----------------------
+// Function CT400_ArchiveIngestFiles
+//
+//  Purpose: Bulk ingest of text exports (CT400_ScanSaveWavelengthResampledFile
+//           and CT400_ScanSaveDetectorResampledFile, one value per line).
+//           Each line of the manifest describes a sweep, with tab separated
+//           fields: the wavelength file, then pairs of a detector number and
+//           its file. Empty lines and lines starting with # are skipped.
+//           Files are read and analysed in parallel, and the sweeps stored
+//           in manifest order. The range and resolution of each sweep come
+//           from its wavelength file, its timestamp from the modification
+//           time of its first detector file and its label from that file's
+//           name; the other settings from pConfig.
+//
+//  Parameters: IN uiArchive: from CT400_ArchiveOpen
+//              IN pcManifest: manifest file
+//              IN pConfig: settings of the sweeps (input, laser...), or NULL
+//                          for CT400_DefaultScanConfig
+//              IN iThreads: 0 for one per hardware thread
+//              IN/OUT piFailed: pointer over a variable receiving the number
+//                               of sweeps that could not be read, or NULL
+//  Returns:  number of sweeps ingested, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int64_t __stdcall CT400_ArchiveIngestFiles(uint64_t uiArchive,
+const char *pcManifest, const rScanConfig *pConfig, int32_t iThreads,
+int32_t *piFailed);
+
+//------------------------------ CT400_DefaultArchiveQuery ---------------------
+// Function CT400_DefaultArchiveQuery
+//
+//  Purpose: Fills a query matching every feature (unbounded ranges, any
+//           input, detector and kind)
+//
+//  Parameters: IN/OUT pQuery: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultArchiveQuery(rArchiveQuery *pQuery);
+
+//------------------------------ CT400_ArchiveQuery ----------------------------
+// Function CT400_ArchiveQuery
+//
+//  Purpose: Finds the features within every range of a query. The most
+//           selective indexed range is read from its index and the others
+//           checked on the features it yields.
+//
+//  Parameters: IN uiArchive: from CT400_ArchiveOpen
+//              IN pQuery: query, from CT400_DefaultArchiveQuery with some
+//                         ranges narrowed
+//              IN/OUT pFeatures: pointer over an initialized array of
+//                                iMaxFeatures values, or NULL
+//              IN/OUT uiFeatures: pointer over an initialized array of
+//                                 iMaxFeatures values receiving the feature
+//                                 numbers, or NULL
+//              IN iMaxFeatures: size of the arrays
+//  Returns:  number of features found (only the first iMaxFeatures are
+//            written, in the order they were ingested), -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int64_t __stdcall CT400_ArchiveQuery(uint64_t uiArchive,
+const rArchiveQuery *pQuery, rArchiveFeature pFeatures[], uint64_t uiFeatures[],
+int32_t iMaxFeatures);
+
+//------------------------------ CT400_ArchiveGetSweep -------------------------
+// Function CT400_ArchiveGetSweep
+//
+//  Purpose: Copies a stored sweep
+//
+//  Parameters: IN uiArchive: from CT400_ArchiveOpen
+//              IN uiSweep: number of the sweep (rArchiveFeature.uiSweep)
+//              IN/OUT pSweep: pointer over a variable, or NULL
+//              IN/OUT dWavelength: pointer over an initialized array of
+//                                  iArraySize values, or NULL
+//              IN/OUT dBlock: pointer over an initialized array of
+//                             iArraySize values per detector of the sweep
+//                             (pSweep->eDetectors), or NULL
+//              IN iArraySize: size of one block row
+//  Returns:  number of points written in each row, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ArchiveGetSweep(uint64_t uiArchive,
+uint64_t uiSweep, rArchiveSweep *pSweep, double dWavelength[], double dBlock[],
+int32_t iArraySize);
+
+//------------------------------ CT400_ArchiveGetInfo --------------------------
+// Function CT400_ArchiveGetInfo
+//
+//  Parameters: IN uiArchive: from CT400_ArchiveOpen
+//              IN/OUT pInfo: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ArchiveGetInfo(uint64_t uiArchive,
+rArchiveInfo *pInfo);
+
+//------------------------------ CT400_ArchiveFlush ----------------------------
+// Function CT400_ArchiveFlush
+//
+//  Purpose: Merges the features indexed in memory into the index file and
+//           writes everything back to disk
+//
+//  Parameters: IN uiArchive: from CT400_ArchiveOpen
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ArchiveFlush(uint64_t uiArchive);
+
+//------------------------------ CT400_ArchiveClose ----------------------------
+// Function CT400_ArchiveClose
+//
+//  Purpose: Flushes and closes the archive
+//
+//  Parameters: IN uiArchive: from CT400_ArchiveOpen
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ArchiveClose(uint64_t uiArchive);
+
+#ifdef __cplusplus
+}
+
+#include "CT400_mmap.h"
+#include "CT400_sweep_file.h"
+
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+namespace ct400
+{
+
+//------------------------------ SpectralArchive -------------------------------
+// Class SpectralArchive
+//
+//  Purpose: Directory holding the sweep data (sweeps.swp, a sweep file),
+//           the sweep and feature tables (sweeps.dat and features.dat,
+//           fixed size records in growing mapped files) and the index
+//           (index.dat). The index keeps, per key, the (key, feature) pairs
+//           sorted by key in leaves of one page, and the first key of each
+//           leaf in memory: a range lookup is a search of that in-memory
+//           level and then of one leaf page at either end, a static B+-tree
+//           of two levels. Features ingested since the index was written are
+//           kept sorted in memory and merged into a new index file once they
+//           reach an eighth of it (or MIN_MERGE), by flush() and close().
+//           Features are found outside the lock, so queries go on during
+//           ingest; queries run concurrently.
+//------------------------------------------------------------------------------
+class SpectralArchive
+{
+public:
+	enum Key
+	{
+		KEY_WAVELENGTH = 0,
+		KEY_EXTINCTION,
+		KEY_FWHM,
+		KEY_Q,
+		KEYS
+	};
+
+	static const size_t LEAF_ENTRIES = 512;         // one 4 KiB page
+	static const size_t MIN_MERGE = 65536;          // features kept in memory at least
+
+	SpectralArchive() {}
+	~SpectralArchive() { close(); }
+
+	SpectralArchive(const SpectralArchive &) = delete;
+	SpectralArchive &operator=(const SpectralArchive &) = delete;
+
+	// Returns 0 if success, -1 otherwise
+	int32_t open(const std::string &strDirectory, const rResonanceSettings *pSettings = nullptr);
+	void close();
+	// Merges the in-memory features into the index and writes the tables
+	// back. Returns 0 if success, -1 otherwise
+	int32_t flush(bool bSync = false);
+
+	// Returns the number of the sweep, -1 otherwise
+	int64_t ingest(const rScanConfig &config, int64_t iTimestamp, const std::string &strLabel,
+		const double *pdWavelength, const rDetector *peDetectors, const double *const *ppdRows, size_t uiDetectors,
+		size_t uiPoints);
+	// See CT400_ArchiveIngestFiles. Returns the number of sweeps ingested,
+	// -1 otherwise
+	int64_t ingestFiles(const std::string &strManifest, const rScanConfig &config, size_t uiThreads,
+		size_t *puiFailed = nullptr);
+
+	// Feature numbers in ingest order. Returns their number, -1 otherwise
+	int64_t query(const rArchiveQuery &query, std::vector<uint64_t> &features) const;
+
+	size_t sweeps() const;
+	size_t features() const;
+	size_t indexed() const;
+	rResonanceSettings settings() const;
+	// Returns 0 if success, -1 otherwise
+	int32_t sweep(uint64_t uiSweep, rArchiveSweep &sweep) const;
+	int32_t feature(uint64_t uiFeature, rArchiveFeature &feature) const;
+	// Wavelength axis and detector rows (one after the other) of a sweep.
+	// Returns the number of points, -1 otherwise
+	int64_t readSweep(uint64_t uiSweep, std::vector<double> &wavelength, std::vector<double> &block);
+
+private:
+	// Index pair; keys are rounded outwards when searched and the feature
+	// checked in full, so float keys lose nothing
+	struct Entry
+	{
+		float fKey;
+		uint32_t uiFeature;
+	};
+
+	// Fixed size records after a header page, in a mapped file doubled as
+	// it fills
+	struct Table
+	{
+		WritableMappedFile file;
+		size_t uiRecordSize = 0;
+		size_t uiCount = 0;
+
+		int32_t open(const std::string &strPath, size_t uiRecord, const char *pcMagic);
+		int32_t reserve(size_t uiRecords);
+		uint8_t *record(size_t i) const;
+		uint8_t *header() const { return file.data(); }
+		void close();
+	};
+
+	struct Prepared;
+
+	// Finds the features of a sweep (any thread)
+	void analyse(Prepared &prepared, const rResonanceSettings &settings, ResonanceAnalyser &analyser) const;
+	// With m_mtx held exclusively. Returns the number of the sweep, -1
+	// otherwise
+	int64_t commit(const Prepared &prepared);
+	// With m_mtx held exclusively
+	void sortDelta();
+	// Delta of every feature from m_uiIndexed on, sorted
+	void loadDelta();
+	int32_t merge();
+	int32_t openIndex();
+	void storeCounts();
+
+	static float key(const rArchiveFeature &feature, size_t uiKey);
+	// Positions of the keys in [fLo, fHi] in the index of uiKey
+	void indexRange(size_t uiKey, float fLo, float fHi, size_t &uiBegin, size_t &uiEnd) const;
+	const Entry *indexEntries(size_t uiKey) const;
+
+	std::string m_strDirectory;
+	rResonanceSettings m_settings;
+	SweepFileWriter m_writer;
+	SweepFileReader m_reader;
+	std::mutex m_mtxReader;
+	Table m_sweeps;
+	Table m_features;
+	MappedFile m_index;
+	size_t m_uiIndexed = 0;
+	Span<const float> m_fences[KEYS];               // first key of each leaf, in m_index
+	std::vector<Entry> m_delta[KEYS];               // features from m_uiIndexed on, sorted by key
+	size_t m_uiSortedDelta[KEYS] = {};
+	bool m_bOpen = false;
+
+	// ingest() analyses outside m_mtx with this one
+	std::mutex m_mtxAnalyser;
+	std::unique_ptr<ResonanceAnalyser> m_analyser;
+	mutable std::shared_mutex m_mtx;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
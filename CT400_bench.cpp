@@ -0,0 +1,654 @@
+//------------------------------------------------------------------------------
+// CT400_bench.cpp
+//
+// Benchmarks of the sweep acquisition and post-processing path, run against
+// the simulator (CT400_sim.cpp) with a fixed seed and, by default, no waits,
+// so that only the host side is measured and runs are comparable between
+// commits. Each case is timed like Google Benchmark: the iteration count is
+// grown until a run lasts --min-time, then --repetitions runs are kept, and
+// --json writes the results in its JSON layout.
+//
+//  CT400_bench [--filter=regex] [--min-time=s] [--repetitions=n]
+//              [--json=path] [--seed=n] [--timescale=x] [--tmp=dir] [--list]
+//
+// Cases, each over the resolution (250 pm to 1 pm over 130 nm) and, where it
+// matters, the number of detectors:
+//   retrieve/per_array   resampled arrays one call each, as perform_scan
+//   retrieve/block       ScanBuffer::fetchResampled
+//   sync/per_array       sync arrays one call each, discard points dropped
+//   sync/block           ScanBuffer::fetchSync
+//   sync/resample        fetchSync then resampling onto the resolution grid
+//   export/text          CT400_ScanSave*ResampledFile
+//   export/f64, f32, xor SweepFileWriter records (raw, float32, XOR+RLE)
+//   poll/read_power      CT400_ReadPowerDetectors
+//   sweep/serial         start, wait and fetch, one sweep after the other
+//   sweep/engine         ScanEngine, fetch overlapping the next sweep
+//------------------------------------------------------------------------------
+
+#include "CT400_config.h"
+#include "CT400_device.h"
+#include "CT400_resample.h"
+#include "CT400_sim.h"
+#include "CT400_sweep_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+	std::string strFilter = ".*";
+	double dMinTime = 0.5;
+	int iRepetitions = 3;
+	std::string strJson;
+	uint64_t uiSeed = 400;
+	double dTimeScale = 0.0;
+	std::string strTmp = "/tmp";
+	bool bList = false;
+};
+
+Options g_options;
+
+//------------------------------ Bench -----------------------------------------
+// State handed to a case. The case prepares what it needs, sets the work done
+// per iteration and calls run() with one iteration; run() does the timing.
+//------------------------------------------------------------------------------
+class Bench
+{
+public:
+	struct Run
+	{
+		uint64_t uiIterations;
+		double dReal;               // s per iteration
+		double dCpu;                // process CPU s per iteration
+	};
+
+	explicit Bench(const std::vector<int64_t> &args) : m_args(args) {}
+
+	int64_t arg(size_t i) const { return m_args[i]; }
+	void setItems(double dItems) { m_dItems = dItems; }
+	void setBytes(double dBytes) { m_dBytes = dBytes; }
+	void skip(const std::string &strReason) { m_strSkip = strReason; }
+
+	void run(const std::function<void()> &iteration)
+	{
+		if (!m_strSkip.empty())
+			return;
+		uint64_t n = 1;
+		for (;;) {
+			Run r = measure(iteration, n);
+			double dTotal = r.dReal * n;
+			if (dTotal >= g_options.dMinTime || n >= 1000000000)
+				break;
+			// aim 40 % past the minimum so that the next try usually ends the search
+			double dNext = dTotal > 0.0 ? n * g_options.dMinTime * 1.4 / dTotal : n * 10.0;
+			n = (uint64_t)std::min(std::max(dNext, n * 2.0), std::min(n * 10.0, 1e9));
+		}
+		for (int i = 0; i < g_options.iRepetitions; i++)
+			m_runs.push_back(measure(iteration, n));
+	}
+
+	const std::vector<Run> &runs() const { return m_runs; }
+	double items() const { return m_dItems; }
+	double bytes() const { return m_dBytes; }
+	const std::string &skipped() const { return m_strSkip; }
+
+private:
+	static Run measure(const std::function<void()> &iteration, uint64_t n)
+	{
+		std::clock_t cStart = std::clock();
+		Clock::time_point tStart = Clock::now();
+		for (uint64_t i = 0; i < n; i++)
+			iteration();
+		Run r;
+		r.uiIterations = n;
+		r.dReal = std::chrono::duration<double>(Clock::now() - tStart).count() / n;
+		r.dCpu = (double)(std::clock() - cStart) / CLOCKS_PER_SEC / n;
+		return r;
+	}
+
+	std::vector<int64_t> m_args;
+	double m_dItems = 0.0;
+	double m_dBytes = 0.0;
+	std::string m_strSkip;
+	std::vector<Run> m_runs;
+};
+
+struct Case
+{
+	std::string strName;
+	std::vector<std::string> argNames;
+	std::vector<std::vector<int64_t> > args;
+	std::function<void(Bench &)> fn;
+};
+
+const int64_t RESOLUTIONS[] = { 250, 100, 50, 10, 5, 2, 1 };
+
+// Every combination of detector counts and resolutions
+std::vector<std::vector<int64_t> > detectorsByResolution(const std::vector<int64_t> &detectors)
+{
+	std::vector<std::vector<int64_t> > args;
+	for (int64_t d : detectors)
+		for (int64_t r : RESOLUTIONS)
+			args.push_back({ d, r });
+	return args;
+}
+
+//------------------------------ Sim -------------------------------------------
+// A simulated CT400 configured for one case and swept once
+//------------------------------------------------------------------------------
+class Sim
+{
+public:
+	Sim()
+	{
+		rSimConfig c;
+		CT400_SimGetConfig(0, &c);
+		c.dTimeScale = g_options.dTimeScale;
+		c.uiSeed = g_options.uiSeed;
+		c.dErrorProbability = 0.0;
+		CT400_SimSetConfig(0, &c);
+		int32_t iError = 0;
+		m_uiHandle = CT400_Init(&iError);
+		// handles are seeded with uiSeed + handle: give every case the same noise
+		// whichever cases ran before it
+		if (m_uiHandle && CT400_SimGetConfig(m_uiHandle, &c) == 0) {
+			c.uiSeed = g_options.uiSeed - m_uiHandle;
+			CT400_SimSetConfig(m_uiHandle, &c);
+		}
+	}
+
+	~Sim()
+	{
+		if (m_uiHandle) {
+			ct400::Device::release(m_uiHandle);
+			CT400_Close(m_uiHandle);
+		}
+	}
+
+	uint64_t handle() const { return m_uiHandle; }
+	const std::vector<rDetector> &detectors() const { return m_detectors; }
+
+	// DE_1 plus uiDetectors - 1 of DE_2..DE_4. Returns 0 if success
+	int32_t configure(size_t uiDetectors, uint32_t uiResolution)
+	{
+		rScanConfig config;
+		CT400_DefaultScanConfig(&config);
+		config.uiResolution = uiResolution;
+		config.eDect2 = uiDetectors > 1 ? ENABLE : DISABLE;
+		config.eDect3 = uiDetectors > 2 ? ENABLE : DISABLE;
+		config.eDect4 = uiDetectors > 3 ? ENABLE : DISABLE;
+		m_config = config;
+		m_detectors = ct400::enabledDetectors(config);
+		return m_uiHandle && CT400_ApplyScanConfig(m_uiHandle, &config) == 0 ? 0 : -1;
+	}
+
+	// Returns 0 if success
+	int32_t sweep()
+	{
+		char tcError[1024];
+		return CT400_ScanStart(m_uiHandle) == 0 && CT400_ScanWaitEnd(m_uiHandle, tcError) == 0 ? 0 : -1;
+	}
+
+	const rScanConfig &config() const { return m_config; }
+
+private:
+	uint64_t m_uiHandle = 0;
+	rScanConfig m_config;
+	std::vector<rDetector> m_detectors;
+};
+
+// Configures and sweeps once; false (and the case skipped) on failure
+bool prepare(Bench &b, Sim &sim, size_t uiDetectors, uint32_t uiResolution)
+{
+	if (sim.configure(uiDetectors, uiResolution) != 0 || sim.sweep() != 0) {
+		b.skip("simulator setup failed");
+		return false;
+	}
+	return true;
+}
+
+void retrievePerArray(Bench &b)
+{
+	Sim sim;
+	if (!prepare(b, sim, (size_t)b.arg(0), (uint32_t)b.arg(1)))
+		return;
+	const uint64_t h = sim.handle();
+	std::vector<double> wavelength, rows;
+	const int32_t iPoints = CT400_GetNbDataPointsResampled(h);
+	b.setItems((double)iPoints * sim.detectors().size());
+	b.setBytes((double)iPoints * (sim.detectors().size() + 1) * sizeof(double));
+	b.run([&] {
+		int32_t n = CT400_GetNbDataPointsResampled(h);
+		wavelength.resize(n);
+		rows.resize((size_t)n * sim.detectors().size());
+		CT400_ScanGetWavelengthResampledArray(h, wavelength.data(), n);
+		for (size_t d = 0; d < sim.detectors().size(); d++)
+			CT400_ScanGetDetectorResampledArray(h, sim.detectors()[d], rows.data() + d * n, n);
+	});
+}
+
+void retrieveBlock(Bench &b)
+{
+	Sim sim;
+	if (!prepare(b, sim, (size_t)b.arg(0), (uint32_t)b.arg(1)))
+		return;
+	ct400::ScanBuffer buffer;
+	const int32_t iPoints = CT400_GetNbDataPointsResampled(sim.handle());
+	b.setItems((double)iPoints * sim.detectors().size());
+	b.setBytes((double)iPoints * (sim.detectors().size() + 1) * sizeof(double));
+	b.run([&] { buffer.fetchResampled(sim.handle(), sim.detectors()); });
+}
+
+void syncPerArray(Bench &b)
+{
+	Sim sim;
+	if (!prepare(b, sim, (size_t)b.arg(0), (uint32_t)b.arg(1)))
+		return;
+	const uint64_t h = sim.handle();
+	std::vector<double> raw, wavelength, rows;
+	int32_t iDataPoints = 0, iDiscard = 0;
+	CT400_GetNbDataPoints(h, &iDataPoints, &iDiscard);
+	const size_t uiValid = (size_t)(iDataPoints - iDiscard);
+	b.setItems((double)uiValid * sim.detectors().size());
+	b.setBytes((double)uiValid * (sim.detectors().size() + 1) * sizeof(double));
+	b.run([&] {
+		int32_t n = 0, iSkip = 0;
+		CT400_GetNbDataPoints(h, &n, &iSkip);
+		const size_t uiKeep = (size_t)(n - iSkip);
+		raw.resize(n);
+		wavelength.resize(uiKeep);
+		rows.resize(uiKeep * sim.detectors().size());
+		CT400_ScanGetWavelengthSyncArray(h, raw.data(), n);
+		std::copy(raw.begin() + iSkip, raw.end(), wavelength.begin());
+		for (size_t d = 0; d < sim.detectors().size(); d++) {
+			CT400_ScanGetDetectorArray(h, sim.detectors()[d], raw.data(), n);
+			std::copy(raw.begin() + iSkip, raw.end(), rows.begin() + d * uiKeep);
+		}
+	});
+}
+
+void syncBlock(Bench &b)
+{
+	Sim sim;
+	if (!prepare(b, sim, (size_t)b.arg(0), (uint32_t)b.arg(1)))
+		return;
+	ct400::ScanBuffer buffer;
+	const int32_t iPoints = buffer.fetchSync(sim.handle(), sim.detectors());
+	b.setItems((double)iPoints * sim.detectors().size());
+	b.setBytes((double)iPoints * (sim.detectors().size() + 1) * sizeof(double));
+	b.run([&] { buffer.fetchSync(sim.handle(), sim.detectors()); });
+}
+
+void syncResample(Bench &b)
+{
+	Sim sim;
+	if (!prepare(b, sim, (size_t)b.arg(0), (uint32_t)b.arg(1)))
+		return;
+	ct400::ScanBuffer sync, out;
+	ct400::AlignedVector grid;
+	const rScanConfig &c = sim.config();
+	const size_t uiGrid = ct400::uniformGrid(c.dMinWavelength, c.dMaxWavelength, c.uiResolution * 1e-3, grid);
+	b.setItems((double)uiGrid * sim.detectors().size());
+	b.run([&] {
+		sync.fetchSync(sim.handle(), sim.detectors());
+		ct400::resample(sync, grid.data(), uiGrid, IM_LINEAR, out);
+	});
+}
+
+std::string tempPath(const std::string &strName)
+{
+	return g_options.strTmp + "/ct400_bench_" + strName;
+}
+
+size_t fileSize(const std::string &strPath)
+{
+	FILE *pFile = std::fopen(strPath.c_str(), "rb");
+	if (pFile == nullptr)
+		return 0;
+	std::fseek(pFile, 0, SEEK_END);
+	long lSize = std::ftell(pFile);
+	std::fclose(pFile);
+	return lSize > 0 ? (size_t)lSize : 0;
+}
+
+void exportText(Bench &b)
+{
+	Sim sim;
+	if (!prepare(b, sim, (size_t)b.arg(0), (uint32_t)b.arg(1)))
+		return;
+	const uint64_t h = sim.handle();
+	std::vector<std::string> paths;
+	paths.push_back(tempPath("wavelength.txt"));
+	for (rDetector d : sim.detectors())
+		paths.push_back(tempPath("detector" + std::to_string((int)d) + ".txt"));
+	auto save = [&] {
+		CT400_ScanSaveWavelengthResampledFile(h, &paths[0][0]);
+		for (size_t d = 0; d < sim.detectors().size(); d++)
+			CT400_ScanSaveDetectorResampledFile(h, sim.detectors()[d], &paths[d + 1][0]);
+	};
+	save();
+	size_t uiBytes = 0;
+	for (const std::string &strPath : paths)
+		uiBytes += fileSize(strPath);
+	b.setItems((double)CT400_GetNbDataPointsResampled(h) * sim.detectors().size());
+	b.setBytes((double)uiBytes);
+	b.run(save);
+	for (const std::string &strPath : paths)
+		std::remove(strPath.c_str());
+}
+
+void exportBinary(Bench &b, ct400::rSampleType eType, ct400::rEncoding eEncoding)
+{
+	Sim sim;
+	if (!prepare(b, sim, (size_t)b.arg(0), (uint32_t)b.arg(1)))
+		return;
+	ct400::ScanBuffer buffer;
+	buffer.fetchResampled(sim.handle(), sim.detectors(), true);
+	ct400::SweepInfo info;
+	info.config = sim.config();
+	const std::string strPath = tempPath("sweeps.ct4");
+	ct400::SweepFileWriter writer;
+	// a fresh file per iteration, like one text export per sweep
+	auto write = [&] {
+		std::remove(strPath.c_str());
+		writer.open(strPath);
+		writer.append(info, buffer, nullptr, eType, eEncoding);
+		writer.close();
+	};
+	write();
+	b.setItems((double)buffer.points() * sim.detectors().size());
+	b.setBytes((double)fileSize(strPath));
+	b.run(write);
+	std::remove(strPath.c_str());
+}
+
+void pollReadPower(Bench &b)
+{
+	Sim sim;
+	if (!sim.handle()) {
+		b.skip("simulator setup failed");
+		return;
+	}
+	double v[6];
+	b.setItems(1.0);
+	b.run([&] { CT400_ReadPowerDetectors(sim.handle(), &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]); });
+}
+
+void sweepSerial(Bench &b)
+{
+	Sim sim;
+	if (!prepare(b, sim, (size_t)b.arg(0), (uint32_t)b.arg(1)))
+		return;
+	ct400::ScanBuffer buffer;
+	b.setItems(1.0);
+	b.run([&] {
+		if (sim.sweep() == 0)
+			buffer.fetchResampled(sim.handle(), sim.detectors());
+	});
+}
+
+void sweepEngine(Bench &b)
+{
+	Sim sim;
+	if (!prepare(b, sim, (size_t)b.arg(0), (uint32_t)b.arg(1)))
+		return;
+	ct400::ScanEngine engine(sim.handle(), sim.detectors(), 2, 2);
+	// iterations queue sweeps; keeping two in flight lets the engine overlap them
+	std::vector<std::future<ct400::SweepResult> > pending;
+	b.setItems(1.0);
+	b.run([&] {
+		pending.push_back(engine.submit());
+		if (pending.size() > 2) {
+			pending.front().get();
+			pending.erase(pending.begin());
+		}
+	});
+	engine.waitIdle();
+}
+
+std::vector<Case> cases()
+{
+	const std::vector<std::string> DR = { "dets", "res_pm" };
+	std::vector<Case> c;
+	c.push_back({ "retrieve/per_array", DR, detectorsByResolution({ 1, 2, 3, 4 }), retrievePerArray });
+	c.push_back({ "retrieve/block", DR, detectorsByResolution({ 1, 2, 3, 4 }), retrieveBlock });
+	c.push_back({ "sync/per_array", DR, { { 1, 1 }, { 4, 1 } }, syncPerArray });
+	c.push_back({ "sync/block", DR, { { 1, 1 }, { 4, 1 } }, syncBlock });
+	c.push_back({ "sync/resample", DR, detectorsByResolution({ 1, 4 }), syncResample });
+	c.push_back({ "export/text", DR, detectorsByResolution({ 1, 4 }), exportText });
+	c.push_back({ "export/f64", DR, detectorsByResolution({ 1, 4 }),
+		[](Bench &b) { exportBinary(b, ct400::SAMPLE_F64, ct400::ENCODING_RAW); } });
+	c.push_back({ "export/f32", DR, detectorsByResolution({ 1, 4 }),
+		[](Bench &b) { exportBinary(b, ct400::SAMPLE_F32, ct400::ENCODING_RAW); } });
+	c.push_back({ "export/xor", DR, detectorsByResolution({ 1, 4 }),
+		[](Bench &b) { exportBinary(b, ct400::SAMPLE_F64, ct400::ENCODING_XOR_RLE); } });
+	c.push_back({ "poll/read_power", {}, { {} }, pollReadPower });
+	c.push_back({ "sweep/serial", DR, detectorsByResolution({ 1, 4 }), sweepSerial });
+	c.push_back({ "sweep/engine", DR, detectorsByResolution({ 1, 4 }), sweepEngine });
+	return c;
+}
+
+std::string runName(const Case &c, const std::vector<int64_t> &args)
+{
+	std::string strName = c.strName;
+	for (size_t i = 0; i < args.size(); i++)
+		strName += "/" + c.argNames[i] + ":" + std::to_string(args[i]);
+	return strName;
+}
+
+std::string jsonEscape(const std::string &str)
+{
+	std::string strOut;
+	for (char ch : str) {
+		if (ch == '"' || ch == '\\')
+			strOut += '\\';
+		strOut += ch;
+	}
+	return strOut;
+}
+
+struct Result
+{
+	std::string strName;
+	std::vector<Bench::Run> runs;
+	double dItems;
+	double dBytes;
+	std::string strSkipped;
+};
+
+// One entry of the "benchmarks" array, times in us
+void jsonEntry(std::string &strJson, const Result &r, const char *pcType, const char *pcAggregate, size_t uiIndex,
+	uint64_t uiIterations, double dReal, double dCpu)
+{
+	char tcLine[1024];
+	std::string strName = r.strName;
+	if (pcAggregate)
+		strName += std::string("_") + pcAggregate;
+	std::snprintf(tcLine, sizeof(tcLine),
+		"    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"%s\",\n"
+		"      \"repetitions\": %d,\n      \"repetition_index\": %zu,\n      \"threads\": 1,\n"
+		"      \"iterations\": %llu,\n      \"real_time\": %.6g,\n      \"cpu_time\": %.6g,\n"
+		"      \"time_unit\": \"us\"",
+		jsonEscape(strName).c_str(), jsonEscape(r.strName).c_str(), pcType, (int)r.runs.size(), uiIndex,
+		(unsigned long long)uiIterations, dReal * 1e6, dCpu * 1e6);
+	strJson += tcLine;
+	if (pcAggregate) {
+		std::snprintf(tcLine, sizeof(tcLine), ",\n      \"aggregate_name\": \"%s\"", pcAggregate);
+		strJson += tcLine;
+	}
+	if (r.dItems > 0.0 && dReal > 0.0 && std::strcmp(pcAggregate ? pcAggregate : "", "stddev") != 0) {
+		std::snprintf(tcLine, sizeof(tcLine), ",\n      \"items_per_second\": %.6g", r.dItems / dReal);
+		strJson += tcLine;
+	}
+	if (r.dBytes > 0.0 && dReal > 0.0 && std::strcmp(pcAggregate ? pcAggregate : "", "stddev") != 0) {
+		std::snprintf(tcLine, sizeof(tcLine), ",\n      \"bytes_per_second\": %.6g", r.dBytes / dReal);
+		strJson += tcLine;
+	}
+	strJson += "\n    }";
+}
+
+int32_t writeJson(const std::string &strPath, const std::vector<Result> &results)
+{
+	char tcDate[64];
+	std::time_t t = std::time(nullptr);
+	std::strftime(tcDate, sizeof(tcDate), "%Y-%m-%dT%H:%M:%S", std::localtime(&t));
+	char tcContext[1024];
+	std::snprintf(tcContext, sizeof(tcContext),
+		"{\n  \"context\": {\n    \"date\": \"%s\",\n    \"num_cpus\": %u,\n"
+#if defined (NDEBUG)
+		"    \"library_build_type\": \"release\",\n"
+#else
+		"    \"library_build_type\": \"debug\",\n"
+#endif
+		"    \"ct400_backend\": \"simulator\",\n    \"sim_seed\": %llu,\n    \"sim_timescale\": %g,\n"
+		"    \"min_time\": %g\n  },\n  \"benchmarks\": [\n",
+		tcDate, std::thread::hardware_concurrency(), (unsigned long long)g_options.uiSeed,
+		g_options.dTimeScale, g_options.dMinTime);
+	std::string strJson = tcContext;
+	bool bFirst = true;
+	auto separator = [&] {
+		if (!bFirst)
+			strJson += ",\n";
+		bFirst = false;
+	};
+	for (const Result &r : results) {
+		if (r.runs.empty())
+			continue;
+		std::vector<double> real, cpu;
+		for (size_t i = 0; i < r.runs.size(); i++) {
+			separator();
+			jsonEntry(strJson, r, "iteration", nullptr, i, r.runs[i].uiIterations, r.runs[i].dReal, r.runs[i].dCpu);
+			real.push_back(r.runs[i].dReal);
+			cpu.push_back(r.runs[i].dCpu);
+		}
+		if (r.runs.size() < 2)
+			continue;
+		auto mean = [](const std::vector<double> &v) {
+			double s = 0.0;
+			for (double x : v)
+				s += x;
+			return s / v.size();
+		};
+		auto median = [](std::vector<double> v) {
+			std::sort(v.begin(), v.end());
+			return v.size() % 2 ? v[v.size() / 2] : 0.5 * (v[v.size() / 2 - 1] + v[v.size() / 2]);
+		};
+		auto stddev = [&](const std::vector<double> &v) {
+			double m = mean(v), s = 0.0;
+			for (double x : v)
+				s += (x - m) * (x - m);
+			return std::sqrt(s / (v.size() - 1));
+		};
+		const uint64_t n = r.runs[0].uiIterations;
+		separator();
+		jsonEntry(strJson, r, "aggregate", "mean", 0, n, mean(real), mean(cpu));
+		separator();
+		jsonEntry(strJson, r, "aggregate", "median", 0, n, median(real), median(cpu));
+		separator();
+		jsonEntry(strJson, r, "aggregate", "stddev", 0, n, stddev(real), stddev(cpu));
+	}
+	strJson += "\n  ]\n}\n";
+	FILE *pFile = std::fopen(strPath.c_str(), "wb");
+	if (pFile == nullptr)
+		return -1;
+	bool bOk = std::fwrite(strJson.data(), 1, strJson.size(), pFile) == strJson.size();
+	return std::fclose(pFile) == 0 && bOk ? 0 : -1;
+}
+
+bool parseOptions(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		std::string strArg = argv[i];
+		size_t uiEq = strArg.find('=');
+		std::string strKey = strArg.substr(0, uiEq);
+		std::string strValue = uiEq == std::string::npos ? std::string() : strArg.substr(uiEq + 1);
+		if (strKey == "--filter")
+			g_options.strFilter = strValue;
+		else if (strKey == "--min-time")
+			g_options.dMinTime = std::atof(strValue.c_str());
+		else if (strKey == "--repetitions")
+			g_options.iRepetitions = std::max(1, std::atoi(strValue.c_str()));
+		else if (strKey == "--json")
+			g_options.strJson = strValue;
+		else if (strKey == "--seed")
+			g_options.uiSeed = std::strtoull(strValue.c_str(), nullptr, 10);
+		else if (strKey == "--timescale")
+			g_options.dTimeScale = std::atof(strValue.c_str());
+		else if (strKey == "--tmp")
+			g_options.strTmp = strValue;
+		else if (strKey == "--list")
+			g_options.bList = true;
+		else {
+			std::fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	if (!parseOptions(argc, argv))
+		return 2;
+	std::regex filter;
+	try {
+		filter = std::regex(g_options.strFilter);
+	}
+	catch (const std::regex_error &) {
+		std::fprintf(stderr, "Invalid filter %s\n", g_options.strFilter.c_str());
+		return 2;
+	}
+
+	std::vector<Result> results;
+	std::printf("%-44s %14s %14s %12s %14s %14s\n", "Benchmark", "Time (us)", "CPU (us)", "Iterations",
+		"Items/s", "MB/s");
+	for (const Case &c : cases())
+		for (const std::vector<int64_t> &args : c.args) {
+			Result r;
+			r.strName = runName(c, args);
+			if (!std::regex_search(r.strName, filter))
+				continue;
+			if (g_options.bList) {
+				std::printf("%s\n", r.strName.c_str());
+				continue;
+			}
+			Bench b(args);
+			c.fn(b);
+			r.runs = b.runs();
+			r.dItems = b.items();
+			r.dBytes = b.bytes();
+			r.strSkipped = b.skipped();
+			if (!r.strSkipped.empty())
+				std::printf("%-44s skipped: %s\n", r.strName.c_str(), r.strSkipped.c_str());
+			for (const Bench::Run &run : r.runs)
+				std::printf("%-44s %14.2f %14.2f %12llu %14.4g %14.4g\n", r.strName.c_str(), run.dReal * 1e6,
+					run.dCpu * 1e6, (unsigned long long)run.uiIterations, r.dItems / run.dReal,
+					r.dBytes / run.dReal * 1e-6);
+			std::fflush(stdout);
+			results.push_back(r);
+		}
+
+	if (!g_options.strJson.empty() && writeJson(g_options.strJson, results) != 0) {
+		std::fprintf(stderr, "Could not write %s\n", g_options.strJson.c_str());
+		return 1;
+	}
+	return 0;
+}
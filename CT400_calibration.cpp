@@ -0,0 +1,523 @@
+//------------------------------------------------------------------------------
+// CT400_calibration.cpp
+//
+// Host-side reference calibration. The per-sweep work is one pass over each
+// detector row: subtract Pout and the reference (dB) and, for linear output,
+// raise 10 to the result. The AVX2/AVX-512 kernels evaluate 10^(x/10) and
+// 10*log10(x) with polynomials to about 1e-14 relative error, so the
+// conversion costs little more than the subtraction.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_calibration.h"
+#include "CT400_config.h"
+#include "CT400_resample.h"
+#include "CT400_simd.h"
+#include "CT400_sweep_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+
+namespace
+{
+
+const double LN2 = 0.693147180559945309417232121458;
+const double LOG2_10_TENTH = 0.332192809488736234787031942949;     // log2(10) / 10
+const double TEN_LOG10_E = 4.34294481903251827651128918917;        // 10 * log10(e)
+
+// 1/k!, k = 0..13: e^g for |g| <= ln(2)/2
+const double EXP_COEFFS[14] = {
+	1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320,
+	1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600, 1.0 / 6227020800.0
+};
+
+void normaliseScalar(const double *pdDetector, const double *pdPower, const double *pdReference, double dOffset,
+	double *pdOut, size_t k0, size_t k1, bool bLinear)
+{
+	for (size_t k = k0; k < k1; k++) {
+		double v = pdDetector[k] - dOffset;
+		if (pdPower)
+			v -= pdPower[k];
+		if (pdReference)
+			v -= pdReference[k];
+		pdOut[k] = bLinear ? std::pow(10.0, v / 10.0) : v;
+	}
+}
+
+void tenLog10Scalar(const double *pdIn, double *pdOut, size_t k0, size_t k1)
+{
+	for (size_t k = k0; k < k1; k++)
+		pdOut[k] = 10.0 * std::log10(pdIn[k]);
+}
+
+#if CT400_SIMD_X86
+
+//------------------------------ AVX2 ------------------------------------------
+
+// 10^(x/10)
+CT400_TARGET_AVX2 inline __m256d pow10TenthAvx2(__m256d x)
+{
+	const __m256d vMin = _mm256_set1_pd(-1021.0);
+	__m256d y = _mm256_mul_pd(x, _mm256_set1_pd(LOG2_10_TENTH));
+	__m256d vUnderflow = _mm256_cmp_pd(y, vMin, _CMP_LT_OQ);
+	y = _mm256_min_pd(_mm256_max_pd(y, vMin), _mm256_set1_pd(1023.0));
+	__m256d n = _mm256_round_pd(y, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d g = _mm256_mul_pd(_mm256_sub_pd(y, n), _mm256_set1_pd(LN2));
+	__m256d p = _mm256_set1_pd(EXP_COEFFS[13]);
+	for (int i = 12; i >= 0; i--)
+		p = _mm256_fmadd_pd(p, g, _mm256_set1_pd(EXP_COEFFS[i]));
+	// 2^n added to the exponent field; n + 1.5*2^52 holds n in its low bits
+	__m256i vScale = _mm256_slli_epi64(_mm256_castpd_si256(_mm256_add_pd(n, _mm256_set1_pd(0x1.8p52))), 52);
+	__m256d r = _mm256_castsi256_pd(_mm256_add_epi64(_mm256_castpd_si256(p), vScale));
+	r = _mm256_andnot_pd(vUnderflow, r);
+	return _mm256_blendv_pd(r, x, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+}
+
+// 10*log10(x)
+CT400_TARGET_AVX2 inline __m256d tenLog10Avx2(__m256d x)
+{
+	const __m256d vOne = _mm256_set1_pd(1.0);
+	__m256i vBits = _mm256_castpd_si256(x);
+	__m256d m = _mm256_castsi256_pd(_mm256_or_si256(
+		_mm256_and_si256(vBits, _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL)), _mm256_castpd_si256(vOne)));
+	// biased exponent converted through the 2^52 magic number
+	__m256d e = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(vBits, 52),
+		_mm256_castpd_si256(_mm256_set1_pd(0x1p52)))), _mm256_set1_pd(0x1p52 + 1023.0));
+	__m256d vBig = _mm256_cmp_pd(m, _mm256_set1_pd(1.41421356237309504880), _CMP_GT_OQ);
+	m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), vBig);
+	e = _mm256_add_pd(e, _mm256_and_pd(vBig, vOne));
+	// ln(m) = 2 atanh(s), s = (m - 1) / (m + 1), |s| < 0.172
+	__m256d s = _mm256_div_pd(_mm256_sub_pd(m, vOne), _mm256_add_pd(m, vOne));
+	__m256d s2 = _mm256_mul_pd(s, s);
+	__m256d p = _mm256_set1_pd(1.0 / 23);
+	for (int i = 10; i >= 0; i--)
+		p = _mm256_fmadd_pd(p, s2, _mm256_set1_pd(1.0 / (2 * i + 1)));
+	__m256d ln = _mm256_fmadd_pd(e, _mm256_set1_pd(LN2), _mm256_mul_pd(_mm256_add_pd(s, s), p));
+	__m256d r = _mm256_mul_pd(ln, _mm256_set1_pd(TEN_LOG10_E));
+	const __m256d vZero = _mm256_setzero_pd();
+	r = _mm256_blendv_pd(r, _mm256_set1_pd(-std::numeric_limits<double>::infinity()),
+		_mm256_cmp_pd(x, vZero, _CMP_EQ_OQ));
+	r = _mm256_blendv_pd(r, x, _mm256_cmp_pd(x, _mm256_set1_pd(std::numeric_limits<double>::infinity()), _CMP_EQ_OQ));
+	return _mm256_blendv_pd(r, _mm256_set1_pd(std::numeric_limits<double>::quiet_NaN()),
+		_mm256_cmp_pd(x, vZero, _CMP_NGE_UQ));
+}
+
+CT400_TARGET_AVX2 void normaliseAvx2(const double *pdDetector, const double *pdPower, const double *pdReference,
+	double dOffset, double *pdOut, size_t k0, size_t k1, bool bLinear)
+{
+	const __m256d vOffset = _mm256_set1_pd(dOffset);
+	size_t k = k0;
+	for (; k + 4 <= k1; k += 4) {
+		__m256d v = _mm256_sub_pd(_mm256_loadu_pd(pdDetector + k), vOffset);
+		if (pdPower)
+			v = _mm256_sub_pd(v, _mm256_loadu_pd(pdPower + k));
+		if (pdReference)
+			v = _mm256_sub_pd(v, _mm256_loadu_pd(pdReference + k));
+		_mm256_storeu_pd(pdOut + k, bLinear ? pow10TenthAvx2(v) : v);
+	}
+	normaliseScalar(pdDetector, pdPower, pdReference, dOffset, pdOut, k, k1, bLinear);
+}
+
+CT400_TARGET_AVX2 void tenLog10Avx2(const double *pdIn, double *pdOut, size_t k0, size_t k1)
+{
+	size_t k = k0;
+	for (; k + 4 <= k1; k += 4)
+		_mm256_storeu_pd(pdOut + k, tenLog10Avx2(_mm256_loadu_pd(pdIn + k)));
+	tenLog10Scalar(pdIn, pdOut, k, k1);
+}
+
+//------------------------------ AVX-512 ---------------------------------------
+
+// GCC 12 reports the _mm512_undefined_pd() inside several intrinsics as
+// uninitialised
+#if defined (__GNUC__) && !defined (__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+CT400_TARGET_AVX512 inline __m512d pow10TenthAvx512(__m512d x)
+{
+	const __m512d vMin = _mm512_set1_pd(-1021.0);
+	__m512d y = _mm512_mul_pd(x, _mm512_set1_pd(LOG2_10_TENTH));
+	__mmask8 kUnderflow = _mm512_cmp_pd_mask(y, vMin, _CMP_LT_OQ);
+	y = _mm512_min_pd(_mm512_max_pd(y, vMin), _mm512_set1_pd(1023.0));
+	__m512d n = _mm512_roundscale_pd(y, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512d g = _mm512_mul_pd(_mm512_sub_pd(y, n), _mm512_set1_pd(LN2));
+	__m512d p = _mm512_set1_pd(EXP_COEFFS[13]);
+	for (int i = 12; i >= 0; i--)
+		p = _mm512_fmadd_pd(p, g, _mm512_set1_pd(EXP_COEFFS[i]));
+	__m512i vScale = _mm512_slli_epi64(_mm512_cvtpd_epi64(n), 52);
+	__m512d r = _mm512_castsi512_pd(_mm512_add_epi64(_mm512_castpd_si512(p), vScale));
+	r = _mm512_mask_blend_pd(kUnderflow, r, _mm512_setzero_pd());
+	return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, x, _CMP_UNORD_Q), r, x);
+}
+
+CT400_TARGET_AVX512 inline __m512d tenLog10Avx512(__m512d x)
+{
+	const __m512d vOne = _mm512_set1_pd(1.0);
+	__m512i vBits = _mm512_castpd_si512(x);
+	__m512d m = _mm512_castsi512_pd(_mm512_or_si512(
+		_mm512_and_si512(vBits, _mm512_set1_epi64(0x000FFFFFFFFFFFFFLL)), _mm512_castpd_si512(vOne)));
+	__m512d e = _mm512_sub_pd(_mm512_cvtepi64_pd(_mm512_srli_epi64(vBits, 52)), _mm512_set1_pd(1023.0));
+	__mmask8 kBig = _mm512_cmp_pd_mask(m, _mm512_set1_pd(1.41421356237309504880), _CMP_GT_OQ);
+	m = _mm512_mask_mul_pd(m, kBig, m, _mm512_set1_pd(0.5));
+	e = _mm512_mask_add_pd(e, kBig, e, vOne);
+	__m512d s = _mm512_div_pd(_mm512_sub_pd(m, vOne), _mm512_add_pd(m, vOne));
+	__m512d s2 = _mm512_mul_pd(s, s);
+	__m512d p = _mm512_set1_pd(1.0 / 23);
+	for (int i = 10; i >= 0; i--)
+		p = _mm512_fmadd_pd(p, s2, _mm512_set1_pd(1.0 / (2 * i + 1)));
+	__m512d ln = _mm512_fmadd_pd(e, _mm512_set1_pd(LN2), _mm512_mul_pd(_mm512_add_pd(s, s), p));
+	__m512d r = _mm512_mul_pd(ln, _mm512_set1_pd(TEN_LOG10_E));
+	const __m512d vZero = _mm512_setzero_pd();
+	r = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, vZero, _CMP_EQ_OQ), r,
+		_mm512_set1_pd(-std::numeric_limits<double>::infinity()));
+	r = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_set1_pd(std::numeric_limits<double>::infinity()),
+		_CMP_EQ_OQ), r, x);
+	return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, vZero, _CMP_NGE_UQ), r,
+		_mm512_set1_pd(std::numeric_limits<double>::quiet_NaN()));
+}
+
+CT400_TARGET_AVX512 void normaliseAvx512(const double *pdDetector, const double *pdPower,
+	const double *pdReference, double dOffset, double *pdOut, size_t k0, size_t k1, bool bLinear)
+{
+	const __m512d vOffset = _mm512_set1_pd(dOffset);
+	size_t k = k0;
+	for (; k + 8 <= k1; k += 8) {
+		__m512d v = _mm512_sub_pd(_mm512_loadu_pd(pdDetector + k), vOffset);
+		if (pdPower)
+			v = _mm512_sub_pd(v, _mm512_loadu_pd(pdPower + k));
+		if (pdReference)
+			v = _mm512_sub_pd(v, _mm512_loadu_pd(pdReference + k));
+		_mm512_storeu_pd(pdOut + k, bLinear ? pow10TenthAvx512(v) : v);
+	}
+	normaliseScalar(pdDetector, pdPower, pdReference, dOffset, pdOut, k, k1, bLinear);
+}
+
+CT400_TARGET_AVX512 void tenLog10Avx512(const double *pdIn, double *pdOut, size_t k0, size_t k1)
+{
+	size_t k = k0;
+	for (; k + 8 <= k1; k += 8)
+		_mm512_storeu_pd(pdOut + k, tenLog10Avx512(_mm512_loadu_pd(pdIn + k)));
+	tenLog10Scalar(pdIn, pdOut, k, k1);
+}
+
+#if defined (__GNUC__) && !defined (__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+typedef void (*NormaliseKernel)(const double *, const double *, const double *, double, double *, size_t, size_t,
+	bool);
+typedef void (*LogKernel)(const double *, double *, size_t, size_t);
+
+NormaliseKernel selectNormalise()
+{
+#if CT400_SIMD_X86
+	switch (ct400::simdLevel()) {
+	case ct400::SIMD_AVX512:
+		return normaliseAvx512;
+	case ct400::SIMD_AVX2:
+		return normaliseAvx2;
+	default:
+		break;
+	}
+#endif
+	return normaliseScalar;
+}
+
+LogKernel selectLog()
+{
+#if CT400_SIMD_X86
+	switch (ct400::simdLevel()) {
+	case ct400::SIMD_AVX512:
+		return tenLog10Avx512;
+	case ct400::SIMD_AVX2:
+		return tenLog10Avx2;
+	default:
+		break;
+	}
+#endif
+	return tenLog10Scalar;
+}
+
+std::mutex g_mtx;
+std::map<uint64_t, std::shared_ptr<ct400::Calibration> > g_calibrations;
+uint64_t g_uiNextCalibration = 1;
+
+std::shared_ptr<ct400::Calibration> findCalibration(uint64_t uiCalibration)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	auto it = g_calibrations.find(uiCalibration);
+	return it == g_calibrations.end() ? nullptr : it->second;
+}
+
+// Row pointers of a caller's block of iNbRows rows of iArraySize values
+template <class T>
+std::vector<T *> blockRows(T *pdBlock, int32_t iNbRows, int32_t iArraySize)
+{
+	std::vector<T *> rows(iNbRows);
+	for (int32_t r = 0; r < iNbRows; r++)
+		rows[r] = pdBlock + (size_t)r * iArraySize;
+	return rows;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC uint64_t __stdcall CT400_CalibrationCreate(void)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	uint64_t uiCalibration = g_uiNextCalibration++;
+	g_calibrations[uiCalibration] = std::make_shared<ct400::Calibration>();
+	return uiCalibration;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationRecord(uint64_t uiCalibration,
+rLaserInput eInput, const double dWavelength[], const double dPower[],
+const rDetector eDetectors[], int32_t iNbDetectors, const double dBlock[],
+int32_t iArraySize)
+{
+	auto calibration = findCalibration(uiCalibration);
+	if (!calibration || iNbDetectors < 0 || iArraySize < 0 || (iNbDetectors > 0 && dBlock == nullptr))
+		return -1;
+	std::vector<const double *> rows = blockRows(dBlock, iNbDetectors, iArraySize);
+	return calibration->record(eInput, dWavelength, dPower, eDetectors, rows.data(), iNbDetectors, iArraySize);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationApply(uint64_t uiCalibration,
+rLaserInput eInput, const double dWavelength[], const double dPower[],
+const rDetector eDetectors[], int32_t iNbDetectors, double dBlock[],
+int32_t iArraySize, rUnit eUnit)
+{
+	auto calibration = findCalibration(uiCalibration);
+	if (!calibration || iNbDetectors < 0 || iArraySize < 0 || (iNbDetectors > 0 && dBlock == nullptr))
+		return -1;
+	std::vector<double *> rows = blockRows(dBlock, iNbDetectors, iArraySize);
+	return calibration->apply(eInput, dWavelength, dPower, eDetectors, rows.data(), iNbDetectors, iArraySize,
+		eUnit);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationSave(uint64_t uiCalibration,
+const char *pcPath)
+{
+	auto calibration = findCalibration(uiCalibration);
+	return calibration && pcPath ? calibration->save(pcPath) : -1;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationLoad(uint64_t uiCalibration,
+const char *pcPath)
+{
+	auto calibration = findCalibration(uiCalibration);
+	return calibration && pcPath ? calibration->load(pcPath) : -1;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationReset(uint64_t uiCalibration,
+int32_t iInput)
+{
+	auto calibration = findCalibration(uiCalibration);
+	if (!calibration || iInput < 0 || iInput > LI_4)
+		return -1;
+	if (iInput == 0)
+		calibration->reset();
+	else
+		calibration->reset((rLaserInput)iInput);
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationDestroy(uint64_t uiCalibration)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	return g_calibrations.erase(uiCalibration) ? 0 : -1;
+}
+
+}
+
+
+namespace ct400
+{
+
+std::shared_ptr<Calibration> calibrationForHandle(uint64_t uiCalibration)
+{
+	return findCalibration(uiCalibration);
+}
+
+void milliwattTodBm(const double *pdIn, double *pdOut, size_t uiPoints)
+{
+	static const LogKernel kernel = selectLog();
+	kernel(pdIn, pdOut, 0, uiPoints);
+}
+
+void dBmToMilliwatt(const double *pdIn, double *pdOut, size_t uiPoints)
+{
+	normalise(pdIn, nullptr, nullptr, 0.0, pdOut, uiPoints, Unit_mW);
+}
+
+void normalise(const double *pdDetector, const double *pdPower, const double *pdReference, double dOffset,
+	double *pdOut, size_t uiPoints, rUnit eUnit)
+{
+	static const NormaliseKernel kernel = selectNormalise();
+	kernel(pdDetector, pdPower, pdReference, dOffset, pdOut, 0, uiPoints, eUnit == Unit_mW);
+}
+
+int32_t Calibration::record(rLaserInput eInput, const ScanBuffer &sweep)
+{
+	std::vector<const double *> rows;
+	for (size_t d = 0; d < sweep.detectors().size(); d++)
+		rows.push_back(sweep.row(d));
+	return record(eInput, sweep.wavelength(), sweep.power(), sweep.detectors().data(), rows.data(), rows.size(),
+		sweep.points());
+}
+
+int32_t Calibration::record(rLaserInput eInput, const double *pdWavelength, const double *pdPower,
+	const rDetector *peDetectors, const double *const *ppdRows, size_t uiDetectors, size_t uiPoints)
+{
+	if (!valid(eInput) || pdWavelength == nullptr || uiPoints < 2 || (uiDetectors > 0 && peDetectors == nullptr))
+		return -1;
+	for (size_t d = 0; d < uiDetectors; d++) {
+		if (!optical(peDetectors[d]))
+			continue;
+		std::unique_ptr<Reference> ref(new Reference);
+		ref->wavelength.assign(pdWavelength, pdWavelength + uiPoints);
+		ref->value.resize(uiPoints);
+		normalise(ppdRows[d], pdPower, nullptr, 0.0, ref->value.data(), uiPoints, Unit_dBm);
+		m_references[eInput - LI_1][peDetectors[d] - DE_1] = std::move(ref);
+	}
+	return 0;
+}
+
+int32_t Calibration::apply(rLaserInput eInput, ScanBuffer &sweep, rUnit eUnit) const
+{
+	std::vector<double *> rows;
+	for (size_t d = 0; d < sweep.detectors().size(); d++)
+		rows.push_back(sweep.row(d));
+	return apply(eInput, sweep.wavelength(), sweep.power(), sweep.detectors().data(), rows.data(), rows.size(),
+		sweep.points(), eUnit);
+}
+
+int32_t Calibration::apply(rLaserInput eInput, const double *pdWavelength, const double *pdPower,
+	const rDetector *peDetectors, double *const *ppdRows, size_t uiDetectors, size_t uiPoints, rUnit eUnit) const
+{
+	if (!valid(eInput) || pdWavelength == nullptr || (uiDetectors > 0 && peDetectors == nullptr))
+		return -1;
+	for (size_t d = 0; d < uiDetectors; d++) {
+		if (!optical(peDetectors[d]))
+			continue;
+		const Reference *pRef = m_references[eInput - LI_1][peDetectors[d] - DE_1].get();
+		std::shared_ptr<const AlignedVector> reference;
+		if (pRef) {
+			reference = lookup(*pRef, pdWavelength, uiPoints);
+			if (!reference)
+				return -1;
+		}
+		normalise(ppdRows[d], pdPower, reference ? reference->data() : nullptr, 0.0, ppdRows[d], uiPoints, eUnit);
+	}
+	return 0;
+}
+
+std::shared_ptr<const AlignedVector> Calibration::lookup(const Reference &ref, const double *pdWavelength,
+	size_t uiPoints) const
+{
+	auto same = [&](const AlignedVector &axis) {
+		return axis.size() == uiPoints && std::memcmp(axis.data(), pdWavelength, uiPoints * sizeof(double)) == 0;
+	};
+	// usual case: the sweep uses the axis of the reference (no copy)
+	if (same(ref.wavelength))
+		return std::shared_ptr<const AlignedVector>(std::shared_ptr<const AlignedVector>(), &ref.value);
+
+	std::lock_guard<std::mutex> lock(ref.mtx);
+	if (ref.cache && same(ref.cacheAxis))
+		return ref.cache;
+	ResamplePlan plan;
+	if (plan.build(ref.wavelength.data(), ref.wavelength.size(), pdWavelength, uiPoints, IM_LINEAR) != 0)
+		return nullptr;
+	auto cache = std::make_shared<AlignedVector>(uiPoints);
+	const double *pdValue = ref.value.data();
+	double *pdCache = cache->data();
+	plan.apply(&pdValue, &pdCache, 1);
+	ref.cacheAxis.assign(pdWavelength, pdWavelength + uiPoints);
+	ref.cache = cache;
+	return cache;
+}
+
+bool Calibration::has(rLaserInput eInput, rDetector eDetector) const
+{
+	return valid(eInput) && optical(eDetector) && m_references[eInput - LI_1][eDetector - DE_1] != nullptr;
+}
+
+void Calibration::reset()
+{
+	for (int i = 0; i < NB_INPUTS; i++)
+		for (int d = 0; d < NB_DETECTORS; d++)
+			m_references[i][d].reset();
+}
+
+void Calibration::reset(rLaserInput eInput)
+{
+	if (!valid(eInput))
+		return;
+	for (int d = 0; d < NB_DETECTORS; d++)
+		m_references[eInput - LI_1][d].reset();
+}
+
+int32_t Calibration::save(const std::string &strPath) const
+{
+	std::remove(strPath.c_str());
+	SweepFileWriter writer;
+	if (writer.open(strPath) != 0)
+		return -1;
+	// one record per reference: its axis and values, the input in the config
+	for (int i = 0; i < NB_INPUTS; i++) {
+		for (int d = 0; d < NB_DETECTORS; d++) {
+			const Reference *pRef = m_references[i][d].get();
+			if (pRef == nullptr)
+				continue;
+			SweepInfo info;
+			CT400_DefaultScanConfig(&info.config);
+			info.config.eInput = (rLaserInput)(LI_1 + i);
+			std::vector<SweepColumnData> columns;
+			columns.push_back(SweepColumnData{ COL_WAVELENGTH, pRef->wavelength.data() });
+			columns.push_back(SweepColumnData{ DE_1 + d, pRef->value.data() });
+			if (writer.append(info, columns, pRef->wavelength.size()) < 0)
+				return -1;
+		}
+	}
+	return writer.flush();
+}
+
+int32_t Calibration::load(const std::string &strPath)
+{
+	SweepFileReader reader;
+	if (reader.open(strPath) != 0)
+		return -1;
+	std::unique_ptr<Reference> loaded[NB_INPUTS][NB_DETECTORS];
+	for (size_t r = 0; r < reader.size(); r++) {
+		const rSweepRecordHeader &header = reader.header(r);
+		if (!valid(header.config.eInput))
+			return -1;
+		std::vector<double> wavelength, value;
+		if (reader.read(r, COL_WAVELENGTH, wavelength) < 2)
+			return -1;
+		for (int d = 0; d < NB_DETECTORS; d++) {
+			if (reader.read(r, DE_1 + d, value) < 0)
+				continue;
+			std::unique_ptr<Reference> ref(new Reference);
+			ref->wavelength.assign(wavelength.begin(), wavelength.end());
+			ref->value.assign(value.begin(), value.end());
+			loaded[header.config.eInput - LI_1][d] = std::move(ref);
+		}
+	}
+	for (int i = 0; i < NB_INPUTS; i++)
+		for (int d = 0; d < NB_DETECTORS; d++)
+			m_references[i][d] = std::move(loaded[i][d]);
+	return 0;
+}
+
+} // namespace ct400
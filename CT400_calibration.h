@@ -0,0 +1,211 @@
+/******************************************************************************/
+/* Header file for CT400_calibration.cpp                                      */
+/*                                                                            */
+/* Host-side calibration: reference traces per laser input and detector,      */
+/* applied to every sweep together with the Pout normalisation and the        */
+/* dBm/mW conversion in a single pass over the detector block.                */
+/******************************************************************************/
+
+#ifndef CT400_CALIBRATION_H
+#define CT400_CALIBRATION_H
+
+#include "CT400_retrieve.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//------------------------------ CT400_CalibrationCreate -----------------------
+// Function CT400_CalibrationCreate
+//
+//  Purpose: Creates an empty set of references
+//
+//  Returns:  uiCalibration for use in the other CT400_Calibration functions,
+//            0 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC uint64_t __stdcall CT400_CalibrationCreate(void);
+
+//------------------------------ CT400_CalibrationRecord -----------------------
+// Function CT400_CalibrationRecord
+//
+//  Purpose: Stores the sweep of each detector as its reference for eInput
+//           (detector - Pout in dB, or the detector alone without Pout).
+//           The sweep is taken with the output connected to the detectors,
+//           as for CT400_UpdateCalibration.
+//
+//  Parameters: IN uiCalibration: from CT400_CalibrationCreate
+//              IN eInput: laser input the references are valid for
+//              IN dWavelength: wavelength axis, iArraySize values
+//              IN dPower: Pout (dBm), iArraySize values, or NULL
+//              IN eDetectors: detector of each block row
+//              IN iNbDetectors: number of detectors
+//              IN dBlock: iNbDetectors rows of iArraySize values (dBm)
+//              IN iArraySize: size of the axis and of one block row
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationRecord(uint64_t uiCalibration,
+rLaserInput eInput, const double dWavelength[], const double dPower[],
+const rDetector eDetectors[], int32_t iNbDetectors, const double dBlock[],
+int32_t iArraySize);
+
+//------------------------------ CT400_CalibrationApply ------------------------
+// Function CT400_CalibrationApply
+//
+//  Purpose: Turns detector powers into transmission: detector - Pout -
+//           reference of eInput, in dB, or as a linear ratio if eUnit is
+//           Unit_mW. Detectors without a reference are only normalised by
+//           Pout; DE_5 (analog input) is left untouched.
+//
+//  Parameters: IN uiCalibration: from CT400_CalibrationCreate
+//              IN eInput: laser input the sweep was taken with
+//              IN dWavelength: wavelength axis, iArraySize values
+//              IN dPower: Pout (dBm), iArraySize values, or NULL
+//              IN eDetectors: detector of each block row
+//              IN iNbDetectors: number of detectors
+//              IN/OUT dBlock: iNbDetectors rows of iArraySize values (dBm),
+//                             overwritten with the result
+//              IN iArraySize: size of the axis and of one block row
+//              IN eUnit: Unit_dBm (dB) or Unit_mW (linear)
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationApply(uint64_t uiCalibration,
+rLaserInput eInput, const double dWavelength[], const double dPower[],
+const rDetector eDetectors[], int32_t iNbDetectors, double dBlock[],
+int32_t iArraySize, rUnit eUnit);
+
+//------------------------------ CT400_CalibrationSave -------------------------
+// Function CT400_CalibrationSave
+//
+//  Purpose: Saves all references to a sweep file (see CT400_sweep_file.h),
+//           one record per input and detector
+//
+//  Parameters: IN uiCalibration: from CT400_CalibrationCreate
+//              IN pcPath: file path, replaced if it exists
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationSave(uint64_t uiCalibration,
+const char *pcPath);
+
+//------------------------------ CT400_CalibrationLoad -------------------------
+// Function CT400_CalibrationLoad
+//
+//  Purpose: Replaces the references with those of a file written by
+//           CT400_CalibrationSave
+//
+//  Parameters: IN uiCalibration: from CT400_CalibrationCreate
+//              IN pcPath: file path
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationLoad(uint64_t uiCalibration,
+const char *pcPath);
+
+//------------------------------ CT400_CalibrationReset ------------------------
+// Function CT400_CalibrationReset
+//
+//  Purpose: Removes the references of one input, or of all of them
+//
+//  Parameters: IN uiCalibration: from CT400_CalibrationCreate
+//              IN iInput: LI_1 to LI_4, or 0 for all inputs
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationReset(uint64_t uiCalibration,
+int32_t iInput);
+
+//------------------------------ CT400_CalibrationDestroy ----------------------
+// Function CT400_CalibrationDestroy
+//
+//  Parameters: IN uiCalibration: from CT400_CalibrationCreate
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_CalibrationDestroy(uint64_t uiCalibration);
+
+#ifdef __cplusplus
+}
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace ct400
+{
+
+// Unit conversions, vectorised (in and out may be the same array)
+void milliwattTodBm(const double *pdIn, double *pdOut, size_t uiPoints);
+void dBmToMilliwatt(const double *pdIn, double *pdOut, size_t uiPoints);
+
+// pdOut = pdDetector - pdPower - pdReference - dOffset (dB), then converted
+// to a linear ratio if eUnit is Unit_mW. pdPower and pdReference may be
+// nullptr; pdOut may be pdDetector.
+void normalise(const double *pdDetector, const double *pdPower, const double *pdReference, double dOffset,
+	double *pdOut, size_t uiPoints, rUnit eUnit);
+
+//------------------------------ Calibration -----------------------------------
+// Class Calibration
+//
+//  Purpose: Reference traces for each laser input (LI_1 to LI_4) and
+//           detector (DE_1 to DE_4), so that switching inputs with
+//           CT400_SwitchInput no longer needs a new calibration sweep.
+//           References are kept on their own wavelength axis and resampled
+//           (once, then cached) when a sweep uses another one. apply() may be
+//           called from several threads; record() and load() must not run
+//           concurrently with it. Not to be combined with
+//           CT400_UpdateCalibration, which already subtracts a reference.
+//------------------------------------------------------------------------------
+class Calibration
+{
+public:
+	static const int NB_INPUTS = 4;
+	static const int NB_DETECTORS = 4;
+
+	// Stores every optical detector row of sweep (Pout row used if present).
+	// Returns 0 if success, -1 otherwise
+	int32_t record(rLaserInput eInput, const ScanBuffer &sweep);
+	int32_t record(rLaserInput eInput, const double *pdWavelength, const double *pdPower,
+		const rDetector *peDetectors, const double *const *ppdRows, size_t uiDetectors, size_t uiPoints);
+
+	// Converts the detector rows of sweep in place (see CT400_CalibrationApply).
+	// Returns 0 if success, -1 otherwise
+	int32_t apply(rLaserInput eInput, ScanBuffer &sweep, rUnit eUnit = Unit_dBm) const;
+	int32_t apply(rLaserInput eInput, const double *pdWavelength, const double *pdPower,
+		const rDetector *peDetectors, double *const *ppdRows, size_t uiDetectors, size_t uiPoints,
+		rUnit eUnit = Unit_dBm) const;
+
+	bool has(rLaserInput eInput, rDetector eDetector) const;
+	void reset();
+	void reset(rLaserInput eInput);
+
+	// Returns 0 if success, -1 otherwise
+	int32_t save(const std::string &strPath) const;
+	int32_t load(const std::string &strPath);
+
+private:
+	struct Reference
+	{
+		AlignedVector wavelength;
+		AlignedVector value;    // dB
+		// value resampled onto the axis of the last sweep that differed
+		mutable std::mutex mtx;
+		mutable AlignedVector cacheAxis;
+		mutable std::shared_ptr<const AlignedVector> cache;
+	};
+
+	// Reference values on pdWavelength, nullptr if there is none
+	std::shared_ptr<const AlignedVector> lookup(const Reference &ref, const double *pdWavelength,
+		size_t uiPoints) const;
+
+	static bool valid(rLaserInput eInput) { return eInput >= LI_1 && eInput <= LI_4; }
+	static bool optical(rDetector eDetector) { return eDetector >= DE_1 && eDetector <= DE_4; }
+
+	std::unique_ptr<Reference> m_references[NB_INPUTS][NB_DETECTORS];
+};
+
+// Calibration of a uiCalibration from CT400_CalibrationCreate, nullptr if none
+std::shared_ptr<Calibration> calibrationForHandle(uint64_t uiCalibration);
+
+} // namespace ct400
+
+#endif
+
+
+#endif
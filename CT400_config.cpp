@@ -0,0 +1,78 @@
+//------------------------------------------------------------------------------
+// CT400_config.cpp
+//
+// Scan configuration helpers.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_config.h"
+
+#include <cstring>
+
+static_assert(sizeof(rScanConfig) == 112, "rScanConfig is stored in files and must keep its layout");
+
+extern "C"
+{
+
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultScanConfig(rScanConfig *pConfig)
+{
+	if (pConfig == nullptr)
+		return -1;
+	std::memset(pConfig, 0, sizeof(*pConfig));
+	pConfig->dLaserMinWavelength = 1500.0;
+	pConfig->dLaserMaxWavelength = 1630.0;
+	pConfig->dPower = 6.0;
+	pConfig->dMinWavelength = 1500.0;
+	pConfig->dMaxWavelength = 1630.0;
+	pConfig->eInput = LI_1;
+	pConfig->eEnable = ENABLE;
+	pConfig->iGPIBAdress = 10;
+	pConfig->eLaserType = LS_TunicsT100s_HP;
+	pConfig->iSpeed = 100;
+	pConfig->uiResolution = 1;
+	pConfig->eDect2 = DISABLE;
+	pConfig->eDect3 = DISABLE;
+	pConfig->eDect4 = DISABLE;
+	pConfig->eExt = DISABLE;
+	pConfig->eBNC = DISABLE;
+	pConfig->eUnit = Unit_mW;
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ApplyScanConfig(uint64_t uiHandle,
+const rScanConfig *pConfig)
+{
+	if (pConfig == nullptr)
+		return -1;
+	const rScanConfig &c = *pConfig;
+	int32_t iResult = 0;
+	iResult |= CT400_SetLaser(uiHandle, c.eInput, c.eEnable, c.iGPIBAdress, c.eLaserType,
+		c.dLaserMinWavelength, c.dLaserMaxWavelength, c.iSpeed);
+	iResult |= CT400_SetScan(uiHandle, c.dPower, c.dMinWavelength, c.dMaxWavelength);
+	iResult |= CT400_SetSamplingResolution(uiHandle, c.uiResolution);
+	iResult |= CT400_SetDetectorArray(uiHandle, c.eDect2, c.eDect3, c.eDect4, c.eExt);
+	iResult |= CT400_SetBNC(uiHandle, c.eBNC, c.dAlpha, c.dBeta, c.eUnit);
+	return iResult == 0 ? 0 : -1;
+}
+
+}
+
+
+namespace ct400
+{
+
+std::vector<rDetector> enabledDetectors(const rScanConfig &config)
+{
+	std::vector<rDetector> detectors(1, DE_1);
+	if (config.eDect2 == ENABLE)
+		detectors.push_back(DE_2);
+	if (config.eDect3 == ENABLE)
+		detectors.push_back(DE_3);
+	if (config.eDect4 == ENABLE)
+		detectors.push_back(DE_4);
+	if (config.eExt == ENABLE)
+		detectors.push_back(DE_5);
+	return detectors;
+}
+
+} // namespace ct400
@@ -0,0 +1,84 @@
+/******************************************************************************/
+/* Header file for CT400_config.cpp                                           */
+/*                                                                            */
+/* Complete scan configuration of a CT400, i.e. the parameters of            */
+/* CT400_SetLaser, CT400_SetScan, CT400_SetSamplingResolution,                */
+/* CT400_SetDetectorArray and CT400_SetBNC in one structure.                  */
+/******************************************************************************/
+
+#ifndef CT400_CONFIG_H
+#define CT400_CONFIG_H
+
+#include "CT400_ext.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Fixed layout (112 bytes): stored as-is in sweep files
+  typedef struct
+  {
+	double dLaserMinWavelength;     // CT400_SetLaser
+	double dLaserMaxWavelength;
+	double dPower;                  // CT400_SetScan, mW
+	double dMinWavelength;
+	double dMaxWavelength;
+	double dAlpha;                  // CT400_SetBNC
+	double dBeta;
+	rLaserInput eInput;             // CT400_SetLaser
+	rEnable eEnable;
+	int32_t iGPIBAdress;
+	rLaserSource eLaserType;
+	int32_t iSpeed;
+	uint32_t uiResolution;          // CT400_SetSamplingResolution, pm
+	rEnable eDect2;                 // CT400_SetDetectorArray
+	rEnable eDect3;
+	rEnable eDect4;
+	rEnable eExt;
+	rEnable eBNC;                   // CT400_SetBNC
+	rUnit eUnit;
+	int32_t iReserved[2];
+  } rScanConfig;
+
+//------------------------------ CT400_DefaultScanConfig -----------------------
+// Function CT400_DefaultScanConfig
+//
+//  Purpose: Fills a configuration with the defaults of CT400_control.py
+//           (LI_1, T100S-HP at GPIB 10, 1500-1630 nm, 100 nm/s, 1 pm,
+//           DE_1 only, BNC disabled)
+//
+//  Parameters: IN/OUT pConfig: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultScanConfig(rScanConfig *pConfig);
+
+//------------------------------ CT400_ApplyScanConfig -------------------------
+// Function CT400_ApplyScanConfig
+//
+//  Purpose: Sends a whole configuration to the CT400
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN pConfig: configuration to apply
+//  Returns:  0 if success, -1 if any call failed
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ApplyScanConfig(uint64_t uiHandle,
+const rScanConfig *pConfig);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+
+namespace ct400
+{
+
+// Detectors recorded by a configuration (DE_1 is always on)
+std::vector<rDetector> enabledDetectors(const rScanConfig &config);
+
+} // namespace ct400
+
+#endif
+
+
+#endif
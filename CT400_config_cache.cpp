@@ -0,0 +1,257 @@
+//------------------------------------------------------------------------------
+// CT400_config_cache.cpp
+//
+// Configuration cache. Settings are compared field by field with the values
+// last sent (doubles exactly: a recipe repeats the same literals), so a sweep
+// whose configuration did not change costs no USB or GPIB traffic at all.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_config_cache.h"
+#include "CT400_device.h"
+
+extern "C"
+{
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ApplyScanConfigCached(uint64_t uiHandle,
+const rScanConfig *pConfig)
+{
+	if (pConfig == nullptr)
+		return -1;
+	auto device = ct400::Device::forHandle(uiHandle);
+	return device->call([&](uint64_t h) { return device->configCache().apply(h, *pConfig); });
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_SetLaserCached(uint64_t uiHandle,
+rLaserInput eLaser, rEnable eEnable, int32_t iGPIBAdress,
+rLaserSource eLaserType, double dMinWavelength,
+double dMaxWavelength, int32_t Speed)
+{
+	auto device = ct400::Device::forHandle(uiHandle);
+	return device->call([&](uint64_t h) {
+		return device->configCache().setLaser(h, eLaser, eEnable, iGPIBAdress, eLaserType, dMinWavelength,
+			dMaxWavelength, Speed);
+	});
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_SwitchInputCached(uint64_t uiHandle,
+rLaserInput eLaser)
+{
+	auto device = ct400::Device::forHandle(uiHandle);
+	return device->call([&](uint64_t h) { return device->configCache().switchInput(h, eLaser); });
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_CheckConnectedCached(uint64_t uiHandle,
+double dMaxAge)
+{
+	auto device = ct400::Device::forHandle(uiHandle);
+	return device->call([&](uint64_t h) { return device->configCache().checkConnected(h, dMaxAge); });
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_InvalidateConfigCache(uint64_t uiHandle)
+{
+	ct400::Device::forHandle(uiHandle)->configCache().invalidate();
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ReleaseDevice(uint64_t uiHandle)
+{
+	ct400::Device::release(uiHandle);
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_GetConfigCacheStats(uint64_t uiHandle,
+uint64_t *puiSent, uint64_t *puiSkipped)
+{
+	const ct400::ConfigCache &cache = ct400::Device::forHandle(uiHandle)->configCache();
+	if (puiSent)
+		*puiSent = cache.sent();
+	if (puiSkipped)
+		*puiSkipped = cache.skipped();
+	return 0;
+}
+
+}
+
+
+namespace ct400
+{
+
+int32_t ConfigCache::apply(uint64_t uiHandle, const rScanConfig &c)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	const uint64_t uiSentBefore = m_uiSent;
+	Laser laser;
+	laser.eEnable = c.eEnable;
+	laser.iGPIBAdress = c.iGPIBAdress;
+	laser.eLaserType = c.eLaserType;
+	laser.dMinWavelength = c.dLaserMinWavelength;
+	laser.dMaxWavelength = c.dLaserMaxWavelength;
+	laser.iSpeed = c.iSpeed;
+	if (setLaserLocked(uiHandle, laser, c.eInput) != 0)
+		return -1;
+
+	// each group is sent if it changed; a failure leaves nothing trusted
+	auto send = [&](bool bSame, int32_t iResult) {
+		if (bSame) {
+			m_uiSkipped++;
+			return true;
+		}
+		if (iResult != 0) {
+			invalidateLocked();
+			return false;
+		}
+		m_uiSent++;
+		return true;
+	};
+	bool bSame = m_bScan && m_dPower == c.dPower && m_dMinWavelength == c.dMinWavelength
+		&& m_dMaxWavelength == c.dMaxWavelength;
+	if (!send(bSame, bSame ? 0 : CT400_SetScan(uiHandle, c.dPower, c.dMinWavelength, c.dMaxWavelength)))
+		return -1;
+	m_bScan = true;
+	m_dPower = c.dPower;
+	m_dMinWavelength = c.dMinWavelength;
+	m_dMaxWavelength = c.dMaxWavelength;
+
+	bSame = m_bResolution && m_uiResolution == c.uiResolution;
+	if (!send(bSame, bSame ? 0 : CT400_SetSamplingResolution(uiHandle, c.uiResolution)))
+		return -1;
+	m_bResolution = true;
+	m_uiResolution = c.uiResolution;
+
+	bSame = m_bDetectors && m_eDetectors[0] == c.eDect2 && m_eDetectors[1] == c.eDect3
+		&& m_eDetectors[2] == c.eDect4 && m_eDetectors[3] == c.eExt;
+	if (!send(bSame, bSame ? 0 : CT400_SetDetectorArray(uiHandle, c.eDect2, c.eDect3, c.eDect4, c.eExt)))
+		return -1;
+	m_bDetectors = true;
+	m_eDetectors[0] = c.eDect2;
+	m_eDetectors[1] = c.eDect3;
+	m_eDetectors[2] = c.eDect4;
+	m_eDetectors[3] = c.eExt;
+
+	bSame = m_bBNC && m_eBNC == c.eBNC && m_dAlpha == c.dAlpha && m_dBeta == c.dBeta && m_eUnit == c.eUnit;
+	if (!send(bSame, bSame ? 0 : CT400_SetBNC(uiHandle, c.eBNC, c.dAlpha, c.dBeta, c.eUnit)))
+		return -1;
+	m_bBNC = true;
+	m_eBNC = c.eBNC;
+	m_dAlpha = c.dAlpha;
+	m_dBeta = c.dBeta;
+	m_eUnit = c.eUnit;
+
+	if (m_uiSent != uiSentBefore) {
+		m_bConnected = true;
+		m_tConnected = std::chrono::steady_clock::now();
+	}
+	return (int32_t)(m_uiSent - uiSentBefore);
+}
+
+int32_t ConfigCache::setLaser(uint64_t uiHandle, rLaserInput eLaser, rEnable eEnable, int32_t iGPIBAdress,
+	rLaserSource eLaserType, double dMinWavelength, double dMaxWavelength, int32_t iSpeed)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	Laser laser;
+	laser.eEnable = eEnable;
+	laser.iGPIBAdress = iGPIBAdress;
+	laser.eLaserType = eLaserType;
+	laser.dMinWavelength = dMinWavelength;
+	laser.dMaxWavelength = dMaxWavelength;
+	laser.iSpeed = iSpeed;
+	return setLaserLocked(uiHandle, laser, eLaser);
+}
+
+int32_t ConfigCache::setLaserLocked(uint64_t uiHandle, const Laser &laser, rLaserInput eLaser)
+{
+	if (eLaser < LI_1 || eLaser > LI_4) {
+		invalidateLocked();
+		return -1;
+	}
+	Laser &cached = m_lasers[eLaser - LI_1];
+	if (cached.bValid && cached.eEnable == laser.eEnable && cached.iGPIBAdress == laser.iGPIBAdress
+		&& cached.eLaserType == laser.eLaserType && cached.dMinWavelength == laser.dMinWavelength
+		&& cached.dMaxWavelength == laser.dMaxWavelength && cached.iSpeed == laser.iSpeed) {
+		m_uiSkipped++;
+		return 0;
+	}
+	if (CT400_SetLaser(uiHandle, eLaser, laser.eEnable, laser.iGPIBAdress, laser.eLaserType,
+		laser.dMinWavelength, laser.dMaxWavelength, laser.iSpeed) != 0) {
+		invalidateLocked();
+		return -1;
+	}
+	m_uiSent++;
+	cached = laser;
+	cached.bValid = true;
+	m_bConnected = true;
+	m_tConnected = std::chrono::steady_clock::now();
+	return 0;
+}
+
+int32_t ConfigCache::switchInput(uint64_t uiHandle, rLaserInput eLaser)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	if (m_iInput == eLaser) {
+		m_uiSkipped++;
+		return 0;
+	}
+	if (eLaser < LI_1 || eLaser > LI_4 || CT400_SwitchInput(uiHandle, eLaser) != 0) {
+		invalidateLocked();
+		return -1;
+	}
+	m_uiSent++;
+	m_iInput = eLaser;
+	m_bConnected = true;
+	m_tConnected = std::chrono::steady_clock::now();
+	return 0;
+}
+
+int32_t ConfigCache::input() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_iInput;
+}
+
+int32_t ConfigCache::checkConnected(uint64_t uiHandle, double dMaxAge)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	std::chrono::steady_clock::time_point tNow = std::chrono::steady_clock::now();
+	if (m_bConnected && std::chrono::duration<double>(tNow - m_tConnected).count() < dMaxAge) {
+		m_uiSkipped++;
+		return 1;
+	}
+	m_uiSent++;
+	if (CT400_CheckConnected(uiHandle) != 1) {
+		invalidateLocked();
+		return 0;
+	}
+	m_bConnected = true;
+	m_tConnected = tNow;
+	return 1;
+}
+
+void ConfigCache::invalidate()
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	invalidateLocked();
+}
+
+void ConfigCache::invalidateLocked()
+{
+	for (Laser &laser : m_lasers)
+		laser.bValid = false;
+	m_iInput = 0;
+	m_bScan = m_bResolution = m_bDetectors = m_bBNC = false;
+	m_bConnected = false;
+}
+
+uint64_t ConfigCache::sent() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_uiSent;
+}
+
+uint64_t ConfigCache::skipped() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_uiSkipped;
+}
+
+} // namespace ct400
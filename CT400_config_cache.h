@@ -0,0 +1,192 @@
+/******************************************************************************/
+/* Header file for CT400_config_cache.cpp                                     */
+/*                                                                            */
+/* Shadow copy of the configuration of each handle, so that only the         */
+/* settings that changed are sent to the CT400 (and through it to the laser). */
+/******************************************************************************/
+
+#ifndef CT400_CONFIG_CACHE_H
+#define CT400_CONFIG_CACHE_H
+
+#include "CT400_config.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//------------------------------ CT400_ApplyScanConfigCached -------------------
+// Function CT400_ApplyScanConfigCached
+//
+//  Purpose: CT400_ApplyScanConfig, skipping the calls whose parameters are
+//           those last sent through the cache of the handle
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN pConfig: configuration to apply
+//  Returns:  number of calls sent (0 if nothing changed), -1 if any call
+//            failed (the cache is then invalidated)
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ApplyScanConfigCached(uint64_t uiHandle,
+const rScanConfig *pConfig);
+
+//------------------------------ CT400_SetLaserCached --------------------------
+// Function CT400_SetLaserCached
+//
+//  Purpose: CT400_SetLaser, skipped if eLaser was last configured through the
+//           cache with the same parameters
+//
+//  Parameters: as for CT400_SetLaser
+//  Returns:  0 if success, -1 otherwise (the cache is then invalidated)
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_SetLaserCached(uint64_t uiHandle,
+rLaserInput eLaser, rEnable eEnable, int32_t iGPIBAdress,
+rLaserSource eLaserType, double dMinWavelength,
+double dMaxWavelength, int32_t Speed);
+
+//------------------------------ CT400_SwitchInputCached -----------------------
+// Function CT400_SwitchInputCached
+//
+//  Purpose: CT400_SwitchInput, skipped if eLaser is the input last selected
+//           through the cache
+//
+//  Parameters: as for CT400_SwitchInput
+//  Returns:  0 if success, -1 otherwise (the cache is then invalidated)
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_SwitchInputCached(uint64_t uiHandle,
+rLaserInput eLaser);
+
+//------------------------------ CT400_CheckConnectedCached --------------------
+// Function CT400_CheckConnectedCached
+//
+//  Purpose: CT400_CheckConnected, answered without a USB round trip when a
+//           call through the cache succeeded less than dMaxAge ago. A lost
+//           connection invalidates the cache, so that everything is sent
+//           again after reconnecting.
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN dMaxAge: s
+//  Returns:  1 if CT400 is connected, 0 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_CheckConnectedCached(uint64_t uiHandle,
+double dMaxAge);
+
+//------------------------------ CT400_InvalidateConfigCache -------------------
+// Function CT400_InvalidateConfigCache
+//
+//  Purpose: Forgets the shadow state of a handle, e.g. after configuring it
+//           with the CT400_Set functions directly
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_InvalidateConfigCache(uint64_t uiHandle);
+
+//------------------------------ CT400_ReleaseDevice ---------------------------
+// Function CT400_ReleaseDevice
+//
+//  Purpose: Forgets a handle (its lock and shadow state) when it is closed
+//           with CT400_Close. Components still running on it keep using
+//           them until they are closed.
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ReleaseDevice(uint64_t uiHandle);
+
+//------------------------------ CT400_GetConfigCacheStats ---------------------
+// Function CT400_GetConfigCacheStats
+//
+//  Purpose: Counts the calls sent and skipped through the cache of a handle
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN/OUT puiSent: pointer over a variable, or NULL
+//              IN/OUT puiSkipped: pointer over a variable, or NULL
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_GetConfigCacheStats(uint64_t uiHandle,
+uint64_t *puiSent, uint64_t *puiSkipped);
+
+#ifdef __cplusplus
+}
+
+#include <chrono>
+#include <mutex>
+
+namespace ct400
+{
+
+//------------------------------ ConfigCache -----------------------------------
+// Class ConfigCache
+//
+//  Purpose: Last parameters sent with CT400_SetLaser (per input),
+//           CT400_SwitchInput, CT400_SetScan, CT400_SetSamplingResolution, CT400_SetDetectorArray
+//           and CT400_SetBNC. Each Device owns one (Device::configCache()),
+//           released with it after CT400_Close. The calls on uiHandle are
+//           made by the caller's thread, which must hold the Device lock;
+//           invalidate() and the counters may be used from any thread.
+//
+//  The shadow state is only right if every setting goes through the cache:
+//  a failed call, a lost connection or a failed sweep invalidates it, and
+//  direct CT400_Set calls must be followed by invalidate().
+//------------------------------------------------------------------------------
+class ConfigCache
+{
+public:
+	// Returns the number of calls sent, -1 if any failed
+	int32_t apply(uint64_t uiHandle, const rScanConfig &config);
+	// Returns 0 if success, -1 otherwise
+	int32_t setLaser(uint64_t uiHandle, rLaserInput eLaser, rEnable eEnable, int32_t iGPIBAdress,
+		rLaserSource eLaserType, double dMinWavelength, double dMaxWavelength, int32_t iSpeed);
+	// Returns 0 if success, -1 otherwise
+	int32_t switchInput(uint64_t uiHandle, rLaserInput eLaser);
+	// Input last selected through the cache, 0 if unknown
+	int32_t input() const;
+	// Returns 1 if connected, 0 otherwise
+	int32_t checkConnected(uint64_t uiHandle, double dMaxAge);
+
+	void invalidate();
+	uint64_t sent() const;
+	uint64_t skipped() const;
+
+private:
+	struct Laser
+	{
+		bool bValid = false;
+		rEnable eEnable;
+		int32_t iGPIBAdress;
+		rLaserSource eLaserType;
+		double dMinWavelength;
+		double dMaxWavelength;
+		int32_t iSpeed;
+	};
+
+	// With m_mtx held
+	int32_t setLaserLocked(uint64_t uiHandle, const Laser &laser, rLaserInput eLaser);
+	void invalidateLocked();
+
+	mutable std::mutex m_mtx;
+	Laser m_lasers[4];
+	int32_t m_iInput = 0;
+	bool m_bScan = false;
+	double m_dPower = 0.0, m_dMinWavelength = 0.0, m_dMaxWavelength = 0.0;
+	bool m_bResolution = false;
+	uint32_t m_uiResolution = 0;
+	bool m_bDetectors = false;
+	rEnable m_eDetectors[4];
+	bool m_bBNC = false;
+	rEnable m_eBNC;
+	double m_dAlpha = 0.0, m_dBeta = 0.0;
+	rUnit m_eUnit;
+	// last successful call through the cache
+	bool m_bConnected = false;
+	std::chrono::steady_clock::time_point m_tConnected;
+	uint64_t m_uiSent = 0;
+	uint64_t m_uiSkipped = 0;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
@@ -10,11 +10,15 @@ To to - 06/12/22
 '''
 
 from ctypes import *
+import os
+import sys
+import tempfile
 import time
 import numpy as np
 import matplotlib.pyplot as plt
 import matplotlib.animation as animation
 from itertools import compress
+from collections import deque
 
 # Definition of various constants to use the same names as the C interface
 (LS_TunicsPlus, LS_TunicsPurity, LS_TunicsReference, LS_TunicsT100s_HP, 
@@ -24,6 +28,893 @@ from itertools import compress
 (DISABLE, ENABLE) = (0,1)
 (Unit_mW, Unit_dBm) = (0,1)
 
+# Load CT400_lib.dll on Windows. Elsewhere load libCT400_lib.so, the simulator
+# built from CT400_sim.cpp (see README.md). Either can be replaced with
+# another library by setting the CT400_LIB environment variable.
+# The library is loaded globally so that libCT400_ext.so binds to it.
+_lib_dir = os.path.dirname(os.path.abspath(__file__))
+if 'CT400_LIB' in os.environ:
+	CT400_lib = WinDLL(os.environ['CT400_LIB']) if sys.platform == 'win32' else CDLL(os.environ['CT400_LIB'], mode=RTLD_GLOBAL)
+elif sys.platform == 'win32':
+	CT400_lib = windll.CT400_lib
+else:
+	CT400_lib = CDLL(os.path.join(_lib_dir, 'libCT400_lib.so'), mode=RTLD_GLOBAL)
+CT400_lib.CT400_Init.restype = c_uint64
+
+# Optional native extensions (CT400_ext.dll / libCT400_ext.so, see README.md)
+try:
+	CT400_ext = WinDLL(os.path.join(_lib_dir, 'CT400_ext.dll')) if sys.platform == 'win32' else CDLL(os.path.join(_lib_dir, 'libCT400_ext.so'))
+except OSError:
+	CT400_ext = None
+if CT400_ext is not None:
+	CT400_ext.CT400_MonitorStart.restype = c_uint64
+	CT400_ext.CT400_CalibrationCreate.restype = c_uint64
+	CT400_ext.CT400_SchedulerCreate.restype = c_uint64
+	CT400_ext.CT400_StatsCreate.restype = c_uint64
+	CT400_ext.CT400_DaemonStart.restype = c_uint64
+	CT400_ext.CT400_ClientConnect.restype = c_uint64
+	CT400_ext.CT400_MapCreate.restype = c_uint64
+	CT400_ext.CT400_MapOpen.restype = c_uint64
+	CT400_ext.CT400_ArchiveOpen.restype = c_uint64
+	CT400_ext.CT400_ArchiveIngest.restype = c_int64
+	CT400_ext.CT400_ArchiveIngestFiles.restype = c_int64
+	CT400_ext.CT400_ArchiveQuery.restype = c_int64
+	CT400_ext.CT400_RunnerOpen.restype = c_uint64
+	CT400_ext.CT400_TrackerCreate.restype = c_uint64
+
+# Phase timing, recorded when CT400_LIB names the metrics shim (libCT400_metrics.so, see README.md)
+_metrics_span = getattr(CT400_lib, 'CT400_MetricsRecordSpan', None)
+
+def _span(handle, name, start):
+	# records the time since start (time.perf_counter) as a phase of the handle's work
+	if _metrics_span is not None:
+		_metrics_span(handle, name.encode(), c_double(time.perf_counter() - start))
+
+def _c_doubles(array):
+	# pointer to the data of a C-contiguous float64 numpy array (no copy)
+	return array.ctypes.data_as(POINTER(c_double))
+
+(IM_LINEAR, IM_CUBIC) = (0,1)
+
+def resample(wavs, data, grid, method = IM_LINEAR):
+	'''
+	Resamples raw (sync) sweep data onto a wavelength grid; grid points outside wavs are NaN
+
+	Parameters
+	----------
+	wavs : np.array[float]
+		non-decreasing wavelength axis of data
+	data : np.array[list[float]]
+		one row per detector, len(wavs) columns
+	grid : np.array[float]
+		increasing wavelength grid, e.g. np.arange(1500, 1630, 0.002)
+	method : int
+		IM_LINEAR, or IM_CUBIC (native extensions only)
+
+	Returns
+	-------
+	np.array[list[float]]
+		one row of len(grid) values per row of data
+	'''
+	wavs = np.ascontiguousarray(wavs, dtype=np.float64)
+	data = np.ascontiguousarray(np.atleast_2d(data), dtype=np.float64)
+	grid = np.ascontiguousarray(grid, dtype=np.float64)
+	# the copies above are C-contiguous float64; the C side trusts these sizes
+	if wavs.ndim != 1 or grid.ndim != 1 or data.ndim != 2 or data.shape[1] != len(wavs):
+		raise ValueError('data must be one row of len(wavs) values per detector, wavs and grid 1-D')
+	out = np.empty((data.shape[0], len(grid)))
+	if CT400_ext is not None:
+		# one pass over the wavelength axis for all rows (SIMD kernels)
+		if CT400_ext.CT400_ResampleBlock(_c_doubles(wavs), _c_doubles(data), data.shape[0], data.shape[1],
+			_c_doubles(grid), _c_doubles(out), len(grid), method) < 0:
+			raise ValueError('could not resample: grid not strictly increasing, or invalid method or sizes')
+	elif method == IM_LINEAR:
+		for i, row in enumerate(data):
+			out[i] = np.interp(grid, wavs, row, left=np.nan, right=np.nan)
+	else:
+		raise ValueError('cubic resampling needs the native extensions')
+	return out
+
+(RK_DIP, RK_PEAK, RK_BOTH) = (1,2,3)
+
+class rResonanceSettings(Structure):
+	_fields_ = [('iKinds', c_int32), ('iFit', c_int32), ('iMaxIterations', c_int32), ('iReserved', c_int32),
+		('dMinDepth', c_double), ('dBaselineWindow', c_double), ('dSmoothing', c_double), ('dFitSpan', c_double)]
+
+class rResonance(Structure):
+	_fields_ = [('eDetector', c_int32), ('iKind', c_int32), ('iIndex', c_int32), ('iFitIterations', c_int32),
+		('dWavelength', c_double), ('dBaseline', c_double), ('dExtinction', c_double), ('dFwhm', c_double),
+		('dQ', c_double), ('dFsr', c_double), ('dFitWavelength', c_double), ('dFitFwhm', c_double),
+		('dFitQ', c_double), ('dFitExtinction', c_double), ('dFitRms', c_double)]
+
+def find_resonances(wavs, det_pows, dets_used, kinds = RK_DIP, fit = False, min_depth = 3.0, baseline_window = 5.0):
+	'''
+	Finds the dips and/or peaks of resampled sweep data (native extensions only)
+
+	Parameters
+	----------
+	wavs : np.array[float]
+		increasing wavelength axis, e.g. from perform_scan
+	det_pows : np.array[list[float]]
+		one row per detector in dB(m), len(wavs) columns
+	dets_used : list
+		detector of each row of det_pows
+	kinds : int
+		RK_DIP, RK_PEAK or RK_BOTH
+	fit : bool
+		if true, also fit a Lorentzian to each resonance (dFit* fields)
+	min_depth : float
+		dB below (above) the local baseline for a dip (peak)
+	baseline_window : float
+		nm, wider than the widest resonance and narrower than the FSR
+
+	Returns
+	-------
+	list[rResonance]
+		ordered by detector then wavelength, with dWavelength, dExtinction, dFwhm, dQ and dFsr
+	'''
+	if CT400_ext is None:
+		raise RuntimeError('resonance analysis needs the native extensions')
+	wavs = np.ascontiguousarray(wavs, dtype=np.float64)
+	det_pows = np.ascontiguousarray(np.atleast_2d(det_pows), dtype=np.float64)
+	settings = rResonanceSettings()
+	CT400_ext.CT400_DefaultResonanceSettings(byref(settings))
+	(settings.iKinds, settings.iFit) = (kinds, ENABLE if fit else DISABLE)
+	(settings.dMinDepth, settings.dBaselineWindow) = (min_depth, baseline_window)
+	dets = (c_int * len(dets_used))(*dets_used)
+	results = (rResonance * 256)()
+	while True:
+		n = CT400_ext.CT400_FindResonances(_c_doubles(wavs), dets, len(dets_used), _c_doubles(det_pows),
+			len(wavs), byref(settings), results, len(results))
+		if n <= len(results):
+			break
+		results = (rResonance * n)()
+	if n < 0:
+		raise ValueError('invalid resonance search arguments')
+	return list(results[:n])
+
+(SR_NONE, SR_SIGMA_CLIP, SR_MEDIAN_OF_MEANS) = (0,1,2)
+(SS_MEAN, SS_STD, SS_MIN, SS_MAX, SS_ROBUST, SS_ACCEPTED) = (0,1,2,3,4,5)
+
+class rStatsSettings(Structure):
+	_fields_ = [('eRobust', c_int32), ('iGroups', c_int32), ('dClipSigma', c_double), ('iWarmup', c_int32),
+		('iReserved', c_int32)]
+
+class SweepStats:
+	'''
+	Per-point mean, standard deviation, min, max and a robust mean of repeated sweeps on one
+	resampled grid, updated natively as each sweep is added: memory does not grow with the
+	number of sweeps (native extensions only)
+
+	Parameters
+	----------
+	nb_dets : int
+		rows of each sweep
+	robust : int
+		SR_SIGMA_CLIP (values beyond clip_sigma deviations are left out, seeded from the first
+		warmup sweeps), SR_MEDIAN_OF_MEANS (median of the means of groups interleaved groups,
+		for rare large outliers) or SR_NONE
+	'''
+	def __init__(self, nb_dets, robust = SR_SIGMA_CLIP, clip_sigma = 3.0, warmup = 10, groups = 8):
+		if CT400_ext is None:
+			raise RuntimeError('sweep statistics need the native extensions')
+		settings = rStatsSettings(robust, groups, clip_sigma, warmup, 0)
+		self.uiStats = c_uint64(CT400_ext.CT400_StatsCreate(nb_dets, byref(settings)))
+		if not self.uiStats.value:
+			raise ValueError('invalid statistics settings')
+		self.nb_dets = nb_dets
+		self.size = 0
+
+	def __del__(self):
+		if CT400_ext is not None and getattr(self, 'uiStats', None):
+			CT400_ext.CT400_StatsDestroy(self.uiStats)
+
+	def add(self, wavs, det_pows):
+		'''
+		Adds a sweep (wavs and det_pows as returned by perform_scan, on the grid of the first sweep).
+		Returns the number of sweeps added so far.
+		'''
+		wavs = np.ascontiguousarray(wavs, dtype=np.float64)
+		det_pows = np.ascontiguousarray(det_pows, dtype=np.float64)
+		if wavs.ndim != 1 or det_pows.shape != (self.nb_dets, len(wavs)):
+			raise ValueError('det_pows must be ({}, {}) for {} wavelengths'.format(self.nb_dets, len(wavs), len(wavs)))
+		n = CT400_ext.CT400_StatsAdd(self.uiStats, _c_doubles(wavs), _c_doubles(det_pows), len(wavs))
+		if n < 0:
+			raise ValueError('sweep not on the grid of the first one')
+		self.size = len(wavs)
+		return n
+
+	def get(self, stat = SS_MEAN):
+		'''
+		Returns (wavs, rows): one row of the SS_* statistic per detector
+		'''
+		(wavs, rows) = (np.empty(self.size), np.empty([self.nb_dets, self.size]))
+		if CT400_ext.CT400_StatsGet(self.uiStats, stat, _c_doubles(wavs), _c_doubles(rows), self.size) < 0:
+			raise RuntimeError('no sweep added yet')
+		return wavs, rows
+
+class rMapInfo(Structure):
+	_fields_ = [('iRows', c_int32), ('iColumns', c_int32), ('iLevels', c_int32), ('iTileRows', c_int32),
+		('iTileColumns', c_int32), ('iReserved', c_int32), ('dMinParameter', c_double), ('dMaxParameter', c_double),
+		('dMinWavelength', c_double), ('dMaxWavelength', c_double), ('dMinValue', c_double), ('dMaxValue', c_double)]
+
+class SweepMap:
+	'''
+	Wavelength x parameter map (one sweep per row) built in a tiled memory-mapped file with a
+	min/max pyramid, so that maps larger than memory can be viewed at any zoom (native
+	extensions only)
+
+	Parameters
+	----------
+	path : str
+		map file
+	wavs : np.array[float]
+		wavelength axis of the rows to create a new map (replacing the file), or None to open
+		an existing one read-only
+	'''
+	def __init__(self, path, wavs = None):
+		if CT400_ext is None:
+			raise RuntimeError('sweep maps need the native extensions')
+		if wavs is not None:
+			wavs = np.ascontiguousarray(wavs, dtype=np.float64)
+			self.uiMap = c_uint64(CT400_ext.CT400_MapCreate(path.encode(), _c_doubles(wavs), len(wavs)))
+		else:
+			self.uiMap = c_uint64(CT400_ext.CT400_MapOpen(path.encode()))
+		if not self.uiMap.value:
+			raise OSError('could not {} {}'.format('create' if wavs is not None else 'open', path))
+
+	def __del__(self):
+		self.close()
+
+	def close(self):
+		if CT400_ext is not None and getattr(self, 'uiMap', None):
+			CT400_ext.CT400_MapClose(self.uiMap)
+			self.uiMap = None
+
+	def append(self, param, row):
+		'''
+		Appends a sweep (one detector row on the axis of the map) with its parameter value.
+		Returns the number of rows.
+		'''
+		row = np.ascontiguousarray(row, dtype=np.float64)
+		n = CT400_ext.CT400_MapAppend(self.uiMap, c_double(param), _c_doubles(row), len(row))
+		if n < 0:
+			raise OSError('could not append to the map')
+		return n
+
+	def refresh(self):
+		'''
+		Takes in the rows appended by the process writing the map; returns the number of rows
+		'''
+		return CT400_ext.CT400_MapRefresh(self.uiMap)
+
+	def info(self):
+		info = rMapInfo()
+		CT400_ext.CT400_MapGetInfo(self.uiMap, byref(info))
+		return info
+
+	def axes(self):
+		'''
+		Returns (wavs, params): the wavelength axis and the parameter of every row
+		'''
+		info = self.info()
+		(wavs, params) = (np.empty(info.iColumns), np.empty(info.iRows))
+		CT400_ext.CT400_MapGetAxes(self.uiMap, _c_doubles(wavs), _c_doubles(params), info.iColumns, info.iRows)
+		return wavs, params
+
+	def row(self, index):
+		row = np.empty(self.info().iColumns)
+		if CT400_ext.CT400_MapGetRow(self.uiMap, index, _c_doubles(row), len(row)) < 0:
+			raise IndexError('no row {}'.format(index))
+		return row
+
+	def view(self, rows = None, cols = None, shape = (600, 800)):
+		'''
+		Min and max of the map over a grid of shape cells covering rows x cols, read from the
+		coarsest pyramid level that resolves it (e.g. for plt.imshow(vmax, aspect='auto'))
+
+		Parameters
+		----------
+		rows, cols : tuple(int, int)
+			first and last + 1 row and column of the region, default the whole map
+		shape : tuple(int, int)
+			cells of the view (height, width)
+
+		Returns
+		-------
+		np.array[list[float]], np.array[list[float]]
+			vmin, vmax, NaN where the region holds no value
+		'''
+		info = self.info()
+		(r0, r1) = rows if rows is not None else (0, info.iRows)
+		(c0, c1) = cols if cols is not None else (0, info.iColumns)
+		(vmin, vmax) = (np.empty(shape), np.empty(shape))
+		if CT400_ext.CT400_MapView(self.uiMap, r0, r1 - r0, c0, c1 - c0, shape[0], shape[1], _c_doubles(vmin),
+			_c_doubles(vmax)) < 0:
+			raise ValueError('invalid view')
+		return vmin, vmax
+
+class rScanConfig(Structure):
+	_fields_ = [('dLaserMinWavelength', c_double), ('dLaserMaxWavelength', c_double), ('dPower', c_double),
+		('dMinWavelength', c_double), ('dMaxWavelength', c_double), ('dAlpha', c_double), ('dBeta', c_double),
+		('eInput', c_int32), ('eEnable', c_int32), ('iGPIBAdress', c_int32), ('eLaserType', c_int32),
+		('iSpeed', c_int32), ('uiResolution', c_uint32), ('eDect2', c_int32), ('eDect3', c_int32),
+		('eDect4', c_int32), ('eExt', c_int32), ('eBNC', c_int32), ('eUnit', c_int32), ('iReserved', c_int32 * 2)]
+
+class rAdaptiveSettings(Structure):
+	_fields_ = [('iCoarseSpeed', c_int32), ('uiCoarseResolution', c_uint32), ('iFineSpeed', c_int32),
+		('uiFineResolution', c_uint32), ('dWindowFwhm', c_double), ('dMargin', c_double),
+		('dSweepOverhead', c_double), ('resonance', rResonanceSettings)]
+
+class rAdaptiveSegment(Structure):
+	_fields_ = [('dMinWavelength', c_double), ('dMaxWavelength', c_double), ('iFirst', c_int32),
+		('iPoints', c_int32), ('iSweep', c_int32), ('iSpeed', c_int32), ('uiResolution', c_uint32),
+		('iReserved', c_int32)]
+
+class rAdaptiveReport(Structure):
+	_fields_ = [('iRegions', c_int32), ('iSegments', c_int32), ('iPoints', c_int32), ('iFullPoints', c_int32),
+		('dSurveyTime', c_double), ('dFineTime', c_double), ('dFullTime', c_double), ('dTimeSaved', c_double)]
+
+(SC_POUT, SC_P1, SC_P2, SC_P3, SC_P4, SC_VEXT) = (1,2,4,8,16,32)
+
+class rStepSettings(Structure):
+	_fields_ = [('eInput', c_int32), ('iAverages', c_int32), ('iWindow', c_int32), ('iMaxReadings', c_int32),
+		('uiSettleChannels', c_uint32), ('iReserved', c_int32), ('dPower', c_double), ('dTolerance', c_double)]
+
+class rSchedulerReport(Structure):
+	_fields_ = [('iJobs', c_int32), ('iSweeps', c_int32), ('iFailed', c_int32), ('iSwitches', c_int32),
+		('iConfigCalls', c_int32), ('iNaiveSwitches', c_int32), ('iNaiveConfigCalls', c_int32), ('iReserved', c_int32),
+		('dElapsed', c_double), ('dSweepTime', c_double), ('dUtilisation', c_double)]
+
+(TM_OFF, TM_RECORD, TM_REPLAY) = (0,1,2)
+
+class rTraceStats(Structure):
+	_fields_ = [('eMode', c_int32), ('iReserved', c_int32), ('uiCalls', c_uint64), ('uiMismatches', c_uint64),
+		('uiMissing', c_uint64), ('uiRecords', c_uint64), ('uiBytes', c_uint64)]
+
+(DC_STATUS, DC_CONFIGURE, DC_START, DC_STOP, DC_SUBSCRIBE, DC_SHUTDOWN) = (0,1,2,3,4,5)
+
+class rSweepInfo(Structure):
+	_fields_ = [('uiSequence', c_uint64), ('iTimestamp', c_int64), ('iError', c_int32), ('iPoints', c_int32),
+		('iTotalPoints', c_int32), ('iNbDetectors', c_int32), ('eDetectors', c_int32 * 5), ('iPower', c_int32),
+		('dScanTime', c_double), ('dFetchTime', c_double), ('config', rScanConfig), ('tcError', c_char * 256)]
+
+class rDaemonRequest(Structure):
+	_fields_ = [('eCommand', c_int32), ('iSweeps', c_int32), ('config', rScanConfig)]
+
+class rDaemonStatus(Structure):
+	_fields_ = [('iStatus', c_int32), ('iPending', c_int32), ('uiPublished', c_uint64), ('uiFailed', c_uint64),
+		('iClients', c_int32), ('iSubscribers', c_int32), ('iSlots', c_int32), ('iMaxPoints', c_int32),
+		('tcRing', c_char * 64)]
+
+class DaemonClient:
+	'''
+	Client of an instrument daemon (CT400_daemon, see README.md): commands go through its Unix
+	domain socket, sweeps are read from its shared memory ring, so any number of processes can
+	follow the same sweeps (native extensions only, not on Windows)
+
+	Parameters
+	----------
+	socket : str
+		socket of the daemon
+	'''
+	def __init__(self, socket = '/tmp/ct400.sock'):
+		if CT400_ext is None:
+			raise RuntimeError('the daemon client needs the native extensions')
+		self.uiClient = c_uint64(CT400_ext.CT400_ClientConnect(socket.encode()))
+		if not self.uiClient.value:
+			raise ConnectionError('no daemon on {}'.format(socket))
+		self.max_points = self.status().iMaxPoints
+
+	def __del__(self):
+		if CT400_ext is not None and getattr(self, 'uiClient', None):
+			CT400_ext.CT400_ClientDisconnect(self.uiClient)
+
+	def _command(self, command, sweeps = 0, config = None):
+		request = rDaemonRequest(command, sweeps)
+		if config is not None:
+			request.config = config
+		status = rDaemonStatus()
+		if CT400_ext.CT400_ClientCommand(self.uiClient, byref(request), byref(status)) != 0:
+			raise RuntimeError('daemon command {} failed'.format(command))
+		return status
+
+	def status(self):
+		'''
+		Returns the rDaemonStatus of the daemon
+		'''
+		return self._command(DC_STATUS)
+
+	def configure(self, config):
+		'''
+		Sets the rScanConfig of the next sweeps (e.g. from CT400_DefaultScanConfig)
+		'''
+		return self._command(DC_CONFIGURE, config = config)
+
+	def start(self, sweeps = 0):
+		'''
+		Asks for sweeps sweeps, or for sweeps until stop() if 0
+		'''
+		return self._command(DC_START, sweeps)
+
+	def stop(self):
+		return self._command(DC_STOP)
+
+	def shutdown(self):
+		return self._command(DC_SHUTDOWN)
+
+	def next_sweep(self, timeout = -1, copy = False):
+		'''
+		Waits for the next sweep this client has not read yet (sweeps overwritten in the ring
+		meanwhile are skipped)
+
+		Parameters
+		----------
+		timeout : int
+			ms, -1 to wait without limit
+		copy : bool
+			False to get read-only views over the ring, which the daemon overwrites status().iSlots - 1
+			sweeps later: check valid(info.uiSequence) once done with them. True to get copies
+
+		Returns
+		-------
+		rSweepInfo, np.array[float], np.array[list[float]], np.array[float]
+			info, wavelength axis, one row per detector of info.eDetectors and Pout (None without
+			Pout), or None on timeout
+		'''
+		uiSequence = c_uint64()
+		while True:
+			rc = CT400_ext.CT400_ClientWaitSweep(self.uiClient, timeout, byref(uiSequence))
+			if rc == 1:
+				return None
+			if rc != 0:
+				raise ConnectionError('daemon stopped')
+			info = rSweepInfo()
+			rows = (POINTER(c_double) * 7)()
+			n = CT400_ext.CT400_ClientMapSweep(self.uiClient, uiSequence, byref(info), rows)
+			if n < 0:
+				continue
+			# rows are max_points apart in the slot: map them all at once
+			block = np.ctypeslib.as_array(rows[0], shape = (1 + info.iNbDetectors + info.iPower, self.max_points))[:, :n]
+			block.flags.writeable = False
+			if copy:
+				block = block.copy()
+				if not self.valid(info.uiSequence):
+					continue
+			return info, block[0], block[1:1 + info.iNbDetectors], block[1 + info.iNbDetectors] if info.iPower else None
+
+	def valid(self, sequence):
+		'''
+		Returns True if the sweep sequence (rSweepInfo.uiSequence) is still in the ring, i.e. the
+		views of next_sweep were not overwritten while in use
+		'''
+		return CT400_ext.CT400_ClientSweepValid(self.uiClient, c_uint64(sequence)) == 0
+
+class rArchiveSweep(Structure):
+	_fields_ = [('uiSweep', c_uint64), ('uiRecord', c_uint64), ('iTimestamp', c_int64), ('uiFirstFeature', c_uint64),
+		('iFeatures', c_int32), ('iPoints', c_int32), ('iNbDetectors', c_int32), ('eDetectors', c_int32 * 5),
+		('config', rScanConfig), ('tcLabel', c_char * 64)]
+
+class rArchiveFeature(Structure):
+	_fields_ = [('uiSweep', c_uint64), ('iTimestamp', c_int64), ('eInput', c_int32), ('eDetector', c_int32),
+		('iKind', c_int32), ('uiResolution', c_uint32), ('dMinWavelength', c_double), ('dMaxWavelength', c_double),
+		('dWavelength', c_double), ('dExtinction', c_double), ('dFwhm', c_double), ('dQ', c_double),
+		('dBaseline', c_double), ('dFsr', c_double)]
+
+class rArchiveQuery(Structure):
+	_fields_ = [('dMinWavelength', c_double), ('dMaxWavelength', c_double), ('dMinExtinction', c_double),
+		('dMaxExtinction', c_double), ('dMinFwhm', c_double), ('dMaxFwhm', c_double), ('dMinQ', c_double),
+		('dMaxQ', c_double), ('iMinTimestamp', c_int64), ('iMaxTimestamp', c_int64), ('eInput', c_int32),
+		('eDetector', c_int32), ('iKinds', c_int32), ('iReserved', c_int32)]
+
+class rArchiveInfo(Structure):
+	_fields_ = [('iSweeps', c_int64), ('iFeatures', c_int64), ('iIndexed', c_int64), ('iReserved', c_int64),
+		('settings', rResonanceSettings)]
+
+class SpectralArchive:
+	'''
+	Archive of sweeps with the resonances found in them at ingest, indexed on wavelength,
+	extinction, FWHM and Q so that queries over millions of sweeps take milliseconds
+	(native extensions only)
+
+	Parameters
+	----------
+	directory : str
+		directory of the archive, created if needed
+	settings : rResonanceSettings
+		resonance detection of a new archive, None for the defaults (see find_resonances)
+	'''
+	def __init__(self, directory, settings = None):
+		if CT400_ext is None:
+			raise RuntimeError('the archive needs the native extensions')
+		self.uiArchive = c_uint64(CT400_ext.CT400_ArchiveOpen(directory.encode(),
+			byref(settings) if settings is not None else None))
+		if not self.uiArchive.value:
+			raise OSError('could not open the archive {}'.format(directory))
+
+	def __del__(self):
+		self.close()
+
+	def close(self):
+		if CT400_ext is not None and getattr(self, 'uiArchive', None):
+			CT400_ext.CT400_ArchiveClose(self.uiArchive)
+			self.uiArchive = None
+
+	def ingest(self, config, wavs, det_pows, dets_used, label = '', timestamp = 0):
+		'''
+		Stores a sweep and indexes its resonances; returns its number
+
+		Parameters
+		----------
+		config : rScanConfig
+			configuration of the sweep (range, resolution, input...)
+		wavs : np.array[float]
+			wavelength axis
+		det_pows : np.array[list[float]]
+			one row per detector in dB(m), len(wavs) columns
+		dets_used : list
+			detector of each row of det_pows
+		label : str
+			device or other label
+		timestamp : int
+			us since 1970, 0 for now
+		'''
+		wavs = np.ascontiguousarray(wavs, dtype=np.float64)
+		det_pows = np.ascontiguousarray(np.atleast_2d(det_pows), dtype=np.float64)
+		if wavs.ndim != 1 or det_pows.shape != (len(dets_used), len(wavs)):
+			raise ValueError('det_pows must be ({}, {}) for {} detectors and {} wavelengths'.format(
+				len(dets_used), len(wavs), len(dets_used), len(wavs)))
+		dets = (c_int32 * len(dets_used))(*dets_used)
+		n = CT400_ext.CT400_ArchiveIngest(self.uiArchive, byref(config), c_int64(timestamp), label.encode(),
+			_c_doubles(wavs), dets, len(dets_used), _c_doubles(det_pows), len(wavs))
+		if n < 0:
+			raise OSError('could not ingest the sweep')
+		return n
+
+	def ingest_files(self, exports, config = None, threads = 0):
+		'''
+		Bulk ingest of text exports, read and analysed in parallel
+
+		Parameters
+		----------
+		exports : list[tuple(str, dict)]
+			(wavelength file, {detector: detector file}) per sweep, e.g. from
+			CT400_ScanSaveWavelengthResampledFile and CT400_ScanSaveDetectorResampledFile
+		config : rScanConfig
+			settings of the sweeps besides their range and resolution, None for the defaults
+		threads : int
+			0 for one per hardware thread
+
+		Returns
+		-------
+		int, int
+			sweeps ingested, sweeps that could not be read
+		'''
+		with tempfile.NamedTemporaryFile('w', suffix='.txt', delete=False) as manifest:
+			for (wav_file, det_files) in exports:
+				fields = [wav_file] + ['{}\t{}'.format(det, path) for (det, path) in sorted(det_files.items())]
+				manifest.write('\t'.join(fields) + '\n')
+		try:
+			failed = c_int32()
+			n = CT400_ext.CT400_ArchiveIngestFiles(self.uiArchive, manifest.name.encode(),
+				byref(config) if config is not None else None, threads, byref(failed))
+		finally:
+			os.remove(manifest.name)
+		if n < 0:
+			raise OSError('could not ingest the exports')
+		return n, failed.value
+
+	def query(self, wav = None, extinction = None, fwhm = None, q = None, time = None, input = 0, det = 0,
+		kinds = RK_BOTH, max_features = 100000):
+		'''
+		Finds the resonances within every given range (inclusive (min, max) tuples, None for
+		any), e.g. query(wav = (1550.1, 1550.3), extinction = (20, np.inf))
+
+		Parameters
+		----------
+		wav : tuple(float, float)
+			nm
+		extinction : tuple(float, float)
+			dB
+		fwhm : tuple(float, float)
+			nm
+		q : tuple(float, float)
+		time : tuple(int, int)
+			us since 1970
+		input, det : int
+			laser input and detector, 0 for any
+		kinds : int
+			RK_DIP, RK_PEAK or RK_BOTH
+		max_features : int
+			most features returned
+
+		Returns
+		-------
+		list[rArchiveFeature]
+			in the order they were ingested (feature.uiSweep gives the sweep, see sweep())
+		'''
+		query = rArchiveQuery()
+		CT400_ext.CT400_DefaultArchiveQuery(byref(query))
+		for (name, bounds) in (('Wavelength', wav), ('Extinction', extinction), ('Fwhm', fwhm), ('Q', q)):
+			if bounds is not None:
+				(lo, hi) = bounds
+				setattr(query, 'dMin' + name, lo)
+				setattr(query, 'dMax' + name, hi)
+		if time is not None:
+			(query.iMinTimestamp, query.iMaxTimestamp) = time
+		(query.eInput, query.eDetector, query.iKinds) = (input, det, kinds)
+		features = (rArchiveFeature * max_features)()
+		n = CT400_ext.CT400_ArchiveQuery(self.uiArchive, byref(query), features, None, max_features)
+		if n < 0:
+			raise ValueError('invalid query')
+		return list(features[:min(n, max_features)])
+
+	def sweep(self, index):
+		'''
+		Returns (info, wavs, det_pows) of a stored sweep: its rArchiveSweep, wavelength axis and one
+		row per detector of info.eDetectors
+		'''
+		info = rArchiveSweep()
+		if CT400_ext.CT400_ArchiveGetSweep(self.uiArchive, c_uint64(index), byref(info), None, None, 0) < 0:
+			raise IndexError('no sweep {}'.format(index))
+		(wavs, det_pows) = (np.empty(info.iPoints), np.empty([info.iNbDetectors, info.iPoints]))
+		if CT400_ext.CT400_ArchiveGetSweep(self.uiArchive, c_uint64(index), None, _c_doubles(wavs),
+			_c_doubles(det_pows), info.iPoints) < 0:
+			raise OSError('could not read sweep {}'.format(index))
+		return info, wavs, det_pows
+
+	def info(self):
+		info = rArchiveInfo()
+		CT400_ext.CT400_ArchiveGetInfo(self.uiArchive, byref(info))
+		return info
+
+	def flush(self):
+		'''
+		Merges the recent features into the index file and writes everything to disk
+		'''
+		return CT400_ext.CT400_ArchiveFlush(self.uiArchive)
+
+(JS_PENDING, JS_DONE, JS_ABANDONED) = (0,1,2)
+
+class rRunnerPolicy(Structure):
+	_fields_ = [('iMaxAttempts', c_int32), ('iReinitAfter', c_int32), ('dBackoff', c_double), ('dMaxBackoff', c_double)]
+
+class rRunnerJob(Structure):
+	_fields_ = [('iSite', c_int32), ('eInput', c_int32), ('iConfig', c_int32), ('eState', c_int32),
+		('iAttempts', c_int32), ('iLastError', c_int32), ('iNbDetectors', c_int32), ('iReserved', c_int32),
+		('uiRecord', c_uint64), ('iTimestamp', c_int64), ('tcError', c_char * 256)]
+
+class rRunnerReport(Structure):
+	_fields_ = [('iJobs', c_int32), ('iDone', c_int32), ('iAbandoned', c_int32), ('iPending', c_int32),
+		('iSweeps', c_int32), ('iRetries', c_int32), ('iReinits', c_int32), ('iCurrentJob', c_int32),
+		('uiHandle', c_uint64), ('dElapsed', c_double), ('dBackoffTime', c_double)]
+
+_SiteCallback = (WINFUNCTYPE if sys.platform == 'win32' else CFUNCTYPE)(c_int32, c_void_p, c_int32)
+
+class JobRunner:
+	'''
+	Runs a recipe (sites x inputs x scan configurations) from a journal file: each sweep is
+	stored in a sweep file as soon as it is taken, failed sweeps are retried with backoff
+	(closing and opening the CT400 again after repeated failures), and a run started again with
+	the same files resumes at the first job without a result, whatever stopped the last one
+	(native extensions only)
+
+	Parameters
+	----------
+	ct400 : Yenista_CT400
+		initialised instance; its uiHandle is updated if the runner reopens the CT400
+	journal, results : str
+		journal and sweep file, created if needed
+	'''
+	def __init__(self, ct400, journal, results):
+		if CT400_ext is None:
+			raise RuntimeError('the job runner needs the native extensions')
+		self.ct400 = ct400
+		self.uiRunner = c_uint64(CT400_ext.CT400_RunnerOpen(ct400.uiHandle, journal.encode(), results.encode()))
+		if not self.uiRunner.value:
+			raise OSError('could not open the journal {}'.format(journal))
+		self.site_callback = None
+
+	def __del__(self):
+		self.close()
+
+	def close(self):
+		if CT400_ext is not None and getattr(self, 'uiRunner', None):
+			CT400_ext.CT400_RunnerClose(self.uiRunner)
+			self.uiRunner = None
+
+	def set_recipe(self, sites, configs, inputs = None):
+		'''
+		Sets the jobs, in the order site, input, configuration. A journal that already has a
+		recipe only accepts the same one.
+
+		Parameters
+		----------
+		sites : int
+		configs : list[rScanConfig]
+		inputs : list[int]
+			laser inputs each configuration runs on, None for the input of each configuration
+
+		Returns
+		-------
+		int
+			number of jobs
+		'''
+		c_configs = (rScanConfig * len(configs))(*configs)
+		c_inputs = (c_int32 * len(inputs))(*inputs) if inputs else None
+		n = CT400_ext.CT400_RunnerSetRecipe(self.uiRunner, sites, c_inputs, len(inputs) if inputs else 0,
+			c_configs, len(configs))
+		if n < 0:
+			raise ValueError('invalid recipe, or not the recipe of the journal')
+		return n
+
+	def set_policy(self, max_attempts = 4, reinit_after = 2, backoff = 1.0, max_backoff = 60.0):
+		'''
+		Sweeps per job and run, failures in a row before reopening the CT400 (0 for never), and
+		the first and longest wait (s) before a retry
+		'''
+		policy = rRunnerPolicy(max_attempts, reinit_after, backoff, max_backoff)
+		if CT400_ext.CT400_RunnerSetPolicy(self.uiRunner, byref(policy)) < 0:
+			raise ValueError('invalid policy')
+
+	def set_site_setup(self, setup):
+		'''
+		setup(site) is called before the first job of each site (e.g. to move the stage); a
+		non-zero return or an exception abandons the jobs of the site. None for no setup.
+		'''
+		def call(context, site):
+			try:
+				return setup(site) or 0
+			except Exception as e:
+				print('Site {} setup failed: {}'.format(site, e))
+				return -1
+		# the callback must outlive the runner's use of it
+		self.site_callback = _SiteCallback(call) if setup is not None else None
+		CT400_ext.CT400_RunnerSetSiteCallback(self.uiRunner, self.site_callback, None)
+
+	def run(self):
+		'''
+		Runs every job without a result (see stop()). Returns the rRunnerReport of the run.
+		'''
+		report = rRunnerReport()
+		n = CT400_ext.CT400_RunnerRun(self.uiRunner, byref(report))
+		# the runner may have reopened the CT400 under a new handle
+		if report.uiHandle != 0:
+			self.ct400.uiHandle = c_longlong(report.uiHandle)
+		if n < 0:
+			raise OSError('the run could not continue (journal or results file not writable?)')
+		return report
+
+	def stop(self):
+		'''
+		Stops run() from another thread; the interrupted job runs again next time
+		'''
+		CT400_ext.CT400_RunnerStop(self.uiRunner)
+
+	def report(self):
+		report = rRunnerReport()
+		CT400_ext.CT400_RunnerGetReport(self.uiRunner, byref(report))
+		return report
+
+	def job(self, index):
+		job = rRunnerJob()
+		if CT400_ext.CT400_RunnerGetJob(self.uiRunner, index, byref(job)) < 0:
+			raise IndexError('no job {}'.format(index))
+		return job
+
+	def result(self, index):
+		'''
+		Returns (wavs, det_pows, pout) of a job done: wavelength axis, one row per enabled
+		detector of its configuration (DE_1 first) and Pout
+		'''
+		rows = self.job(index).iNbDetectors
+		# the number of points first, then the arrays sized for it
+		n = CT400_ext.CT400_RunnerGetResult(self.uiRunner, index, None, None, None, 0)
+		if n < 0:
+			raise IndexError('no result for job {}'.format(index))
+		(wavs, det_pows, pout) = (np.empty(n), np.empty([rows, n]), np.empty(n))
+		if CT400_ext.CT400_RunnerGetResult(self.uiRunner, index, _c_doubles(wavs), _c_doubles(det_pows),
+			_c_doubles(pout), n) != n:
+			raise IndexError('no result for job {}'.format(index))
+		return wavs, det_pows, pout
+
+(LT_TENTATIVE, LT_LOCKED) = (0,1)
+(LE_LOCK, LE_LOSS) = (1,2)
+
+class rTrackerSettings(Structure):
+	_fields_ = [('dGate', c_double), ('dGateSigma', c_double), ('dAlpha', c_double), ('dBeta', c_double),
+		('iLockHits', c_int32), ('iLossMisses', c_int32), ('iMaxTracks', c_int32), ('iReserved', c_int32)]
+
+class rLineTrack(Structure):
+	_fields_ = [('uiId', c_uint64), ('eState', c_int32), ('iMisses', c_int32), ('iHits', c_int64),
+		('uiFirstSweep', c_uint64), ('uiLastSweep', c_uint64), ('dWavelength', c_double), ('dDrift', c_double),
+		('dMeasured', c_double), ('dScatter', c_double), ('dFirstWavelength', c_double), ('dMinWavelength', c_double),
+		('dMaxWavelength', c_double), ('iLastTimestamp', c_int64)]
+
+class rLineEvent(Structure):
+	_fields_ = [('uiIndex', c_uint64), ('uiSweep', c_uint64), ('iTimestamp', c_int64), ('uiId', c_uint64),
+		('eType', c_int32), ('iReserved', c_int32), ('dWavelength', c_double)]
+
+class rTrackerStatus(Structure):
+	_fields_ = [('uiSweeps', c_uint64), ('uiEvents', c_uint64), ('iTimestamp', c_int64), ('iTracks', c_int32),
+		('iLocked', c_int32), ('iLines', c_int32), ('iAssigned', c_int32), ('iDropped', c_int32),
+		('iReserved', c_int32), ('dUpdateTime', c_double)]
+
+CT400_MAX_LINE_TRACKS = 256
+
+class LineTracker:
+	'''
+	Follows the heterodyne detection lines from sweep to sweep: lines are assigned to tracks
+	within a gate around each track's prediction, and each track keeps its filtered wavelength,
+	drift (nm/s), scatter and lock/loss events. tracks() and events() never wait for update(),
+	so a monitor thread can poll them during acquisition (native extensions only)
+
+	Parameters
+	----------
+	gate : float
+		nm, largest distance from a track's prediction to its line
+	gate_sigma : float
+		the gate also spans this many rms scatters of the track
+	alpha, beta : float
+		position and drift gains of the alpha-beta filter
+	lock_hits, loss_misses : int
+		sweeps in a row with a line before a track locks, without before it is lost
+	max_tracks : int
+		at most CT400_MAX_LINE_TRACKS
+	'''
+	def __init__(self, gate = 0.02, gate_sigma = 4.0, alpha = 0.5, beta = 0.15, lock_hits = 3, loss_misses = 5,
+		max_tracks = 64):
+		if CT400_ext is None:
+			raise RuntimeError('line tracking needs the native extensions')
+		settings = rTrackerSettings(gate, gate_sigma, alpha, beta, lock_hits, loss_misses, max_tracks, 0)
+		self.uiTracker = c_uint64(CT400_ext.CT400_TrackerCreate(byref(settings)))
+		if not self.uiTracker.value:
+			raise ValueError('invalid tracker settings')
+		self.next_event = c_uint64(0)
+
+	def __del__(self):
+		self.close()
+
+	def close(self):
+		if CT400_ext is not None and getattr(self, 'uiTracker', None):
+			CT400_ext.CT400_TrackerClose(self.uiTracker)
+			self.uiTracker = None
+
+	def update(self, lines, timestamp = 0):
+		'''
+		Takes in the lines of one sweep (nm, any order); timestamp in us since 1970, 0 for now.
+		Returns the number of lines assigned to a track.
+		'''
+		lines = np.ascontiguousarray(lines, dtype=np.float64)
+		return CT400_ext.CT400_TrackerUpdate(self.uiTracker, _c_doubles(lines), len(lines), c_int64(timestamp))
+
+	def acquire(self, ct400, timestamp = 0):
+		'''
+		update() with the lines of the last sweep of a Yenista_CT400
+		'''
+		return CT400_ext.CT400_TrackerAcquire(self.uiTracker, ct400.uiHandle, c_int64(timestamp))
+
+	def tracks(self):
+		'''
+		Returns (status, tracks): the rTrackerStatus and the list of rLineTrack, in wavelength
+		order, of the last update
+		'''
+		status = rTrackerStatus()
+		tracks = (rLineTrack * CT400_MAX_LINE_TRACKS)()
+		n = CT400_ext.CT400_TrackerGetTracks(self.uiTracker, byref(status), tracks, CT400_MAX_LINE_TRACKS)
+		return status, list(tracks[:max(n, 0)])
+
+	def events(self, max_events = 4096):
+		'''
+		Returns the rLineEvent (LE_LOCK, LE_LOSS) since the last call
+		'''
+		events = (rLineEvent * max_events)()
+		n = CT400_ext.CT400_TrackerGetEvents(self.uiTracker, byref(self.next_event), events, max_events)
+		return list(events[:max(n, 0)])
+
+	def reset(self):
+		CT400_ext.CT400_TrackerReset(self.uiTracker)
+
 class Yenista_CT400:
 
 	uiHandle = None
@@ -53,14 +944,14 @@ class Yenista_CT400:
 		# initialise CT400
 		iErrorSize = c_int * 1
 		(iError)=(iErrorSize())
-		uiHandle = c_longlong(windll.CT400_lib.CT400_Init(byref(iError)))
+		uiHandle = c_longlong(CT400_lib.CT400_Init(byref(iError)))
 		print("{}{}".format("Error/Warning: ",iError[0]))
 		if uiHandle:
 			print("Initialisation complete\n")
 			print("Default laser power: {}mW".format(def_pow))
-			print("{}{}".format("Number of Inputs: ", windll.CT400_lib.CT400_GetNbInputs(uiHandle)))
-			print("{}{}".format("Number of Detectors: ", windll.CT400_lib.CT400_GetNbDetectors(uiHandle)))
-			# print("{}{}".format("CT400 Option: ", windll.CT400_lib.CT400_GetCT400Type(uiHandle)))
+			print("{}{}".format("Number of Inputs: ", CT400_lib.CT400_GetNbInputs(uiHandle)))
+			print("{}{}".format("Number of Detectors: ", CT400_lib.CT400_GetNbDetectors(uiHandle)))
+			# print("{}{}".format("CT400 Option: ", CT400_lib.CT400_GetCT400Type(uiHandle)))
 		else:
 			print("Initialising failed. Error/Warning: {}".format(iError[0]))
 
@@ -68,13 +959,20 @@ class Yenista_CT400:
 		self.tcError = tcError
 		self.strRet = strRet
 		self.def_pow = def_pow
+		# host-side references per laser input (see record_host_calib)
+		self.host_calib = c_uint64(CT400_ext.CT400_CalibrationCreate()) if CT400_ext is not None else None
 
 
 	def close_conn(self):
 		'''
 		closes the connection to the CT400 and releases all memory allocated by CT400_Init
 		'''
-		windll.CT400_lib.CT400_Close(self.uiHandle)
+		if CT400_ext is not None:
+			CT400_ext.CT400_ReleaseDevice(self.uiHandle)
+			if self.host_calib is not None:
+				CT400_ext.CT400_CalibrationDestroy(self.host_calib)
+				self.host_calib = None
+		CT400_lib.CT400_Close(self.uiHandle)
 
 
 	def __del__(self):
@@ -95,10 +993,14 @@ class Yenista_CT400:
 		'''
 		if self.uiHandle is None:
 			print("Error: the CT400 has not been initialised")
-		elif windll.CT400_lib.CT400_CheckConnected(self.uiHandle):
+		elif self._connected():
 			if power == None: power = self.def_pow
-			windll.CT400_lib.CT400_SetLaser(self.uiHandle, self.las_input, ENABLE, self.GPIB_addr, self.laser_model, c_double(self.las_min_wav), c_double(self.las_max_wav), 100)
-			windll.CT400_lib.CT400_CmdLaser(self.uiHandle, self.las_input, ENABLE, c_double(wav), c_double(power))
+			if CT400_ext is not None:
+				# not sent again while the laser configuration is unchanged
+				CT400_ext.CT400_SetLaserCached(self.uiHandle, self.las_input, ENABLE, self.GPIB_addr, self.laser_model, c_double(self.las_min_wav), c_double(self.las_max_wav), 100)
+			else:
+				CT400_lib.CT400_SetLaser(self.uiHandle, self.las_input, ENABLE, self.GPIB_addr, self.laser_model, c_double(self.las_min_wav), c_double(self.las_max_wav), 100)
+			CT400_lib.CT400_CmdLaser(self.uiHandle, self.las_input, ENABLE, c_double(wav), c_double(power))
 			print("Laser on and set to {}nm and {}mW".format(wav, power))
 		else:
 			strRet = 'Error: could not connect to the CT400'
@@ -111,8 +1013,8 @@ class Yenista_CT400:
 		'''
 		if self.uiHandle is None:
 			print("Error: the CT400 has not been initialised")
-		elif windll.CT400_lib.CT400_CheckConnected(self.uiHandle):
-			windll.CT400_lib.CT400_CmdLaser(self.uiHandle, self.las_input, DISABLE, c_double(1550.0), c_double(self.def_pow))
+		elif self._connected():
+			CT400_lib.CT400_CmdLaser(self.uiHandle, self.las_input, DISABLE, c_double(1550.0), c_double(self.def_pow))
 			print("Laser switched off")
 		else:
 			strRet = 'Error: could not connect to the CT400'
@@ -131,7 +1033,7 @@ class Yenista_CT400:
 		'''
 		PowerArraySize = c_double * 1
 		(Pout, P1, P2, P3, P4, Vext) = (PowerArraySize(), PowerArraySize(), PowerArraySize(), PowerArraySize(), PowerArraySize(), PowerArraySize())
-		windll.CT400_lib.CT400_ReadPowerDetectors(self.uiHandle, byref(Pout), byref(P1), byref(P2), byref(P3), byref(P4), byref(Vext))
+		CT400_lib.CT400_ReadPowerDetectors(self.uiHandle, byref(Pout), byref(P1), byref(P2), byref(P3), byref(P4), byref(Vext))
 		all_powers = [Pout[0], P1[0], P2[0], P3[0], P4[0], Vext[0]]
 		det_names = ['Pout', 'P1', 'P2', 'P3', 'P4', 'Vext']
 		[print("{}: {:.3f} dBm".format(det_names[i], all_powers[i])) for i in det_list]
@@ -154,55 +1056,112 @@ class Yenista_CT400:
 		'''
 		PowerArraySize = c_double * 1
 		(Pout, P1, P2, P3, P4, Vext) = (PowerArraySize(), PowerArraySize(), PowerArraySize(), PowerArraySize(), PowerArraySize(), PowerArraySize())
-		windll.CT400_lib.CT400_ReadPowerDetectors(self.uiHandle, byref(Pout), byref(P1), byref(P2), byref(P3), byref(P4), byref(Vext))
+		CT400_lib.CT400_ReadPowerDetectors(self.uiHandle, byref(Pout), byref(P1), byref(P2), byref(P3), byref(P4), byref(Vext))
 		all_powers = [Pout[0], P1[0], P2[0], P3[0], P4[0], Vext[0]]
 		powers = [all_powers[i] for i in det_list]
 		return powers
 
-	def plot_powers(self, det = None, array_Live = 50):
+	def plot_powers(self, det = None, array_Live = 50, rate = 500, fps = 10, decimation = 1):
 		'''
 		function that live plots the power (dBm) of one of the detectors specified
 		title includes the current power reading the the max power read so far
 
+		With the native extensions (libCT400_ext) the detectors are sampled in the background at a fixed
+		rate, independently of the redraws; otherwise they are read once per loop.
+
 		Parameters
 		----------
 		det : int
 			(DE_1, DE_2, DE_3, DE_4, DE_5) = (1,2,3,4,5)
 		array_Live : int
 			the size of the array of data points displayed in the live plot
+		rate : float
+			background sampling rate of the detectors in Hz (native extensions only)
+		fps : float
+			maximum number of redraws of the plot per second
+		decimation : int
+			display one sample out of decimation (native extensions only)
 		'''
 
 		if det is None:
 			print("No power meter specified")
 
 		else:
+			monitor = None
 			try:
 				get_ipython().magic('matplotlib notebook')
-				counter = 0
-				n_sample = []
-				powers = []
 				fig, ax = plt.subplots(figsize=(8,4))
 				ax.set_xlabel("Time flies")
 				ax.set_ylabel("Power (dBm)")
 				ax.grid()
 				ax.plot([],[])
+				fig.tight_layout()
+
+				if CT400_ext is not None:
+					monitor = CT400_ext.CT400_MonitorStart(self.uiHandle, c_double(rate), int(max(4 * array_Live * decimation, 2 * rate)))
+				if monitor:
+					ax.set_xlabel("Time (s)")
+					t_live = np.empty(array_Live)
+					p_live = np.empty([6, array_Live])
+					(dMin, dMax, dRate) = ((c_double * 6)(), (c_double * 6)(), c_double())
+				else:
+					# only the displayed samples are kept
+					counter = 0
+					n_sample = deque(maxlen=array_Live)
+					powers = deque(maxlen=array_Live)
+					max_power = float('-inf')
+				last_draw = 0.0
 
 				while True:
-					powers.append(self.return_det_pows([det])[0])
-					n_sample.append(counter)
-					ax.lines[0].set_data(n_sample[-min(array_Live,len(n_sample)):],powers[-min(array_Live,len(n_sample)):])
-					ax.set_title("Detector: {}\nCurrent power: {:.3f} dBm | Max power: {:.3f} dBm".format(det, powers[-1], max(powers)))
+					if monitor:
+						time.sleep(1.0 / fps)
+						n = CT400_ext.CT400_MonitorSnapshot(c_uint64(monitor), _c_doubles(t_live), _c_doubles(p_live), array_Live, decimation)
+						CT400_ext.CT400_MonitorStats(c_uint64(monitor), dMin, dMax, byref(dRate))
+						if n <= 0:
+							continue
+						ax.lines[0].set_data(t_live[:n], p_live[det, :n])
+						current_power, max_power = p_live[det, n - 1], dMax[det]
+					else:
+						powers.append(self.return_det_pows([det])[0])
+						n_sample.append(counter)
+						counter += 1
+						max_power = max(max_power, powers[-1])
+						if time.perf_counter() - last_draw < 1.0 / fps:
+							continue
+						ax.lines[0].set_data(n_sample, powers)
+						current_power = powers[-1]
+					last_draw = time.perf_counter()
+					ax.set_title("Detector: {}\nCurrent power: {:.3f} dBm | Max power: {:.3f} dBm".format(det, current_power, max_power))
 					ax.relim()
 					ax.autoscale_view()
-					fig.tight_layout()
 					fig.canvas.draw()
-					counter += 1
 
 			except KeyboardInterrupt:
 				get_ipython().magic('matplotlib inline')
 				print("Plotting stopped")
 
+			finally:
+				if monitor:
+					CT400_ext.CT400_MonitorStop(c_uint64(monitor))
+
+
 
+	def _connected(self):
+		# with the native extensions, a successful call in the last second counts as connected
+		if CT400_ext is not None:
+			return CT400_ext.CT400_CheckConnectedCached(self.uiHandle, c_double(1.0))
+		return CT400_lib.CT400_CheckConnected(self.uiHandle)
+
+	def _scan_config_struct(self, min_wav, max_wav, las_pow, res, det_list, speed):
+		# the parameters of scan_config as an rScanConfig (native extensions)
+		config = rScanConfig()
+		CT400_ext.CT400_DefaultScanConfig(byref(config))
+		(config.dLaserMinWavelength, config.dLaserMaxWavelength) = (self.las_min_wav, self.las_max_wav)
+		(config.dPower, config.dMinWavelength, config.dMaxWavelength) = (las_pow, min_wav, max_wav)
+		(config.eInput, config.iGPIBAdress, config.eLaserType) = (self.las_input, self.GPIB_addr, self.laser_model)
+		(config.iSpeed, config.uiResolution) = (speed, res)
+		(config.eDect2, config.eDect3, config.eDect4, config.eExt) = det_list
+		return config
 
 	def scan_config(self, min_wav = 1500.0, max_wav = 1630.0, las_pow = None, 
 		res = 1, det_list = [DISABLE, DISABLE, DISABLE, DISABLE], speed = 100):
@@ -235,17 +1194,27 @@ class Yenista_CT400:
 			print("Error: the CT400 has not been initialised")
 
 		# checking the CT400 is connected to the computer
-		elif windll.CT400_lib.CT400_CheckConnected(self.uiHandle):
+		elif self._connected():
 			print("Configuring laser for scan")
-			# configure laser input
+			start_time = time.perf_counter()
 			if las_pow == None: las_pow = float(self.def_pow)
-			windll.CT400_lib.CT400_SetLaser(self.uiHandle, self.las_input, ENABLE, self.GPIB_addr, 
-				self.laser_model, c_double(self.las_min_wav), c_double(self.las_max_wav), speed)
-			# configure laser sweep
-			windll.CT400_lib.CT400_SetScan(self.uiHandle, c_double(las_pow), c_double(min_wav), c_double(max_wav))
-			windll.CT400_lib.CT400_SetSamplingResolution(self.uiHandle, res)
-			windll.CT400_lib.CT400_SetDetectorArray(self.uiHandle, det_list[0], det_list[1], det_list[2], det_list[3])
-			windll.CT400_lib.CT400_SetBNC(self.uiHandle, DISABLE, c_double(0.0), c_double(0.0), Unit_mW)
+			if CT400_ext is not None:
+				# only the settings that changed since the last configuration are sent
+				config = self._scan_config_struct(min_wav, max_wav, las_pow, res, det_list, speed)
+				# kept for archive_scan
+				self.config = config
+				if CT400_ext.CT400_ApplyScanConfigCached(self.uiHandle, byref(config)) < 0:
+					print("Error: scan configuration failed")
+			else:
+				# configure laser input
+				CT400_lib.CT400_SetLaser(self.uiHandle, self.las_input, ENABLE, self.GPIB_addr, 
+					self.laser_model, c_double(self.las_min_wav), c_double(self.las_max_wav), speed)
+				# configure laser sweep
+				CT400_lib.CT400_SetScan(self.uiHandle, c_double(las_pow), c_double(min_wav), c_double(max_wav))
+				CT400_lib.CT400_SetSamplingResolution(self.uiHandle, res)
+				CT400_lib.CT400_SetDetectorArray(self.uiHandle, det_list[0], det_list[1], det_list[2], det_list[3])
+				CT400_lib.CT400_SetBNC(self.uiHandle, DISABLE, c_double(0.0), c_double(0.0), Unit_mW)
+			_span(self.uiHandle, 'configure', start_time)
 			print("Scan configuration complete")
 			print("Configuration settings:")
 			print("Wavelength range: {}-{}nm, Power: {}mW, Resolution: {}pm, Speed: {}nm/s, Detectors enabled: D1:1 D2:{} D3:{} D4:{} BNC:{}"
@@ -255,7 +1224,8 @@ class Yenista_CT400:
 			return strRet
 
 
-	def perform_scan(self, dets_used = [DE_1], set_laser = False, heterodyne = False):
+	def perform_scan(self, dets_used = [DE_1], set_laser = False, heterodyne = False, out = None, grid = None, method = IM_LINEAR,
+		calibrate = False, unit = Unit_dBm, tracker = None):
 		'''
 		Performs a wavelength scan with the preconfigured range, speed, laser power and resolution
 
@@ -268,7 +1238,24 @@ class Yenista_CT400:
 			if true, set the laser to 1550nm and def_pow
 		heterodyne : bool
 			bool deciding whether to perform heterodyne detection (HD) measurements of spectral lines
-			if true, will print spectral lines detected with HD
+			if true, will print spectral lines detected with HD, or pass them to tracker
+		out : tuple(np.array[float], np.array[float])
+			optional preallocated (wavs, det_pows) arrays to fill in place when repeating sweeps
+			wavs must hold at least the number of resampled points and det_pows be (len(dets_used), len(wavs)),
+			both writeable C-contiguous float64; the returned arrays are then views of them (ValueError otherwise or if too small)
+		grid : np.array[float]
+			optional wavelength grid: the raw (sync) arrays are resampled onto it instead of
+			returning the fixed resolution arrays of the DLL (see resample); out is then ignored
+		method : int
+			interpolation used with grid, IM_LINEAR or IM_CUBIC
+		calibrate : bool
+			if true, return transmission instead of power: each detector minus Pout and minus the
+			reference recorded by record_host_calib for the current laser input
+			(RuntimeError without the native extensions)
+		unit : int
+			with calibrate, Unit_dBm for dB or Unit_mW for a linear ratio
+		tracker : LineTracker
+			with heterodyne, takes in the lines of the sweep instead of printing them
 
 		Returns
 		-------
@@ -278,56 +1265,115 @@ class Yenista_CT400:
 			array with lists of resampled powers for each of the detectors used
 		'''
 
+		if calibrate and self.host_calib is None:
+			raise RuntimeError('host calibration needs the native extensions')
 		print("Beginning scan...")
-		start_time = time.clock()
-		windll.CT400_lib.CT400_ScanStart(self.uiHandle)
-		self.iErrorID = windll.CT400_lib.CT400_ScanWaitEnd(self.uiHandle, self.tcError)
+		start_time = time.perf_counter()
+		CT400_lib.CT400_ScanStart(self.uiHandle)
+		self.iErrorID = CT400_lib.CT400_ScanWaitEnd(self.uiHandle, self.tcError)
+		_span(self.uiHandle, 'sweep', start_time)
 		if self.iErrorID == 0:
+			fetch_time = time.perf_counter()
 
 			# prepare arrays for storing measurement data
 			DataPointSize = c_int * 1
 			(iDataPoints, iDiscardPoints) =(DataPointSize(), DataPointSize())
-			windll.CT400_lib.CT400_GetNbDataPoints(self.uiHandle,byref(iDataPoints),byref(iDiscardPoints))
+			if CT400_lib.CT400_GetNbDataPoints(self.uiHandle,byref(iDataPoints),byref(iDiscardPoints)) < 0:
+				raise RuntimeError('could not get the number of points of the sweep')
 			iPointsNumber = iDataPoints[0]
-			iPointsNumberResampled = windll.CT400_lib.CT400_GetNbDataPointsResampled(self.uiHandle)
-			det_pows = np.empty([len(dets_used), iPointsNumberResampled])
-			# DataArraySize = c_double * iPointsNumber
-			DataArraySizeResampled = c_double * iPointsNumberResampled
-
-			for i, det in enumerate(dets_used):
-
-				# (dWavelengthSync, dDetector1Sync) = (DataArraySize(), DataArraySize())
-				(dWavelengthResampled, dDetectorResampled) = (DataArraySizeResampled(), DataArraySizeResampled())
-
-				# call functions for scanning
-				# windll.CT400_lib.CT400_ScanGetWavelengthSyncArray(uiHandle, byref(dWavelengthSync), iPointsNumber)
-				windll.CT400_lib.CT400_ScanGetWavelengthResampledArray(self.uiHandle, byref(dWavelengthResampled), iPointsNumberResampled)
+			iPointsNumberResampled = CT400_lib.CT400_GetNbDataPointsResampled(self.uiHandle)
+			if grid is not None:
+				# raw arrays without the discarded points, resampled onto the caller's grid
+				iValid = iPointsNumber - iDiscardPoints[0]
+				(sync_wavs, sync_pows) = (np.empty(iValid), np.empty([len(dets_used), iValid]))
+				if CT400_ext is not None:
+					dets = (c_int * len(dets_used))(*dets_used)
+					if CT400_ext.CT400_ScanGetSyncBlock(self.uiHandle, dets, len(dets_used),
+						_c_doubles(sync_wavs), None, _c_doubles(sync_pows), iValid) < 0:
+						raise RuntimeError('could not retrieve the sweep')
+				else:
+					buf = np.empty(iPointsNumber)
+					if CT400_lib.CT400_ScanGetWavelengthSyncArray(self.uiHandle, _c_doubles(buf), iPointsNumber) < 0:
+						raise RuntimeError('could not retrieve the wavelength array')
+					sync_wavs[:] = buf[iDiscardPoints[0]:]
+					for i, det in enumerate(dets_used):
+						if CT400_lib.CT400_ScanGetDetectorArray(self.uiHandle, det, _c_doubles(buf), iPointsNumber) < 0:
+							raise RuntimeError('could not retrieve detector {}'.format(det))
+						sync_pows[i] = buf[iDiscardPoints[0]:]
+				wavs = np.array(grid, dtype=np.float64)
+				det_pows = resample(sync_wavs, sync_pows, wavs, method)
+				if calibrate:
+					buf = np.empty(iPointsNumber)
+					if CT400_lib.CT400_ScanGetPowerSyncArray(self.uiHandle, _c_doubles(buf), iPointsNumber) < 0:
+						raise RuntimeError('could not retrieve the Pout array')
+					pout = resample(sync_wavs, buf[iDiscardPoints[0]:], wavs, method)[0]
+			else:
+				if iPointsNumberResampled < 0:
+					raise RuntimeError('could not get the number of resampled points')
+				if out is None:
+					out = (np.empty(iPointsNumberResampled), np.empty([len(dets_used), iPointsNumberResampled]))
+				elif any(not isinstance(a, np.ndarray) or a.dtype != np.float64 or not a.flags['C_CONTIGUOUS']
+					or not a.flags['WRITEABLE'] for a in out):
+					# the C side writes through raw pointers with shape[1] as the row stride
+					raise ValueError('out must be writeable C-contiguous float64 arrays')
+				elif (out[0].ndim != 1 or len(out[0]) < iPointsNumberResampled or out[1].ndim != 2
+					or out[1].shape[0] < len(dets_used) or out[1].shape[1] < iPointsNumberResampled):
+					raise ValueError('out holds fewer than the {} resampled points of {} detectors'.format(
+						iPointsNumberResampled, len(dets_used)))
+				wavs = out[0][:iPointsNumberResampled]
+				det_pows = out[1][:len(dets_used), :iPointsNumberResampled]
 
-				# windll.CT400_lib.CT400_ScanGetDetectorArray(uiHandle, det, byref(dDetector1Sync), iPointsNumber)
-				windll.CT400_lib.CT400_ScanGetDetectorResampledArray(self.uiHandle, det, byref(dDetectorResampled), iPointsNumberResampled)
+				# the DLL writes straight into the numpy arrays: the wavelength axis once,
+				# then one row per detector
+				if CT400_ext is not None:
+					dets = (c_int * len(dets_used))(*dets_used)
+					if CT400_ext.CT400_ScanGetResampledBlock(self.uiHandle, dets, len(dets_used),
+						_c_doubles(out[0]), _c_doubles(out[1]), out[1].shape[1]) < 0:
+						raise RuntimeError('could not retrieve the sweep')
+				else:
+					if CT400_lib.CT400_ScanGetWavelengthResampledArray(self.uiHandle, _c_doubles(wavs), iPointsNumberResampled) < 0:
+						raise RuntimeError('could not retrieve the wavelength array')
+					for i, det in enumerate(dets_used):
+						if CT400_lib.CT400_ScanGetDetectorResampledArray(self.uiHandle, det, _c_doubles(det_pows[i]), iPointsNumberResampled) < 0:
+							raise RuntimeError('could not retrieve detector {}'.format(det))
+				if calibrate:
+					pout = np.empty(iPointsNumberResampled)
+					if CT400_lib.CT400_ScanGetPowerResampledArray(self.uiHandle, _c_doubles(pout), iPointsNumberResampled) < 0:
+						raise RuntimeError('could not retrieve the Pout array')
+			_span(self.uiHandle, 'fetch', fetch_time)
 
-				det_pows[i, :] = dDetectorResampled
-
-			wavs = np.array(dWavelengthResampled)
+			if calibrate:
+				analyse_time = time.perf_counter()
+				# Pout normalisation, reference subtraction and unit conversion in one native pass per row
+				for i, det in enumerate(dets_used):
+					row = det_pows[i]
+					if CT400_ext.CT400_CalibrationApply(self.host_calib, self.las_input, _c_doubles(wavs), _c_doubles(pout),
+						byref(c_int(det)), 1, _c_doubles(row), len(row), unit) < 0:
+						raise RuntimeError('could not calibrate detector {}'.format(det))
+				_span(self.uiHandle, 'analyse', analyse_time)
 
 			# display the number of points for standard and resampled measurements
-			print("Scan executed in {:.2f}s".format(time.clock()-start_time))
+			print("Scan executed in {:.2f}s".format(time.perf_counter()-start_time))
 			print("Total number of points, discarded points, resampled points: {}, {}, {}\n".format(iPointsNumber,iDiscardPoints[0],iPointsNumberResampled))
 
 			if heterodyne:
 				# returns the number of spectral lines detected with heterodyne detection (HD)
-				iLinesDetected = windll.CT400_lib.CT400_GetNbLinesDetected(uiHandle)
+				iLinesDetected = max(CT400_lib.CT400_GetNbLinesDetected(self.uiHandle), 0)
 				LinesArraySize = c_double * iLinesDetected
 				dLinesValues = LinesArraySize()
 				# returns the values of spectral lines detected by HD
-				windll.CT400_lib.CT400_ScanGetLinesDetectionArray(uiHandle, byref(dLinesValues) ,iLinesDetected)
-				# print lines detected by HD
-				for i in range (iLinesDetected):
-						print ("Spectral line #{i+1}:{:.4f}".format(dLinesValues[i]))
+				if iLinesDetected > 0:
+					CT400_lib.CT400_ScanGetLinesDetectionArray(self.uiHandle, dLinesValues, iLinesDetected)
+				if tracker is not None:
+					tracker.update(np.array(dLinesValues[:]))
+				else:
+					# print lines detected by HD
+					for i in range(iLinesDetected):
+						print("Spectral line #{}: {:.4f}".format(i+1, dLinesValues[i]))
 
 			if set_laser == True:
 				# turn laser on and set to 1550nm once sweep complete
-				windll.CT400_lib.CT400_CmdLaser(self.uiHandle, self.las_input, ENABLE, c_double(1550.0), c_double(self.def_pow))
+				CT400_lib.CT400_CmdLaser(self.uiHandle, self.las_input, ENABLE, c_double(1550.0), c_double(self.def_pow))
 				print("Laser set to 1550nm and {}mW\n".format(self.def_pow))
 
 			return wavs, det_pows
@@ -336,6 +1382,327 @@ class Yenista_CT400:
 			print('Error: ' + repr(self.tcError.value))
 
 	
+	def repeat_scan(self, repeats, dets_used = [DE_1], stats = None, **kwargs):
+		'''
+		Performs the preconfigured scan repeats times and accumulates it into per-point statistics
+		in fixed memory, instead of keeping every sweep
+
+		Parameters
+		----------
+		repeats : int
+			number of sweeps
+		dets_used : list
+			as for perform_scan
+		stats : SweepStats
+			statistics to add to (e.g. from an earlier call), default a new SweepStats with sigma clipping
+		kwargs :
+			other perform_scan parameters (calibrate, unit...)
+
+		Returns
+		-------
+		stats : SweepStats
+			get(SS_MEAN), get(SS_STD), get(SS_ROBUST)... give (wavs, rows) per statistic
+		'''
+		if stats is None:
+			stats = SweepStats(len(dets_used))
+		out = None
+		for i in range(repeats):
+			result = self.perform_scan(dets_used, out = out, **kwargs)
+			if result is None:
+				continue
+			stats.add(*result)
+			if out is None and kwargs.get('grid') is None:
+				# the following sweeps are written in place
+				out = (np.empty(len(result[0])), np.empty([len(dets_used), len(result[0])]))
+		return stats
+
+	def map_scan(self, path, values, set_value = None, det = DE_1, **kwargs):
+		'''
+		Performs the preconfigured scan once per value of an external parameter (temperature,
+		voltage...) and appends each sweep as a row of a SweepMap file, instead of concatenating
+		arrays in memory
+
+		Parameters
+		----------
+		path : str
+			map file (replaced)
+		values : list[float]
+			parameter values, one sweep each
+		set_value : function
+			called with each value before its sweep (e.g. to set a temperature controller), or
+			None to record the voltage on the BNC Vext input (see CT400_SetBNC) as the parameter
+		det : int
+			detector of the map rows
+		kwargs :
+			other perform_scan parameters (calibrate, unit, grid...)
+
+		Returns
+		-------
+		map : SweepMap
+			view() gives min/max images at any zoom, axes() the wavelengths and parameters
+		'''
+		sweep_map = None
+		for value in values:
+			if set_value is not None:
+				set_value(value)
+			else:
+				value = self.return_det_pows([5])[0]
+			result = self.perform_scan([det], **kwargs)
+			if result is None:
+				continue
+			(wavs, det_pows) = result
+			if sweep_map is None:
+				sweep_map = SweepMap(path, wavs)
+			sweep_map.append(value, det_pows[0])
+		return sweep_map
+
+	def archive_scan(self, archive, dets_used = [DE_1], label = '', **kwargs):
+		'''
+		Performs the preconfigured scan and stores it in a SpectralArchive with its configuration
+		and the resonances found in it
+
+		Parameters
+		----------
+		archive : SpectralArchive
+		dets_used : list
+			detectors of the sweep
+		label : str
+			device or other label stored with the sweep
+		kwargs :
+			other perform_scan parameters (calibrate, grid...)
+
+		Returns
+		-------
+		int
+			number of the sweep in the archive, None if the scan failed
+		'''
+		result = self.perform_scan(dets_used, **kwargs)
+		if result is None:
+			return None
+		(wavs, det_pows) = result
+		config = getattr(self, 'config', None)
+		if config is None:
+			config = rScanConfig()
+			CT400_ext.CT400_DefaultScanConfig(byref(config))
+		return archive.ingest(config, wavs, det_pows, dets_used, label)
+
+	def adaptive_scan(self, min_wav = 1500.0, max_wav = 1630.0, las_pow = None, det_list = [DISABLE, DISABLE, DISABLE, DISABLE],
+		coarse = (100, 250), fine = (10, 1), kinds = RK_DIP, min_depth = 3.0, margin = 0.05):
+		'''
+		Surveys the range with a fast coarse sweep, then sweeps again at the fine speed and resolution
+		only around the resonances found in the survey (native extensions only). The configuration
+		of scan_config with these parameters is left applied.
+
+		Parameters
+		----------
+		min_wav, max_wav, las_pow, det_list :
+			as for scan_config
+		coarse : tuple(int, int)
+			(speed in nm/s, resolution in pm) of the survey
+		fine : tuple(int, int)
+			(speed in nm/s, resolution in pm) of the sweeps around the resonances
+		kinds : int
+			resonances looked for in the survey, RK_DIP, RK_PEAK or RK_BOTH
+		min_depth : float
+			dB, see find_resonances
+		margin : float
+			nm swept either side of each resonance, on top of 5 FWHM
+
+		Returns
+		-------
+		wavs : np.array[float]
+			non-uniform wavelength axis: survey points outside the regions, fine points inside
+		det_pows : np.array[list[float]]
+			one row per enabled detector (DE_1 first)
+		segments : list[rAdaptiveSegment]
+			provenance of each range of wavs: survey (iSweep 0) or fine sweep number, speed and resolution
+		report : rAdaptiveReport
+			points and time taken compared with one fine sweep of the whole range (dTimeSaved)
+		'''
+		if CT400_ext is None:
+			raise RuntimeError('adaptive scans need the native extensions')
+		config = self._scan_config_struct(min_wav, max_wav, float(self.def_pow) if las_pow is None else las_pow,
+			coarse[1], det_list, coarse[0])
+		settings = rAdaptiveSettings()
+		CT400_ext.CT400_DefaultAdaptiveSettings(byref(settings))
+		(settings.iCoarseSpeed, settings.uiCoarseResolution) = coarse
+		(settings.iFineSpeed, settings.uiFineResolution) = fine
+		(settings.resonance.iKinds, settings.resonance.dMinDepth, settings.dMargin) = (kinds, min_depth, margin)
+
+		# the merged spectrum has fewer points than a fine and a survey sweep of the whole range
+		segments = (rAdaptiveSegment * 1024)()
+		size = int((max_wav - min_wav) * 1000 / fine[1]) + int((max_wav - min_wav) * 1000 / coarse[1]) + len(segments)
+		nb_rows = 1 + sum(1 for det in det_list if det == ENABLE)
+		(wavs, det_pows) = (np.empty(size), np.empty([nb_rows, size]))
+		report = rAdaptiveReport()
+		n = CT400_ext.CT400_AdaptiveScan(self.uiHandle, byref(config), byref(settings), _c_doubles(wavs),
+			_c_doubles(det_pows), size, segments, len(segments), byref(report))
+		# the instrument is left with config, also after a failure (see archive_scan)
+		self.config = config
+		if n < 0:
+			print("Error: adaptive scan failed")
+			return None
+		print("Adaptive scan: {} regions, {} points instead of {}, {:.1f}s saved".format(
+			report.iRegions, report.iPoints, report.iFullPoints, report.dTimeSaved))
+		return wavs[:n], det_pows[:, :n], list(segments[:min(report.iSegments, len(segments))]), report
+
+	def step_scan(self, wavs, power = None, averages = 4, window = 32, tolerance = 0.01, channels = SC_POUT | SC_P1):
+		'''
+		Moves the laser to each wavelength in turn and reads all the detectors there as soon as the
+		readings have stopped drifting, instead of waiting a fixed delay (native extensions only).
+		The laser must be on (las_on) and is left at the last wavelength.
+
+		Parameters
+		----------
+		wavs : np.array[float]
+			wavelengths to measure, nm
+		power : float
+			laser power in mW, default power if not stated
+		averages : int
+			readings averaged at each point once settled
+		window : int
+			readings of the settle test, spanning about the settling time of the laser
+		tolerance : float
+			drift in dB (V for Vext) allowed over the window
+		channels : int
+			SC_* mask of the channels that must settle
+
+		Returns
+		-------
+		det_pows : np.array[list[float]]
+			six rows: Pout, P1, P2, P3, P4 (dBm) and Vext, one column per wavelength measured
+		readings : np.array[int]
+			readings taken before each point settled, -1 where it did not
+		'''
+		if CT400_ext is None:
+			raise RuntimeError('step scans need the native extensions')
+		wavs = np.ascontiguousarray(wavs, dtype=np.float64)
+		settings = rStepSettings()
+		CT400_ext.CT400_DefaultStepSettings(byref(settings))
+		settings.eInput = self.las_input
+		settings.dPower = float(self.def_pow if power is None else power)
+		(settings.iAverages, settings.iWindow, settings.dTolerance, settings.uiSettleChannels) = (averages, window, tolerance, channels)
+		det_pows = np.empty([6, len(wavs)])
+		readings = np.empty(len(wavs), dtype=np.int32)
+		n = CT400_ext.CT400_StepScan(self.uiHandle, byref(settings), _c_doubles(wavs), len(wavs),
+			_c_doubles(det_pows), readings.ctypes.data_as(POINTER(c_int32)))
+		if n < len(wavs):
+			print("Error: step scan stopped after {} of {} points".format(max(n, 0), len(wavs)))
+		n = max(n, 0)
+		return det_pows[:, :n], readings[:n]
+
+	def multi_input_scan(self, jobs, calibrate = False):
+		'''
+		Runs sweeps on several laser inputs (e.g. O, C and L band sources) in the order that switches
+		each input once and resends the fewest settings; sweeps asking for the same range with other
+		detectors share one sweep (native extensions only). The input of las_input is selected again
+		once done.
+
+		Parameters
+		----------
+		jobs : list[dict]
+			one dict per sweep with the keys
+			input : LI_1 to LI_4 (required)
+			min_wav, max_wav : scan range in nm (required)
+			las_range : (min, max) wavelength range of the laser on that input, default (las_min_wav, las_max_wav)
+			gpib, laser : GPIB address and LS_* model of the laser on that input, default GPIB_addr and laser_model
+			las_pow, res, speed, det_list : as for scan_config (default power, 1 pm, 100 nm/s, DE_1 only)
+		calibrate : bool
+			apply the host references recorded for each input (record_host_calib)
+
+		Returns
+		-------
+		results : list
+			(wavs, det_pows) per job in the order given, None where the sweep failed
+		report : rSchedulerReport
+			sweeps, input switches and settings calls made against submission order, and the share
+			of the run spent sweeping (dUtilisation)
+		'''
+		if CT400_ext is None:
+			raise RuntimeError('multi-input scans need the native extensions')
+		if calibrate and self.host_calib is None:
+			raise RuntimeError('host calibration needs the native extensions')
+		scheduler = c_uint64(CT400_ext.CT400_SchedulerCreate(self.uiHandle))
+		if scheduler.value == 0:
+			raise RuntimeError('could not create the input scheduler')
+		try:
+			if calibrate and CT400_ext.CT400_SchedulerSetCalibration(scheduler, self.host_calib, Unit_dBm) != 0:
+				raise RuntimeError('could not set the host calibration')
+			rows = []
+			for job in jobs:
+				det_list = job.get('det_list', [DISABLE, DISABLE, DISABLE, DISABLE])
+				config = self._scan_config_struct(job['min_wav'], job['max_wav'],
+					float(job.get('las_pow', self.def_pow)), job.get('res', 1), det_list, job.get('speed', 100))
+				(config.dLaserMinWavelength, config.dLaserMaxWavelength) = job.get('las_range', (self.las_min_wav, self.las_max_wav))
+				config.eInput = job['input']
+				(config.iGPIBAdress, config.eLaserType) = (job.get('gpib', self.GPIB_addr), job.get('laser', self.laser_model))
+				if CT400_ext.CT400_SchedulerSubmit(scheduler, byref(config)) < 0:
+					raise ValueError('invalid job {}'.format(job))
+				rows.append(1 + sum(1 for det in det_list if det == ENABLE))
+			report = rSchedulerReport()
+			CT400_ext.CT400_SchedulerRun(scheduler, byref(report))
+			results = []
+			for (i, nb_rows) in enumerate(rows):
+				# the number of points first, then the arrays sized for it
+				n = CT400_ext.CT400_SchedulerGetResult(scheduler, i, None, None, 0, self.tcError)
+				if n >= 0:
+					(wavs, det_pows) = (np.empty(n), np.empty([nb_rows, n]))
+					n = CT400_ext.CT400_SchedulerGetResult(scheduler, i, _c_doubles(wavs), _c_doubles(det_pows), n, self.tcError)
+				if n < 0:
+					print("Error: job {} failed: {}".format(i, self.tcError.value.decode(errors='replace')))
+				results.append((wavs, det_pows) if n >= 0 else None)
+		finally:
+			CT400_ext.CT400_SchedulerDestroy(scheduler)
+			CT400_ext.CT400_SwitchInputCached(self.uiHandle, self.las_input)
+		print("Multi-input scan: {} jobs in {} sweeps, {} input switches instead of {}, {:.0f}% of the time sweeping".format(
+			report.iJobs, report.iSweeps, report.iSwitches, report.iNaiveSwitches, 100 * report.dUtilisation))
+		return results, report
+
+	def export_metrics(self, path = None):
+		'''
+		Call latencies, error counts and phase durations in the Prometheus text format,
+		when CT400_LIB names the metrics shim (libCT400_metrics.so, see README.md)
+
+		Parameters
+		----------
+		path : str
+			file to write (replaced atomically), or None to return the text
+
+		Returns
+		-------
+		str
+			the metrics text if path is None
+		'''
+		if _metrics_span is None:
+			raise RuntimeError('metrics need CT400_LIB to name the metrics shim')
+		if path is not None:
+			if CT400_lib.CT400_MetricsExport(path.encode()) != 0:
+				print("Error: could not write " + path)
+			return None
+		size = CT400_lib.CT400_MetricsText(None, 0)
+		text = create_string_buffer(size + 1)
+		CT400_lib.CT400_MetricsText(text, size + 1)
+		return text.value.decode()
+
+	def trace_stats(self):
+		'''
+		Counters of the call trace being recorded or replayed, when CT400_LIB names the trace shim
+		(libCT400_trace.so, see README.md)
+
+		Returns
+		-------
+		dict
+			mode (TM_OFF, TM_RECORD or TM_REPLAY), calls recorded or replayed, replayed calls whose
+			inputs differed from the recorded ones (mismatches) or that had no recorded call (missing),
+			records and bytes of the trace
+		'''
+		if getattr(CT400_lib, 'CT400_TraceGetStats', None) is None:
+			raise RuntimeError('trace statistics need CT400_LIB to name the trace shim')
+		stats = rTraceStats()
+		CT400_lib.CT400_TraceGetStats(byref(stats))
+		return {'mode': stats.eMode, 'calls': stats.uiCalls, 'mismatches': stats.uiMismatches,
+			'missing': stats.uiMissing, 'records': stats.uiRecords, 'bytes': stats.uiBytes}
+
 	def update_det_calib(self, det = None):
 		'''
 		Calibrates one of the detectors - effectively sets where 0dBm is to account for input losses,
@@ -355,9 +1722,51 @@ class Yenista_CT400:
 		if det == None:
 			print('No detector specified')
 		else:
-			windll.CT400_lib.CT400_UpdateCalibration(self.uiHandle, det)
+			CT400_lib.CT400_UpdateCalibration(self.uiHandle, det)
 			print("Calibration for detector {} updated".format(det))
 
+	def record_host_calib(self, dets_used = [DE_1]):
+		'''
+		Host-side alternative to update_det_calib: performs a scan and keeps it as the reference of
+		the detectors for the current laser input, used by perform_scan(calibrate = True).
+		References of the other inputs are kept, so switching inputs needs no new calibration sweep.
+
+		Setup: the optical output of the CT400 should be connected directly to the detectors.
+
+		Parameters
+		----------
+		dets_used : list
+			detectors to calibrate
+		'''
+		if self.host_calib is None:
+			raise RuntimeError('host calibration needs the native extensions')
+		result = self.perform_scan(dets_used)
+		if result is None:
+			raise RuntimeError('the calibration sweep failed')
+		(wavs, det_pows) = result
+		pout = np.empty(len(wavs))
+		if CT400_lib.CT400_ScanGetPowerResampledArray(self.uiHandle, _c_doubles(pout), len(wavs)) < 0:
+			raise RuntimeError('could not retrieve the Pout array')
+		dets = (c_int * len(dets_used))(*dets_used)
+		if CT400_ext.CT400_CalibrationRecord(self.host_calib, self.las_input, _c_doubles(wavs), _c_doubles(pout),
+			dets, len(dets_used), _c_doubles(det_pows), len(wavs)) != 0:
+			raise RuntimeError('could not record the host calibration')
+		print("Host calibration recorded for input {} and detectors {}".format(self.las_input, dets_used))
+
+	def save_host_calib(self, path):
+		'''
+		Saves the references of record_host_calib (all inputs) to a binary sweep file
+		'''
+		if self.host_calib is not None:
+			CT400_ext.CT400_CalibrationSave(self.host_calib, path.encode())
+
+	def load_host_calib(self, path):
+		'''
+		Loads references saved by save_host_calib, replacing the current ones
+		'''
+		if self.host_calib is not None and CT400_ext.CT400_CalibrationLoad(self.host_calib, path.encode()) != 0:
+			print("Error: could not load host calibration from {}".format(path))
+
 	def reset_dets_calib(self):
 		'''
 		Reset all of the detector calibrations.
@@ -366,5 +1775,5 @@ class Yenista_CT400:
 		if self.uiHandle is None:
 			print("Error: the CT400 has not been initialised")
 		else:
-			windll.CT400_lib.CT400_ResetCalibration(self.uiHandle)
+			CT400_lib.CT400_ResetCalibration(self.uiHandle)
 			print("Calibration for detector {} reset".format(det))
\ No newline at end of file
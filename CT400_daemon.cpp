@@ -0,0 +1,657 @@
+//------------------------------------------------------------------------------
+// CT400_daemon.cpp
+//
+// Instrument daemon and its client. Sweep data never goes through the
+// socket: the daemon fetches each sweep into the shared ring and the socket
+// only carries fixed-size commands, replies and 16-byte sweep events, so a
+// new reader costs the daemon one non-blocking send per sweep.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_daemon.h"
+#include "CT400_device.h"
+#include "CT400_retrieve.h"
+#include "CT400_span.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+
+#if !defined (_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds(Clock::time_point tFrom, Clock::time_point tTo)
+{
+	return std::chrono::duration<double>(tTo - tFrom).count();
+}
+
+#if !defined (_WIN32)
+
+#if defined (MSG_NOSIGNAL)
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+bool sendAll(int iFd, const void *p, size_t uiSize)
+{
+	const char *pc = static_cast<const char *>(p);
+	while (uiSize > 0) {
+		ssize_t n = send(iFd, pc, uiSize, SEND_FLAGS);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		pc += n;
+		uiSize -= (size_t)n;
+	}
+	return true;
+}
+
+bool receiveAll(int iFd, void *p, size_t uiSize)
+{
+	char *pc = static_cast<char *>(p);
+	while (uiSize > 0) {
+		ssize_t n = recv(iFd, pc, uiSize, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		pc += n;
+		uiSize -= (size_t)n;
+	}
+	return true;
+}
+
+bool socketAddress(const std::string &strPath, sockaddr_un &address)
+{
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strPath.empty() || strPath.size() >= sizeof(address.sun_path))
+		return false;
+	std::memcpy(address.sun_path, strPath.c_str(), strPath.size());
+	return true;
+}
+
+int connectTo(const std::string &strPath)
+{
+	sockaddr_un address;
+	if (!socketAddress(strPath, address))
+		return -1;
+	int iFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (iFd < 0)
+		return -1;
+	fcntl(iFd, F_SETFD, FD_CLOEXEC);
+	if (connect(iFd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+		close(iFd);
+		return -1;
+	}
+	return iFd;
+}
+
+#endif
+
+std::mutex g_mtx;
+std::map<uint64_t, std::shared_ptr<ct400::Daemon> > g_daemons;
+std::map<uint64_t, std::shared_ptr<ct400::DaemonClient> > g_clients;
+uint64_t g_uiNextDaemon = 1;
+uint64_t g_uiNextClient = 1;
+
+template <class T>
+std::shared_ptr<T> find(std::map<uint64_t, std::shared_ptr<T> > &items, uint64_t uiId)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	auto it = items.find(uiId);
+	return it == items.end() ? nullptr : it->second;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC uint64_t __stdcall CT400_DaemonStart(uint64_t uiHandle,
+const char *pcSocket, const char *pcRing, int32_t iSlots, int32_t iMaxPoints)
+{
+	if (uiHandle == 0 || pcSocket == nullptr || pcRing == nullptr || iSlots < 2 || iMaxPoints <= 0)
+		return 0;
+	auto daemon = std::make_shared<ct400::Daemon>(uiHandle);
+	if (daemon->start(pcSocket, pcRing, (size_t)iSlots, (size_t)iMaxPoints) != 0)
+		return 0;
+	std::lock_guard<std::mutex> lock(g_mtx);
+	uint64_t uiDaemon = g_uiNextDaemon++;
+	g_daemons[uiDaemon] = daemon;
+	return uiDaemon;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_DaemonWait(uint64_t uiDaemon)
+{
+	auto daemon = find(g_daemons, uiDaemon);
+	if (daemon == nullptr)
+		return -1;
+	daemon->wait();
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_DaemonStop(uint64_t uiDaemon)
+{
+	std::shared_ptr<ct400::Daemon> daemon;
+	{
+		std::lock_guard<std::mutex> lock(g_mtx);
+		auto it = g_daemons.find(uiDaemon);
+		if (it == g_daemons.end())
+			return -1;
+		daemon = it->second;
+		g_daemons.erase(it);
+	}
+	daemon->stop();
+	return 0;
+}
+
+_EXT_DECLSPEC uint64_t __stdcall CT400_ClientConnect(const char *pcSocket)
+{
+	if (pcSocket == nullptr)
+		return 0;
+	auto client = std::make_shared<ct400::DaemonClient>();
+	if (client->connect(pcSocket) != 0)
+		return 0;
+	std::lock_guard<std::mutex> lock(g_mtx);
+	uint64_t uiClient = g_uiNextClient++;
+	g_clients[uiClient] = client;
+	return uiClient;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientCommand(uint64_t uiClient,
+const rDaemonRequest *pRequest, rDaemonStatus *pStatus)
+{
+	auto client = find(g_clients, uiClient);
+	if (client == nullptr || pRequest == nullptr)
+		return -1;
+	return client->command(*pRequest, pStatus);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientWaitSweep(uint64_t uiClient,
+int32_t iTimeout, uint64_t *puiSequence)
+{
+	auto client = find(g_clients, uiClient);
+	if (client == nullptr || puiSequence == nullptr)
+		return -1;
+	return client->waitSweep(iTimeout, *puiSequence);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientGetSweep(uint64_t uiClient,
+uint64_t uiSequence, rSweepInfo *pInfo, double dWavelength[], double dBlock[],
+double dPower[], int32_t iArraySize)
+{
+	auto client = find(g_clients, uiClient);
+	if (client == nullptr || iArraySize < 0)
+		return -1;
+	return client->ring().copy(uiSequence, pInfo, dWavelength, dBlock, dPower, (size_t)iArraySize);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientMapSweep(uint64_t uiClient,
+uint64_t uiSequence, rSweepInfo *pInfo, const double *pdRows[])
+{
+	auto client = find(g_clients, uiClient);
+	if (client == nullptr || pdRows == nullptr)
+		return -1;
+	const ct400::SweepRing &ring = client->ring();
+	const rSweepInfo *pSlotInfo = ring.info(uiSequence);
+	if (pSlotInfo == nullptr)
+		return -1;
+	const rSweepInfo info = *pSlotInfo;
+	const size_t uiRows = (size_t)std::min(std::max(info.iNbDetectors, 0), 5) + (info.iPower ? 2 : 1);
+	for (size_t r = 0; r < ct400::SweepRing::MAX_ROWS; r++)
+		pdRows[r] = r < uiRows ? ring.row(uiSequence, r) : nullptr;
+	if (!ring.valid(uiSequence))
+		return -1;
+	if (pInfo)
+		*pInfo = info;
+	return (int32_t)std::min((size_t)std::max(info.iPoints, 0), ring.stride());
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientSweepValid(uint64_t uiClient,
+uint64_t uiSequence)
+{
+	auto client = find(g_clients, uiClient);
+	return client != nullptr && client->ring().valid(uiSequence) ? 0 : -1;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientDisconnect(uint64_t uiClient)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	return g_clients.erase(uiClient) ? 0 : -1;
+}
+
+}
+
+
+namespace ct400
+{
+
+//------------------------------ Daemon ----------------------------------------
+
+Daemon::Daemon(uint64_t uiHandle) : m_device(Device::forHandle(uiHandle))
+{
+	CT400_DefaultScanConfig(&m_config);
+}
+
+int32_t Daemon::start(const std::string &strSocket, const std::string &strRing, size_t uiSlots,
+	size_t uiMaxPoints)
+{
+#if defined (_WIN32)
+	(void)strSocket;
+	(void)strRing;
+	(void)uiSlots;
+	(void)uiMaxPoints;
+	return -1;
+#else
+	if (m_server.joinable() || strRing.size() >= sizeof(rDaemonStatus().tcRing))
+		return -1;
+	sockaddr_un address;
+	if (!socketAddress(strSocket, address) || m_ring.create(strRing, uiSlots, uiMaxPoints) != 0)
+		return -1;
+	unlink(strSocket.c_str());
+	m_iListen = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_iListen < 0 || fcntl(m_iListen, F_SETFD, FD_CLOEXEC) != 0
+		|| bind(m_iListen, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0
+		|| listen(m_iListen, 16) != 0 || pipe(m_iWake) != 0) {
+		stop();
+		return -1;
+	}
+	m_strSocket = strSocket;
+	m_bStop = false;
+	m_server = std::thread([this] { serve(); });
+	m_acquisition = std::thread([this] { acquire(); });
+	return 0;
+#endif
+}
+
+void Daemon::shutdown()
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	if (m_bStop)
+		return;
+	m_bStop = true;
+	m_iPending = 0;
+	if (m_bScanning)
+		m_device->stop();
+#if !defined (_WIN32)
+	if (m_iWake[1] >= 0) {
+		const char c = 0;
+		if (write(m_iWake[1], &c, 1) < 0) {
+			// the server also sees m_bStop on its next command
+		}
+	}
+#endif
+	m_cv.notify_all();
+}
+
+void Daemon::stop()
+{
+	std::lock_guard<std::mutex> lockStop(m_mtxStop);
+	shutdown();
+	if (m_server.joinable())
+		m_server.join();
+	if (m_acquisition.joinable())
+		m_acquisition.join();
+#if !defined (_WIN32)
+	for (int *piFd : { &m_iListen, &m_iWake[0], &m_iWake[1] })
+		if (*piFd >= 0) {
+			close(*piFd);
+			*piFd = -1;
+		}
+	if (!m_strSocket.empty())
+		unlink(m_strSocket.c_str());
+#endif
+	m_strSocket.clear();
+	m_ring.close();
+}
+
+void Daemon::wait()
+{
+	std::unique_lock<std::mutex> lock(m_mtx);
+	m_cv.wait(lock, [this] { return m_bStop; });
+}
+
+rDaemonStatus Daemon::status() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return statusLocked();
+}
+
+rDaemonStatus Daemon::statusLocked() const
+{
+	rDaemonStatus s;
+	std::memset(&s, 0, sizeof(s));
+	s.iPending = (int32_t)std::min<int64_t>(m_iPending, INT32_MAX);
+	s.uiPublished = m_ring.published();
+	s.uiFailed = m_uiFailed;
+	s.iClients = (int32_t)m_uiClients;
+	s.iSubscribers = (int32_t)m_subscribers.size();
+	s.iSlots = (int32_t)m_ring.slots();
+	s.iMaxPoints = (int32_t)m_ring.maxPoints();
+	std::strncpy(s.tcRing, m_ring.name().c_str(), sizeof(s.tcRing) - 1);
+	return s;
+}
+
+void Daemon::execute(const rDaemonRequest &request, rDaemonStatus &reply)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	int32_t iStatus = 0;
+	switch (request.eCommand) {
+	case DC_STATUS:
+	case DC_SUBSCRIBE:
+		break;
+	case DC_CONFIGURE:
+		m_config = request.config;
+		break;
+	case DC_START:
+		m_iPending = request.iSweeps > 0 ? request.iSweeps : -1;
+		m_cv.notify_all();
+		break;
+	case DC_STOP:
+		m_iPending = 0;
+		if (m_bScanning)
+			m_device->stop();
+		break;
+	default:
+		iStatus = -1;
+		break;
+	}
+	reply = statusLocked();
+	reply.iStatus = iStatus;
+}
+
+void Daemon::serve()
+{
+#if !defined (_WIN32)
+	std::vector<int> clients;
+	std::vector<pollfd> fds;
+	for (;;) {
+		fds.clear();
+		fds.push_back({ m_iWake[0], POLLIN, 0 });
+		fds.push_back({ m_iListen, POLLIN, 0 });
+		for (int iFd : clients)
+			fds.push_back({ iFd, POLLIN, 0 });
+		if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+			break;
+		if (fds[0].revents) {
+			std::lock_guard<std::mutex> lock(m_mtx);
+			if (m_bStop)
+				break;
+		}
+		if (fds[1].revents & POLLIN) {
+			int iFd = accept(m_iListen, nullptr, nullptr);
+			if (iFd >= 0) {
+				fcntl(iFd, F_SETFD, FD_CLOEXEC);
+				// a client sending half a request cannot hold the server
+				timeval timeout = { 1, 0 };
+				setsockopt(iFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+				setsockopt(iFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+				clients.push_back(iFd);
+				std::lock_guard<std::mutex> lock(m_mtx);
+				m_uiClients = clients.size();
+			}
+		}
+
+		bool bShutdown = false;
+		for (size_t i = 2; i < fds.size(); i++) {
+			if (fds[i].revents == 0)
+				continue;
+			const int iFd = fds[i].fd;
+			rDaemonRequest request;
+			rDaemonStatus reply;
+			bool bKeep = receiveAll(iFd, &request, sizeof(request));
+			if (bKeep && request.eCommand == DC_SHUTDOWN) {
+				bShutdown = true;
+				std::lock_guard<std::mutex> lock(m_mtx);
+				reply = statusLocked();
+				reply.iStatus = 0;
+			}
+			else if (bKeep) {
+				execute(request, reply);
+			}
+			bKeep = bKeep && sendAll(iFd, &reply, sizeof(reply));
+			std::lock_guard<std::mutex> lock(m_mtx);
+			if (bKeep && request.eCommand == DC_SUBSCRIBE) {
+				// after the reply, so that events follow it on the connection
+				m_subscribers.push_back(iFd);
+			}
+			else if (!bKeep) {
+				m_subscribers.erase(std::remove(m_subscribers.begin(), m_subscribers.end(), iFd),
+					m_subscribers.end());
+				clients.erase(std::remove(clients.begin(), clients.end(), iFd), clients.end());
+				m_uiClients = clients.size();
+				close(iFd);
+			}
+		}
+		if (bShutdown)
+			shutdown();
+	}
+
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_subscribers.clear();
+	for (int iFd : clients)
+		close(iFd);
+	m_uiClients = 0;
+#endif
+}
+
+void Daemon::notify(const rSweepEvent &event)
+{
+#if !defined (_WIN32)
+	std::lock_guard<std::mutex> lock(m_mtx);
+	for (int iFd : m_subscribers) {
+		// a full connection (a reader not waiting) drops the event
+		if (send(iFd, &event, sizeof(event), MSG_DONTWAIT | SEND_FLAGS) < 0) {
+		}
+	}
+#else
+	(void)event;
+#endif
+}
+
+void Daemon::acquire()
+{
+	for (;;) {
+		rScanConfig config;
+		{
+			std::unique_lock<std::mutex> lock(m_mtx);
+			m_cv.wait(lock, [this] { return m_bStop || m_iPending != 0; });
+			if (m_bStop)
+				break;
+			config = m_config;
+			if (m_iPending > 0)
+				m_iPending--;
+			m_bScanning = true;
+		}
+		const rSweepEvent event = sweep(config);
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_bScanning = false;
+			if (event.iError != 0)
+				m_uiFailed++;
+		}
+		notify(event);
+	}
+}
+
+rSweepEvent Daemon::sweep(const rScanConfig &config)
+{
+	rSweepInfo &info = m_ring.begin();
+	info.config = config;
+	const std::vector<rDetector> detectors = enabledDetectors(config);
+	info.iNbDetectors = (int32_t)std::min<size_t>(detectors.size(), 5);
+	std::copy(detectors.begin(), detectors.begin() + info.iNbDetectors, info.eDetectors);
+	info.iPower = 1;
+
+	ConfigCache &cache = m_device->configCache();
+	m_device->call([&](uint64_t uiHandle) {
+		auto fail = [&](const char *pcError) {
+			info.iError = -1;
+			std::strncpy(info.tcError, pcError, sizeof(info.tcError) - 1);
+		};
+		{
+			ScopedSpan span(uiHandle, "configure");
+			if (cache.input() != config.eInput && cache.switchInput(uiHandle, config.eInput) != 0)
+				return fail("CT400_SwitchInput failed");
+			if (cache.apply(uiHandle, config) < 0)
+				return fail("Scan configuration failed");
+		}
+		char tcError[1024];
+		tcError[0] = '\0';
+		const Clock::time_point tStart = Clock::now();
+		if (CT400_ScanStart(uiHandle) != 0)
+			return fail("CT400_ScanStart failed");
+		info.iError = CT400_ScanWaitEnd(uiHandle, tcError);
+		std::memcpy(info.tcError, tcError, std::min(std::strlen(tcError), sizeof(info.tcError) - 1));
+		const Clock::time_point tEnd = Clock::now();
+		info.dScanTime = seconds(tStart, tEnd);
+		recordSpan(uiHandle, "sweep", info.dScanTime);
+		if (info.iError != 0) {
+			cache.invalidate();
+			return;
+		}
+
+		// straight into the ring rows: wavelength, detectors, then Pout
+		info.iTotalPoints = CT400_GetNbDataPointsResampled(uiHandle);
+		const int32_t iStride = (int32_t)m_ring.stride();
+		const int32_t iPoints = CT400_ScanGetResampledBlock(uiHandle, detectors.data(), info.iNbDetectors,
+			m_ring.row(0), m_ring.row(1), iStride);
+		if (iPoints < 0 || CT400_ScanGetPowerResampledArray(uiHandle, m_ring.row(1 + info.iNbDetectors),
+			iPoints) != iPoints)
+			return fail("Sweep retrieval failed");
+		info.iPoints = iPoints;
+		info.dFetchTime = seconds(tEnd, Clock::now());
+		recordSpan(uiHandle, "fetch", info.dFetchTime);
+	});
+	info.iTimestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+
+	rSweepEvent event;
+	event.uiSequence = info.uiSequence;
+	event.iError = info.iError;
+	event.iPoints = info.iPoints;
+	m_ring.publish();
+	return event;
+}
+
+
+//------------------------------ DaemonClient ----------------------------------
+
+int32_t DaemonClient::connect(const std::string &strSocket)
+{
+	disconnect();
+#if defined (_WIN32)
+	(void)strSocket;
+	return -1;
+#else
+	rDaemonRequest request;
+	std::memset(&request, 0, sizeof(request));
+	rDaemonStatus status;
+	m_iCommand = connectTo(strSocket);
+	m_iEvents = connectTo(strSocket);
+	request.eCommand = DC_SUBSCRIBE;
+	if (m_iCommand < 0 || m_iEvents < 0 || !sendAll(m_iEvents, &request, sizeof(request))
+		|| !receiveAll(m_iEvents, &status, sizeof(status)) || status.iStatus != 0) {
+		disconnect();
+		return -1;
+	}
+	status.tcRing[sizeof(status.tcRing) - 1] = '\0';
+	if (m_ring.open(status.tcRing) != 0) {
+		disconnect();
+		return -1;
+	}
+	m_uiNext = m_ring.published();
+	return 0;
+#endif
+}
+
+void DaemonClient::disconnect()
+{
+#if !defined (_WIN32)
+	if (m_iCommand >= 0)
+		close(m_iCommand);
+	if (m_iEvents >= 0)
+		close(m_iEvents);
+#endif
+	m_iCommand = -1;
+	m_iEvents = -1;
+	m_ring.close();
+}
+
+int32_t DaemonClient::command(const rDaemonRequest &request, rDaemonStatus *pStatus)
+{
+#if defined (_WIN32)
+	(void)request;
+	(void)pStatus;
+	return -1;
+#else
+	rDaemonStatus status;
+	if (m_iCommand < 0 || request.eCommand == DC_SUBSCRIBE || !sendAll(m_iCommand, &request, sizeof(request))
+		|| !receiveAll(m_iCommand, &status, sizeof(status)))
+		return -1;
+	if (pStatus)
+		*pStatus = status;
+	return status.iStatus;
+#endif
+}
+
+int32_t DaemonClient::waitSweep(int iTimeout, uint64_t &uiSequence)
+{
+#if defined (_WIN32)
+	(void)iTimeout;
+	(void)uiSequence;
+	return -1;
+#else
+	if (m_iEvents < 0)
+		return -1;
+	const Clock::time_point tEnd = Clock::now() + std::chrono::milliseconds(std::max(iTimeout, 0));
+	for (;;) {
+		// the ring is the reference, events only wake the client up
+		const uint64_t uiPublished = m_ring.published();
+		if (uiPublished > m_uiNext) {
+			// the slot after the newest sweep may be being overwritten
+			const uint64_t uiKept = m_ring.slots() - 1;
+			if (uiPublished - m_uiNext > uiKept)
+				m_uiNext = uiPublished - uiKept;
+			uiSequence = m_uiNext++;
+			return 0;
+		}
+		int iWait = -1;
+		if (iTimeout >= 0) {
+			const int64_t iLeft = std::chrono::duration_cast<std::chrono::milliseconds>(
+				tEnd - Clock::now()).count();
+			if (iLeft <= 0)
+				return 1;
+			iWait = (int)iLeft;
+		}
+		pollfd fd = { m_iEvents, POLLIN, 0 };
+		int n = poll(&fd, 1, iWait);
+		if (n < 0 && errno != EINTR)
+			return -1;
+		if (n <= 0)
+			continue;
+		rSweepEvent events[64];
+		ssize_t iRead = recv(m_iEvents, events, sizeof(events), MSG_DONTWAIT);
+		if (iRead == 0 || (iRead < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			return -1;
+	}
+#endif
+}
+
+} // namespace ct400
@@ -0,0 +1,330 @@
+/******************************************************************************/
+/* Header file for CT400_daemon.cpp                                           */
+/*                                                                            */
+/* Instrument daemon: one process owns the CT400 handle, takes commands from */
+/* local clients over a Unix domain socket and publishes every sweep into a  */
+/* shared memory ring (CT400_sweep_ring.h) that any number of client         */
+/* processes read in place. POSIX only: on Windows the functions fail.       */
+/******************************************************************************/
+
+#ifndef CT400_DAEMON_H
+#define CT400_DAEMON_H
+
+#include "CT400_sweep_ring.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef enum
+  {
+	DC_STATUS = 0,                  // reply only
+	DC_CONFIGURE,                   // settings of the next sweeps (config)
+	DC_START,                       // iSweeps sweeps, 0 until DC_STOP
+	DC_STOP,                        // drops pending sweeps and stops the current one
+	DC_SUBSCRIBE,                   // after the reply, the connection receives an rSweepEvent per sweep
+	DC_SHUTDOWN                     // stops the daemon
+  } rDaemonCommand;
+
+  // Command, as sent on the socket
+  typedef struct
+  {
+	int32_t eCommand;               // rDaemonCommand
+	int32_t iSweeps;                // DC_START
+	rScanConfig config;             // DC_CONFIGURE
+  } rDaemonRequest;
+
+  // Reply to every command
+  typedef struct
+  {
+	int32_t iStatus;                // 0 if success, -1 otherwise
+	int32_t iPending;               // sweeps still to take, -1 until DC_STOP
+	uint64_t uiPublished;           // sweeps published in the ring
+	uint64_t uiFailed;              // sweeps published with an error
+	int32_t iClients;               // connections, subscribers included
+	int32_t iSubscribers;
+	int32_t iSlots;                 // of the ring
+	int32_t iMaxPoints;             // of each ring row
+	char tcRing[64];                // shared memory name of the ring
+  } rDaemonStatus;
+
+  // Sent to the subscribers once a sweep is in the ring
+  typedef struct
+  {
+	uint64_t uiSequence;
+	int32_t iError;
+	int32_t iPoints;
+  } rSweepEvent;
+
+//------------------------------ CT400_DaemonStart -----------------------------
+// Function CT400_DaemonStart
+//
+//  Purpose: Serves a CT400 to local clients: listens on pcSocket and
+//           publishes sweeps into the ring pcRing. Sweeps are taken on a
+//           thread of the daemon, with the settings sent through the
+//           configuration cache.
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN pcSocket: path of the Unix domain socket (replaced)
+//              IN pcRing: shared memory name of the ring, e.g. "/ct400"
+//              IN iSlots: sweeps kept in the ring (2 to 1024)
+//              IN iMaxPoints: points per row of the ring (longer sweeps are
+//                             truncated, see rSweepInfo.iTotalPoints)
+//  Returns:  uiDaemon for use in the other CT400_Daemon functions,
+//            0 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC uint64_t __stdcall CT400_DaemonStart(uint64_t uiHandle,
+const char *pcSocket, const char *pcRing, int32_t iSlots, int32_t iMaxPoints);
+
+//------------------------------ CT400_DaemonWait ------------------------------
+// Function CT400_DaemonWait
+//
+//  Purpose: Blocks until a client sends DC_SHUTDOWN or CT400_DaemonStop is
+//           called
+//
+//  Parameters: IN uiDaemon: from CT400_DaemonStart
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_DaemonWait(uint64_t uiDaemon);
+
+//------------------------------ CT400_DaemonStop ------------------------------
+// Function CT400_DaemonStop
+//
+//  Purpose: Stops the sweeps, disconnects the clients, removes the socket
+//           and the ring. The handle stays open.
+//
+//  Parameters: IN uiDaemon: from CT400_DaemonStart
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_DaemonStop(uint64_t uiDaemon);
+
+//------------------------------ CT400_ClientConnect ---------------------------
+// Function CT400_ClientConnect
+//
+//  Purpose: Connects to a daemon and maps its ring. Sweeps published from
+//           now on are returned by CT400_ClientWaitSweep.
+//
+//  Parameters: IN pcSocket: socket of the daemon
+//  Returns:  uiClient for use in the other CT400_Client functions,
+//            0 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC uint64_t __stdcall CT400_ClientConnect(const char *pcSocket);
+
+//------------------------------ CT400_ClientCommand ---------------------------
+// Function CT400_ClientCommand
+//
+//  Purpose: Sends a command to the daemon and waits for its reply
+//
+//  Parameters: IN uiClient: from CT400_ClientConnect
+//              IN pRequest: command (DC_SUBSCRIBE is sent by
+//                           CT400_ClientConnect on a connection of its own)
+//              IN/OUT pStatus: pointer over a variable, or NULL
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientCommand(uint64_t uiClient,
+const rDaemonRequest *pRequest, rDaemonStatus *pStatus);
+
+//------------------------------ CT400_ClientWaitSweep -------------------------
+// Function CT400_ClientWaitSweep
+//
+//  Purpose: Returns the sequence number of the oldest sweep this client has
+//           not been given yet, waiting for the next one if there is none.
+//           Sweeps overwritten before the client asked are skipped.
+//
+//  Parameters: IN uiClient: from CT400_ClientConnect
+//              IN iTimeout: ms, -1 to wait without limit
+//              IN/OUT puiSequence: pointer over a variable
+//  Returns:  0 if success, 1 on timeout, -1 otherwise (e.g. daemon stopped)
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientWaitSweep(uint64_t uiClient,
+int32_t iTimeout, uint64_t *puiSequence);
+
+//------------------------------ CT400_ClientGetSweep --------------------------
+// Function CT400_ClientGetSweep
+//
+//  Purpose: Copies a sweep out of the ring
+//
+//  Parameters: IN uiClient: from CT400_ClientConnect
+//              IN uiSequence: from CT400_ClientWaitSweep
+//              IN/OUT pInfo: pointer over a variable, or NULL
+//              IN/OUT dWavelength: pointer over an initialized array of
+//                                  iArraySize values, or NULL
+//              IN/OUT dBlock: pointer over an initialized array of
+//                             iArraySize values per detector of the sweep
+//                             (pInfo->eDetectors), or NULL
+//              IN/OUT dPower: pointer over an initialized array of
+//                             iArraySize values (Pout), or NULL
+//              IN iArraySize: size of one block row
+//  Returns:  number of points written in each row, -1 otherwise (the sweep
+//            is no longer in the ring)
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientGetSweep(uint64_t uiClient,
+uint64_t uiSequence, rSweepInfo *pInfo, double dWavelength[], double dBlock[],
+double dPower[], int32_t iArraySize);
+
+//------------------------------ CT400_ClientMapSweep --------------------------
+// Function CT400_ClientMapSweep
+//
+//  Purpose: Gives the rows of a sweep where they are in the ring, without
+//           copying them. The writer may overwrite the sweep at any time:
+//           check CT400_ClientSweepValid after using the rows.
+//
+//  Parameters: IN uiClient: from CT400_ClientConnect
+//              IN uiSequence: from CT400_ClientWaitSweep
+//              IN/OUT pInfo: pointer over a variable, or NULL
+//              IN/OUT pdRows: pointer over an array of 7 pointers: the
+//                             wavelength row, one row per detector of the
+//                             sweep (pInfo->eDetectors), then Pout if
+//                             pInfo->iPower; the others are set to NULL.
+//                             Rows are iMaxPoints values apart
+//                             (rDaemonStatus).
+//  Returns:  number of points of each row, -1 otherwise (the sweep is no
+//            longer in the ring)
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientMapSweep(uint64_t uiClient,
+uint64_t uiSequence, rSweepInfo *pInfo, const double *pdRows[]);
+
+//------------------------------ CT400_ClientSweepValid ------------------------
+// Function CT400_ClientSweepValid
+//
+//  Purpose: Checks that a sweep of CT400_ClientMapSweep was not overwritten
+//
+//  Parameters: IN uiClient: from CT400_ClientConnect
+//              IN uiSequence: from CT400_ClientWaitSweep
+//  Returns:  0 if the sweep is still in the ring, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientSweepValid(uint64_t uiClient,
+uint64_t uiSequence);
+
+//------------------------------ CT400_ClientDisconnect ------------------------
+// Function CT400_ClientDisconnect
+//
+//  Parameters: IN uiClient: from CT400_ClientConnect
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ClientDisconnect(uint64_t uiClient);
+
+#ifdef __cplusplus
+}
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ct400
+{
+
+class Device;
+
+//------------------------------ Daemon ----------------------------------------
+// Class Daemon
+//
+//  Purpose: Owner of a handle for local clients. A server thread polls the
+//           socket and the client connections and answers their commands;
+//           the acquisition thread sweeps while sweeps are pending, fetching
+//           each straight into its ring slot (the only copy out of the DLL)
+//           and then rings every subscriber with an rSweepEvent, sent
+//           without blocking: a subscriber that does not read its
+//           connection misses events, not sweeps, and never slows the
+//           others down.
+//------------------------------------------------------------------------------
+class Daemon
+{
+public:
+	explicit Daemon(uint64_t uiHandle);
+	~Daemon() { stop(); }
+
+	Daemon(const Daemon &) = delete;
+	Daemon &operator=(const Daemon &) = delete;
+
+	// Returns 0 if success, -1 otherwise
+	int32_t start(const std::string &strSocket, const std::string &strRing, size_t uiSlots, size_t uiMaxPoints);
+	// Stops the threads and removes the socket and the ring
+	void stop();
+	// Asks the threads to stop without waiting for them (e.g. from a signal
+	// handling thread); stop() still has to be called
+	void shutdown();
+	// Blocks until shutdown(), stop() or DC_SHUTDOWN
+	void wait();
+
+	rDaemonStatus status() const;
+
+private:
+	void serve();
+	void acquire();
+	// Takes one sweep into the ring; returns its event
+	rSweepEvent sweep(const rScanConfig &config);
+	// Runs a command and fills the reply
+	void execute(const rDaemonRequest &request, rDaemonStatus &reply);
+	void notify(const rSweepEvent &event);
+	rDaemonStatus statusLocked() const;
+
+	std::shared_ptr<Device> m_device;
+	SweepRing m_ring;
+	std::string m_strSocket;
+	int m_iListen = -1;
+	int m_iWake[2] = { -1, -1 };            // pipe ending the server's poll()
+
+	mutable std::mutex m_mtx;
+	std::condition_variable m_cv;
+	rScanConfig m_config;
+	int64_t m_iPending = 0;                 // -1: until DC_STOP
+	uint64_t m_uiFailed = 0;
+	size_t m_uiClients = 0;
+	std::vector<int> m_subscribers;
+	bool m_bScanning = false;
+	bool m_bStop = false;
+
+	std::mutex m_mtxStop;                   // serialises stop()
+
+	std::thread m_server;
+	std::thread m_acquisition;
+};
+
+//------------------------------ DaemonClient ----------------------------------
+// Class DaemonClient
+//
+//  Purpose: Connection to a Daemon: a command connection, a subscribed one
+//           for the sweep events and the ring mapped read-only. Sweeps are
+//           read in place through ring() (see SweepRing) or copied. Not
+//           thread safe.
+//------------------------------------------------------------------------------
+class DaemonClient
+{
+public:
+	DaemonClient() {}
+	~DaemonClient() { disconnect(); }
+
+	DaemonClient(const DaemonClient &) = delete;
+	DaemonClient &operator=(const DaemonClient &) = delete;
+
+	// Returns 0 if success, -1 otherwise
+	int32_t connect(const std::string &strSocket);
+	void disconnect();
+
+	// Returns 0 if success, -1 otherwise
+	int32_t command(const rDaemonRequest &request, rDaemonStatus *pStatus = nullptr);
+
+	// Returns 0 and the sequence of the next sweep, 1 on timeout (iTimeout
+	// ms, -1 without limit), -1 otherwise
+	int32_t waitSweep(int iTimeout, uint64_t &uiSequence);
+
+	const SweepRing &ring() const { return m_ring; }
+
+private:
+	int m_iCommand = -1;
+	int m_iEvents = -1;
+	SweepRing m_ring;
+	uint64_t m_uiNext = 0;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
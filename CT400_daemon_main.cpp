@@ -0,0 +1,117 @@
+//------------------------------------------------------------------------------
+// CT400_daemon_main.cpp
+//
+// Command line instrument daemon: opens the CT400, serves it with a
+// ct400::Daemon until a client sends DC_SHUTDOWN or the process gets SIGINT
+// or SIGTERM, then removes the socket and the ring and closes the CT400.
+//
+//  CT400_daemon [--socket=path] [--ring=name] [--slots=n] [--max-points=n]
+//
+// Defaults: /tmp/ct400.sock, /ct400, 8 slots, 262144 points (130 nm at
+// 0.5 pm). Clients connect with CT400_ClientConnect or the DaemonClient
+// class of CT400_control.py.
+//------------------------------------------------------------------------------
+
+#include "CT400_daemon.h"
+#include "CT400_device.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#if !defined (_WIN32)
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+namespace
+{
+
+struct Options
+{
+	std::string strSocket = "/tmp/ct400.sock";
+	std::string strRing = "/ct400";
+	size_t uiSlots = 8;
+	size_t uiMaxPoints = 262144;
+};
+
+bool parseOptions(int argc, char *argv[], Options &options)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string strArg = argv[i];
+		size_t uiEq = strArg.find('=');
+		std::string strKey = strArg.substr(0, uiEq);
+		std::string strValue = uiEq == std::string::npos ? std::string() : strArg.substr(uiEq + 1);
+		if (strKey == "--socket")
+			options.strSocket = strValue;
+		else if (strKey == "--ring")
+			options.strRing = strValue;
+		else if (strKey == "--slots")
+			options.uiSlots = std::strtoul(strValue.c_str(), nullptr, 10);
+		else if (strKey == "--max-points")
+			options.uiMaxPoints = std::strtoul(strValue.c_str(), nullptr, 10);
+		else {
+			std::fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+		return 2;
+#if defined (_WIN32)
+	std::fprintf(stderr, "The daemon needs Unix domain sockets and POSIX shared memory\n");
+	return 1;
+#else
+	// blocked before any thread starts, so that only sigwait() gets them
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	int32_t iError = 0;
+	uint64_t uiHandle = CT400_Init(&iError);
+	if (uiHandle == 0) {
+		std::fprintf(stderr, "CT400_Init failed (%d)\n", iError);
+		return 1;
+	}
+
+	int iStatus = 0;
+	{
+		ct400::Daemon daemon(uiHandle);
+		if (daemon.start(options.strSocket, options.strRing, options.uiSlots, options.uiMaxPoints) != 0) {
+			std::fprintf(stderr, "Could not serve %s with ring %s\n", options.strSocket.c_str(),
+				options.strRing.c_str());
+			iStatus = 1;
+		}
+		else {
+			std::printf("Serving %s, ring %s (%zu slots of %zu points)\n", options.strSocket.c_str(),
+				options.strRing.c_str(), options.uiSlots, options.uiMaxPoints);
+			std::fflush(stdout);
+			std::thread waiter([&daemon, signals] {
+				int iSignal = 0;
+				sigwait(&signals, &iSignal);
+				daemon.shutdown();
+			});
+			daemon.wait();
+			// wakes the waiter if a client shut the daemon down
+			pthread_kill(waiter.native_handle(), SIGTERM);
+			waiter.join();
+		}
+		daemon.stop();
+	}
+
+	ct400::Device::release(uiHandle);
+	CT400_Close(uiHandle);
+	return iStatus;
+#endif
+}
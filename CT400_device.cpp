@@ -0,0 +1,130 @@
+//------------------------------------------------------------------------------
+// CT400_device.cpp
+//
+// Handle registry and multi-instrument manager. Calls on different handles
+// run in parallel; calls on one handle are serialised by its Device.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_device.h"
+
+#include <chrono>
+#include <map>
+
+namespace ct400
+{
+
+namespace
+{
+
+std::mutex g_mtx;
+std::map<uint64_t, std::shared_ptr<Device> > g_devices;
+
+} // namespace
+
+std::shared_ptr<Device> Device::forHandle(uint64_t uiHandle)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	std::shared_ptr<Device> &device = g_devices[uiHandle];
+	if (!device)
+		device = std::make_shared<Device>(uiHandle);
+	return device;
+}
+
+void Device::release(uint64_t uiHandle)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	g_devices.erase(uiHandle);
+}
+
+int32_t DeviceManager::open(size_t uiCount)
+{
+	int32_t iOpened = 0;
+	for (size_t i = 0; i < uiCount; i++) {
+		int32_t iError = 0;
+		uint64_t uiHandle = CT400_Init(&iError);
+		if (uiHandle == 0)
+			continue;
+		m_devices.push_back(Device::forHandle(uiHandle));
+		m_owned.push_back(true);
+		iOpened++;
+	}
+	return iOpened > 0 ? iOpened : -1;
+}
+
+void DeviceManager::add(uint64_t uiHandle)
+{
+	m_devices.push_back(Device::forHandle(uiHandle));
+	m_owned.push_back(false);
+}
+
+void DeviceManager::close()
+{
+	for (size_t i = 0; i < m_devices.size(); i++) {
+		if (!m_owned[i])
+			continue;
+		m_devices[i]->call(CT400_Close);
+		Device::release(m_devices[i]->handle());
+	}
+	m_devices.clear();
+	m_owned.clear();
+}
+
+DeviceManager::RunStats DeviceManager::runSweeps(size_t uiSweeps, const std::vector<rDetector> &detectors,
+	UnitProcessor process, UnitSetup setup, size_t uiWorkersPerUnit)
+{
+	RunStats stats;
+	stats.units.resize(m_devices.size());
+	std::vector<std::unique_ptr<ScanEngine> > engines;
+	std::vector<std::vector<std::future<SweepResult> > > futures(m_devices.size());
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (size_t u = 0; u < m_devices.size(); u++)
+		engines.emplace_back(new ScanEngine(m_devices[u]->handle(), detectors, uiWorkersPerUnit));
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		for (auto &engine : engines)
+			m_engines.push_back(engine.get());
+	}
+	// queue every sweep up front: each unit's acquisition thread then runs
+	// them back to back independently of the others
+	for (size_t u = 0; u < m_devices.size(); u++) {
+		SweepProcessor unitProcess;
+		SweepSetup unitSetup;
+		if (process)
+			unitProcess = [process, u](SweepResult &result) { process(u, result); };
+		if (setup)
+			unitSetup = [setup, u](uint64_t uiHandle) { return setup(u, uiHandle); };
+		for (size_t i = 0; i < uiSweeps; i++)
+			futures[u].push_back(engines[u]->submit(unitProcess, unitSetup));
+	}
+	for (size_t u = 0; u < m_devices.size(); u++)
+		for (auto &future : futures[u])
+			if (future.get().iError != 0)
+				stats.units[u].uiErrors++;
+	stats.dElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_engines.clear();
+	}
+	uint64_t uiTotal = 0;
+	for (size_t u = 0; u < m_devices.size(); u++) {
+		UnitStats &unit = stats.units[u];
+		unit.uiSweeps = engines[u]->sweepsCompleted();
+		unit.dBusy = engines[u]->busyTime();
+		unit.dUtilisation = stats.dElapsed > 0.0 ? unit.dBusy / stats.dElapsed : 0.0;
+		uiTotal += unit.uiSweeps;
+	}
+	stats.dSweepsPerSecond = stats.dElapsed > 0.0 ? uiTotal / stats.dElapsed : 0.0;
+	return stats;
+}
+
+void DeviceManager::stopAll()
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	for (ScanEngine *engine : m_engines)
+		engine->cancel();
+}
+
+} // namespace ct400
@@ -0,0 +1,128 @@
+/******************************************************************************/
+/* Header file for CT400_device.cpp                                           */
+/*                                                                            */
+/* Per-handle call serialisation and a manager running several CT400s from   */
+/* one process.                                                               */
+/******************************************************************************/
+
+#ifndef CT400_DEVICE_H
+#define CT400_DEVICE_H
+
+#include "CT400_config_cache.h"
+#include "CT400_scan_engine.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ct400
+{
+
+//------------------------------ Device ----------------------------------------
+// Class Device
+//
+//  Purpose: One CT400 handle and the lock serialising calls on it. The DLL
+//           is not documented as reentrant, so every native component goes
+//           through call() for the handle it uses. There is a single Device
+//           per handle, shared through forHandle().
+//------------------------------------------------------------------------------
+class Device
+{
+public:
+	// Returns the Device of a handle, creating it for handles from CT400_Init
+	// calls made elsewhere
+	static std::shared_ptr<Device> forHandle(uint64_t uiHandle);
+	// Forgets a handle after CT400_Close
+	static void release(uint64_t uiHandle);
+
+	uint64_t handle() const { return m_uiHandle; }
+
+	// Runs fn(uiHandle) with the handle locked and returns its result
+	template <class Fn>
+	auto call(Fn fn) -> decltype(fn(uint64_t()))
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		return fn(m_uiHandle);
+	}
+
+	// CT400_ScanStop bypasses the lock: it is the call that interrupts a
+	// CT400_ScanWaitEnd holding it
+	int32_t stop() { return CT400_ScanStop(m_uiHandle); }
+
+	// Shadow configuration, used from within call()
+	ConfigCache &configCache() { return m_configCache; }
+
+	explicit Device(uint64_t uiHandle) : m_uiHandle(uiHandle) {}
+
+private:
+	uint64_t m_uiHandle;
+	std::mutex m_mtx;
+	ConfigCache m_configCache;
+};
+
+//------------------------------ DeviceManager ---------------------------------
+// Class DeviceManager
+//
+//  Purpose: Opens several CT400s and runs sweeps on all of them at once,
+//           one ScanEngine per unit, reporting aggregate throughput and the
+//           share of the run each unit spent sweeping.
+//------------------------------------------------------------------------------
+class DeviceManager
+{
+public:
+	struct UnitStats
+	{
+		uint64_t uiSweeps = 0;      // sweeps retrieved without error
+		uint64_t uiErrors = 0;
+		double dBusy = 0.0;         // s spent sweeping
+		double dUtilisation = 0.0;  // dBusy / run time
+	};
+
+	struct RunStats
+	{
+		double dElapsed = 0.0;
+		double dSweepsPerSecond = 0.0;  // all units together
+		std::vector<UnitStats> units;
+	};
+
+	// Called on a worker thread for every successful sweep of unit uiUnit
+	typedef std::function<void(size_t uiUnit, SweepResult &result)> UnitProcessor;
+	// Called on the acquisition thread of unit uiUnit before each sweep
+	typedef std::function<int32_t(size_t uiUnit, uint64_t uiHandle)> UnitSetup;
+
+	DeviceManager() {}
+	~DeviceManager() { close(); }
+
+	DeviceManager(const DeviceManager &) = delete;
+	DeviceManager &operator=(const DeviceManager &) = delete;
+
+	// Calls CT400_Init uiCount times.
+	// Returns the number of units opened, -1 if none could be
+	int32_t open(size_t uiCount);
+	// Adopts a handle opened elsewhere
+	void add(uint64_t uiHandle);
+	// Calls CT400_Close on every unit opened by open()
+	void close();
+
+	size_t size() const { return m_devices.size(); }
+	const std::shared_ptr<Device> &device(size_t uiUnit) const { return m_devices[uiUnit]; }
+
+	// Runs uiSweeps sweeps on every unit concurrently and waits for them
+	RunStats runSweeps(size_t uiSweeps, const std::vector<rDetector> &detectors,
+		UnitProcessor process = nullptr, UnitSetup setup = nullptr, size_t uiWorkersPerUnit = 1);
+
+	// Stops the sweeps of every unit (from any thread)
+	void stopAll();
+
+private:
+	std::vector<std::shared_ptr<Device> > m_devices;
+	std::vector<bool> m_owned;
+	std::mutex m_mtx;
+	std::vector<ScanEngine *> m_engines;    // engines of the running runSweeps()
+};
+
+} // namespace ct400
+
+
+#endif
@@ -0,0 +1,82 @@
+/******************************************************************************/
+/* Common definitions for the native CT400 extensions (libCT400_ext)          */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef CT400_EXT_H
+#define CT400_EXT_H
+
+#include "CT400_lib.h"
+
+#if defined (_WIN32)
+#   if defined (CT400_EXT_EXPORT)
+#       define _EXT_DECLSPEC __declspec(dllexport)
+#   else
+#       define _EXT_DECLSPEC __declspec(dllimport)
+#   endif
+#else
+#   define _EXT_DECLSPEC __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace ct400
+{
+
+// Alignment of the sample blocks handed to the SIMD kernels
+const size_t BLOCK_ALIGN = 64;
+
+template <class T>
+struct AlignedAllocator
+{
+	typedef T value_type;
+
+	AlignedAllocator() {}
+	template <class U> AlignedAllocator(const AlignedAllocator<U> &) {}
+
+	T *allocate(size_t n)
+	{
+		size_t bytes = (n * sizeof(T) + BLOCK_ALIGN - 1) / BLOCK_ALIGN * BLOCK_ALIGN;
+#if defined (_WIN32)
+		void *p = _aligned_malloc(bytes, BLOCK_ALIGN);
+#else
+		void *p = std::aligned_alloc(BLOCK_ALIGN, bytes);
+#endif
+		if (p == nullptr)
+			throw std::bad_alloc();
+		return static_cast<T *>(p);
+	}
+
+	void deallocate(T *p, size_t)
+	{
+#if defined (_WIN32)
+		_aligned_free(p);
+#else
+		std::free(p);
+#endif
+	}
+
+	template <class U> bool operator==(const AlignedAllocator<U> &) const { return true; }
+	template <class U> bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+typedef std::vector<double, AlignedAllocator<double> > AlignedVector;
+
+// Rounds a row length up so that every row of a block starts aligned
+inline size_t alignedStride(size_t uiPoints)
+{
+	const size_t uiLanes = BLOCK_ALIGN / sizeof(double);
+	return (uiPoints + uiLanes - 1) / uiLanes * uiLanes;
+}
+
+} // namespace ct400
+
+#endif
+
+
+#endif
@@ -0,0 +1,449 @@
+//------------------------------------------------------------------------------
+// CT400_input_scheduler.cpp
+//
+// Multi-input sweep queue. A switch of the input costs a relay move and a
+// new laser costs GPIB commands, both large next to a USB setting, so the
+// plan visits each input once and, within an input, sorts the sweeps by
+// laser settings first and scan settings second. Jobs asking for the same
+// sweep with other detectors are served by one sweep recording all of them.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_input_scheduler.h"
+#include "CT400_device.h"
+#include "CT400_span.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <numeric>
+#include <tuple>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds(Clock::time_point tFrom, Clock::time_point tTo)
+{
+	return std::chrono::duration<double>(tTo - tFrom).count();
+}
+
+// Settings of CT400_SetLaser, then of CT400_SetScan, CT400_SetSamplingResolution
+// and CT400_SetBNC, in the order the plan groups them
+auto laserKey(const rScanConfig &c)
+	-> decltype(std::make_tuple(c.eLaserType, c.iGPIBAdress, c.eEnable, c.dLaserMinWavelength,
+		c.dLaserMaxWavelength, c.iSpeed))
+{
+	return std::make_tuple(c.eLaserType, c.iGPIBAdress, c.eEnable, c.dLaserMinWavelength, c.dLaserMaxWavelength,
+		c.iSpeed);
+}
+
+auto scanKey(const rScanConfig &c)
+	-> decltype(std::make_tuple(c.dMinWavelength, c.dMaxWavelength, c.dPower, c.uiResolution, c.eBNC, c.dAlpha,
+		c.dBeta, c.eUnit))
+{
+	return std::make_tuple(c.dMinWavelength, c.dMaxWavelength, c.dPower, c.uiResolution, c.eBNC, c.dAlpha, c.dBeta,
+		c.eUnit);
+}
+
+auto detectorKey(const rScanConfig &c) -> decltype(std::make_tuple(c.eDect2, c.eDect3, c.eDect4, c.eExt))
+{
+	return std::make_tuple(c.eDect2, c.eDect3, c.eDect4, c.eExt);
+}
+
+// CT400_SetScan, CT400_SetSamplingResolution, CT400_SetDetectorArray and
+// CT400_SetBNC calls sent by the configuration cache to go from pFrom
+// (nullptr if unknown) to to
+int32_t settingCalls(const rScanConfig *pFrom, const rScanConfig &to)
+{
+	if (pFrom == nullptr)
+		return 4;
+	const rScanConfig &c = *pFrom;
+	return (std::make_tuple(c.dPower, c.dMinWavelength, c.dMaxWavelength)
+		!= std::make_tuple(to.dPower, to.dMinWavelength, to.dMaxWavelength))
+		+ (c.uiResolution != to.uiResolution) + (detectorKey(c) != detectorKey(to))
+		+ (std::make_tuple(c.eBNC, c.dAlpha, c.dBeta, c.eUnit) != std::make_tuple(to.eBNC, to.dAlpha, to.dBeta, to.eUnit));
+}
+
+std::mutex g_mtx;
+std::map<uint64_t, std::shared_ptr<ct400::InputScheduler> > g_schedulers;
+uint64_t g_uiNextScheduler = 1;
+
+std::shared_ptr<ct400::InputScheduler> findScheduler(uint64_t uiScheduler)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	auto it = g_schedulers.find(uiScheduler);
+	return it == g_schedulers.end() ? nullptr : it->second;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC uint64_t __stdcall CT400_SchedulerCreate(uint64_t uiHandle)
+{
+	if (uiHandle == 0)
+		return 0;
+	auto scheduler = std::make_shared<ct400::InputScheduler>(uiHandle);
+	std::lock_guard<std::mutex> lock(g_mtx);
+	uint64_t uiScheduler = g_uiNextScheduler++;
+	g_schedulers[uiScheduler] = scheduler;
+	return uiScheduler;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerSetCalibration(
+uint64_t uiScheduler, uint64_t uiCalibration, rUnit eUnit)
+{
+	auto scheduler = findScheduler(uiScheduler);
+	if (!scheduler || (eUnit != Unit_dBm && eUnit != Unit_mW))
+		return -1;
+	std::shared_ptr<ct400::Calibration> calibration;
+	if (uiCalibration != 0 && !(calibration = ct400::calibrationForHandle(uiCalibration)))
+		return -1;
+	scheduler->setCalibration(calibration, eUnit);
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerSubmit(uint64_t uiScheduler,
+const rScanConfig *pConfig)
+{
+	auto scheduler = findScheduler(uiScheduler);
+	if (!scheduler || pConfig == nullptr || pConfig->eInput < LI_1 || pConfig->eInput > LI_4)
+		return -1;
+	return (int32_t)scheduler->submit(*pConfig);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerRun(uint64_t uiScheduler,
+rSchedulerReport *pReport)
+{
+	auto scheduler = findScheduler(uiScheduler);
+	if (!scheduler)
+		return -1;
+	rSchedulerReport report;
+	int32_t iResult = scheduler->run(report);
+	if (pReport)
+		*pReport = report;
+	return iResult;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerGetResult(uint64_t uiScheduler,
+int32_t iJob, double dWavelength[], double dBlock[], int32_t iArraySize,
+char *pcError)
+{
+	auto scheduler = findScheduler(uiScheduler);
+	if (!scheduler || iJob < 0 || iArraySize < 0
+		|| (iArraySize > 0 && (dWavelength == nullptr || dBlock == nullptr)))
+		return -1;
+	// a copy: submit() and clear() may reallocate the results meanwhile
+	ct400::SweepResult result;
+	if (!scheduler->result(iJob, result))
+		return -1;
+	if (pcError)
+		std::snprintf(pcError, 1024, "%s", result.strError.c_str());
+	if (result.iError != 0 || !result.data)
+		return -1;
+	const ct400::ScanBuffer &data = *result.data;
+	if (iArraySize == 0)
+		return (int32_t)data.points();
+	const size_t uiCopy = std::min<size_t>(data.points(), iArraySize);
+	std::copy(data.wavelength(), data.wavelength() + uiCopy, dWavelength);
+	for (size_t d = 0; d < data.detectors().size(); d++)
+		std::copy(data.row(d), data.row(d) + uiCopy, dBlock + d * iArraySize);
+	return (int32_t)data.points();
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerClear(uint64_t uiScheduler)
+{
+	auto scheduler = findScheduler(uiScheduler);
+	if (!scheduler)
+		return -1;
+	scheduler->clear();
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerDestroy(uint64_t uiScheduler)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	return g_schedulers.erase(uiScheduler) ? 0 : -1;
+}
+
+}
+
+
+namespace ct400
+{
+
+std::vector<PlannedSweep> planSweeps(const std::vector<rScanConfig> &jobs, int32_t iFirstInput)
+{
+	// the input already selected goes first, the others in order
+	auto inputRank = [iFirstInput](const rScanConfig &c) { return c.eInput == iFirstInput ? 0 : (int32_t)c.eInput; };
+	std::vector<size_t> order(jobs.size());
+	std::iota(order.begin(), order.end(), 0);
+	// stable, so that equal sweeps keep their submission order
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		const rScanConfig &ca = jobs[a], &cb = jobs[b];
+		return std::make_tuple(inputRank(ca), laserKey(ca), scanKey(ca))
+			< std::make_tuple(inputRank(cb), laserKey(cb), scanKey(cb));
+	});
+
+	std::vector<PlannedSweep> groups;
+	for (size_t j : order) {
+		const rScanConfig &c = jobs[j];
+		if (!groups.empty()) {
+			rScanConfig &last = groups.back().config;
+			if (last.eInput == c.eInput && laserKey(last) == laserKey(c) && scanKey(last) == scanKey(c)) {
+				// DE_1 is always recorded; the others are the union
+				auto merge = [](rEnable &e, rEnable eOther) { e = e == ENABLE || eOther == ENABLE ? ENABLE : DISABLE; };
+				merge(last.eDect2, c.eDect2);
+				merge(last.eDect3, c.eDect3);
+				merge(last.eDect4, c.eDect4);
+				merge(last.eExt, c.eExt);
+				groups.back().jobs.push_back(j);
+				continue;
+			}
+		}
+		PlannedSweep sweep;
+		sweep.config = c;
+		sweep.jobs.push_back(j);
+		groups.push_back(sweep);
+	}
+
+	// within an input, the sweep needing the fewest settings changes comes
+	// next; a laser reprogrammed over GPIB weighs as much as several USB calls
+	std::vector<PlannedSweep> plan;
+	plan.reserve(groups.size());
+	for (size_t uiFirst = 0; uiFirst < groups.size();) {
+		size_t uiEnd = uiFirst;
+		while (uiEnd < groups.size() && groups[uiEnd].config.eInput == groups[uiFirst].config.eInput)
+			uiEnd++;
+		const rScanConfig *pLaser = nullptr;
+		for (size_t i = uiFirst; i < uiEnd; i++) {
+			const rScanConfig *pLast = plan.empty() ? nullptr : &plan.back().config;
+			size_t uiBest = i;
+			int32_t iBest = 0;
+			for (size_t k = i; k < uiEnd; k++) {
+				bool bLaser = !pLaser || laserKey(*pLaser) != laserKey(groups[k].config);
+				int32_t iCost = settingCalls(pLast, groups[k].config) + (bLaser ? 4 : 0);
+				if (k == i || iCost < iBest) {
+					uiBest = k;
+					iBest = iCost;
+				}
+			}
+			std::swap(groups[i], groups[uiBest]);
+			plan.push_back(std::move(groups[i]));
+			pLaser = &plan.back().config;
+		}
+		uiFirst = uiEnd;
+	}
+	return plan;
+}
+
+void countConfigCalls(const std::vector<rScanConfig> &configs, int32_t &iSwitches, int32_t &iCalls)
+{
+	iSwitches = iCalls = 0;
+	const rScanConfig *pLaser[4] = { nullptr, nullptr, nullptr, nullptr };
+	const rScanConfig *pLast = nullptr;
+	int32_t iInput = 0;
+	for (const rScanConfig &c : configs) {
+		if (c.eInput < LI_1 || c.eInput > LI_4)
+			continue;
+		if (c.eInput != iInput) {
+			iSwitches++;
+			iInput = c.eInput;
+		}
+		const rScanConfig *&pPrevious = pLaser[c.eInput - LI_1];
+		iCalls += (!pPrevious || laserKey(*pPrevious) != laserKey(c)) + settingCalls(pLast, c);
+		pPrevious = &c;
+		pLast = &c;
+	}
+}
+
+InputScheduler::InputScheduler(uint64_t uiHandle, size_t uiWorkers)
+	: m_device(Device::forHandle(uiHandle)), m_uiWorkers(std::max<size_t>(uiWorkers, 1))
+{
+}
+
+void InputScheduler::setCalibration(std::shared_ptr<const Calibration> calibration, rUnit eUnit)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_calibration = std::move(calibration);
+	m_eUnit = eUnit;
+}
+
+size_t InputScheduler::submit(const rScanConfig &config)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_configs.push_back(config);
+	m_results.emplace_back();
+	m_done.push_back(false);
+	return m_configs.size() - 1;
+}
+
+size_t InputScheduler::jobs() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_configs.size();
+}
+
+void InputScheduler::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_configs.clear();
+	m_results.clear();
+	m_done.clear();
+	m_uiFirstPending = 0;
+}
+
+bool InputScheduler::result(size_t uiJob, SweepResult &result) const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	if (uiJob >= m_done.size() || !m_done[uiJob])
+		return false;
+	result = m_results[uiJob];
+	return true;
+}
+
+std::shared_ptr<ScanBuffer> InputScheduler::extract(const ScanBuffer &sweep, const rScanConfig &config) const
+{
+	const std::vector<rDetector> detectors = enabledDetectors(config);
+	auto out = std::make_shared<ScanBuffer>();
+	out->resize(detectors.size(), sweep.points(), sweep.power() != nullptr);
+	out->setDetectors(detectors);
+	const size_t uiPoints = sweep.points();
+	std::copy(sweep.wavelength(), sweep.wavelength() + uiPoints, out->wavelength());
+	for (size_t d = 0; d < detectors.size(); d++) {
+		size_t r = std::find(sweep.detectors().begin(), sweep.detectors().end(), detectors[d])
+			- sweep.detectors().begin();
+		std::copy(sweep.row(r), sweep.row(r) + uiPoints, out->row(d));
+	}
+	if (sweep.power())
+		std::copy(sweep.power(), sweep.power() + uiPoints, out->power());
+	return out;
+}
+
+int32_t InputScheduler::run(rSchedulerReport &report, JobProcessor process)
+{
+	std::memset(&report, 0, sizeof(report));
+	std::vector<rScanConfig> pending;
+	size_t uiFirst;
+	std::shared_ptr<const Calibration> calibration;
+	rUnit eUnit;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		uiFirst = m_uiFirstPending;
+		pending.assign(m_configs.begin() + uiFirst, m_configs.end());
+		m_uiFirstPending = m_configs.size();
+		calibration = m_calibration;
+		eUnit = m_eUnit;
+	}
+	if (pending.empty())
+		return -1;
+
+	ConfigCache &cache = m_device->configCache();
+	const std::vector<PlannedSweep> plan = planSweeps(pending, cache.input());
+	report.iJobs = (int32_t)pending.size();
+	report.iSweeps = (int32_t)plan.size();
+	countConfigCalls(pending, report.iNaiveSwitches, report.iNaiveConfigCalls);
+
+	// calibration and copies run here while the next sweep is under way
+	ThreadPool workers(m_uiWorkers, 2 * m_uiWorkers);
+	int32_t iResults = 0;
+	auto finish = [&](size_t uiJob, SweepResult &result) {
+		if (process)
+			process(uiFirst + uiJob, result);
+		std::lock_guard<std::mutex> lock(m_mtx);
+		if (result.iError == 0)
+			iResults++;
+		m_results[uiFirst + uiJob] = std::move(result);
+		m_done[uiFirst + uiJob] = true;
+	};
+
+	const uint64_t uiSentBefore = cache.sent();
+	const Clock::time_point tRun = Clock::now();
+	for (const PlannedSweep &sweep : plan) {
+		const std::vector<rDetector> detectors = enabledDetectors(sweep.config);
+		SweepResult result;
+		result.data = std::make_shared<ScanBuffer>();
+		m_device->call([&](uint64_t uiHandle) {
+			{
+				ScopedSpan span(uiHandle, "configure");
+				if (cache.input() != sweep.config.eInput) {
+					if (cache.switchInput(uiHandle, sweep.config.eInput) != 0) {
+						result.iError = -1;
+						result.strError = "CT400_SwitchInput failed";
+						return;
+					}
+					report.iSwitches++;
+				}
+				if (cache.apply(uiHandle, sweep.config) < 0) {
+					result.iError = -1;
+					result.strError = "Scan configuration failed";
+					return;
+				}
+			}
+			char tcError[1024];
+			tcError[0] = '\0';
+			Clock::time_point tStart = Clock::now();
+			if (CT400_ScanStart(uiHandle) != 0) {
+				result.iError = -1;
+				result.strError = "CT400_ScanStart failed";
+			}
+			else {
+				result.iError = CT400_ScanWaitEnd(uiHandle, tcError);
+				result.strError = tcError;
+			}
+			if (result.iError != 0) {
+				cache.invalidate();
+				return;
+			}
+			Clock::time_point tEnd = Clock::now();
+			result.dScanTime = seconds(tStart, tEnd);
+			report.dSweepTime += result.dScanTime;
+			recordSpan(uiHandle, "sweep", result.dScanTime);
+			// Pout is needed to normalise the calibrated rows
+			if (result.data->fetchResampled(uiHandle, detectors, calibration != nullptr) < 0) {
+				result.iError = -1;
+				result.strError = "Sweep retrieval failed";
+			}
+			result.dFetchTime = seconds(tEnd, Clock::now());
+			recordSpan(uiHandle, "fetch", result.dFetchTime);
+		});
+		if (result.iError != 0)
+			result.data.reset();
+
+		workers.post([&, result]() {
+			Clock::time_point tStart = Clock::now();
+			for (size_t i = 0; i < sweep.jobs.size(); i++) {
+				const size_t uiJob = sweep.jobs[i];
+				SweepResult job = result;
+				if (job.iError == 0) {
+					const rScanConfig &config = pending[uiJob];
+					if (sweep.jobs.size() > 1 || detectorKey(config) != detectorKey(sweep.config))
+						job.data = extract(*result.data, config);
+					if (calibration && calibration->apply(config.eInput, *job.data, eUnit) != 0) {
+						job.iError = -1;
+						job.strError = "Calibration failed";
+						job.data.reset();
+					}
+				}
+				job.dProcessTime = seconds(tStart, Clock::now());
+				finish(uiJob, job);
+			}
+			recordSpan(m_device->handle(), "analyse", seconds(tStart, Clock::now()));
+		});
+	}
+	workers.waitIdle();
+
+	report.dElapsed = seconds(tRun, Clock::now());
+	report.dUtilisation = report.dElapsed > 0.0 ? std::min(report.dSweepTime / report.dElapsed, 1.0) : 0.0;
+	report.iConfigCalls = (int32_t)(cache.sent() - uiSentBefore) - report.iSwitches;
+	report.iFailed = report.iJobs - iResults;
+	return iResults;
+}
+
+} // namespace ct400
@@ -0,0 +1,219 @@
+/******************************************************************************/
+/* Header file for CT400_input_scheduler.cpp                                  */
+/*                                                                            */
+/* Sweeps queued for several laser inputs (e.g. O, C and L band sources on   */
+/* LI_1 to LI_3) run in an order that switches each input once and resends   */
+/* as few settings as possible, with host-side calibration per input.         */
+/******************************************************************************/
+
+#ifndef CT400_INPUT_SCHEDULER_H
+#define CT400_INPUT_SCHEDULER_H
+
+#include "CT400_calibration.h"
+#include "CT400_config.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef struct
+  {
+	int32_t iJobs;                  // sweeps asked for
+	int32_t iSweeps;                // sweeps made, after merging compatible jobs
+	int32_t iFailed;                // jobs without a result
+	int32_t iSwitches;              // CT400_SwitchInput calls sent
+	int32_t iConfigCalls;           // CT400_SetLaser, SetScan... calls sent
+	int32_t iNaiveSwitches;         // the same in submission order, one sweep
+	int32_t iNaiveConfigCalls;      // per job (estimated)
+	int32_t iReserved;
+	double dElapsed;                // s
+	double dSweepTime;              // s from CT400_ScanStart to end of sweep, all sweeps
+	double dUtilisation;            // dSweepTime / dElapsed
+  } rSchedulerReport;
+
+//------------------------------ CT400_SchedulerCreate -------------------------
+// Function CT400_SchedulerCreate
+//
+//  Purpose: Creates an empty sweep queue for a CT400
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//  Returns:  uiScheduler for use in the other CT400_Scheduler functions,
+//            0 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC uint64_t __stdcall CT400_SchedulerCreate(uint64_t uiHandle);
+
+//------------------------------ CT400_SchedulerSetCalibration -----------------
+// Function CT400_SchedulerSetCalibration
+//
+//  Purpose: Applies the references of a calibration to every result, with
+//           those of the input each job ran on (see CT400_CalibrationApply)
+//
+//  Parameters: IN uiScheduler: from CT400_SchedulerCreate
+//              IN uiCalibration: from CT400_CalibrationCreate, or 0 for none
+//              IN eUnit: Unit_dBm (dB) or Unit_mW (linear)
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerSetCalibration(
+uint64_t uiScheduler, uint64_t uiCalibration, rUnit eUnit);
+
+//------------------------------ CT400_SchedulerSubmit -------------------------
+// Function CT400_SchedulerSubmit
+//
+//  Purpose: Queues a sweep: its input (eInput), laser, span and detectors
+//
+//  Parameters: IN uiScheduler: from CT400_SchedulerCreate
+//              IN pConfig: configuration of the sweep
+//  Returns:  job index (0 for the first job since the last
+//            CT400_SchedulerClear), -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerSubmit(uint64_t uiScheduler,
+const rScanConfig *pConfig);
+
+//------------------------------ CT400_SchedulerRun ----------------------------
+// Function CT400_SchedulerRun
+//
+//  Purpose: Sweeps every job queued since the last run. Jobs are sorted by
+//           input (the current one first), then by laser and scan
+//           settings; jobs differing only in their detectors share one
+//           sweep. Calibration runs on a worker thread while the next sweep
+//           is under way.
+//
+//  Parameters: IN uiScheduler: from CT400_SchedulerCreate
+//              IN/OUT pReport: pointer over a variable, or NULL
+//  Returns:  number of jobs with a result, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerRun(uint64_t uiScheduler,
+rSchedulerReport *pReport);
+
+//------------------------------ CT400_SchedulerGetResult ----------------------
+// Function CT400_SchedulerGetResult
+//
+//  Purpose: Copies the resampled arrays of a job
+//
+//  Parameters: IN uiScheduler: from CT400_SchedulerCreate
+//              IN iJob: from CT400_SchedulerSubmit
+//              IN/OUT dWavelength: pointer over an initialized array of
+//                                  iArraySize values (NULL if iArraySize is 0)
+//              IN/OUT dBlock: pointer over an initialized array of
+//                             iArraySize values per enabled detector of the
+//                             job (DE_1, then DE_2 to DE_5 when enabled)
+//              IN iArraySize: size of one block row, 0 to get the number
+//                             of points only
+//              IN/OUT pcError: pointer over an initialized array of 1024
+//                              characters, or NULL (sweep error, if any)
+//  Returns:  number of points of the job (only the first iArraySize are
+//            written), -1 otherwise (no result yet, or the sweep failed)
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerGetResult(uint64_t uiScheduler,
+int32_t iJob, double dWavelength[], double dBlock[], int32_t iArraySize,
+char *pcError);
+
+//------------------------------ CT400_SchedulerClear --------------------------
+// Function CT400_SchedulerClear
+//
+//  Purpose: Removes every job and result
+//
+//  Parameters: IN uiScheduler: from CT400_SchedulerCreate
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerClear(uint64_t uiScheduler);
+
+//------------------------------ CT400_SchedulerDestroy ------------------------
+// Function CT400_SchedulerDestroy
+//
+//  Parameters: IN uiScheduler: from CT400_SchedulerCreate
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_SchedulerDestroy(uint64_t uiScheduler);
+
+#ifdef __cplusplus
+}
+
+#include "CT400_scan_engine.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ct400
+{
+
+class Device;
+
+// One sweep of a plan, serving every job in jobs (the detectors of config
+// are those of all of them)
+struct PlannedSweep
+{
+	rScanConfig config;
+	std::vector<size_t> jobs;
+};
+
+// Sweeps for the jobs, in the order InputScheduler::run() makes them.
+// iFirstInput (0 if unknown) is the input selected before the first sweep.
+std::vector<PlannedSweep> planSweeps(const std::vector<rScanConfig> &jobs, int32_t iFirstInput);
+
+// CT400_SwitchInput and settings calls needed to run configs in that order
+// from an unknown state, as the configuration cache would send them
+void countConfigCalls(const std::vector<rScanConfig> &configs, int32_t &iSwitches, int32_t &iCalls);
+
+//------------------------------ InputScheduler --------------------------------
+// Class InputScheduler
+//
+//  Purpose: Queue of sweeps on several inputs of one CT400. run() switches
+//           inputs and sends settings through the configuration cache of the
+//           Device, so each input is selected once per run and a laser that
+//           kept its settings since the last visit is not reprogrammed over
+//           GPIB. Results are calibrated with the references of their own
+//           input, so the inputs need no calibration sweep after switching.
+//           submit() and the result accessors may be used from any thread,
+//           but not during run().
+//------------------------------------------------------------------------------
+class InputScheduler
+{
+public:
+	// Called on a worker thread for every job once its result is ready
+	typedef std::function<void(size_t uiJob, const SweepResult &result)> JobProcessor;
+
+	explicit InputScheduler(uint64_t uiHandle, size_t uiWorkers = 2);
+
+	// calibration = nullptr: results in dBm, as retrieved
+	void setCalibration(std::shared_ptr<const Calibration> calibration, rUnit eUnit = Unit_dBm);
+
+	// Returns the job index
+	size_t submit(const rScanConfig &config);
+	size_t jobs() const;
+	void clear();
+
+	// Runs the jobs queued since the last run. Returns the number of jobs
+	// with a result, -1 otherwise (e.g. nothing to run)
+	int32_t run(rSchedulerReport &report, JobProcessor process = nullptr);
+
+	// Copies the result of a job (its data stays shared). Returns false
+	// before the job ran
+	bool result(size_t uiJob, SweepResult &result) const;
+
+private:
+	// Copies the rows of a job out of the sweep shared with other jobs
+	std::shared_ptr<ScanBuffer> extract(const ScanBuffer &sweep, const rScanConfig &config) const;
+
+	std::shared_ptr<Device> m_device;
+	size_t m_uiWorkers;
+	std::shared_ptr<const Calibration> m_calibration;
+	rUnit m_eUnit = Unit_dBm;
+
+	mutable std::mutex m_mtx;
+	std::vector<rScanConfig> m_configs;
+	std::vector<SweepResult> m_results;
+	std::vector<bool> m_done;
+	size_t m_uiFirstPending = 0;    // jobs before this one already ran
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
@@ -0,0 +1,810 @@
+//------------------------------------------------------------------------------
+// CT400_job_runner.cpp
+//
+// A wafer map is hundreds of configure + sweep cycles; run from a notebook,
+// a failed CT400_ScanWaitEnd or a dead kernel loses the place in the map
+// and often the sweeps taken so far. The runner takes the whole recipe,
+// stores each sweep as soon as it is retrieved and journals its progress,
+// so a run stopped by anything resumes at the first job without a result.
+//
+// Record types of the journal:
+//   RECORD_RECIPE     RecipeHeader, inputs (int32), configurations
+//   RECORD_DONE       JobEvent: the job's result is record uiRecord
+//   RECORD_FAILED     JobEvent: a sweep of the job failed
+//   RECORD_ABANDONED  JobEvent: the run gave up on the job
+//   RECORD_REINIT     JobEvent: the handle was closed and opened again
+// A record is valid if its magic, size and CRC are; replay stops at the
+// first invalid one, which only a crash while appending can leave.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_job_runner.h"
+#include "CT400_device.h"
+#include "CT400_retrieve.h"
+#include "CT400_span.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <map>
+
+#if defined (_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+const char JOURNAL_MAGIC[4] = { 'J', 'R', 'N', '1' };
+const uint32_t MAX_PAYLOAD = 64 << 20;
+
+enum : uint32_t
+{
+	RECORD_RECIPE = 1,
+	RECORD_DONE,
+	RECORD_FAILED,
+	RECORD_ABANDONED,
+	RECORD_REINIT
+};
+
+struct RecipeHeader
+{
+	int32_t iSites;
+	int32_t iNbInputs;
+	int32_t iNbConfigs;
+	int32_t iReserved;
+};
+
+struct JobEvent
+{
+	int32_t iJob;
+	int32_t iError;
+	uint64_t uiRecord;
+	int64_t iTimestamp;             // us since 1970
+	char tcError[256];
+};
+
+double seconds(Clock::time_point tFrom, Clock::time_point tTo)
+{
+	return std::chrono::duration<double>(tTo - tFrom).count();
+}
+
+int64_t nowMicroseconds()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// CRC-32 (IEEE 802.3, as zlib), continued from uiCrc
+uint32_t crc32(uint32_t uiCrc, const void *pData, size_t uiSize)
+{
+	static const struct Table
+	{
+		uint32_t ui[256];
+		Table()
+		{
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; k++)
+					c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				ui[i] = c;
+			}
+		}
+	} table;
+	const uint8_t *p = static_cast<const uint8_t *>(pData);
+	uiCrc = ~uiCrc;
+	for (size_t i = 0; i < uiSize; i++)
+		uiCrc = table.ui[(uiCrc ^ p[i]) & 0xFF] ^ (uiCrc >> 8);
+	return ~uiCrc;
+}
+
+uint32_t recordCrc(const ct400::JournalRecord &record, const void *pPayload, size_t uiSize)
+{
+	return crc32(crc32(0, &record, offsetof(ct400::JournalRecord, uiCrc)), pPayload, uiSize);
+}
+
+void copyError(char *pcTo, size_t uiSize, const std::string &strError)
+{
+	const size_t uiLength = std::min(strError.size(), uiSize - 1);
+	std::memcpy(pcTo, strError.data(), uiLength);
+	pcTo[uiLength] = '\0';
+}
+
+int32_t syncFile(FILE *pFile)
+{
+	if (std::fflush(pFile) != 0)
+		return -1;
+#if defined (_WIN32)
+	return _commit(_fileno(pFile)) == 0 ? 0 : -1;
+#else
+	return fsync(fileno(pFile)) == 0 ? 0 : -1;
+#endif
+}
+
+int32_t truncateFile(FILE *pFile, uint64_t uiSize)
+{
+	if (std::fflush(pFile) != 0)
+		return -1;
+#if defined (_WIN32)
+	return _chsize_s(_fileno(pFile), (__int64)uiSize) == 0 ? 0 : -1;
+#else
+	return ftruncate(fileno(pFile), (off_t)uiSize) == 0 ? 0 : -1;
+#endif
+}
+
+} // namespace
+
+
+namespace ct400
+{
+
+static_assert(sizeof(JournalRecord) == 16, "JournalRecord layout");
+static_assert(sizeof(rRunnerJob) == 304, "rRunnerJob layout");
+
+JobRunner::JobRunner(uint64_t uiHandle) : m_device(Device::forHandle(uiHandle))
+{
+	CT400_DefaultRunnerPolicy(&m_policy);
+	std::memset(&m_report, 0, sizeof(m_report));
+	m_report.iCurrentJob = -1;
+}
+
+int32_t JobRunner::open(const std::string &strJournal, const std::string &strResults)
+{
+	close();
+	m_pJournal = std::fopen(strJournal.c_str(), "r+b");
+	if (m_pJournal == nullptr)
+		m_pJournal = std::fopen(strJournal.c_str(), "w+b");
+	if (m_pJournal == nullptr)
+		return -1;
+	m_strJournal = strJournal;
+	m_strResults = strResults;
+	if (m_writer.open(strResults) != 0 || replay() != 0) {
+		close();
+		return -1;
+	}
+	// a result the results file lost (e.g. it was replaced) is run again
+	std::lock_guard<std::mutex> lock(m_mtx);
+	for (rRunnerJob &job : m_jobs)
+		if (job.eState == JS_DONE && job.uiRecord >= m_writer.records())
+			job.eState = JS_PENDING;
+	return 0;
+}
+
+void JobRunner::close()
+{
+	stop();
+	if (m_pJournal)
+		std::fclose(m_pJournal);
+	m_pJournal = nullptr;
+	m_writer.close();
+	m_reader.close();
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_recipe = Recipe();
+	m_jobs.clear();
+}
+
+int32_t JobRunner::replay()
+{
+	if (std::fseek(m_pJournal, 0, SEEK_SET) != 0)
+		return -1;
+	uint64_t uiValid = 0;
+	std::vector<uint8_t> payload;
+	for (;;) {
+		JournalRecord record;
+		if (std::fread(&record, sizeof(record), 1, m_pJournal) != 1
+			|| std::memcmp(record.tcMagic, JOURNAL_MAGIC, sizeof(record.tcMagic)) != 0
+			|| record.uiSize > MAX_PAYLOAD)
+			break;
+		payload.resize(record.uiSize);
+		if ((record.uiSize > 0 && std::fread(payload.data(), record.uiSize, 1, m_pJournal) != 1)
+			|| recordCrc(record, payload.data(), payload.size()) != record.uiCrc)
+			break;
+		// events before the recipe cannot belong to it
+		if (record.uiType != RECORD_RECIPE && m_jobs.empty())
+			break;
+		apply(record.uiType, payload.data(), payload.size());
+		uiValid += sizeof(record) + record.uiSize;
+	}
+	// drops a record cut short by a crash, then appends after the others
+	if (truncateFile(m_pJournal, uiValid) != 0 || std::fseek(m_pJournal, (long)uiValid, SEEK_SET) != 0)
+		return -1;
+	return 0;
+}
+
+void JobRunner::apply(uint32_t uiType, const uint8_t *pPayload, size_t uiSize)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	if (uiType == RECORD_RECIPE) {
+		RecipeHeader header;
+		if (uiSize < sizeof(header) || !m_jobs.empty())
+			return;
+		std::memcpy(&header, pPayload, sizeof(header));
+		const size_t uiInputs = (size_t)std::max(header.iNbInputs, 0);
+		const size_t uiConfigs = (size_t)std::max(header.iNbConfigs, 0);
+		if (uiSize != sizeof(header) + uiInputs * sizeof(int32_t) + uiConfigs * sizeof(rScanConfig))
+			return;
+		m_recipe.iSites = header.iSites;
+		m_recipe.inputs.resize(uiInputs);
+		m_recipe.configs.resize(uiConfigs);
+		if (uiInputs > 0)
+			std::memcpy(m_recipe.inputs.data(), pPayload + sizeof(header), uiInputs * sizeof(int32_t));
+		if (uiConfigs > 0)
+			std::memcpy(m_recipe.configs.data(), pPayload + sizeof(header) + uiInputs * sizeof(int32_t),
+				uiConfigs * sizeof(rScanConfig));
+		expand();
+		return;
+	}
+
+	JobEvent event;
+	if (uiSize != sizeof(event))
+		return;
+	std::memcpy(&event, pPayload, sizeof(event));
+	if (event.iJob < 0 || (size_t)event.iJob >= m_jobs.size())
+		return;
+	rRunnerJob &job = m_jobs[event.iJob];
+	switch (uiType) {
+	case RECORD_DONE:
+		job.eState = JS_DONE;
+		job.iAttempts++;
+		job.uiRecord = event.uiRecord;
+		job.iTimestamp = event.iTimestamp;
+		break;
+	case RECORD_FAILED:
+		job.iAttempts++;
+		job.iLastError = event.iError;
+		std::memcpy(job.tcError, event.tcError, sizeof(job.tcError));
+		job.tcError[sizeof(job.tcError) - 1] = '\0';
+		break;
+	case RECORD_ABANDONED:
+		if (job.eState != JS_DONE)
+			job.eState = JS_ABANDONED;
+		break;
+	default:
+		break;
+	}
+}
+
+void JobRunner::expand()
+{
+	// site by site, then input by input, so that a site is visited once and
+	// each input selected once per site
+	m_jobs.clear();
+	const size_t uiInputs = std::max<size_t>(m_recipe.inputs.size(), 1);
+	for (int32_t iSite = 0; iSite < m_recipe.iSites; iSite++)
+		for (size_t i = 0; i < uiInputs; i++)
+			for (size_t c = 0; c < m_recipe.configs.size(); c++) {
+				rRunnerJob job;
+				std::memset(&job, 0, sizeof(job));
+				job.iSite = iSite;
+				job.eInput = m_recipe.inputs.empty() ? m_recipe.configs[c].eInput : m_recipe.inputs[i];
+				job.iConfig = (int32_t)c;
+				job.iNbDetectors = (int32_t)enabledDetectors(m_recipe.configs[c]).size();
+				job.eState = JS_PENDING;
+				m_jobs.push_back(job);
+			}
+}
+
+int32_t JobRunner::append(uint32_t uiType, const void *pPayload, size_t uiSize)
+{
+	if (m_pJournal == nullptr)
+		return -1;
+	JournalRecord record;
+	std::memcpy(record.tcMagic, JOURNAL_MAGIC, sizeof(record.tcMagic));
+	record.uiType = uiType;
+	record.uiSize = (uint32_t)uiSize;
+	record.uiCrc = recordCrc(record, pPayload, uiSize);
+	if (std::fwrite(&record, sizeof(record), 1, m_pJournal) != 1
+		|| (uiSize > 0 && std::fwrite(pPayload, uiSize, 1, m_pJournal) != 1))
+		return -1;
+	return syncFile(m_pJournal);
+}
+
+int32_t JobRunner::setRecipe(int32_t iSites, const std::vector<int32_t> &inputs,
+	const std::vector<rScanConfig> &configs)
+{
+	if (m_pJournal == nullptr || iSites <= 0 || configs.empty())
+		return -1;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		if (m_bRunning)
+			return -1;
+		if (!m_jobs.empty()) {
+			const bool bSame = m_recipe.iSites == iSites && m_recipe.inputs == inputs
+				&& m_recipe.configs.size() == configs.size()
+				&& std::memcmp(m_recipe.configs.data(), configs.data(), configs.size() * sizeof(rScanConfig)) == 0;
+			return bSame ? (int32_t)m_jobs.size() : -1;
+		}
+	}
+	RecipeHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.iSites = iSites;
+	header.iNbInputs = (int32_t)inputs.size();
+	header.iNbConfigs = (int32_t)configs.size();
+	std::vector<uint8_t> payload(sizeof(header) + inputs.size() * sizeof(int32_t)
+		+ configs.size() * sizeof(rScanConfig));
+	std::memcpy(payload.data(), &header, sizeof(header));
+	if (!inputs.empty())
+		std::memcpy(payload.data() + sizeof(header), inputs.data(), inputs.size() * sizeof(int32_t));
+	std::memcpy(payload.data() + sizeof(header) + inputs.size() * sizeof(int32_t), configs.data(),
+		configs.size() * sizeof(rScanConfig));
+	if (payload.size() > MAX_PAYLOAD || append(RECORD_RECIPE, payload.data(), payload.size()) != 0)
+		return -1;
+	apply(RECORD_RECIPE, payload.data(), payload.size());
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return (int32_t)m_jobs.size();
+}
+
+void JobRunner::setPolicy(const rRunnerPolicy &policy)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_policy = policy;
+	m_policy.iMaxAttempts = std::max(m_policy.iMaxAttempts, 1);
+}
+
+void JobRunner::setSiteSetup(SiteSetup setup)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_siteSetup = setup;
+}
+
+rScanConfig JobRunner::config(size_t uiJob) const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	rScanConfig config = m_recipe.configs[m_jobs[uiJob].iConfig];
+	config.eInput = (rLaserInput)m_jobs[uiJob].eInput;
+	return config;
+}
+
+uint64_t JobRunner::handle() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_device->handle();
+}
+
+rRunnerReport JobRunner::report() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	rRunnerReport report = m_report;
+	report.iJobs = (int32_t)m_jobs.size();
+	report.iDone = report.iAbandoned = report.iPending = 0;
+	for (const rRunnerJob &job : m_jobs) {
+		if (job.eState == JS_DONE)
+			report.iDone++;
+		else if (job.eState == JS_ABANDONED)
+			report.iAbandoned++;
+		else
+			report.iPending++;
+	}
+	report.uiHandle = m_device->handle();
+	return report;
+}
+
+int32_t JobRunner::job(size_t uiJob, rRunnerJob &job) const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	if (uiJob >= m_jobs.size())
+		return -1;
+	job = m_jobs[uiJob];
+	return 0;
+}
+
+void JobRunner::stop()
+{
+	std::shared_ptr<Device> device;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		if (!m_bRunning)
+			return;
+		m_bStop = true;
+		device = m_device;
+	}
+	m_cvStop.notify_all();
+	device->stop();
+}
+
+bool JobRunner::wait(double dSeconds)
+{
+	std::unique_lock<std::mutex> lock(m_mtx);
+	return !m_cvStop.wait_for(lock, std::chrono::duration<double>(dSeconds), [this] { return m_bStop.load(); });
+}
+
+int64_t JobRunner::sweep(size_t uiJob, int32_t &iError, std::string &strError)
+{
+	const rScanConfig config = this->config(uiJob);
+	const std::vector<rDetector> detectors = enabledDetectors(config);
+	std::shared_ptr<Device> device;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		device = m_device;
+	}
+	ScanBuffer buffer;
+	iError = 0;
+	device->call([&](uint64_t uiHandle) {
+		ConfigCache &cache = device->configCache();
+		auto fail = [&](const char *pcError) {
+			iError = -1;
+			strError = pcError;
+			cache.invalidate();
+		};
+		{
+			ScopedSpan span(uiHandle, "configure");
+			if (cache.input() != config.eInput && cache.switchInput(uiHandle, config.eInput) != 0)
+				return fail("CT400_SwitchInput failed");
+			if (cache.apply(uiHandle, config) < 0)
+				return fail("Scan configuration failed");
+		}
+		char tcError[1024];
+		tcError[0] = '\0';
+		const Clock::time_point tStart = Clock::now();
+		if (CT400_ScanStart(uiHandle) != 0)
+			return fail("CT400_ScanStart failed");
+		iError = CT400_ScanWaitEnd(uiHandle, tcError);
+		const Clock::time_point tEnd = Clock::now();
+		recordSpan(uiHandle, "sweep", seconds(tStart, tEnd));
+		if (iError != 0) {
+			strError = tcError;
+			cache.invalidate();
+			return;
+		}
+		if (buffer.fetchResampled(uiHandle, detectors, true) < 0)
+			return fail("Sweep retrieval failed");
+		recordSpan(uiHandle, "fetch", seconds(tEnd, Clock::now()));
+	});
+	if (iError != 0)
+		return -1;
+
+	SweepInfo info;
+	info.config = config;
+	info.iDataPoints = (int32_t)buffer.points();
+	const int64_t iRecord = m_writer.append(info, buffer);
+	if (iRecord < 0 || m_writer.flush(true) != 0) {
+		iError = -1;
+		strError = "Result could not be written";
+		return -1;
+	}
+	return iRecord;
+}
+
+int32_t JobRunner::reinitialise()
+{
+	std::shared_ptr<Device> device;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		device = m_device;
+	}
+	const uint64_t uiOld = device->handle();
+	// waits for anything still using the handle
+	device->call([](uint64_t uiHandle) { return CT400_Close(uiHandle); });
+	Device::release(uiOld);
+	int32_t iError = 0;
+	const uint64_t uiHandle = CT400_Init(&iError);
+	if (uiHandle == 0)
+		return -1;
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_device = Device::forHandle(uiHandle);
+	return 0;
+}
+
+int32_t JobRunner::run(rRunnerReport *pReport)
+{
+	rRunnerPolicy policy;
+	SiteSetup siteSetup;
+	size_t uiJobs;
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		if (m_bRunning || m_pJournal == nullptr || m_jobs.empty()) {
+			// the caller still learns the current handle
+			lock.unlock();
+			if (pReport)
+				*pReport = report();
+			return -1;
+		}
+		m_bRunning = true;
+		m_bStop = false;
+		policy = m_policy;
+		siteSetup = m_siteSetup;
+		uiJobs = m_jobs.size();
+		std::memset(&m_report, 0, sizeof(m_report));
+		m_report.iCurrentJob = -1;
+	}
+	const Clock::time_point tRun = Clock::now();
+	int32_t iStatus = 0;
+	int32_t iSite = -1;
+	bool bSiteReady = false;
+	int32_t iFailedInRow = 0;
+
+	auto event = [&](uint32_t uiType, size_t uiJob, int32_t iError, uint64_t uiRecord, const std::string &strError) {
+		JobEvent jobEvent;
+		std::memset(&jobEvent, 0, sizeof(jobEvent));
+		jobEvent.iJob = (int32_t)uiJob;
+		jobEvent.iError = iError;
+		jobEvent.uiRecord = uiRecord;
+		jobEvent.iTimestamp = nowMicroseconds();
+		copyError(jobEvent.tcError, sizeof(jobEvent.tcError), strError);
+		if (append(uiType, &jobEvent, sizeof(jobEvent)) != 0)
+			return false;
+		apply(uiType, reinterpret_cast<const uint8_t *>(&jobEvent), sizeof(jobEvent));
+		return true;
+	};
+
+	for (size_t uiJob = 0; uiJob < uiJobs && !m_bStop && iStatus == 0; uiJob++) {
+		rRunnerJob current;
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			current = m_jobs[uiJob];
+			if (current.eState == JS_DONE)
+				continue;
+			m_report.iCurrentJob = (int32_t)uiJob;
+		}
+		if (current.iSite != iSite) {
+			iSite = current.iSite;
+			bSiteReady = !siteSetup || siteSetup(iSite) == 0;
+		}
+		if (!bSiteReady) {
+			if (!event(RECORD_ABANDONED, uiJob, -1, 0, "Site setup failed"))
+				iStatus = -1;
+			continue;
+		}
+
+		for (int32_t iAttempt = 0; !m_bStop; iAttempt++) {
+			int32_t iError = 0;
+			std::string strError;
+			const int64_t iRecord = sweep(uiJob, iError, strError);
+			{
+				std::lock_guard<std::mutex> lock(m_mtx);
+				m_report.iSweeps++;
+			}
+			if (iRecord >= 0) {
+				iFailedInRow = 0;
+				if (!event(RECORD_DONE, uiJob, 0, (uint64_t)iRecord, std::string()))
+					iStatus = -1;
+				break;
+			}
+			// a sweep stopped by stop() runs again next time
+			if (m_bStop)
+				break;
+			iFailedInRow++;
+			if (!event(RECORD_FAILED, uiJob, iError, 0, strError)) {
+				iStatus = -1;
+				break;
+			}
+			if (iAttempt + 1 >= policy.iMaxAttempts) {
+				if (!event(RECORD_ABANDONED, uiJob, iError, 0, strError))
+					iStatus = -1;
+				break;
+			}
+
+			const double dBackoff = std::min(policy.dBackoff * std::pow(2.0, iAttempt), policy.dMaxBackoff);
+			{
+				std::lock_guard<std::mutex> lock(m_mtx);
+				m_report.iRetries++;
+				m_report.dBackoffTime += std::max(dBackoff, 0.0);
+			}
+			if (dBackoff > 0.0 && !wait(dBackoff))
+				break;
+			std::shared_ptr<Device> device;
+			{
+				std::lock_guard<std::mutex> lock(m_mtx);
+				device = m_device;
+			}
+			const bool bConnected = device->call([](uint64_t uiHandle) {
+				return CT400_CheckConnected(uiHandle) == 1;
+			});
+			if (!bConnected || (policy.iReinitAfter > 0 && iFailedInRow >= policy.iReinitAfter)) {
+				const int32_t iReinit = reinitialise();
+				{
+					std::lock_guard<std::mutex> lock(m_mtx);
+					m_report.iReinits++;
+				}
+				if (iReinit == 0)
+					iFailedInRow = 0;
+				if (!event(RECORD_REINIT, uiJob, iReinit, 0, iReinit == 0 ? "" : "CT400_Init failed")) {
+					iStatus = -1;
+					break;
+				}
+			}
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_report.iCurrentJob = -1;
+		m_report.dElapsed = seconds(tRun, Clock::now());
+		m_bRunning = false;
+	}
+	const rRunnerReport done = report();
+	if (pReport)
+		*pReport = done;
+	return iStatus == 0 ? done.iDone : -1;
+}
+
+int64_t JobRunner::result(size_t uiJob, std::vector<double> &wavelength, std::vector<double> &block,
+	std::vector<double> &power)
+{
+	rRunnerJob state;
+	if (job(uiJob, state) != 0 || state.eState != JS_DONE)
+		return -1;
+	const std::vector<rDetector> detectors = enabledDetectors(config(uiJob));
+	if (state.uiRecord >= m_reader.size()) {
+		// the writer syncs every result, so the mapping only needs renewing
+		if (m_reader.open(m_strResults) != 0 || state.uiRecord >= m_reader.size())
+			return -1;
+	}
+	const int64_t iPoints = m_reader.read((size_t)state.uiRecord, COL_WAVELENGTH, wavelength);
+	if (iPoints < 0 || m_reader.read((size_t)state.uiRecord, COL_POWER, power) != iPoints)
+		return -1;
+	block.resize(detectors.size() * (size_t)iPoints);
+	std::vector<double> row;
+	for (size_t d = 0; d < detectors.size(); d++) {
+		if (m_reader.read((size_t)state.uiRecord, detectors[d], row) != iPoints)
+			return -1;
+		std::copy(row.begin(), row.end(), block.begin() + d * iPoints);
+	}
+	return iPoints;
+}
+
+} // namespace ct400
+
+
+
+namespace
+{
+
+std::mutex g_mtx;
+std::map<uint64_t, std::shared_ptr<ct400::JobRunner> > g_runners;
+uint64_t g_uiNextRunner = 1;
+
+std::shared_ptr<ct400::JobRunner> findRunner(uint64_t uiRunner)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	auto it = g_runners.find(uiRunner);
+	return it == g_runners.end() ? nullptr : it->second;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultRunnerPolicy(rRunnerPolicy *pPolicy)
+{
+	if (pPolicy == nullptr)
+		return -1;
+	pPolicy->iMaxAttempts = 4;
+	pPolicy->iReinitAfter = 2;
+	pPolicy->dBackoff = 1.0;
+	pPolicy->dMaxBackoff = 60.0;
+	return 0;
+}
+
+_EXT_DECLSPEC uint64_t __stdcall CT400_RunnerOpen(uint64_t uiHandle,
+const char *pcJournal, const char *pcResults)
+{
+	if (uiHandle == 0 || pcJournal == nullptr || pcResults == nullptr)
+		return 0;
+	auto runner = std::make_shared<ct400::JobRunner>(uiHandle);
+	if (runner->open(pcJournal, pcResults) != 0)
+		return 0;
+	std::lock_guard<std::mutex> lock(g_mtx);
+	uint64_t uiRunner = g_uiNextRunner++;
+	g_runners[uiRunner] = runner;
+	return uiRunner;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerSetRecipe(uint64_t uiRunner,
+int32_t iSites, const rLaserInput eInputs[], int32_t iNbInputs,
+const rScanConfig pConfigs[], int32_t iNbConfigs)
+{
+	auto runner = findRunner(uiRunner);
+	if (!runner || iNbInputs < 0 || (iNbInputs > 0 && eInputs == nullptr) || iNbConfigs <= 0 || pConfigs == nullptr)
+		return -1;
+	std::vector<int32_t> inputs;
+	for (int32_t i = 0; eInputs && i < iNbInputs; i++)
+		inputs.push_back(eInputs[i]);
+	return runner->setRecipe(iSites, inputs, std::vector<rScanConfig>(pConfigs, pConfigs + iNbConfigs));
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerSetPolicy(uint64_t uiRunner,
+const rRunnerPolicy *pPolicy)
+{
+	auto runner = findRunner(uiRunner);
+	if (!runner || pPolicy == nullptr || pPolicy->iMaxAttempts < 1 || pPolicy->iReinitAfter < 0
+		|| !(pPolicy->dBackoff >= 0.0) || !(pPolicy->dMaxBackoff >= 0.0))
+		return -1;
+	runner->setPolicy(*pPolicy);
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerSetSiteCallback(uint64_t uiRunner,
+CT400_SiteCallback pCallback, void *pContext)
+{
+	auto runner = findRunner(uiRunner);
+	if (!runner)
+		return -1;
+	if (pCallback)
+		runner->setSiteSetup([pCallback, pContext](int32_t iSite) { return pCallback(pContext, iSite); });
+	else
+		runner->setSiteSetup(nullptr);
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerRun(uint64_t uiRunner,
+rRunnerReport *pReport)
+{
+	auto runner = findRunner(uiRunner);
+	return runner ? runner->run(pReport) : -1;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerStop(uint64_t uiRunner)
+{
+	auto runner = findRunner(uiRunner);
+	if (!runner)
+		return -1;
+	runner->stop();
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerGetReport(uint64_t uiRunner,
+rRunnerReport *pReport)
+{
+	auto runner = findRunner(uiRunner);
+	if (!runner || pReport == nullptr)
+		return -1;
+	*pReport = runner->report();
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerGetJob(uint64_t uiRunner,
+int32_t iJob, rRunnerJob *pJob)
+{
+	auto runner = findRunner(uiRunner);
+	if (!runner || iJob < 0 || pJob == nullptr)
+		return -1;
+	return runner->job((size_t)iJob, *pJob);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerGetResult(uint64_t uiRunner,
+int32_t iJob, double dWavelength[], double dBlock[], double dPower[],
+int32_t iArraySize)
+{
+	auto runner = findRunner(uiRunner);
+	if (!runner || iJob < 0 || iArraySize < 0)
+		return -1;
+	std::vector<double> wavelength, block, power;
+	const int64_t iPoints = runner->result((size_t)iJob, wavelength, block, power);
+	if (iPoints < 0)
+		return -1;
+	const size_t uiCopy = std::min((size_t)iPoints, (size_t)iArraySize);
+	if (dWavelength)
+		std::copy(wavelength.begin(), wavelength.begin() + uiCopy, dWavelength);
+	if (dPower)
+		std::copy(power.begin(), power.begin() + uiCopy, dPower);
+	const size_t uiRows = block.size() / (size_t)std::max<int64_t>(iPoints, 1);
+	for (size_t d = 0; dBlock && d < uiRows; d++)
+		std::copy(block.begin() + d * iPoints, block.begin() + d * iPoints + uiCopy, dBlock + d * iArraySize);
+	return (int32_t)iPoints;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerClose(uint64_t uiRunner)
+{
+	std::shared_ptr<ct400::JobRunner> runner;
+	{
+		std::lock_guard<std::mutex> lock(g_mtx);
+		auto it = g_runners.find(uiRunner);
+		if (it == g_runners.end())
+			return -1;
+		runner = it->second;
+		g_runners.erase(it);
+	}
+	runner->close();
+	return 0;
+}
+
+}
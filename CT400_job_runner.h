@@ -0,0 +1,358 @@
+/******************************************************************************/
+/* Header file for CT400_job_runner.cpp                                       */
+/*                                                                            */
+/* Measurement recipes (sites x inputs x scan configurations) run from a      */
+/* crash-safe journal: every sweep is stored as soon as it is taken, failed   */
+/* sweeps are retried with backoff (reopening the CT400 if needed), and a     */
+/* run resumes at the first job without a result after any interruption.      */
+/******************************************************************************/
+
+#ifndef CT400_JOB_RUNNER_H
+#define CT400_JOB_RUNNER_H
+
+#include "CT400_config.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef enum
+  {
+	JS_PENDING = 0,                 // not run yet
+	JS_DONE,                        // result stored
+	JS_ABANDONED                    // failed iMaxAttempts times in a run, retried by the next run
+  } rJobState;
+
+  typedef struct
+  {
+	int32_t iMaxAttempts;           // sweeps per job and run (at least 1)
+	int32_t iReinitAfter;           // failed sweeps in a row before CT400_Close / CT400_Init, 0 for never
+	double dBackoff;                // s before the first retry, doubled at each retry
+	double dMaxBackoff;             // s
+  } rRunnerPolicy;
+
+  typedef struct
+  {
+	int32_t iSite;
+	int32_t eInput;                 // rLaserInput the job runs on
+	int32_t iConfig;                // index in the recipe configurations
+	int32_t eState;                 // rJobState
+	int32_t iAttempts;              // sweeps taken for the job, over every run
+	int32_t iLastError;             // CT400_ScanWaitEnd error of the last failed sweep, -1 on call failure
+	int32_t iNbDetectors;           // rows of the result: detectors enabled in its configuration
+	int32_t iReserved;
+	uint64_t uiRecord;              // of the result in the results file (JS_DONE)
+	int64_t iTimestamp;             // of the result, us since 1970
+	char tcError[256];              // of the last failed sweep
+  } rRunnerJob;
+
+  typedef struct
+  {
+	int32_t iJobs;
+	int32_t iDone;                  // over every run
+	int32_t iAbandoned;
+	int32_t iPending;
+	int32_t iSweeps;                // sweeps taken by the last run
+	int32_t iRetries;               // of the last run
+	int32_t iReinits;               // CT400_Close / CT400_Init of the last run
+	int32_t iCurrentJob;            // being run, -1 otherwise
+	uint64_t uiHandle;              // current handle (it changes on reinitialisation)
+	double dElapsed;                // s, last run
+	double dBackoffTime;            // s waited before retries, last run
+  } rRunnerReport;
+
+  // Called before the first job of each site (e.g. to move a wafer prober).
+  // Returns 0 if success; otherwise the jobs of the site are abandoned.
+  typedef int32_t (__stdcall *CT400_SiteCallback)(void *pContext,
+  int32_t iSite);
+
+//------------------------------ CT400_DefaultRunnerPolicy ---------------------
+// Function CT400_DefaultRunnerPolicy
+//
+//  Purpose: 4 attempts per job, reinitialisation after 2 failed sweeps in a
+//           row, 1 s backoff doubled up to 60 s
+//
+//  Parameters: IN/OUT pPolicy: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultRunnerPolicy(rRunnerPolicy *pPolicy);
+
+//------------------------------ CT400_RunnerOpen ------------------------------
+// Function CT400_RunnerOpen
+//
+//  Purpose: Opens a journal (created if needed) and its results file. The
+//           recipe and progress of an existing journal are read back, the
+//           record a crash may have left incomplete being dropped.
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN pcJournal: journal file
+//              IN pcResults: sweep file receiving the results
+//  Returns:  uiRunner for use in the other CT400_Runner functions,
+//            0 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC uint64_t __stdcall CT400_RunnerOpen(uint64_t uiHandle,
+const char *pcJournal, const char *pcResults);
+
+//------------------------------ CT400_RunnerSetRecipe -------------------------
+// Function CT400_RunnerSetRecipe
+//
+//  Purpose: Sets the jobs: every configuration on every input at every site,
+//           run site by site, then input by input. A journal that already
+//           holds a recipe only accepts the same one.
+//
+//  Parameters: IN uiRunner: from CT400_RunnerOpen
+//              IN iSites: number of sites (at least 1)
+//              IN eInputs: rLaserInput of each input, or NULL to run each
+//                          configuration on its own eInput
+//              IN iNbInputs: size of eInputs
+//              IN pConfigs: scan configurations
+//              IN iNbConfigs: size of pConfigs
+//  Returns:  number of jobs, -1 otherwise (e.g. another recipe in the
+//            journal)
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerSetRecipe(uint64_t uiRunner,
+int32_t iSites, const rLaserInput eInputs[], int32_t iNbInputs,
+const rScanConfig pConfigs[], int32_t iNbConfigs);
+
+//------------------------------ CT400_RunnerSetPolicy -------------------------
+// Function CT400_RunnerSetPolicy
+//
+//  Parameters: IN uiRunner: from CT400_RunnerOpen
+//              IN pPolicy: retry policy, from CT400_DefaultRunnerPolicy
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerSetPolicy(uint64_t uiRunner,
+const rRunnerPolicy *pPolicy);
+
+//------------------------------ CT400_RunnerSetSiteCallback -------------------
+// Function CT400_RunnerSetSiteCallback
+//
+//  Parameters: IN uiRunner: from CT400_RunnerOpen
+//              IN pCallback: called on the thread of CT400_RunnerRun, or NULL
+//              IN pContext: passed to pCallback
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerSetSiteCallback(uint64_t uiRunner,
+CT400_SiteCallback pCallback, void *pContext);
+
+//------------------------------ CT400_RunnerRun -------------------------------
+// Function CT400_RunnerRun
+//
+//  Purpose: Runs every job without a result, in order, until all are done
+//           or abandoned or CT400_RunnerStop is called. Each result is
+//           written and synced to the results file, then recorded in the
+//           journal, before the next sweep. The handle may be replaced (see
+//           CT400_RunnerGetReport): other users of the CT400 must not use
+//           it during the run.
+//
+//  Parameters: IN uiRunner: from CT400_RunnerOpen
+//              IN/OUT pReport: pointer over a variable, or NULL
+//  Returns:  number of jobs done (over every run), -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerRun(uint64_t uiRunner,
+rRunnerReport *pReport);
+
+//------------------------------ CT400_RunnerStop ------------------------------
+// Function CT400_RunnerStop
+//
+//  Purpose: Stops a run from another thread; the sweep under way is stopped
+//           and run again by the next run
+//
+//  Parameters: IN uiRunner: from CT400_RunnerOpen
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerStop(uint64_t uiRunner);
+
+//------------------------------ CT400_RunnerGetReport -------------------------
+// Function CT400_RunnerGetReport
+//
+//  Purpose: Progress, also during a run
+//
+//  Parameters: IN uiRunner: from CT400_RunnerOpen
+//              IN/OUT pReport: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerGetReport(uint64_t uiRunner,
+rRunnerReport *pReport);
+
+//------------------------------ CT400_RunnerGetJob ----------------------------
+// Function CT400_RunnerGetJob
+//
+//  Parameters: IN uiRunner: from CT400_RunnerOpen
+//              IN iJob: job index (0 to rRunnerReport.iJobs - 1)
+//              IN/OUT pJob: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerGetJob(uint64_t uiRunner,
+int32_t iJob, rRunnerJob *pJob);
+
+//------------------------------ CT400_RunnerGetResult -------------------------
+// Function CT400_RunnerGetResult
+//
+//  Purpose: Copies the result of a job from the results file
+//
+//  Parameters: IN uiRunner: from CT400_RunnerOpen
+//              IN iJob: job index
+//              IN/OUT dWavelength: pointer over an initialized array of
+//                                  iArraySize values, or NULL
+//              IN/OUT dBlock: pointer over an initialized array of
+//                             iArraySize values per enabled detector of the
+//                             job's configuration (DE_1, then DE_2 to DE_5
+//                             when enabled), or NULL
+//              IN/OUT dPower: pointer over an initialized array of
+//                             iArraySize values (Pout), or NULL
+//              IN iArraySize: size of one block row, 0 to get the number
+//                             of points only
+//  Returns:  number of points of the job (only the first iArraySize are
+//            written), -1 otherwise (no result)
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerGetResult(uint64_t uiRunner,
+int32_t iJob, double dWavelength[], double dBlock[], double dPower[],
+int32_t iArraySize);
+
+//------------------------------ CT400_RunnerClose -----------------------------
+// Function CT400_RunnerClose
+//
+//  Purpose: Closes the journal and the results file. The current handle
+//           (see CT400_RunnerGetReport) stays open.
+//
+//  Parameters: IN uiRunner: from CT400_RunnerOpen
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_RunnerClose(uint64_t uiRunner);
+
+#ifdef __cplusplus
+}
+
+#include "CT400_sweep_file.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ct400
+{
+
+class Device;
+
+// Journal layout: records of a JournalRecord header and its payload, the
+// CRC-32 of which covers the header fields before it and the payload. The
+// first record is the recipe; every later one is a job event (a result, a
+// failed sweep, an abandoned job) or a reinitialisation.
+struct JournalRecord
+{
+	char tcMagic[4];
+	uint32_t uiType;
+	uint32_t uiSize;                // of the payload
+	uint32_t uiCrc;
+};
+
+//------------------------------ JobRunner -------------------------------------
+// Class JobRunner
+//
+//  Purpose: Runs a recipe on one CT400 from a journal, so that a run killed
+//           at any point resumes with the first job without a result. A
+//           result goes to the results file (synced) before its journal
+//           record (synced), so a job is only recorded done once its data
+//           is on disk; a crash in between leaves an unreferenced sweep in
+//           the results file and the job runs again. Reopening the journal
+//           replays its records and cuts it after the last valid one.
+//           Failed sweeps are retried after a growing backoff; after
+//           iReinitAfter failures in a row, or as soon as
+//           CT400_CheckConnected fails, the handle is closed and the CT400
+//           opened again. Settings go through the configuration cache, so
+//           consecutive jobs send only what changes. One run at a time.
+//------------------------------------------------------------------------------
+class JobRunner
+{
+public:
+	// Called before the first job of each site; non-zero abandons the site
+	typedef std::function<int32_t(int32_t iSite)> SiteSetup;
+
+	explicit JobRunner(uint64_t uiHandle);
+	~JobRunner() { close(); }
+
+	JobRunner(const JobRunner &) = delete;
+	JobRunner &operator=(const JobRunner &) = delete;
+
+	// Returns 0 if success, -1 otherwise
+	int32_t open(const std::string &strJournal, const std::string &strResults);
+	void close();
+
+	// Returns the number of jobs, -1 otherwise
+	int32_t setRecipe(int32_t iSites, const std::vector<int32_t> &inputs, const std::vector<rScanConfig> &configs);
+	void setPolicy(const rRunnerPolicy &policy);
+	void setSiteSetup(SiteSetup setup);
+
+	// Returns the number of jobs done, -1 otherwise
+	int32_t run(rRunnerReport *pReport = nullptr);
+	// From any thread
+	void stop();
+
+	rRunnerReport report() const;
+	// Returns 0 if success, -1 otherwise
+	int32_t job(size_t uiJob, rRunnerJob &job) const;
+	// Configuration of a job (recipe configuration on the job's input)
+	rScanConfig config(size_t uiJob) const;
+	// Wavelength, detector rows (one after the other) and Pout of a result.
+	// Returns the number of points, -1 otherwise
+	int64_t result(size_t uiJob, std::vector<double> &wavelength, std::vector<double> &block,
+		std::vector<double> &power);
+
+	uint64_t handle() const;
+
+private:
+	struct Recipe
+	{
+		int32_t iSites = 0;
+		std::vector<int32_t> inputs;
+		std::vector<rScanConfig> configs;
+	};
+
+	// Adds a record to the journal and syncs it. Returns 0 if success, -1
+	// otherwise
+	int32_t append(uint32_t uiType, const void *pPayload, size_t uiSize);
+	// Reads the journal back. Returns 0 if success, -1 otherwise
+	int32_t replay();
+	void apply(uint32_t uiType, const uint8_t *pPayload, size_t uiSize);
+	void expand();
+
+	// One sweep of a job into the results file. Returns the record, -1
+	// otherwise (iError and strError set)
+	int64_t sweep(size_t uiJob, int32_t &iError, std::string &strError);
+	// CT400_Close then CT400_Init. Returns 0 if success, -1 otherwise
+	int32_t reinitialise();
+	// Sleeps up to dSeconds, returning early on stop(). Returns false if
+	// stopped
+	bool wait(double dSeconds);
+
+	std::shared_ptr<Device> m_device;
+	std::string m_strJournal;
+	FILE *m_pJournal = nullptr;
+	SweepFileWriter m_writer;
+	SweepFileReader m_reader;
+	std::string m_strResults;
+	rRunnerPolicy m_policy;
+	SiteSetup m_siteSetup;
+
+	mutable std::mutex m_mtx;
+	std::condition_variable m_cvStop;
+	Recipe m_recipe;
+	std::vector<rRunnerJob> m_jobs;
+	rRunnerReport m_report;
+	std::atomic<bool> m_bStop{ false };
+	bool m_bRunning = false;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
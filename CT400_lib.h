@@ -5,11 +5,18 @@
 
 #ifndef CT400_LIB_H
 #define CT400_LIB_H
+#if defined (_WIN32)
 #   if defined (CT400_LIB_EXPORT)
 #       define _DECLSPEC __declspec(dllexport)
 #   else
 #       define _DECLSPEC __declspec(dllimport)
 #   endif
+#else
+// Non-Windows builds (e.g. the CT400_sim.cpp simulator): no import/export
+// decoration and no calling convention.
+#   define _DECLSPEC __attribute__((visibility("default")))
+#   define __stdcall
+#endif
 
 // Definition of the integer types
 #include "CT400_Types.h"
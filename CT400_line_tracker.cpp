@@ -0,0 +1,379 @@
+//------------------------------------------------------------------------------
+// CT400_line_tracker.cpp
+//
+// The heterodyne detection returns only the wavelengths of the lines of a
+// sweep, in no guaranteed order and with lines coming and going as they
+// cross the scan range or fade. Following them over hours of back-to-back
+// sweeps therefore needs an association step before any filtering: each
+// track predicts its line, gates the candidates, and the pairs are taken
+// nearest first. With the lines sorted, the candidates of a track are found
+// by binary search, so an update is O((lines + tracks) log lines) and takes
+// microseconds against the seconds of a sweep.
+//
+// The alpha-beta filter runs on the time between sweeps (timestamps), so the
+// drift is in nm/s whatever the sweep rate, and a track missing a sweep
+// coasts on its drift until it is found again or lost.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_line_tracker.h"
+#include "CT400_device.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <map>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+const double SCATTER_WINDOW = 32.0;     // sweeps of the scatter average
+
+int64_t nowMicroseconds()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool validSettings(const rTrackerSettings &settings)
+{
+	return settings.dGate > 0.0 && settings.dGateSigma >= 0.0 && settings.dAlpha > 0.0 && settings.dAlpha <= 1.0
+		&& settings.dBeta >= 0.0 && settings.dBeta < 2.0 && settings.iLockHits >= 1 && settings.iLossMisses >= 1
+		&& settings.iMaxTracks >= 1 && settings.iMaxTracks <= CT400_MAX_LINE_TRACKS;
+}
+
+} // namespace
+
+
+namespace ct400
+{
+
+static_assert(sizeof(rLineTrack) == 104, "rLineTrack layout");
+
+LineTracker::LineTracker(const rTrackerSettings &settings) : m_settings(settings),
+	m_pScratch(new TrackerSnapshot()), m_snapshots(SNAPSHOTS), m_events(EVENTS)
+{
+	m_tracks.reserve(m_settings.iMaxTracks);
+}
+
+void LineTracker::event(rLineEventType eType, const rLineTrack &track, int64_t iTimestamp)
+{
+	rLineEvent lineEvent;
+	std::memset(&lineEvent, 0, sizeof(lineEvent));
+	lineEvent.uiIndex = m_events.written();
+	lineEvent.uiSweep = m_uiSweeps - 1;
+	lineEvent.iTimestamp = iTimestamp;
+	lineEvent.uiId = track.uiId;
+	lineEvent.eType = eType;
+	lineEvent.dWavelength = track.dWavelength;
+	m_events.push(lineEvent);
+}
+
+int32_t LineTracker::update(const double *pdLines, size_t uiLines, int64_t iTimestamp)
+{
+	std::lock_guard<std::mutex> lock(m_mtxUpdate);
+	const Clock::time_point tStart = Clock::now();
+	if (iTimestamp == 0)
+		iTimestamp = nowMicroseconds();
+	const uint64_t uiSweep = m_uiSweeps++;
+	const double dt = m_iLastTimestamp != 0 && iTimestamp > m_iLastTimestamp
+		? (iTimestamp - m_iLastTimestamp) * 1e-6 : 0.0;
+	m_iLastTimestamp = std::max(m_iLastTimestamp, iTimestamp);
+
+	m_lines.clear();
+	for (size_t i = 0; i < uiLines; i++)
+		if (std::isfinite(pdLines[i]))
+			m_lines.push_back(pdLines[i]);
+	std::sort(m_lines.begin(), m_lines.end());
+	m_lineTaken.assign(m_lines.size(), 0);
+	m_assigned.assign(m_tracks.size(), -1);
+
+	// Gating: every line within the gate of a track's prediction
+	m_candidates.clear();
+	for (size_t k = 0; k < m_tracks.size(); k++) {
+		const rLineTrack &track = m_tracks[k];
+		const double dPredicted = track.dWavelength + track.dDrift * dt;
+		const double dGate = m_settings.dGate + m_settings.dGateSigma * track.dScatter;
+		auto it = std::lower_bound(m_lines.begin(), m_lines.end(), dPredicted - dGate);
+		for (; it != m_lines.end() && *it <= dPredicted + dGate; ++it) {
+			const size_t j = it - m_lines.begin();
+			m_candidates.push_back({ std::fabs(*it - dPredicted), (uint32_t)k, (uint32_t)j });
+			// a gated line never starts a track of its own, taken or not
+			m_lineTaken[j] = 1;
+		}
+	}
+	// Assignment: nearest pairs first
+	std::sort(m_candidates.begin(), m_candidates.end(), [](const Candidate &a, const Candidate &b) {
+		if (a.dDistance != b.dDistance)
+			return a.dDistance < b.dDistance;
+		return a.uiTrack != b.uiTrack ? a.uiTrack < b.uiTrack : a.uiLine < b.uiLine;
+	});
+	size_t uiAssigned = 0;
+	for (const Candidate &candidate : m_candidates) {
+		if (m_assigned[candidate.uiTrack] >= 0 || m_lineTaken[candidate.uiLine] == 2)
+			continue;
+		m_lineTaken[candidate.uiLine] = 2;
+		m_assigned[candidate.uiTrack] = (int32_t)candidate.uiLine;
+		uiAssigned++;
+	}
+
+	// Filter: hits update, misses coast
+	for (size_t k = 0; k < m_tracks.size(); k++) {
+		rLineTrack &track = m_tracks[k];
+		const double dPredicted = track.dWavelength + track.dDrift * dt;
+		if (m_assigned[k] < 0) {
+			track.dWavelength = dPredicted;
+			track.iMisses++;
+			if (track.eState == LT_TENTATIVE)
+				track.uiId = 0;
+			else if (track.iMisses >= m_settings.iLossMisses) {
+				event(LE_LOSS, track, iTimestamp);
+				track.uiId = 0;
+			}
+			continue;
+		}
+		const double dLine = m_lines[m_assigned[k]];
+		const double dResidual = dLine - dPredicted;
+		track.dWavelength = dPredicted + m_settings.dAlpha * dResidual;
+		if (dt > 0.0)
+			track.dDrift += m_settings.dBeta / dt * dResidual;
+		track.iHits++;
+		track.iMisses = 0;
+		const double dWeight = 1.0 / std::min((double)track.iHits - 1.0, SCATTER_WINDOW);
+		track.dScatter = std::sqrt(track.dScatter * track.dScatter
+			+ (dResidual * dResidual - track.dScatter * track.dScatter) * dWeight);
+		track.dMeasured = dLine;
+		track.dMinWavelength = std::min(track.dMinWavelength, dLine);
+		track.dMaxWavelength = std::max(track.dMaxWavelength, dLine);
+		track.uiLastSweep = uiSweep;
+		track.iLastTimestamp = iTimestamp;
+		if (track.eState == LT_TENTATIVE && track.iHits >= m_settings.iLockHits) {
+			track.eState = LT_LOCKED;
+			event(LE_LOCK, track, iTimestamp);
+		}
+	}
+	m_tracks.erase(std::remove_if(m_tracks.begin(), m_tracks.end(),
+		[](const rLineTrack &track) { return track.uiId == 0; }), m_tracks.end());
+
+	// New tracks on the lines left over, one per gate
+	size_t uiDropped = 0;
+	double dLastNew = -HUGE_VAL;
+	for (size_t j = 0; j < m_lines.size(); j++) {
+		if (m_lineTaken[j]) {
+			uiDropped += m_lineTaken[j] == 1;
+			continue;
+		}
+		if (m_lines[j] - dLastNew <= m_settings.dGate || m_tracks.size() >= (size_t)m_settings.iMaxTracks) {
+			uiDropped++;
+			continue;
+		}
+		rLineTrack track;
+		std::memset(&track, 0, sizeof(track));
+		track.uiId = m_uiNextId++;
+		track.eState = LT_TENTATIVE;
+		track.iHits = 1;
+		track.uiFirstSweep = track.uiLastSweep = uiSweep;
+		track.dWavelength = track.dMeasured = track.dFirstWavelength = m_lines[j];
+		track.dMinWavelength = track.dMaxWavelength = m_lines[j];
+		track.iLastTimestamp = iTimestamp;
+		if (m_settings.iLockHits <= 1) {
+			track.eState = LT_LOCKED;
+			event(LE_LOCK, track, iTimestamp);
+		}
+		m_tracks.push_back(track);
+		dLastNew = m_lines[j];
+	}
+	std::sort(m_tracks.begin(), m_tracks.end(), [](const rLineTrack &a, const rLineTrack &b) {
+		return a.dWavelength < b.dWavelength;
+	});
+
+	publish(iTimestamp, m_lines.size(), uiAssigned, uiDropped,
+		std::chrono::duration<double>(Clock::now() - tStart).count());
+	return (int32_t)uiAssigned;
+}
+
+void LineTracker::publish(int64_t iTimestamp, size_t uiLines, size_t uiAssigned, size_t uiDropped,
+	double dSeconds)
+{
+	TrackerSnapshot &snapshot = *m_pScratch;
+	std::memset(&snapshot.status, 0, sizeof(snapshot.status));
+	snapshot.status.uiSweeps = m_uiSweeps;
+	snapshot.status.uiEvents = m_events.written();
+	snapshot.status.iTimestamp = iTimestamp;
+	snapshot.status.iTracks = (int32_t)m_tracks.size();
+	for (const rLineTrack &track : m_tracks)
+		if (track.eState == LT_LOCKED)
+			snapshot.status.iLocked++;
+	snapshot.status.iLines = (int32_t)uiLines;
+	snapshot.status.iAssigned = (int32_t)uiAssigned;
+	snapshot.status.iDropped = (int32_t)uiDropped;
+	snapshot.status.dUpdateTime = dSeconds;
+	if (!m_tracks.empty())
+		std::memcpy(snapshot.tracks, m_tracks.data(), m_tracks.size() * sizeof(rLineTrack));
+	m_snapshots.push(snapshot);
+}
+
+void LineTracker::reset()
+{
+	std::lock_guard<std::mutex> lock(m_mtxUpdate);
+	m_tracks.clear();
+	publish(m_iLastTimestamp, 0, 0, 0, 0.0);
+}
+
+bool LineTracker::snapshot(TrackerSnapshot &snapshot) const
+{
+	// a copy fails only if SNAPSHOTS - 1 updates were published meanwhile
+	for (int i = 0; i < 16; i++) {
+		const uint64_t uiWritten = m_snapshots.written();
+		if (uiWritten == 0)
+			return false;
+		if (m_snapshots.read(uiWritten - 1, snapshot))
+			return true;
+	}
+	return false;
+}
+
+size_t LineTracker::events(uint64_t &uiNext, rLineEvent *pEvents, size_t uiMax) const
+{
+	const uint64_t uiWritten = m_events.written();
+	if (uiNext + m_events.capacity() < uiWritten)
+		uiNext = uiWritten - m_events.capacity();
+	size_t n = 0;
+	// events overwritten while copying are skipped
+	for (; uiNext < uiWritten && n < uiMax; uiNext++)
+		if (m_events.read(uiNext, pEvents[n]))
+			n++;
+	return n;
+}
+
+} // namespace ct400
+
+
+
+namespace
+{
+
+std::mutex g_mtx;
+std::map<uint64_t, std::shared_ptr<ct400::LineTracker> > g_trackers;
+uint64_t g_uiNextTracker = 1;
+
+std::shared_ptr<ct400::LineTracker> findTracker(uint64_t uiTracker)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	auto it = g_trackers.find(uiTracker);
+	return it == g_trackers.end() ? nullptr : it->second;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultTrackerSettings(rTrackerSettings *pSettings)
+{
+	if (pSettings == nullptr)
+		return -1;
+	std::memset(pSettings, 0, sizeof(*pSettings));
+	pSettings->dGate = 0.02;
+	pSettings->dGateSigma = 4.0;
+	pSettings->dAlpha = 0.5;
+	pSettings->dBeta = 0.15;
+	pSettings->iLockHits = 3;
+	pSettings->iLossMisses = 5;
+	pSettings->iMaxTracks = 64;
+	return 0;
+}
+
+_EXT_DECLSPEC uint64_t __stdcall CT400_TrackerCreate(const rTrackerSettings *pSettings)
+{
+	rTrackerSettings settings;
+	CT400_DefaultTrackerSettings(&settings);
+	if (pSettings)
+		settings = *pSettings;
+	if (!validSettings(settings))
+		return 0;
+	auto tracker = std::make_shared<ct400::LineTracker>(settings);
+	std::lock_guard<std::mutex> lock(g_mtx);
+	uint64_t uiTracker = g_uiNextTracker++;
+	g_trackers[uiTracker] = tracker;
+	return uiTracker;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerUpdate(uint64_t uiTracker,
+const double dLines[], int32_t iNbLines, int64_t iTimestamp)
+{
+	auto tracker = findTracker(uiTracker);
+	if (!tracker || iNbLines < 0 || (iNbLines > 0 && dLines == nullptr))
+		return -1;
+	return tracker->update(dLines, (size_t)iNbLines, iTimestamp);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerAcquire(uint64_t uiTracker,
+uint64_t uiHandle, int64_t iTimestamp)
+{
+	auto tracker = findTracker(uiTracker);
+	if (!tracker)
+		return -1;
+	std::vector<double> lines;
+	const int32_t iResult = ct400::Device::forHandle(uiHandle)->call([&](uint64_t uiHandle) {
+		const int32_t iLines = CT400_GetNbLinesDetected(uiHandle);
+		if (iLines <= 0)
+			return iLines;
+		lines.resize(iLines);
+		return CT400_ScanGetLinesDetectionArray(uiHandle, lines.data(), iLines) < 0 ? -1 : iLines;
+	});
+	if (iResult < 0)
+		return -1;
+	return tracker->update(lines.data(), lines.size(), iTimestamp);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerGetTracks(uint64_t uiTracker,
+rTrackerStatus *pStatus, rLineTrack pTracks[], int32_t iMaxTracks)
+{
+	auto tracker = findTracker(uiTracker);
+	if (!tracker || iMaxTracks < 0 || (iMaxTracks > 0 && pTracks == nullptr))
+		return -1;
+	std::unique_ptr<ct400::TrackerSnapshot> snapshot(new ct400::TrackerSnapshot());
+	if (!tracker->snapshot(*snapshot)) {
+		// nothing published yet
+		if (pStatus)
+			std::memset(pStatus, 0, sizeof(*pStatus));
+		return 0;
+	}
+	if (pStatus)
+		*pStatus = snapshot->status;
+	const int32_t iCopy = std::min(iMaxTracks, snapshot->status.iTracks);
+	if (iCopy > 0)
+		std::memcpy(pTracks, snapshot->tracks, iCopy * sizeof(rLineTrack));
+	return snapshot->status.iTracks;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerGetEvents(uint64_t uiTracker,
+uint64_t *puiNext, rLineEvent pEvents[], int32_t iMaxEvents)
+{
+	auto tracker = findTracker(uiTracker);
+	if (!tracker || puiNext == nullptr || iMaxEvents < 0 || (iMaxEvents > 0 && pEvents == nullptr))
+		return -1;
+	return (int32_t)tracker->events(*puiNext, pEvents, (size_t)iMaxEvents);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerReset(uint64_t uiTracker)
+{
+	auto tracker = findTracker(uiTracker);
+	if (!tracker)
+		return -1;
+	tracker->reset();
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerClose(uint64_t uiTracker)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	return g_trackers.erase(uiTracker) ? 0 : -1;
+}
+
+}
@@ -0,0 +1,278 @@
+/******************************************************************************/
+/* Header file for CT400_line_tracker.cpp                                     */
+/*                                                                            */
+/* Tracking of the heterodyne detection lines (CT400_ScanGetLinesDetection-   */
+/* Array) from sweep to sweep: each line is followed by an alpha-beta filter  */
+/* giving its drift, and tracks are published lock-free with their lock and   */
+/* loss events so that a monitor never holds up acquisition.                  */
+/******************************************************************************/
+
+#ifndef CT400_LINE_TRACKER_H
+#define CT400_LINE_TRACKER_H
+
+#include "CT400_ext.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef enum
+  {
+	LT_TENTATIVE = 0,               // not seen in iLockHits sweeps in a row yet
+	LT_LOCKED
+  } rTrackState;
+
+  typedef enum
+  {
+	LE_LOCK = 1,                    // a tentative track became locked
+	LE_LOSS                         // a locked track missed iLossMisses sweeps in a row
+  } rLineEventType;
+
+  typedef struct
+  {
+	double dGate;                   // nm, largest distance from a track's prediction to a line assigned to it
+	double dGateSigma;              // the gate also spans this many rms scatters of the track
+	double dAlpha;                  // position gain of the alpha-beta filter, (0, 1]
+	double dBeta;                   // drift gain, [0, 2)
+	int32_t iLockHits;              // sweeps in a row before a new track locks
+	int32_t iLossMisses;            // sweeps in a row without a line before a track is lost
+	int32_t iMaxTracks;             // at most CT400_MAX_LINE_TRACKS
+	int32_t iReserved;
+  } rTrackerSettings;
+
+  // Fixed layout (104 bytes)
+  typedef struct
+  {
+	uint64_t uiId;                  // unique over the life of the tracker
+	int32_t eState;                 // rTrackState
+	int32_t iMisses;                // sweeps in a row without a line
+	int64_t iHits;                  // sweeps with a line
+	uint64_t uiFirstSweep;          // sweep numbers (CT400_TrackerUpdate calls)
+	uint64_t uiLastSweep;           // with a line
+	double dWavelength;             // filtered, nm
+	double dDrift;                  // nm/s
+	double dMeasured;               // last line, nm
+	double dScatter;                // rms of the innovations, nm: jitter and linewidth proxy
+	double dFirstWavelength;        // nm, of the first line
+	double dMinWavelength;          // nm, lines of the track
+	double dMaxWavelength;
+	int64_t iLastTimestamp;         // us since 1970, last line
+  } rLineTrack;
+
+  typedef struct
+  {
+	uint64_t uiIndex;               // of the event, from 0
+	uint64_t uiSweep;
+	int64_t iTimestamp;             // us since 1970
+	uint64_t uiId;                  // of the track
+	int32_t eType;                  // rLineEventType
+	int32_t iReserved;
+	double dWavelength;             // nm
+  } rLineEvent;
+
+  typedef struct
+  {
+	uint64_t uiSweeps;              // updates so far
+	uint64_t uiEvents;              // events so far
+	int64_t iTimestamp;             // of the last update
+	int32_t iTracks;
+	int32_t iLocked;
+	int32_t iLines;                 // lines of the last update
+	int32_t iAssigned;              // of them, assigned to a track
+	int32_t iDropped;               // of them, neither assigned nor starting a track
+	int32_t iReserved;
+	double dUpdateTime;             // s spent in the last update
+  } rTrackerStatus;
+
+#define CT400_MAX_LINE_TRACKS 256
+
+//------------------------------ CT400_DefaultTrackerSettings ------------------
+// Function CT400_DefaultTrackerSettings
+//
+//  Purpose: 20 pm gate widened by 4 rms scatters, alpha 0.5, beta 0.15,
+//           lock after 3 sweeps, loss after 5, 64 tracks
+//
+//  Parameters: IN/OUT pSettings: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultTrackerSettings(rTrackerSettings *pSettings);
+
+//------------------------------ CT400_TrackerCreate ---------------------------
+// Function CT400_TrackerCreate
+//
+//  Parameters: IN pSettings: settings, or NULL for the defaults
+//  Returns:  uiTracker for use in the other CT400_Tracker functions,
+//            0 if the settings are invalid
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC uint64_t __stdcall CT400_TrackerCreate(const rTrackerSettings *pSettings);
+
+//------------------------------ CT400_TrackerUpdate ---------------------------
+// Function CT400_TrackerUpdate
+//
+//  Purpose: Takes in the lines of one sweep: assigns them to the tracks
+//           (nearest first, within the gates), starts tracks on the others,
+//           and publishes the tracks and events. One thread at a time.
+//
+//  Parameters: IN uiTracker: from CT400_TrackerCreate
+//              IN dLines: iNbLines wavelengths in nm, any order
+//              IN iNbLines: number of lines (0 for a sweep without any)
+//              IN iTimestamp: of the sweep, us since 1970, 0 for now
+//  Returns:  number of lines assigned to a track, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerUpdate(uint64_t uiTracker,
+const double dLines[], int32_t iNbLines, int64_t iTimestamp);
+
+//------------------------------ CT400_TrackerAcquire --------------------------
+// Function CT400_TrackerAcquire
+//
+//  Purpose: CT400_TrackerUpdate with the lines of the last sweep of a CT400
+//           (CT400_GetNbLinesDetected, CT400_ScanGetLinesDetectionArray)
+//
+//  Parameters: IN uiTracker: from CT400_TrackerCreate
+//              IN uiHandle: from CT400_Init, after CT400_ScanWaitEnd
+//              IN iTimestamp: of the sweep, us since 1970, 0 for now
+//  Returns:  number of lines assigned to a track, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerAcquire(uint64_t uiTracker,
+uint64_t uiHandle, int64_t iTimestamp);
+
+//------------------------------ CT400_TrackerGetTracks ------------------------
+// Function CT400_TrackerGetTracks
+//
+//  Purpose: Copies the tracks as of the last update, in wavelength order.
+//           Never waits for CT400_TrackerUpdate.
+//
+//  Parameters: IN uiTracker: from CT400_TrackerCreate
+//              IN/OUT pStatus: pointer over a variable, or NULL
+//              IN/OUT pTracks: pointer over an initialized array of
+//                              iMaxTracks values, or NULL
+//              IN iMaxTracks: size of pTracks
+//  Returns:  number of tracks (some may not fit in pTracks), -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerGetTracks(uint64_t uiTracker,
+rTrackerStatus *pStatus, rLineTrack pTracks[], int32_t iMaxTracks);
+
+//------------------------------ CT400_TrackerGetEvents ------------------------
+// Function CT400_TrackerGetEvents
+//
+//  Purpose: Copies the events from *puiNext on; the newest 4096 events are
+//           kept, older ones are skipped. Never waits for CT400_TrackerUpdate.
+//
+//  Parameters: IN uiTracker: from CT400_TrackerCreate
+//              IN/OUT puiNext: first event wanted, set to the event after
+//                              the last one copied
+//              IN/OUT pEvents: pointer over an initialized array of
+//                              iMaxEvents values
+//              IN iMaxEvents: size of pEvents
+//  Returns:  number of events copied, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerGetEvents(uint64_t uiTracker,
+uint64_t *puiNext, rLineEvent pEvents[], int32_t iMaxEvents);
+
+//------------------------------ CT400_TrackerReset ----------------------------
+// Function CT400_TrackerReset
+//
+//  Purpose: Drops every track (the sweep and event counts go on)
+//
+//  Parameters: IN uiTracker: from CT400_TrackerCreate
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerReset(uint64_t uiTracker);
+
+//------------------------------ CT400_TrackerClose ----------------------------
+// Function CT400_TrackerClose
+//
+//  Parameters: IN uiTracker: from CT400_TrackerCreate
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_TrackerClose(uint64_t uiTracker);
+
+#ifdef __cplusplus
+}
+
+#include "CT400_ring.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ct400
+{
+
+// Tracks and status as of one update
+struct TrackerSnapshot
+{
+	rTrackerStatus status;
+	rLineTrack tracks[CT400_MAX_LINE_TRACKS];
+};
+
+//------------------------------ LineTracker -----------------------------------
+// Class LineTracker
+//
+//  Purpose: Multi-line tracker over the line lists of consecutive sweeps.
+//           Each track predicts its line from its position and drift; the
+//           lines within its gate are candidates, and pairs are assigned
+//           nearest first (global nearest neighbour), each line and track
+//           taken once. A line left over starts a tentative track unless it
+//           lies within the gate of another track. The state is written by
+//           update() only; every update is published as a TrackerSnapshot
+//           in a SampleRing and events in another, so readers copy them
+//           without a lock and update() never waits for a reader.
+//------------------------------------------------------------------------------
+class LineTracker
+{
+public:
+	static const size_t SNAPSHOTS = 4;
+	static const size_t EVENTS = 4096;
+
+	explicit LineTracker(const rTrackerSettings &settings);
+
+	LineTracker(const LineTracker &) = delete;
+	LineTracker &operator=(const LineTracker &) = delete;
+
+	// Returns the number of lines assigned
+	int32_t update(const double *pdLines, size_t uiLines, int64_t iTimestamp);
+	void reset();
+
+	// Any thread. Returns false if no update was published yet or it could
+	// not be copied (the writer lapped the reader)
+	bool snapshot(TrackerSnapshot &snapshot) const;
+	// Any thread: events from uiNext on. Returns the number copied and
+	// moves uiNext past them
+	size_t events(uint64_t &uiNext, rLineEvent *pEvents, size_t uiMax) const;
+
+private:
+	struct Candidate
+	{
+		double dDistance;
+		uint32_t uiTrack;
+		uint32_t uiLine;
+	};
+
+	void event(rLineEventType eType, const rLineTrack &track, int64_t iTimestamp);
+	void publish(int64_t iTimestamp, size_t uiLines, size_t uiAssigned, size_t uiDropped, double dSeconds);
+
+	rTrackerSettings m_settings;
+	std::mutex m_mtxUpdate;                 // update() and reset() only
+	std::vector<rLineTrack> m_tracks;
+	uint64_t m_uiSweeps = 0;
+	uint64_t m_uiNextId = 1;
+	int64_t m_iLastTimestamp = 0;
+	// scratch of update()
+	std::vector<double> m_lines;
+	std::vector<Candidate> m_candidates;
+	std::vector<uint8_t> m_lineTaken;       // 1: gated, 2: assigned
+	std::vector<int32_t> m_assigned;        // line of each track, -1 if none
+	std::unique_ptr<TrackerSnapshot> m_pScratch;
+
+	SampleRing<TrackerSnapshot> m_snapshots;
+	SampleRing<rLineEvent> m_events;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
@@ -0,0 +1,397 @@
+//------------------------------------------------------------------------------
+// CT400_metrics.cpp
+//
+// Latency histograms, the per-handle registry and the Prometheus text export.
+// Built into libCT400_metrics with CT400_metrics_shim.cpp (see README.md).
+//------------------------------------------------------------------------------
+
+#define CT400_LIB_EXPORT
+#include "CT400_metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined (_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+
+unsigned highestBit(uint64_t v)
+{
+#if defined (_MSC_VER)
+	unsigned long i;
+	_BitScanReverse64(&i, v | 1);
+	return (unsigned)i;
+#else
+	return 63u - (unsigned)__builtin_clzll(v | 1);
+#endif
+}
+
+// Histogram bucket boundaries of the export, s: 1, 2.5 and 5 per decade
+const double EXPORT_BOUNDS[] = { 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2,
+	0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 25.0, 50.0, 100.0 };
+const double EXPORT_QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+
+void appendf(std::string &str, const char *pcFormat, ...)
+#if defined (__GNUC__)
+	__attribute__((format(printf, 2, 3)))
+#endif
+	;
+
+void appendf(std::string &str, const char *pcFormat, ...)
+{
+	char tcLine[512];
+	va_list args;
+	va_start(args, pcFormat);
+	int n = std::vsnprintf(tcLine, sizeof(tcLine), pcFormat, args);
+	va_end(args);
+	if (n > 0)
+		str.append(tcLine, std::min<size_t>((size_t)n, sizeof(tcLine) - 1));
+}
+
+std::string handleLabel(uint64_t uiHandle, bool bOverflow)
+{
+	return bOverflow ? std::string("other") : std::to_string(uiHandle);
+}
+
+// One Prometheus histogram series, labels without braces
+void appendHistogram(std::string &str, const char *pcMetric, const std::string &strLabels,
+	const ct400::LatencyHistogram &h)
+{
+	for (double dBound : EXPORT_BOUNDS)
+		appendf(str, "%s_bucket{%s,le=\"%g\"} %llu\n", pcMetric, strLabels.c_str(), dBound,
+			(unsigned long long)h.countBelow((uint64_t)std::llround(dBound * 1e9)));
+	appendf(str, "%s_bucket{%s,le=\"+Inf\"} %llu\n", pcMetric, strLabels.c_str(), (unsigned long long)h.count());
+	appendf(str, "%s_sum{%s} %.9g\n", pcMetric, strLabels.c_str(), h.sum() * 1e-9);
+	appendf(str, "%s_count{%s} %llu\n", pcMetric, strLabels.c_str(), (unsigned long long)h.count());
+}
+
+void appendQuantiles(std::string &str, const char *pcMetric, const std::string &strLabels,
+	const ct400::LatencyHistogram &h)
+{
+	for (double dQuantile : EXPORT_QUANTILES)
+		appendf(str, "%s{%s,quantile=\"%g\"} %.9g\n", pcMetric, strLabels.c_str(), dQuantile,
+			h.quantile(dQuantile) * 1e-9);
+	appendf(str, "%s{%s,quantile=\"1\"} %.9g\n", pcMetric, strLabels.c_str(), h.max() * 1e-9);
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_DECLSPEC int32_t __stdcall CT400_MetricsRecordSpan(uint64_t uiHandle,
+const char *pcName, double dSeconds)
+{
+	if (pcName == nullptr || !(dSeconds >= 0.0))
+		return -1;
+	ct400::Metrics::instance().recordSpan(uiHandle, pcName, (uint64_t)std::llround(dSeconds * 1e9));
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_MetricsGetLatency(uint64_t uiHandle,
+const char *pcName, double dQuantile, double *pdSeconds, uint64_t *puiCount)
+{
+	if (pcName == nullptr || pdSeconds == nullptr || !(dQuantile >= 0.0 && dQuantile <= 1.0))
+		return -1;
+	const ct400::LatencyHistogram *h = ct400::Metrics::instance().find(uiHandle, pcName);
+	if (h == nullptr || h->count() == 0)
+		return -1;
+	*pdSeconds = h->quantile(dQuantile) * 1e-9;
+	if (puiCount)
+		*puiCount = h->count();
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_MetricsText(char *pcBuffer, int32_t iSize)
+{
+	if (iSize < 0 || (iSize > 0 && pcBuffer == nullptr))
+		return -1;
+	std::string str = ct400::Metrics::instance().prometheus();
+	if (iSize > 0) {
+		size_t uiCopy = std::min<size_t>(str.size(), (size_t)iSize - 1);
+		std::memcpy(pcBuffer, str.data(), uiCopy);
+		pcBuffer[uiCopy] = '\0';
+	}
+	return (int32_t)str.size();
+}
+
+_DECLSPEC int32_t __stdcall CT400_MetricsExport(const char *pcPath)
+{
+	if (pcPath == nullptr)
+		return -1;
+	return ct400::Metrics::instance().exportFile(pcPath);
+}
+
+_DECLSPEC int32_t __stdcall CT400_MetricsReset()
+{
+	ct400::Metrics::instance().reset();
+	return 0;
+}
+
+}
+
+
+namespace ct400
+{
+
+size_t LatencyHistogram::bucket(uint64_t uiNs)
+{
+	if (uiNs >> MAX_BITS)
+		uiNs = (1ULL << MAX_BITS) - 1;
+	if (uiNs < (1ULL << SUB_BITS))
+		return (size_t)uiNs;
+	const unsigned uiShift = highestBit(uiNs) - SUB_BITS + 1;
+	return ((size_t)uiShift << (SUB_BITS - 1)) + (size_t)(uiNs >> uiShift);
+}
+
+uint64_t LatencyHistogram::bucketEnd(size_t uiBucket)
+{
+	if (uiBucket < (1u << SUB_BITS))
+		return uiBucket + 1;
+	const unsigned uiShift = (unsigned)(uiBucket >> (SUB_BITS - 1)) - 1;
+	const uint64_t uiMantissa = uiBucket - ((size_t)uiShift << (SUB_BITS - 1));
+	return (uiMantissa + 1) << uiShift;
+}
+
+void LatencyHistogram::record(uint64_t uiNs)
+{
+	m_buckets[bucket(uiNs)].fetch_add(1, std::memory_order_relaxed);
+	m_uiCount.fetch_add(1, std::memory_order_relaxed);
+	m_uiSum.fetch_add(uiNs, std::memory_order_relaxed);
+	uint64_t uiMax = m_uiMax.load(std::memory_order_relaxed);
+	while (uiNs > uiMax && !m_uiMax.compare_exchange_weak(uiMax, uiNs, std::memory_order_relaxed))
+		;
+}
+
+void LatencyHistogram::reset()
+{
+	for (std::atomic<uint64_t> &b : m_buckets)
+		b.store(0, std::memory_order_relaxed);
+	m_uiCount.store(0, std::memory_order_relaxed);
+	m_uiSum.store(0, std::memory_order_relaxed);
+	m_uiMax.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::quantile(double dQuantile) const
+{
+	// the buckets are read one by one while calls go on: clamp to what they hold
+	uint64_t uiTotal = 0;
+	for (const std::atomic<uint64_t> &b : m_buckets)
+		uiTotal += b.load(std::memory_order_relaxed);
+	if (uiTotal == 0)
+		return 0;
+	uint64_t uiRank = (uint64_t)std::ceil(dQuantile * uiTotal);
+	uiRank = std::min(std::max<uint64_t>(uiRank, 1), uiTotal);
+	uint64_t uiSeen = 0;
+	for (size_t i = 0; i < NB_BUCKETS; i++) {
+		uiSeen += m_buckets[i].load(std::memory_order_relaxed);
+		if (uiSeen >= uiRank) {
+			// the largest value recorded is exact
+			const uint64_t uiMax = max();
+			return uiMax > 0 ? std::min(bucketEnd(i) - 1, uiMax) : bucketEnd(i) - 1;
+		}
+	}
+	return max();
+}
+
+uint64_t LatencyHistogram::countBelow(uint64_t uiNs) const
+{
+	uint64_t uiCount = 0;
+	for (size_t i = 0; i < NB_BUCKETS && bucketEnd(i) <= uiNs; i++)
+		uiCount += m_buckets[i].load(std::memory_order_relaxed);
+	return uiCount;
+}
+
+Metrics &Metrics::instance()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+Metrics::Metrics()
+{
+	for (Slot &s : m_slots)
+		for (std::atomic<CallStats *> &p : s.calls)
+			p.store(nullptr, std::memory_order_relaxed);
+}
+
+Metrics::~Metrics()
+{
+	for (Slot &s : m_slots)
+		for (std::atomic<CallStats *> &p : s.calls)
+			delete p.load();
+}
+
+Metrics::Slot &Metrics::slot(uint64_t uiHandle)
+{
+	// slots are only appended: the published ones never change handle
+	size_t n = m_uiSlots.load(std::memory_order_acquire);
+	for (size_t i = 0; i < n; i++)
+		if (m_slots[i].uiHandle.load(std::memory_order_relaxed) == uiHandle)
+			return m_slots[i];
+	std::lock_guard<std::mutex> lock(m_mtx);
+	n = m_uiSlots.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < n; i++)
+		if (m_slots[i].uiHandle.load(std::memory_order_relaxed) == uiHandle)
+			return m_slots[i];
+	if (n == MAX_HANDLES)
+		return m_slots[MAX_HANDLES];
+	m_slots[n].uiHandle.store(uiHandle, std::memory_order_relaxed);
+	m_uiSlots.store(n + 1, std::memory_order_release);
+	return m_slots[n];
+}
+
+CallStats &Metrics::stats(Slot &s, ApiFunction eFunction)
+{
+	std::atomic<CallStats *> &p = s.calls[eFunction];
+	CallStats *pStats = p.load(std::memory_order_acquire);
+	if (pStats == nullptr) {
+		CallStats *pNew = new CallStats();
+		if (p.compare_exchange_strong(pStats, pNew, std::memory_order_acq_rel))
+			pStats = pNew;
+		else
+			delete pNew;
+	}
+	return *pStats;
+}
+
+void Metrics::recordCall(uint64_t uiHandle, ApiFunction eFunction, rCallResult eKind, int64_t iResult,
+	uint64_t uiNs)
+{
+	CallStats &s = stats(slot(uiHandle), eFunction);
+	s.latency.record(uiNs);
+	if (callFailed(eKind, iResult)) {
+		std::lock_guard<std::mutex> lock(s.mtx);
+		s.errors[iResult]++;
+	}
+}
+
+void Metrics::recordSpan(uint64_t uiHandle, const std::string &strName, uint64_t uiNs)
+{
+	LatencyHistogram *h;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		std::unique_ptr<LatencyHistogram> &p = m_spans[std::make_pair(uiHandle, strName)];
+		if (!p)
+			p.reset(new LatencyHistogram());
+		h = p.get();
+	}
+	h->record(uiNs);
+}
+
+const LatencyHistogram *Metrics::find(uint64_t uiHandle, const std::string &strName) const
+{
+	const size_t n = m_uiSlots.load(std::memory_order_acquire);
+	for (size_t f = 0; f < NB_API_FUNCTIONS; f++)
+		if (strName == apiName(f)) {
+			for (size_t i = 0; i < n; i++)
+				if (m_slots[i].uiHandle.load(std::memory_order_relaxed) == uiHandle) {
+					const CallStats *pStats = m_slots[i].calls[f].load(std::memory_order_acquire);
+					return pStats ? &pStats->latency : nullptr;
+				}
+			return nullptr;
+		}
+	std::lock_guard<std::mutex> lock(m_mtx);
+	auto it = m_spans.find(std::make_pair(uiHandle, strName));
+	return it == m_spans.end() ? nullptr : it->second.get();
+}
+
+std::string Metrics::prometheus() const
+{
+	struct Series
+	{
+		std::string strLabels;
+		const CallStats *pStats;
+	};
+	std::vector<Series> calls;
+	const size_t n = m_uiSlots.load(std::memory_order_acquire);
+	for (size_t i = 0; i <= MAX_HANDLES; i++) {
+		if (i >= n && i < MAX_HANDLES)
+			continue;
+		const Slot &s = m_slots[i];
+		for (size_t f = 0; f < NB_API_FUNCTIONS; f++) {
+			const CallStats *pStats = s.calls[f].load(std::memory_order_acquire);
+			if (pStats)
+				calls.push_back(Series{ std::string("function=\"") + apiName(f) + "\",handle=\""
+					+ handleLabel(s.uiHandle.load(std::memory_order_relaxed), i == MAX_HANDLES) + "\"", pStats });
+		}
+	}
+
+	std::string str;
+	str.reserve(4096 + calls.size() * 2048);
+	str += "# HELP ct400_call_duration_seconds Latency of CT400_lib calls.\n";
+	str += "# TYPE ct400_call_duration_seconds histogram\n";
+	for (const Series &c : calls)
+		appendHistogram(str, "ct400_call_duration_seconds", c.strLabels, c.pStats->latency);
+	str += "# HELP ct400_call_duration_quantile_seconds Latency quantiles of CT400_lib calls (within 3 %).\n";
+	str += "# TYPE ct400_call_duration_quantile_seconds gauge\n";
+	for (const Series &c : calls)
+		appendQuantiles(str, "ct400_call_duration_quantile_seconds", c.strLabels, c.pStats->latency);
+	str += "# HELP ct400_call_errors_total Failed CT400_lib calls by returned value.\n";
+	str += "# TYPE ct400_call_errors_total counter\n";
+	for (const Series &c : calls) {
+		std::lock_guard<std::mutex> lock(c.pStats->mtx);
+		for (const auto &e : c.pStats->errors)
+			appendf(str, "ct400_call_errors_total{%s,code=\"%lld\"} %llu\n", c.strLabels.c_str(),
+				(long long)e.first, (unsigned long long)e.second);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mtx);
+	str += "# HELP ct400_span_duration_seconds Duration of the phases marked by the caller.\n";
+	str += "# TYPE ct400_span_duration_seconds histogram\n";
+	for (const auto &s : m_spans)
+		appendHistogram(str, "ct400_span_duration_seconds", "span=\"" + s.first.second + "\",handle=\""
+			+ std::to_string(s.first.first) + "\"", *s.second);
+	str += "# HELP ct400_span_duration_quantile_seconds Duration quantiles of the phases (within 3 %).\n";
+	str += "# TYPE ct400_span_duration_quantile_seconds gauge\n";
+	for (const auto &s : m_spans)
+		appendQuantiles(str, "ct400_span_duration_quantile_seconds", "span=\"" + s.first.second + "\",handle=\""
+			+ std::to_string(s.first.first) + "\"", *s.second);
+	return str;
+}
+
+int32_t Metrics::exportFile(const std::string &strPath) const
+{
+	const std::string str = prometheus();
+	const std::string strTemp = strPath + ".tmp";
+	FILE *pFile = std::fopen(strTemp.c_str(), "wb");
+	if (pFile == nullptr)
+		return -1;
+	bool bOk = std::fwrite(str.data(), 1, str.size(), pFile) == str.size();
+	bOk = std::fclose(pFile) == 0 && bOk;
+#if defined (_WIN32)
+	// rename does not replace an existing file on Windows
+	std::remove(strPath.c_str());
+#endif
+	if (!bOk || std::rename(strTemp.c_str(), strPath.c_str()) != 0) {
+		std::remove(strTemp.c_str());
+		return -1;
+	}
+	return 0;
+}
+
+void Metrics::reset()
+{
+	for (Slot &s : m_slots)
+		for (std::atomic<CallStats *> &p : s.calls) {
+			CallStats *pStats = p.load(std::memory_order_acquire);
+			if (pStats) {
+				pStats->latency.reset();
+				std::lock_guard<std::mutex> lock(pStats->mtx);
+				pStats->errors.clear();
+			}
+		}
+	std::lock_guard<std::mutex> lock(m_mtx);
+	for (auto &s : m_spans)
+		s.second->reset();
+}
+
+} // namespace ct400
@@ -0,0 +1,196 @@
+/******************************************************************************/
+/* Header file for CT400_metrics.cpp and CT400_metrics_shim.cpp               */
+/*                                                                            */
+/* Call latency metrics. libCT400_metrics exports every function of           */
+/* CT400_lib.h, forwards each call to the real library and records its       */
+/* latency and result per handle; loaded in place of CT400_lib (CT400_LIB)   */
+/* it instruments CT400_control.py and the native extensions unchanged.      */
+/******************************************************************************/
+
+#ifndef CT400_METRICS_H
+#define CT400_METRICS_H
+
+#include "CT400_api.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//------------------------------ CT400_MetricsRecordSpan -----------------------
+// Function CT400_MetricsRecordSpan
+//
+//  Purpose: Records the duration of a phase of the caller's work (e.g.
+//           "configure", "sweep", "fetch", "analyse") next to the call
+//           latencies
+//
+//  Parameters: IN uiHandle: from CT400_Init, or 0
+//              IN pcName: phase name
+//              IN dSeconds: duration in s
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_DECLSPEC int32_t __stdcall CT400_MetricsRecordSpan(uint64_t uiHandle,
+const char *pcName, double dSeconds);
+
+//------------------------------ CT400_MetricsGetLatency -----------------------
+// Function CT400_MetricsGetLatency
+//
+//  Purpose: Returns a latency quantile of a function or phase on a handle
+//
+//  Parameters: IN uiHandle: from CT400_Init (0 for CT400_Init itself)
+//              IN pcName: CT400_lib function or phase name
+//              IN dQuantile: 0 to 1
+//              IN/OUT pdSeconds: pointer over a variable (within 3 %)
+//              IN/OUT puiCount: pointer over a variable (calls or phases
+//                               recorded), or NULL
+//  Returns:  0 if success, -1 otherwise (nothing recorded under that name)
+//------------------------------------------------------------------------------
+_DECLSPEC int32_t __stdcall CT400_MetricsGetLatency(uint64_t uiHandle,
+const char *pcName, double dQuantile, double *pdSeconds, uint64_t *puiCount);
+
+//------------------------------ CT400_MetricsText -----------------------------
+// Function CT400_MetricsText
+//
+//  Purpose: Writes every metric in the Prometheus text exposition format
+//
+//  Parameters: IN/OUT pcBuffer: pointer over an initialized array, or NULL
+//              IN iSize: size of the array
+//  Returns:  length of the text without the terminating 0 (truncated to
+//            iSize - 1 if larger), -1 otherwise
+//------------------------------------------------------------------------------
+_DECLSPEC int32_t __stdcall CT400_MetricsText(char *pcBuffer, int32_t iSize);
+
+//------------------------------ CT400_MetricsExport ---------------------------
+// Function CT400_MetricsExport
+//
+//  Purpose: Writes the Prometheus text to a file, replaced atomically so that
+//           a scraper (e.g. the node_exporter textfile collector) never reads
+//           a partial file. With the CT400_METRICS_FILE environment variable
+//           set, the shim also does this every CT400_METRICS_INTERVAL s
+//           (default 10), after each CT400_Close and when unloaded.
+//
+//  Parameters: IN pcPath: file to write
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_DECLSPEC int32_t __stdcall CT400_MetricsExport(const char *pcPath);
+
+//------------------------------ CT400_MetricsReset ----------------------------
+// Function CT400_MetricsReset
+//
+//  Purpose: Clears every histogram and counter
+//
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_DECLSPEC int32_t __stdcall CT400_MetricsReset();
+
+#ifdef __cplusplus
+}
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace ct400
+{
+
+//------------------------------ LatencyHistogram ------------------------------
+// Class LatencyHistogram
+//
+//  Purpose: Log-linear (HDR style) histogram of durations in ns: 32 buckets
+//           per power of two below 2^40 ns (18 min), so any quantile is
+//           within 3 % whatever the range. record() is a few relaxed atomic
+//           increments, safe from any number of threads.
+//------------------------------------------------------------------------------
+class LatencyHistogram
+{
+public:
+	static const unsigned SUB_BITS = 6;
+	static const unsigned MAX_BITS = 40;
+	static const size_t NB_BUCKETS = (size_t)(MAX_BITS - SUB_BITS + 2) << (SUB_BITS - 1);
+
+	LatencyHistogram() { reset(); }
+
+	void record(uint64_t uiNs);
+	void reset();
+
+	uint64_t count() const { return m_uiCount.load(std::memory_order_relaxed); }
+	uint64_t sum() const { return m_uiSum.load(std::memory_order_relaxed); }
+	uint64_t max() const { return m_uiMax.load(std::memory_order_relaxed); }
+	// Highest value of the bucket holding the quantile, ns
+	uint64_t quantile(double dQuantile) const;
+	// Values recorded below uiNs (to bucket precision)
+	uint64_t countBelow(uint64_t uiNs) const;
+
+	static size_t bucket(uint64_t uiNs);
+	// First value of the next bucket
+	static uint64_t bucketEnd(size_t uiBucket);
+
+private:
+	std::atomic<uint64_t> m_buckets[NB_BUCKETS];
+	std::atomic<uint64_t> m_uiCount;
+	std::atomic<uint64_t> m_uiSum;
+	std::atomic<uint64_t> m_uiMax;
+};
+
+//------------------------------ CallStats -------------------------------------
+// Latency of one function on one handle, and its failed results by value
+//------------------------------------------------------------------------------
+struct CallStats
+{
+	LatencyHistogram latency;
+	mutable std::mutex mtx;                 // errors only: failures are rare
+	std::map<int64_t, uint64_t> errors;
+};
+
+//------------------------------ Metrics ---------------------------------------
+// Class Metrics
+//
+//  Purpose: Process-wide registry of call and phase latencies. Calls are
+//           kept per handle (up to MAX_HANDLES, later handles share one
+//           "other" entry) and looked up without a lock, so recording a
+//           call costs about two clock reads.
+//------------------------------------------------------------------------------
+class Metrics
+{
+public:
+	static const size_t MAX_HANDLES = 16;
+
+	static Metrics &instance();
+
+	void recordCall(uint64_t uiHandle, ApiFunction eFunction, rCallResult eKind, int64_t iResult, uint64_t uiNs);
+	void recordSpan(uint64_t uiHandle, const std::string &strName, uint64_t uiNs);
+
+	// Histogram of a function or phase, nullptr if nothing was recorded
+	const LatencyHistogram *find(uint64_t uiHandle, const std::string &strName) const;
+
+	std::string prometheus() const;
+	// Returns 0 if success, -1 otherwise
+	int32_t exportFile(const std::string &strPath) const;
+	void reset();
+
+private:
+	struct Slot
+	{
+		std::atomic<uint64_t> uiHandle{ 0 };
+		std::atomic<CallStats *> calls[NB_API_FUNCTIONS];
+	};
+
+	Metrics();
+	~Metrics();
+	Slot &slot(uint64_t uiHandle);
+	CallStats &stats(Slot &s, ApiFunction eFunction);
+
+	Slot m_slots[MAX_HANDLES + 1];          // the last one for the overflow
+	std::atomic<size_t> m_uiSlots{ 0 };
+	mutable std::mutex m_mtx;
+	std::map<std::pair<uint64_t, std::string>, std::unique_ptr<LatencyHistogram> > m_spans;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
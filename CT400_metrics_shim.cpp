@@ -0,0 +1,167 @@
+//------------------------------------------------------------------------------
+// CT400_metrics_shim.cpp
+//
+// Forwarding definitions of every CT400_lib.h function (CT400_api.h). The
+// real library is loaded on the first call, from CT400_REAL_LIB if set, or
+// else libCT400_lib.so next to this library (CT400_lib.dll on Windows). Each
+// call costs two steady_clock reads and a few relaxed atomic increments on
+// top of the real one.
+//------------------------------------------------------------------------------
+
+#define CT400_LIB_EXPORT
+#include "CT400_metrics.h"
+#include "CT400_shim.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+//------------------------------ Exporter --------------------------------------
+// Writes CT400_METRICS_FILE every CT400_METRICS_INTERVAL s, after each
+// CT400_Close and when the library is unloaded
+//------------------------------------------------------------------------------
+class Exporter
+{
+public:
+	static Exporter &instance()
+	{
+		static Exporter exporter;
+		return exporter;
+	}
+
+	void poke()
+	{
+		if (m_strPath.empty())
+			return;
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_bPoked = true;
+		m_cv.notify_one();
+	}
+
+	~Exporter()
+	{
+		if (!m_thread.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_bStop = true;
+		}
+		m_cv.notify_one();
+		m_thread.join();
+		ct400::Metrics::instance().exportFile(m_strPath);
+	}
+
+private:
+	Exporter()
+	{
+		// constructed first, so destroyed after the registry it exports
+		ct400::Metrics::instance();
+		const char *pcPath = std::getenv("CT400_METRICS_FILE");
+		if (pcPath == nullptr || pcPath[0] == '\0')
+			return;
+		m_strPath = pcPath;
+		const char *pcInterval = std::getenv("CT400_METRICS_INTERVAL");
+		double dInterval = pcInterval ? std::atof(pcInterval) : 10.0;
+		m_interval = std::chrono::milliseconds((int64_t)((dInterval > 0.0 ? dInterval : 10.0) * 1000.0));
+		m_thread = std::thread([this] { run(); });
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		while (!m_bStop) {
+			m_cv.wait_for(lock, m_interval, [this] { return m_bStop || m_bPoked; });
+			if (m_bStop)
+				break;
+			m_bPoked = false;
+			lock.unlock();
+			ct400::Metrics::instance().exportFile(m_strPath);
+			lock.lock();
+		}
+	}
+
+	std::string m_strPath;
+	std::chrono::milliseconds m_interval{ 10000 };
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	bool m_bStop = false;
+	bool m_bPoked = false;
+	std::thread m_thread;
+};
+
+//------------------------------ RealLibrary -----------------------------------
+// The instrumented library, loaded once
+//------------------------------------------------------------------------------
+class RealLibrary
+{
+public:
+	static RealLibrary &instance()
+	{
+		static RealLibrary library;
+		return library;
+	}
+
+	// Address of a function of the real library, nullptr if missing or if it
+	// resolves back to this library's own definition
+	void *symbol(const char *pcName, void *pSelf)
+	{
+		return ct400::realSymbol(m_hLib, pcName, pSelf);
+	}
+
+private:
+	RealLibrary()
+	{
+		Exporter::instance();
+		m_hLib = ct400::openRealLibrary((void *)&RealLibrary::instance);
+	}
+
+	void *m_hLib = nullptr;
+};
+
+int64_t failureResult(rCallResult eKind)
+{
+	return eKind == CR_HANDLE || eKind == CR_CONNECTED ? 0 : -1;
+}
+
+void record(uint64_t uiHandle, ct400::ApiFunction eFunction, rCallResult eKind, int64_t iResult,
+	Clock::time_point tStart)
+{
+	const uint64_t uiNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		Clock::now() - tStart).count();
+	ct400::Metrics::instance().recordCall(uiHandle, eFunction, eKind, iResult, uiNs);
+	if (eFunction == ct400::API_CT400_Close)
+		Exporter::instance().poke();
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+#define CT400_FORWARD(ret, name, params, args, handle, kind) \
+_DECLSPEC ret __stdcall name params \
+{ \
+	typedef ret (__stdcall *Fn) params; \
+	static const Fn fn = (Fn)RealLibrary::instance().symbol(#name, (void *)&name); \
+	if (fn == nullptr) \
+		return (ret)failureResult(kind); \
+	const Clock::time_point tStart = Clock::now(); \
+	const ret result = fn args; \
+	record(handle, ct400::API_##name, kind, (int64_t)result, tStart); \
+	return result; \
+}
+
+CT400_API_LIST(CT400_FORWARD)
+
+#undef CT400_FORWARD
+
+}
@@ -0,0 +1,269 @@
+//------------------------------------------------------------------------------
+// CT400_mmap.cpp
+//
+// File mapping on Windows (CreateFileMapping) and POSIX (mmap), read-only or
+// read-write and growing.
+//------------------------------------------------------------------------------
+
+#include "CT400_mmap.h"
+
+#if defined (_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ct400
+{
+
+#if defined (_WIN32)
+
+int32_t MappedFile::open(const std::string &strPath)
+{
+	close();
+	HANDLE hFile = CreateFileA(strPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return -1;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size)) {
+		CloseHandle(hFile);
+		return -1;
+	}
+	m_hFile = hFile;
+	m_uiSize = (size_t)size.QuadPart;
+	if (m_uiSize == 0)
+		return 0;
+	HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (hMapping == nullptr) {
+		close();
+		return -1;
+	}
+	m_hMapping = hMapping;
+	m_pData = static_cast<const uint8_t *>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_pData == nullptr) {
+		close();
+		return -1;
+	}
+	return 0;
+}
+
+void MappedFile::close()
+{
+	if (m_pData)
+		UnmapViewOfFile(m_pData);
+	if (m_hMapping)
+		CloseHandle(m_hMapping);
+	if (m_hFile)
+		CloseHandle(m_hFile);
+	m_pData = nullptr;
+	m_hMapping = nullptr;
+	m_hFile = nullptr;
+	m_uiSize = 0;
+}
+
+int32_t WritableMappedFile::create(const std::string &strPath, size_t uiSize)
+{
+	close();
+	HANDLE hFile = CreateFileA(strPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return -1;
+	m_hFile = hFile;
+	return resize(uiSize);
+}
+
+int32_t WritableMappedFile::open(const std::string &strPath)
+{
+	close();
+	HANDLE hFile = CreateFileA(strPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return -1;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size)) {
+		CloseHandle(hFile);
+		return -1;
+	}
+	m_hFile = hFile;
+	m_uiSize = (size_t)size.QuadPart;
+	if (map() != 0) {
+		close();
+		return -1;
+	}
+	return 0;
+}
+
+int32_t WritableMappedFile::map()
+{
+	if (m_uiSize == 0)
+		return 0;
+	// a mapping larger than the file extends it
+	const uint64_t uiSize = m_uiSize;
+	HANDLE hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READWRITE, (DWORD)(uiSize >> 32), (DWORD)uiSize,
+		nullptr);
+	if (hMapping == nullptr)
+		return -1;
+	m_hMapping = hMapping;
+	m_pData = static_cast<uint8_t *>(MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, 0));
+	return m_pData ? 0 : -1;
+}
+
+void WritableMappedFile::unmap()
+{
+	if (m_pData)
+		UnmapViewOfFile(m_pData);
+	if (m_hMapping)
+		CloseHandle(m_hMapping);
+	m_pData = nullptr;
+	m_hMapping = nullptr;
+}
+
+int32_t WritableMappedFile::resize(size_t uiSize)
+{
+	if (m_hFile == nullptr)
+		return -1;
+	unmap();
+	LARGE_INTEGER size;
+	size.QuadPart = (LONGLONG)uiSize;
+	m_uiSize = uiSize;
+	if (!SetFilePointerEx(m_hFile, size, nullptr, FILE_BEGIN) || !SetEndOfFile(m_hFile) || map() != 0) {
+		close();
+		return -1;
+	}
+	return 0;
+}
+
+int32_t WritableMappedFile::flush(bool bSync)
+{
+	if (m_pData && !FlushViewOfFile(m_pData, 0))
+		return -1;
+	return !bSync || m_hFile == nullptr || FlushFileBuffers(m_hFile) ? 0 : -1;
+}
+
+void WritableMappedFile::close()
+{
+	unmap();
+	if (m_hFile)
+		CloseHandle(m_hFile);
+	m_hFile = nullptr;
+	m_uiSize = 0;
+}
+
+#else
+
+int32_t MappedFile::open(const std::string &strPath)
+{
+	close();
+	int fd = ::open(strPath.c_str(), O_RDONLY);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return -1;
+	}
+	m_uiSize = (size_t)st.st_size;
+	if (m_uiSize > 0) {
+		void *p = mmap(nullptr, m_uiSize, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			::close(fd);
+			m_uiSize = 0;
+			return -1;
+		}
+		m_pData = static_cast<const uint8_t *>(p);
+	}
+	// the mapping stays valid after the descriptor is closed
+	::close(fd);
+	return 0;
+}
+
+void MappedFile::close()
+{
+	if (m_pData)
+		munmap(const_cast<uint8_t *>(m_pData), m_uiSize);
+	m_pData = nullptr;
+	m_uiSize = 0;
+}
+
+int32_t WritableMappedFile::create(const std::string &strPath, size_t uiSize)
+{
+	close();
+	m_fd = ::open(strPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (m_fd < 0)
+		return -1;
+	return resize(uiSize);
+}
+
+int32_t WritableMappedFile::open(const std::string &strPath)
+{
+	close();
+	m_fd = ::open(strPath.c_str(), O_RDWR);
+	if (m_fd < 0)
+		return -1;
+	struct stat st;
+	if (fstat(m_fd, &st) != 0) {
+		close();
+		return -1;
+	}
+	m_uiSize = (size_t)st.st_size;
+	if (map() != 0) {
+		close();
+		return -1;
+	}
+	return 0;
+}
+
+int32_t WritableMappedFile::map()
+{
+	if (m_uiSize == 0)
+		return 0;
+	void *p = mmap(nullptr, m_uiSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	m_pData = static_cast<uint8_t *>(p);
+	return 0;
+}
+
+void WritableMappedFile::unmap()
+{
+	if (m_pData)
+		munmap(m_pData, m_uiSize);
+	m_pData = nullptr;
+}
+
+int32_t WritableMappedFile::resize(size_t uiSize)
+{
+	if (m_fd < 0)
+		return -1;
+	unmap();
+	m_uiSize = uiSize;
+	if (ftruncate(m_fd, (off_t)uiSize) != 0 || map() != 0) {
+		close();
+		return -1;
+	}
+	return 0;
+}
+
+int32_t WritableMappedFile::flush(bool bSync)
+{
+	if (m_pData && msync(m_pData, m_uiSize, bSync ? MS_SYNC : MS_ASYNC) != 0)
+		return -1;
+	return 0;
+}
+
+void WritableMappedFile::close()
+{
+	unmap();
+	if (m_fd >= 0)
+		::close(m_fd);
+	m_fd = -1;
+	m_uiSize = 0;
+}
+
+#endif
+
+} // namespace ct400
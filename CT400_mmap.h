@@ -0,0 +1,112 @@
+/******************************************************************************/
+/* Header file for CT400_mmap.cpp                                             */
+/*                                                                            */
+/* Memory-mapped files for the sweep storage formats.                         */
+/******************************************************************************/
+
+#ifndef CT400_MMAP_H
+#define CT400_MMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ct400
+{
+
+// Contiguous view of mapped data
+template <class T>
+struct Span
+{
+	T *pData = nullptr;
+	size_t uiSize = 0;
+
+	Span() {}
+	Span(T *p, size_t n) : pData(p), uiSize(n) {}
+
+	T *data() const { return pData; }
+	size_t size() const { return uiSize; }
+	bool empty() const { return uiSize == 0; }
+	T *begin() const { return pData; }
+	T *end() const { return pData + uiSize; }
+	T &operator[](size_t i) const { return pData[i]; }
+};
+
+//------------------------------ MappedFile ------------------------------------
+// Class MappedFile
+//
+//  Purpose: Read-only mapping of a whole file
+//------------------------------------------------------------------------------
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	// Returns 0 if success, -1 otherwise (an empty file maps to size() == 0)
+	int32_t open(const std::string &strPath);
+	void close();
+
+	const uint8_t *data() const { return m_pData; }
+	size_t size() const { return m_uiSize; }
+
+private:
+	const uint8_t *m_pData = nullptr;
+	size_t m_uiSize = 0;
+#if defined (_WIN32)
+	void *m_hFile = nullptr;
+	void *m_hMapping = nullptr;
+#endif
+};
+
+//------------------------------ WritableMappedFile ----------------------------
+// Class WritableMappedFile
+//
+//  Purpose: Read-write mapping of a file that grows: resize() extends (or
+//           cuts) the file and maps it again, so pointers into data() are
+//           only valid until the next resize()
+//------------------------------------------------------------------------------
+class WritableMappedFile
+{
+public:
+	WritableMappedFile() {}
+	~WritableMappedFile() { close(); }
+
+	WritableMappedFile(const WritableMappedFile &) = delete;
+	WritableMappedFile &operator=(const WritableMappedFile &) = delete;
+
+	// Creates (or empties) strPath and maps uiSize zero-filled bytes.
+	// Returns 0 if success, -1 otherwise
+	int32_t create(const std::string &strPath, size_t uiSize);
+	// Maps an existing file as it is. Returns 0 if success, -1 otherwise
+	int32_t open(const std::string &strPath);
+	// Returns 0 if success, -1 otherwise (the file is then closed)
+	int32_t resize(size_t uiSize);
+	// Writes the dirty pages back to the file (and waits for them if bSync)
+	int32_t flush(bool bSync = false);
+	void close();
+
+	uint8_t *data() const { return m_pData; }
+	size_t size() const { return m_uiSize; }
+
+private:
+	int32_t map();
+	void unmap();
+
+	uint8_t *m_pData = nullptr;
+	size_t m_uiSize = 0;
+#if defined (_WIN32)
+	void *m_hFile = nullptr;
+	void *m_hMapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+};
+
+} // namespace ct400
+
+
+#endif
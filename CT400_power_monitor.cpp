@@ -0,0 +1,207 @@
+//------------------------------------------------------------------------------
+// CT400_power_monitor.cpp
+//
+// Fixed-rate power detector sampler. The sampling thread is the only writer
+// of the ring, the extremes and the rate; display code reads them at its own
+// pace, so the detector rate no longer depends on how fast a plot redraws.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_power_monitor.h"
+#include "CT400_device.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace ct400
+{
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+} // namespace
+
+PowerMonitor::PowerMonitor(uint64_t uiHandle, double dRate, size_t uiCapacity)
+	: m_device(Device::forHandle(uiHandle)), m_dPeriod(dRate > 0.0 ? 1.0 / dRate : 0.0),
+	m_ring(std::max<size_t>(uiCapacity, 2))
+{
+	for (int c = 0; c < NB_POWER_CHANNELS; c++) {
+		m_dMin[c].store(std::numeric_limits<double>::quiet_NaN());
+		m_dMax[c].store(std::numeric_limits<double>::quiet_NaN());
+	}
+}
+
+PowerMonitor::~PowerMonitor()
+{
+	stop();
+}
+
+void PowerMonitor::start()
+{
+	if (m_bRunning.exchange(true))
+		return;
+	m_thread = std::thread([this] { run(); });
+}
+
+void PowerMonitor::stop()
+{
+	m_bRunning.store(false);
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void PowerMonitor::extremes(double dMin[NB_POWER_CHANNELS], double dMax[NB_POWER_CHANNELS]) const
+{
+	for (int c = 0; c < NB_POWER_CHANNELS; c++) {
+		dMin[c] = m_dMin[c].load(std::memory_order_relaxed);
+		dMax[c] = m_dMax[c].load(std::memory_order_relaxed);
+	}
+}
+
+void PowerMonitor::run()
+{
+	const Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(m_dPeriod));
+	Clock::time_point tStart = Clock::now();
+	Clock::time_point tNext = tStart;
+	Clock::time_point tWindow = tStart;
+	uint64_t uiWindowSamples = 0;
+
+	while (m_bRunning.load(std::memory_order_relaxed)) {
+		PowerSample sample;
+		double *p = sample.dPower;
+		int32_t iResult = m_device->call([p](uint64_t uiHandle) {
+			return CT400_ReadPowerDetectors(uiHandle, &p[0], &p[1], &p[2], &p[3], &p[4], &p[5]);
+		});
+		Clock::time_point tNow = Clock::now();
+		if (iResult == 0) {
+			sample.dTime = std::chrono::duration<double>(tNow - tStart).count();
+			m_ring.push(sample);
+			bool bReset = m_bReset.exchange(false, std::memory_order_relaxed);
+			for (int c = 0; c < NB_POWER_CHANNELS; c++) {
+				double dMin = m_dMin[c].load(std::memory_order_relaxed);
+				double dMax = m_dMax[c].load(std::memory_order_relaxed);
+				if (bReset || !(p[c] >= dMin))
+					m_dMin[c].store(p[c], std::memory_order_relaxed);
+				if (bReset || !(p[c] <= dMax))
+					m_dMax[c].store(p[c], std::memory_order_relaxed);
+			}
+			uiWindowSamples++;
+		}
+		else {
+			m_uiErrors.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		double dWindow = std::chrono::duration<double>(tNow - tWindow).count();
+		if (dWindow >= 1.0) {
+			m_dRate.store(uiWindowSamples / dWindow, std::memory_order_relaxed);
+			uiWindowSamples = 0;
+			tWindow = tNow;
+		}
+
+		// fixed schedule; after a stall (e.g. a sweep holding the handle)
+		// resume from now rather than bursting to catch up
+		tNext += period;
+		if (tNext < tNow)
+			tNext = tNow;
+		else
+			std::this_thread::sleep_until(tNext);
+	}
+}
+
+} // namespace ct400
+
+
+namespace
+{
+
+std::mutex g_mtx;
+std::map<uint64_t, std::shared_ptr<ct400::PowerMonitor> > g_monitors;
+uint64_t g_uiNextMonitor = 1;
+
+std::shared_ptr<ct400::PowerMonitor> findMonitor(uint64_t uiMonitor)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	auto it = g_monitors.find(uiMonitor);
+	return it == g_monitors.end() ? nullptr : it->second;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC uint64_t __stdcall CT400_MonitorStart(uint64_t uiHandle,
+double dRate, int32_t iCapacity)
+{
+	if (dRate <= 0.0 || iCapacity <= 0 || CT400_CheckConnected(uiHandle) != 1)
+		return 0;
+	auto monitor = std::make_shared<ct400::PowerMonitor>(uiHandle, dRate, iCapacity);
+	monitor->start();
+	std::lock_guard<std::mutex> lock(g_mtx);
+	uint64_t uiMonitor = g_uiNextMonitor++;
+	g_monitors[uiMonitor] = std::move(monitor);
+	return uiMonitor;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_MonitorSnapshot(uint64_t uiMonitor,
+double dTime[], double dPowers[], int32_t iPoints, int32_t iDecimation)
+{
+	std::shared_ptr<ct400::PowerMonitor> monitor = findMonitor(uiMonitor);
+	if (monitor == nullptr || dPowers == nullptr || iPoints < 0)
+		return -1;
+	std::vector<ct400::PowerSample> samples(iPoints);
+	size_t n = monitor->snapshot(samples.data(), iPoints, std::max(iDecimation, 1));
+	for (size_t i = 0; i < n; i++) {
+		if (dTime)
+			dTime[i] = samples[i].dTime;
+		for (int c = 0; c < ct400::NB_POWER_CHANNELS; c++)
+			dPowers[c * iPoints + i] = samples[i].dPower[c];
+	}
+	return (int32_t)n;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_MonitorStats(uint64_t uiMonitor,
+double dMin[6], double dMax[6], double *dRate)
+{
+	std::shared_ptr<ct400::PowerMonitor> monitor = findMonitor(uiMonitor);
+	if (monitor == nullptr || dMin == nullptr || dMax == nullptr)
+		return -1;
+	monitor->extremes(dMin, dMax);
+	if (dRate)
+		*dRate = monitor->rate();
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_MonitorResetStats(uint64_t uiMonitor)
+{
+	std::shared_ptr<ct400::PowerMonitor> monitor = findMonitor(uiMonitor);
+	if (monitor == nullptr)
+		return -1;
+	monitor->resetExtremes();
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_MonitorStop(uint64_t uiMonitor)
+{
+	std::shared_ptr<ct400::PowerMonitor> monitor;
+	{
+		std::lock_guard<std::mutex> lock(g_mtx);
+		auto it = g_monitors.find(uiMonitor);
+		if (it == g_monitors.end())
+			return -1;
+		monitor = std::move(it->second);
+		g_monitors.erase(it);
+	}
+	monitor->stop();
+	return 0;
+}
+
+}
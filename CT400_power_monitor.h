@@ -0,0 +1,162 @@
+/******************************************************************************/
+/* Header file for CT400_power_monitor.cpp                                    */
+/*                                                                            */
+/* Background sampling of CT400_ReadPowerDetectors into a lock-free ring,     */
+/* for live power display during fibre alignment.                             */
+/******************************************************************************/
+
+#ifndef CT400_POWER_MONITOR_H
+#define CT400_POWER_MONITOR_H
+
+#include "CT400_ext.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//------------------------------ CT400_MonitorStart ----------------------------
+// Function CT400_MonitorStart
+//
+//  Purpose: Starts sampling the power detectors of a CT400 in the background
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN dRate: sampling rate in Hz
+//              IN iCapacity: number of samples kept
+//  Returns:  uiMonitor for use in the other CT400_Monitor functions,
+//            0 if the monitor could not be started
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC uint64_t __stdcall CT400_MonitorStart(uint64_t uiHandle,
+double dRate, int32_t iCapacity);
+
+//------------------------------ CT400_MonitorSnapshot -------------------------
+// Function CT400_MonitorSnapshot
+//
+//  Purpose: Returns the newest samples, oldest first
+//
+//  Parameters: IN uiMonitor: from CT400_MonitorStart
+//              IN/OUT dTime: pointer over an initialized array of iPoints
+//                            values (s since the monitor started), or NULL
+//              IN/OUT dPowers: pointer over an initialized array of
+//                              6 * iPoints values, one row of iPoints per
+//                              channel: Pout, P1, P2, P3, P4, Vext
+//              IN iPoints: number of samples wanted
+//              IN iDecimation: keep one sample out of iDecimation
+//  Returns:  number of samples written, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_MonitorSnapshot(uint64_t uiMonitor,
+double dTime[], double dPowers[], int32_t iPoints, int32_t iDecimation);
+
+//------------------------------ CT400_MonitorStats ----------------------------
+// Function CT400_MonitorStats
+//
+//  Purpose: Returns the running minimum and maximum of every channel since
+//           the start or the last CT400_MonitorResetStats, and the measured
+//           sampling rate
+//
+//  Parameters: IN uiMonitor: from CT400_MonitorStart
+//              IN/OUT dMin: pointer over an initialized array of 6 values
+//              IN/OUT dMax: pointer over an initialized array of 6 values
+//              IN/OUT dRate: pointer over a variable (samples per second)
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_MonitorStats(uint64_t uiMonitor,
+double dMin[6], double dMax[6], double *dRate);
+
+//------------------------------ CT400_MonitorResetStats -----------------------
+// Function CT400_MonitorResetStats
+//
+//  Purpose: Restarts the running minimum and maximum
+//
+//  Parameters: IN uiMonitor: from CT400_MonitorStart
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_MonitorResetStats(uint64_t uiMonitor);
+
+//------------------------------ CT400_MonitorStop -----------------------------
+// Function CT400_MonitorStop
+//
+//  Purpose: Stops sampling and releases the monitor
+//
+//  Parameters: IN uiMonitor: from CT400_MonitorStart
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_MonitorStop(uint64_t uiMonitor);
+
+#ifdef __cplusplus
+}
+
+#include "CT400_ring.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace ct400
+{
+
+class Device;
+
+const int NB_POWER_CHANNELS = 6;    // Pout, P1, P2, P3, P4, Vext
+
+struct PowerSample
+{
+	double dTime;                           // s since the monitor started
+	double dPower[NB_POWER_CHANNELS];
+};
+
+//------------------------------ PowerMonitor ----------------------------------
+// Class PowerMonitor
+//
+//  Purpose: Polls CT400_ReadPowerDetectors at a fixed rate on its own thread
+//           (through the handle's Device lock) and publishes the samples in
+//           a SampleRing. Readers never block the sampler.
+//------------------------------------------------------------------------------
+class PowerMonitor
+{
+public:
+	PowerMonitor(uint64_t uiHandle, double dRate = 1000.0, size_t uiCapacity = 1 << 16);
+	~PowerMonitor();
+
+	PowerMonitor(const PowerMonitor &) = delete;
+	PowerMonitor &operator=(const PowerMonitor &) = delete;
+
+	void start();
+	void stop();
+
+	// Newest samples, oldest first, one out of uiDecimation.
+	// Returns the number of samples copied
+	size_t snapshot(PowerSample *out, size_t uiCount, size_t uiDecimation = 1) const
+	{
+		return m_ring.readLatest(out, uiCount, uiDecimation);
+	}
+
+	void extremes(double dMin[NB_POWER_CHANNELS], double dMax[NB_POWER_CHANNELS]) const;
+	// The sampler restarts the extremes at its next sample
+	void resetExtremes() { m_bReset.store(true); }
+	// Samples per second over the last second
+	double rate() const { return m_dRate.load(); }
+	uint64_t samples() const { return m_ring.written(); }
+	uint64_t errors() const { return m_uiErrors.load(); }
+
+private:
+	void run();
+
+	std::shared_ptr<Device> m_device;
+	double m_dPeriod;
+	SampleRing<PowerSample> m_ring;
+	std::atomic<double> m_dMin[NB_POWER_CHANNELS];
+	std::atomic<double> m_dMax[NB_POWER_CHANNELS];
+	std::atomic<double> m_dRate{ 0.0 };
+	std::atomic<uint64_t> m_uiErrors{ 0 };
+	std::atomic<bool> m_bReset{ true };
+	std::atomic<bool> m_bRunning{ false };
+	std::thread m_thread;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
@@ -0,0 +1,270 @@
+//------------------------------------------------------------------------------
+// CT400_resample.cpp
+//
+// Resampling kernels. The plan stores, for every grid point, the index of the
+// first source sample used and 2 (linear) or 4 (cubic) weights in separate
+// aligned arrays, so the kernels gather the source values and accumulate
+// weight * value lane by lane. Rows are processed in blocks of grid points so
+// the indices and weights of a block stay in cache across all detectors.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_resample.h"
+#include "CT400_simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+
+const size_t BLOCK_POINTS = 2048;
+
+template <int TAPS>
+void kernelScalar(const int32_t *pIndex, const double *const *ppWeight, const double *pSrc, double *pOut,
+	size_t k0, size_t k1)
+{
+	for (size_t k = k0; k < k1; k++) {
+		const double *p = pSrc + pIndex[k];
+		double dValue = p[0] * ppWeight[0][k];
+		for (int t = 1; t < TAPS; t++)
+			dValue += p[t] * ppWeight[t][k];
+		pOut[k] = dValue;
+	}
+}
+
+#if CT400_SIMD_X86
+
+// Four values at arbitrary offsets. Built from scalar loads rather than
+// vgatherdpd, which is slower than the loads on CPUs with the gather data
+// sampling microcode fix
+CT400_TARGET_AVX2 inline __m256d gather4(const double *p, const int32_t *pIndex)
+{
+	__m128d vLow = _mm_loadh_pd(_mm_load_sd(p + pIndex[0]), p + pIndex[1]);
+	__m128d vHigh = _mm_loadh_pd(_mm_load_sd(p + pIndex[2]), p + pIndex[3]);
+	return _mm256_insertf128_pd(_mm256_castpd128_pd256(vLow), vHigh, 1);
+}
+
+// Eight values, from scalar loads for the same reason as gather4
+CT400_TARGET_AVX512 inline __m512d gather8(const double *p, const int32_t *pIndex)
+{
+	return _mm512_set_pd(p[pIndex[7]], p[pIndex[6]], p[pIndex[5]], p[pIndex[4]],
+		p[pIndex[3]], p[pIndex[2]], p[pIndex[1]], p[pIndex[0]]);
+}
+
+template <int TAPS>
+CT400_TARGET_AVX2 void kernelAvx2(const int32_t *pIndex, const double *const *ppWeight, const double *pSrc,
+	double *pOut, size_t k0, size_t k1)
+{
+	size_t k = k0;
+	for (; k + 4 <= k1; k += 4) {
+		__m256d vSum = _mm256_mul_pd(gather4(pSrc, pIndex + k), _mm256_loadu_pd(ppWeight[0] + k));
+		for (int t = 1; t < TAPS; t++)
+			vSum = _mm256_fmadd_pd(gather4(pSrc + t, pIndex + k), _mm256_loadu_pd(ppWeight[t] + k), vSum);
+		_mm256_storeu_pd(pOut + k, vSum);
+	}
+	kernelScalar<TAPS>(pIndex, ppWeight, pSrc, pOut, k, k1);
+}
+
+template <int TAPS>
+CT400_TARGET_AVX512 void kernelAvx512(const int32_t *pIndex, const double *const *ppWeight, const double *pSrc,
+	double *pOut, size_t k0, size_t k1)
+{
+	size_t k = k0;
+	for (; k + 8 <= k1; k += 8) {
+		__m512d vSum = _mm512_mul_pd(gather8(pSrc, pIndex + k), _mm512_loadu_pd(ppWeight[0] + k));
+		for (int t = 1; t < TAPS; t++)
+			vSum = _mm512_fmadd_pd(gather8(pSrc + t, pIndex + k), _mm512_loadu_pd(ppWeight[t] + k), vSum);
+		_mm512_storeu_pd(pOut + k, vSum);
+	}
+	kernelScalar<TAPS>(pIndex, ppWeight, pSrc, pOut, k, k1);
+}
+
+#endif
+
+typedef void (*Kernel)(const int32_t *, const double *const *, const double *, double *, size_t, size_t);
+
+template <int TAPS>
+Kernel selectKernel()
+{
+#if CT400_SIMD_X86
+	switch (ct400::simdLevel()) {
+	case ct400::SIMD_AVX512:
+		return kernelAvx512<TAPS>;
+	case ct400::SIMD_AVX2:
+		return kernelAvx2<TAPS>;
+	default:
+		break;
+	}
+#endif
+	return kernelScalar<TAPS>;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ResampleBlock(const double dWavelength[],
+const double dBlock[], int32_t iNbRows, int32_t iArraySize, const double dGrid[],
+double dOut[], int32_t iGridSize, rInterpolation eMethod)
+{
+	if (dWavelength == nullptr || dGrid == nullptr || iNbRows < 0 || iArraySize < 0 || iGridSize < 0
+		|| (iNbRows > 0 && (dBlock == nullptr || dOut == nullptr)))
+		return -1;
+	thread_local ct400::ResamplePlan plan;
+	if (plan.build(dWavelength, iArraySize, dGrid, iGridSize, eMethod) != 0)
+		return -1;
+	std::vector<const double *> rows(iNbRows);
+	std::vector<double *> out(iNbRows);
+	for (int32_t r = 0; r < iNbRows; r++) {
+		rows[r] = dBlock + (size_t)r * iArraySize;
+		out[r] = dOut + (size_t)r * iGridSize;
+	}
+	plan.apply(rows.data(), out.data(), iNbRows);
+	return iGridSize;
+}
+
+}
+
+
+namespace ct400
+{
+
+int32_t ResamplePlan::build(const double *pdSource, size_t uiSource, const double *pdGrid, size_t uiGrid,
+	rInterpolation eMethod)
+{
+	if (uiSource < 2 || uiSource > (size_t)std::numeric_limits<int32_t>::max()
+		|| (eMethod != IM_LINEAR && eMethod != IM_CUBIC))
+		return -1;
+	// the merge walk below needs an increasing grid (NaN fails the test too)
+	for (size_t k = 1; k < uiGrid; k++)
+		if (!(pdGrid[k] > pdGrid[k - 1]))
+			return -1;
+	if (eMethod == IM_CUBIC && uiSource < 4)
+		eMethod = IM_LINEAR;
+	m_eMethod = eMethod;
+	m_uiSource = uiSource;
+	m_uiGrid = uiGrid;
+	const int iTaps = eMethod == IM_CUBIC ? 4 : 2;
+	m_index.resize(uiGrid);
+	for (int t = 0; t < 4; t++)
+		m_weight[t].resize(t < iTaps ? uiGrid : 0);
+
+	m_uiFirst = 0;
+	while (m_uiFirst < uiGrid && pdGrid[m_uiFirst] < pdSource[0])
+		m_uiFirst++;
+	m_uiLast = uiGrid;
+	while (m_uiLast > m_uiFirst && pdGrid[m_uiLast - 1] > pdSource[uiSource - 1])
+		m_uiLast--;
+
+	// merge walk: j only moves forward since both axes are sorted
+	size_t j = 0;
+	for (size_t k = m_uiFirst; k < m_uiLast; k++) {
+		const double x = pdGrid[k];
+		while (j + 2 < uiSource && pdSource[j + 1] < x)
+			j++;
+		const double dSpan = pdSource[j + 1] - pdSource[j];
+		const double t = dSpan > 0.0 ? (x - pdSource[j]) / dSpan : 0.0;
+		if (iTaps == 2) {
+			m_index[k] = (int32_t)j;
+			m_weight[0][k] = 1.0 - t;
+			m_weight[1][k] = t;
+			continue;
+		}
+
+		size_t uiBase = std::min(j > 0 ? j - 1 : 0, uiSource - 4);
+		const double *n = pdSource + uiBase;
+		double w[4];
+		bool bDistinct = true;
+		for (int a = 0; a < 4; a++) {
+			double dNum = 1.0, dDen = 1.0;
+			for (int b = 0; b < 4; b++) {
+				if (b == a)
+					continue;
+				dNum *= x - n[b];
+				dDen *= n[a] - n[b];
+			}
+			bDistinct = bDistinct && dDen != 0.0;
+			w[a] = bDistinct ? dNum / dDen : 0.0;
+		}
+		if (!bDistinct) {
+			// repeated sync wavelengths: fall back to linear weights
+			std::fill(w, w + 4, 0.0);
+			w[j - uiBase] = 1.0 - t;
+			w[j - uiBase + 1] = t;
+		}
+		m_index[k] = (int32_t)uiBase;
+		for (int a = 0; a < 4; a++)
+			m_weight[a][k] = w[a];
+	}
+	return 0;
+}
+
+void ResamplePlan::apply(const double *const *ppRows, double *const *ppOut, size_t uiRows) const
+{
+	static const Kernel linear = selectKernel<2>();
+	static const Kernel cubic = selectKernel<4>();
+	const Kernel kernel = m_eMethod == IM_CUBIC ? cubic : linear;
+	const double *ppWeight[4] = { m_weight[0].data(), m_weight[1].data(), m_weight[2].data(), m_weight[3].data() };
+	const double dNaN = std::numeric_limits<double>::quiet_NaN();
+
+	for (size_t r = 0; r < uiRows; r++) {
+		std::fill(ppOut[r], ppOut[r] + m_uiFirst, dNaN);
+		std::fill(ppOut[r] + m_uiLast, ppOut[r] + m_uiGrid, dNaN);
+	}
+	for (size_t k0 = m_uiFirst; k0 < m_uiLast; k0 += BLOCK_POINTS) {
+		size_t k1 = std::min(k0 + BLOCK_POINTS, m_uiLast);
+		for (size_t r = 0; r < uiRows; r++)
+			kernel(m_index.data(), ppWeight, ppRows[r], ppOut[r], k0, k1);
+	}
+}
+
+size_t uniformGrid(double dMin, double dMax, double dStep, AlignedVector &grid)
+{
+	if (!(dStep > 0.0) || !(dMax >= dMin)) {
+		grid.clear();
+		return 0;
+	}
+	// same rounding as the resampled arrays of the DLL
+	size_t uiPoints = (size_t)std::floor((dMax - dMin) / dStep + 1e-6) + 1;
+	grid.resize(uiPoints);
+	for (size_t i = 0; i < uiPoints; i++)
+		grid[i] = dMin + i * dStep;
+	return uiPoints;
+}
+
+int32_t resample(const ScanBuffer &sync, const double *pdGrid, size_t uiGrid, rInterpolation eMethod,
+	ScanBuffer &out, ResamplePlan &plan)
+{
+	if (plan.build(sync.wavelength(), sync.points(), pdGrid, uiGrid, eMethod) != 0)
+		return -1;
+	const size_t uiDetectors = sync.detectors().size();
+	out.resize(uiDetectors, uiGrid, sync.power() != nullptr);
+	out.setDetectors(sync.detectors());
+	std::copy(pdGrid, pdGrid + uiGrid, out.wavelength());
+
+	std::vector<const double *> rows;
+	std::vector<double *> dest;
+	for (size_t d = 0; d < uiDetectors; d++) {
+		rows.push_back(sync.row(d));
+		dest.push_back(out.row(d));
+	}
+	if (sync.power()) {
+		rows.push_back(sync.power());
+		dest.push_back(out.power());
+	}
+	plan.apply(rows.data(), dest.data(), rows.size());
+	return (int32_t)uiGrid;
+}
+
+int32_t resample(const ScanBuffer &sync, const double *pdGrid, size_t uiGrid, rInterpolation eMethod,
+	ScanBuffer &out)
+{
+	ResamplePlan plan;
+	return resample(sync, pdGrid, uiGrid, eMethod, out, plan);
+}
+
+} // namespace ct400
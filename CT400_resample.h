@@ -0,0 +1,108 @@
+/******************************************************************************/
+/* Header file for CT400_resample.cpp                                         */
+/*                                                                            */
+/* Resampling of the raw (sync) arrays of a sweep onto a uniform or any       */
+/* other wavelength grid, linear or cubic, instead of the fixed grid of       */
+/* CT400_ScanGet*ResampledArray.                                              */
+/******************************************************************************/
+
+#ifndef CT400_RESAMPLE_H
+#define CT400_RESAMPLE_H
+
+#include "CT400_retrieve.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef enum
+  {
+	IM_LINEAR = 0,
+	IM_CUBIC                        // 4 point Lagrange on the sync wavelengths
+  } rInterpolation;
+
+//------------------------------ CT400_ResampleBlock ---------------------------
+// Function CT400_ResampleBlock
+//
+//  Purpose: Resamples several arrays sharing one wavelength axis (e.g. the
+//           block of CT400_ScanGetSyncBlock) onto a wavelength grid. Grid
+//           points outside the wavelength axis are set to NaN.
+//
+//  Parameters: IN dWavelength: wavelength axis, non-decreasing,
+//                              iArraySize values
+//              IN dBlock: iNbRows rows of iArraySize values
+//              IN iNbRows: number of rows
+//              IN iArraySize: size of the axis and of one block row
+//              IN dGrid: increasing grid, iGridSize values
+//              IN/OUT dOut: pointer over an initialized array of
+//                           iNbRows * iGridSize values
+//              IN iGridSize: size of the grid and of one output row
+//              IN eMethod: IM_LINEAR or IM_CUBIC
+//  Returns:  iGridSize if success, -1 otherwise (dGrid not increasing...)
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ResampleBlock(const double dWavelength[],
+const double dBlock[], int32_t iNbRows, int32_t iArraySize, const double dGrid[],
+double dOut[], int32_t iGridSize, rInterpolation eMethod);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+
+namespace ct400
+{
+
+//------------------------------ ResamplePlan ----------------------------------
+// Class ResamplePlan
+//
+//  Purpose: Source indices and weights of every grid point, computed in one
+//           merge walk of the source and grid wavelengths. Applying the plan
+//           to the detector rows is then a gather and a few multiply-adds per
+//           point (AVX2/AVX-512 when available), and a plan can be reused for
+//           all rows of a sweep and for sweeps sharing the same axis.
+//------------------------------------------------------------------------------
+class ResamplePlan
+{
+public:
+	// pdSource must be non-decreasing. Returns 0 if success, -1 otherwise
+	// (including a pdGrid that is not increasing)
+	int32_t build(const double *pdSource, size_t uiSource, const double *pdGrid, size_t uiGrid,
+		rInterpolation eMethod = IM_LINEAR);
+
+	// ppOut[r] receives gridSize() values interpolated from ppRows[r]
+	// (source size values); points outside the source range are NaN
+	void apply(const double *const *ppRows, double *const *ppOut, size_t uiRows) const;
+
+	size_t sourceSize() const { return m_uiSource; }
+	size_t gridSize() const { return m_uiGrid; }
+	rInterpolation method() const { return m_eMethod; }
+
+private:
+	rInterpolation m_eMethod = IM_LINEAR;
+	size_t m_uiSource = 0;
+	size_t m_uiGrid = 0;
+	size_t m_uiFirst = 0;       // grid points [m_uiFirst, m_uiLast) are in range
+	size_t m_uiLast = 0;
+	std::vector<int32_t, AlignedAllocator<int32_t> > m_index;
+	AlignedVector m_weight[4];
+};
+
+// Fills grid with dMin, dMin + dStep, ... up to dMax (nm).
+// Returns the number of points
+size_t uniformGrid(double dMin, double dMax, double dStep, AlignedVector &grid);
+
+// Resamples the wavelength, detector and Pout rows of a sync ScanBuffer
+// (see ScanBuffer::fetchSync) into out. Returns the number of points, -1
+// otherwise
+int32_t resample(const ScanBuffer &sync, const double *pdGrid, size_t uiGrid, rInterpolation eMethod,
+	ScanBuffer &out, ResamplePlan &plan);
+int32_t resample(const ScanBuffer &sync, const double *pdGrid, size_t uiGrid, rInterpolation eMethod,
+	ScanBuffer &out);
+
+} // namespace ct400
+
+#endif
+
+
+#endif
@@ -0,0 +1,411 @@
+//------------------------------------------------------------------------------
+// CT400_resonance.cpp
+//
+// Resonance detection and Lorentzian fitting. Detection is linear in the
+// number of points (moving average and running extrema with a monotonic
+// deque): about ten milliseconds for a 130k point detector row. The optional
+// fits only cover a few FWHM each and run on the pool, so they add little.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_resonance.h"
+#include "CT400_calibration.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <mutex>
+
+namespace
+{
+
+// Centred moving average of dSign * pdIn over uiWidth (odd) points; the
+// window shrinks at the ends
+void movingAverage(const double *pdIn, double dSign, size_t uiPoints, size_t uiWidth, double *pdOut)
+{
+	const size_t uiHalf = uiWidth / 2;
+	double dSum = 0.0;
+	size_t uiLow = 0, uiHigh = 0;   // window [uiLow, uiHigh)
+	for (size_t k = 0; k < uiPoints; k++) {
+		size_t uiWantLow = k > uiHalf ? k - uiHalf : 0;
+		size_t uiWantHigh = std::min(k + uiHalf + 1, uiPoints);
+		while (uiHigh < uiWantHigh)
+			dSum += pdIn[uiHigh++];
+		while (uiLow < uiWantLow)
+			dSum -= pdIn[uiLow++];
+		pdOut[k] = dSign * dSum / (double)(uiHigh - uiLow);
+	}
+}
+
+// Running maximum over [k - uiBehind, k + uiAhead]
+void runningMax(const double *pdIn, size_t uiPoints, size_t uiBehind, size_t uiAhead, double *pdOut)
+{
+	std::deque<size_t> window;      // indices of decreasing values
+	size_t uiNext = 0;
+	for (size_t k = 0; k < uiPoints; k++) {
+		size_t uiWantHigh = std::min(k + uiAhead + 1, uiPoints);
+		for (; uiNext < uiWantHigh; uiNext++) {
+			while (!window.empty() && pdIn[window.back()] <= pdIn[uiNext])
+				window.pop_back();
+			window.push_back(uiNext);
+		}
+		while (window.front() + uiBehind < k)
+			window.pop_front();
+		pdOut[k] = pdIn[window.front()];
+	}
+}
+
+// Solves the 4x4 system a x = b by Gaussian elimination with partial pivoting
+bool solve4(double a[4][4], double b[4], double x[4])
+{
+	for (int c = 0; c < 4; c++) {
+		int iPivot = c;
+		for (int r = c + 1; r < 4; r++)
+			if (std::fabs(a[r][c]) > std::fabs(a[iPivot][c]))
+				iPivot = r;
+		if (a[iPivot][c] == 0.0)
+			return false;
+		std::swap(a[c], a[iPivot]);
+		std::swap(b[c], b[iPivot]);
+		for (int r = c + 1; r < 4; r++) {
+			double f = a[r][c] / a[c][c];
+			for (int k = c; k < 4; k++)
+				a[r][k] -= f * a[c][k];
+			b[r] -= f * b[c];
+		}
+	}
+	for (int r = 3; r >= 0; r--) {
+		double s = b[r];
+		for (int k = r + 1; k < 4; k++)
+			s -= a[r][k] * x[k];
+		x[r] = s / a[r][r];
+	}
+	return true;
+}
+
+std::mutex g_mtx;
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultResonanceSettings(
+rResonanceSettings *pSettings)
+{
+	if (pSettings == nullptr)
+		return -1;
+	std::memset(pSettings, 0, sizeof(*pSettings));
+	pSettings->iKinds = RK_DIP;
+	pSettings->iFit = DISABLE;
+	pSettings->iMaxIterations = 50;
+	pSettings->dMinDepth = 3.0;
+	pSettings->dBaselineWindow = 5.0;
+	pSettings->dSmoothing = 0.003;
+	pSettings->dFitSpan = 3.0;
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_FindResonances(const double dWavelength[],
+const rDetector eDetectors[], int32_t iNbDetectors, const double dBlock[],
+int32_t iArraySize, const rResonanceSettings *pSettings,
+rResonance pResonances[], int32_t iMaxResonances)
+{
+	if (iNbDetectors < 0 || iArraySize < 0 || iMaxResonances < 0 || (iNbDetectors > 0 && dBlock == nullptr)
+		|| (iMaxResonances > 0 && pResonances == nullptr))
+		return -1;
+	rResonanceSettings settings;
+	if (pSettings)
+		settings = *pSettings;
+	else
+		CT400_DefaultResonanceSettings(&settings);
+	std::vector<const double *> rows(iNbDetectors);
+	for (int32_t d = 0; d < iNbDetectors; d++)
+		rows[d] = dBlock + (size_t)d * iArraySize;
+
+	static ct400::ResonanceAnalyser analyser;
+	thread_local std::vector<rResonance> found;
+	int32_t iFound;
+	{
+		std::lock_guard<std::mutex> lock(g_mtx);
+		iFound = analyser.analyse(dWavelength, eDetectors, rows.data(), iNbDetectors, iArraySize, settings, found);
+	}
+	if (iFound > 0)
+		std::copy(found.begin(), found.begin() + std::min(iFound, iMaxResonances), pResonances);
+	return iFound;
+}
+
+}
+
+
+namespace ct400
+{
+
+ResonanceAnalyser::ResonanceAnalyser(size_t uiThreads)
+	: m_pool(uiThreads)
+{
+}
+
+int32_t ResonanceAnalyser::analyse(const ScanBuffer &sweep, const rResonanceSettings &settings,
+	std::vector<rResonance> &out)
+{
+	std::vector<const double *> rows;
+	for (size_t d = 0; d < sweep.detectors().size(); d++)
+		rows.push_back(sweep.row(d));
+	return analyse(sweep.wavelength(), sweep.detectors().data(), rows.data(), rows.size(), sweep.points(),
+		settings, out);
+}
+
+int32_t ResonanceAnalyser::analyse(const double *pdWavelength, const rDetector *peDetectors,
+	const double *const *ppdRows, size_t uiDetectors, size_t uiPoints, const rResonanceSettings &settings,
+	std::vector<rResonance> &out)
+{
+	out.clear();
+	if (pdWavelength == nullptr || uiPoints < 3 || !(pdWavelength[uiPoints - 1] > pdWavelength[0])
+		|| (uiDetectors > 0 && peDetectors == nullptr) || !(settings.dMinDepth > 0.0)
+		|| !(settings.dBaselineWindow > 0.0) || (settings.iKinds & RK_BOTH) == 0)
+		return -1;
+
+	if (m_work.size() < uiDetectors)
+		m_work.resize(uiDetectors);
+	m_pool.parallelFor(uiDetectors, [&](size_t d) {
+		detect(pdWavelength, peDetectors[d], ppdRows[d], uiPoints, settings, m_work[d]);
+	});
+
+	if (settings.iFit == ENABLE) {
+		std::vector<std::pair<size_t, size_t> > jobs;
+		for (size_t d = 0; d < uiDetectors; d++)
+			for (size_t r = 0; r < m_work[d].found.size(); r++)
+				jobs.push_back(std::make_pair(d, r));
+		m_pool.parallelFor(jobs.size(), [&](size_t j) {
+			Work &work = m_work[jobs[j].first];
+			fit(pdWavelength, work.linear.data(), uiPoints, settings, work.found[jobs[j].second]);
+		});
+	}
+
+	for (size_t d = 0; d < uiDetectors; d++)
+		out.insert(out.end(), m_work[d].found.begin(), m_work[d].found.end());
+	return (int32_t)out.size();
+}
+
+void ResonanceAnalyser::detect(const double *pdWavelength, rDetector eDetector, const double *pdRow,
+	size_t uiPoints, const rResonanceSettings &settings, Work &work)
+{
+	work.found.clear();
+	work.linear.resize(uiPoints);
+	work.smooth.resize(uiPoints);
+	work.envelope.resize(uiPoints);
+	work.ahead.resize(uiPoints);
+	dBmToMilliwatt(pdRow, work.linear.data(), uiPoints);
+
+	const double dStep = (pdWavelength[uiPoints - 1] - pdWavelength[0]) / (uiPoints - 1);
+	const size_t uiSmooth = (size_t)std::max(0.0, std::round(settings.dSmoothing / dStep / 2.0)) * 2 + 1;
+	const size_t uiWindow = std::max<size_t>(3, (size_t)std::round(settings.dBaselineWindow / dStep));
+	const size_t uiHalf = uiWindow / 2;
+	const double *s = work.smooth.data();
+
+	for (int iKind = RK_DIP; iKind <= RK_PEAK; iKind++) {
+		if ((settings.iKinds & iKind) == 0)
+			continue;
+		// peaks are handled as dips of the negated spectrum
+		const double dSign = iKind == RK_DIP ? 1.0 : -1.0;
+		movingAverage(pdRow, dSign, uiPoints, uiSmooth, work.smooth.data());
+		// baseline: the lower of the highest points behind and ahead, so that
+		// a sloped spectrum (coupler roll-off, band edges) has no depth
+		runningMax(s, uiPoints, uiHalf, 0, work.envelope.data());
+		runningMax(s, uiPoints, 0, uiHalf, work.ahead.data());
+		for (size_t j = 0; j < uiPoints; j++)
+			work.envelope[j] = std::min(work.envelope[j], work.ahead[j]);
+		const double *e = work.envelope.data();
+
+		size_t k = 0;
+		while (k < uiPoints) {
+			if (e[k] - s[k] < settings.dMinDepth) {
+				k++;
+				continue;
+			}
+			// run with hysteresis: ends when the depth falls below half the threshold
+			size_t c = k;
+			for (; k < uiPoints && e[k] - s[k] >= 0.5 * settings.dMinDepth; k++)
+				if (s[k] < s[c])
+					c = k;
+
+			rResonance r;
+			std::memset(&r, 0, sizeof(r));
+			r.eDetector = eDetector;
+			r.iKind = iKind;
+			r.iIndex = (int32_t)c;
+
+			double dOffset = 0.0;
+			if (c > 0 && c + 1 < uiPoints) {
+				double dCurvature = s[c - 1] - 2.0 * s[c] + s[c + 1];
+				if (dCurvature > 0.0)
+					dOffset = 0.5 * (s[c - 1] - s[c + 1]) / dCurvature;
+			}
+			r.dWavelength = pdWavelength[c] + dOffset * dStep;
+
+			// baseline: line between the highest points either side
+			size_t uiLeft = c, uiRight = c;
+			for (size_t j = c > uiHalf ? c - uiHalf : 0; j < c; j++)
+				if (s[j] > s[uiLeft])
+					uiLeft = j;
+			for (size_t j = c + 1; j < std::min(c + uiHalf + 1, uiPoints); j++)
+				if (s[j] > s[uiRight])
+					uiRight = j;
+			double dBase = s[uiLeft];
+			if (uiRight != uiLeft && uiLeft != c && uiRight != c)
+				dBase = s[uiLeft] + (s[uiRight] - s[uiLeft]) * (double)(c - uiLeft) / (double)(uiRight - uiLeft);
+			else
+				dBase = std::max(s[uiLeft], s[uiRight]);
+			r.dBaseline = dSign * dBase;
+			r.dExtinction = dBase - s[c];
+
+			// FWHM at half depth in linear power
+			const double dHalf = 0.5 * (std::pow(10.0, r.dBaseline / 10.0) + std::pow(10.0, dSign * s[c] / 10.0));
+			auto inside = [&](size_t j) { return dSign * (std::pow(10.0, dSign * s[j] / 10.0) - dHalf) < 0.0; };
+			auto crossing = [&](size_t uiIn, size_t uiOut) {
+				double a = std::pow(10.0, dSign * s[uiIn] / 10.0), b = std::pow(10.0, dSign * s[uiOut] / 10.0);
+				double t = b != a ? (dHalf - a) / (b - a) : 0.5;
+				return pdWavelength[uiIn] + t * (pdWavelength[uiOut] - pdWavelength[uiIn]);
+			};
+			size_t uiLow = c, uiHigh = c;
+			size_t uiLowLimit = c > uiHalf ? c - uiHalf : 0, uiHighLimit = std::min(c + uiHalf, uiPoints - 1);
+			while (uiLow > uiLowLimit && inside(uiLow - 1))
+				uiLow--;
+			while (uiHigh < uiHighLimit && inside(uiHigh + 1))
+				uiHigh++;
+			// unresolved within the window, or too shallow against the local baseline
+			if (uiLow == uiLowLimit || uiHigh == uiHighLimit || r.dExtinction < 0.5 * settings.dMinDepth)
+				continue;
+			r.dFwhm = crossing(uiHigh, uiHigh + 1) - crossing(uiLow, uiLow - 1);
+			r.dQ = r.dFwhm > 0.0 ? r.dWavelength / r.dFwhm : 0.0;
+			work.found.push_back(r);
+		}
+	}
+
+	// Searching both kinds, the stretch between two dips is also a "peak" (and
+	// conversely): drop any resonance whose FWHM spans a narrower one of the
+	// other kind within it
+	if ((settings.iKinds & RK_BOTH) == RK_BOTH) {
+		std::vector<rResonance> kept;
+		for (const rResonance &r : work.found) {
+			bool bComplement = false;
+			for (const rResonance &o : work.found)
+				bComplement = bComplement || (o.iKind != r.iKind && o.dFwhm < r.dFwhm
+					&& std::fabs(o.dWavelength - r.dWavelength) < r.dFwhm);
+			if (!bComplement)
+				kept.push_back(r);
+		}
+		work.found.swap(kept);
+	}
+
+	std::sort(work.found.begin(), work.found.end(), [](const rResonance &a, const rResonance &b) {
+		return a.dWavelength < b.dWavelength;
+	});
+	// FSR to the next resonance of the same kind (the previous one for the last)
+	for (int iKind = RK_DIP; iKind <= RK_PEAK; iKind++) {
+		rResonance *pPrevious = nullptr;
+		for (rResonance &r : work.found) {
+			if (r.iKind != iKind)
+				continue;
+			if (pPrevious) {
+				pPrevious->dFsr = r.dWavelength - pPrevious->dWavelength;
+				r.dFsr = pPrevious->dFsr;
+			}
+			pPrevious = &r;
+		}
+	}
+}
+
+// Levenberg-Marquardt fit of B + A / (1 + ((x - x0) / g)^2) on linear power
+void ResonanceAnalyser::fit(const double *pdWavelength, const double *pdLinear, size_t uiPoints,
+	const rResonanceSettings &settings, rResonance &r) const
+{
+	r.iFitIterations = -1;
+	if (!(r.dFwhm > 0.0))
+		return;
+	const double dSpan = settings.dFitSpan * r.dFwhm;
+	size_t i0 = std::lower_bound(pdWavelength, pdWavelength + uiPoints, r.dWavelength - dSpan) - pdWavelength;
+	size_t i1 = std::upper_bound(pdWavelength, pdWavelength + uiPoints, r.dWavelength + dSpan) - pdWavelength;
+	if (i1 < i0 + 6)
+		return;
+
+	// x relative to the detected centre keeps the normal equations well conditioned
+	const double xc = r.dWavelength;
+	const double dBase = std::pow(10.0, r.dBaseline / 10.0);
+	const double dSign = r.iKind == RK_DIP ? -1.0 : 1.0;
+	double p[4] = { dBase, dBase * (std::pow(10.0, dSign * r.dExtinction / 10.0) - 1.0), 0.0, 0.5 * r.dFwhm };
+
+	auto evaluate = [&](const double q[4], double jtj[4][4], double jtr[4]) {
+		double dCost = 0.0;
+		if (jtj) {
+			std::memset(jtj, 0, 16 * sizeof(double));
+			std::memset(jtr, 0, 4 * sizeof(double));
+		}
+		for (size_t i = i0; i < i1; i++) {
+			double u = (pdWavelength[i] - xc - q[2]) / q[3];
+			double l = 1.0 / (1.0 + u * u);
+			double dResidual = pdLinear[i] - (q[0] + q[1] * l);
+			dCost += dResidual * dResidual;
+			if (jtj) {
+				double j[4] = { 1.0, l, 2.0 * q[1] * u * l * l / q[3], 2.0 * q[1] * u * u * l * l / q[3] };
+				for (int a = 0; a < 4; a++) {
+					jtr[a] += j[a] * dResidual;
+					for (int b = 0; b < 4; b++)
+						jtj[a][b] += j[a] * j[b];
+				}
+			}
+		}
+		return dCost;
+	};
+
+	double jtj[4][4], jtr[4];
+	double dCost = evaluate(p, jtj, jtr);
+	double dLambda = 1e-3;
+	int iIteration = 0;
+	while (iIteration < settings.iMaxIterations) {
+		iIteration++;
+		bool bAccepted = false;
+		double dNewCost = dCost;
+		for (int iAttempt = 0; iAttempt < 10 && !bAccepted; iAttempt++) {
+			double m[4][4], g[4], d[4], q[4];
+			std::memcpy(m, jtj, sizeof(m));
+			std::memcpy(g, jtr, sizeof(g));
+			for (int a = 0; a < 4; a++)
+				m[a][a] *= 1.0 + dLambda;
+			if (solve4(m, g, d)) {
+				for (int a = 0; a < 4; a++)
+					q[a] = p[a] + d[a];
+				if (q[3] != 0.0 && (dNewCost = evaluate(q, nullptr, nullptr)) < dCost) {
+					std::memcpy(p, q, sizeof(p));
+					bAccepted = true;
+					dLambda = std::max(dLambda * 0.1, 1e-12);
+					continue;
+				}
+			}
+			dLambda *= 10.0;
+		}
+		if (!bAccepted)
+			break;
+		bool bConverged = dCost - dNewCost <= 1e-10 * dCost;
+		dCost = evaluate(p, jtj, jtr);
+		if (bConverged)
+			break;
+	}
+
+	const double dFwhm = 2.0 * std::fabs(p[3]);
+	if (!(p[0] > 0.0) || !(dFwhm > 0.0) || std::fabs(p[2]) > dSpan)
+		return;
+	r.iFitIterations = iIteration;
+	r.dFitWavelength = xc + p[2];
+	r.dFitFwhm = dFwhm;
+	r.dFitQ = r.dFitWavelength / dFwhm;
+	// a fitted minimum at or below zero means complete extinction: capped at 120 dB
+	double dExtreme = std::max(p[0] + p[1], p[0] * 1e-12);
+	r.dFitExtinction = r.iKind == RK_DIP ? 10.0 * std::log10(p[0] / dExtreme) : 10.0 * std::log10(dExtreme / p[0]);
+	r.dFitRms = std::sqrt(dCost / (double)(i1 - i0)) / std::fabs(p[1]);
+}
+
+} // namespace ct400
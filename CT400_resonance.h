@@ -0,0 +1,152 @@
+/******************************************************************************/
+/* Header file for CT400_resonance.cpp                                        */
+/*                                                                            */
+/* Resonance analysis of swept spectra: dips and peaks with their extinction  */
+/* ratio, FWHM, Q and FSR, optionally refined by Lorentzian fits.             */
+/******************************************************************************/
+
+#ifndef CT400_RESONANCE_H
+#define CT400_RESONANCE_H
+
+#include "CT400_retrieve.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef enum
+  {
+	RK_DIP = 1,
+	RK_PEAK = 2,
+	RK_BOTH = 3
+  } rResonanceKind;
+
+  typedef struct
+  {
+	int32_t iKinds;                 // rResonanceKind searched for
+	int32_t iFit;                   // ENABLE for Lorentzian fits
+	int32_t iMaxIterations;         // of each fit
+	int32_t iReserved;
+	double dMinDepth;               // dB below (above) the baseline
+	double dBaselineWindow;         // nm, wider than the widest resonance
+	double dSmoothing;              // nm, moving average used for detection
+	double dFitSpan;                // fit window, in FWHM either side
+  } rResonanceSettings;
+
+  typedef struct
+  {
+	rDetector eDetector;
+	int32_t iKind;                  // RK_DIP or RK_PEAK
+	int32_t iIndex;                 // sample of the extremum
+	int32_t iFitIterations;         // 0 without fit, -1 if the fit failed
+	double dWavelength;             // nm, parabolic interpolation
+	double dBaseline;               // dB at dWavelength
+	double dExtinction;             // dB, positive for dips and peaks
+	double dFwhm;                   // nm, 0 if it could not be measured
+	double dQ;
+	double dFsr;                    // nm, to the next resonance of the kind
+	double dFitWavelength;          // Lorentzian fit results
+	double dFitFwhm;
+	double dFitQ;
+	double dFitExtinction;
+	double dFitRms;                 // residual, relative to the amplitude
+  } rResonance;
+
+//------------------------------ CT400_DefaultResonanceSettings ----------------
+// Function CT400_DefaultResonanceSettings
+//
+//  Purpose: Dips of at least 3 dB, 5 nm baseline window, 3 pm smoothing,
+//           no fit (fits over +/- 3 FWHM, 50 iterations when enabled)
+//
+//  Parameters: IN/OUT pSettings: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultResonanceSettings(
+rResonanceSettings *pSettings);
+
+//------------------------------ CT400_FindResonances --------------------------
+// Function CT400_FindResonances
+//
+//  Purpose: Finds the resonances of several detector arrays sharing one
+//           wavelength axis, in parallel
+//
+//  Parameters: IN dWavelength: increasing wavelength axis, iArraySize values
+//              IN eDetectors: detector of each block row
+//              IN iNbDetectors: number of detectors
+//              IN dBlock: iNbDetectors rows of iArraySize values in dB(m)
+//              IN iArraySize: size of the axis and of one block row
+//              IN pSettings: search settings, or NULL for the defaults
+//              IN/OUT pResonances: pointer over an initialized array of
+//                                  iMaxResonances values
+//              IN iMaxResonances: size of the array
+//  Returns:  number of resonances found (only the first iMaxResonances are
+//            written, ordered by detector then wavelength), -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_FindResonances(const double dWavelength[],
+const rDetector eDetectors[], int32_t iNbDetectors, const double dBlock[],
+int32_t iArraySize, const rResonanceSettings *pSettings,
+rResonance pResonances[], int32_t iMaxResonances);
+
+#ifdef __cplusplus
+}
+
+#include "CT400_thread_pool.h"
+
+#include <vector>
+
+namespace ct400
+{
+
+//------------------------------ ResonanceAnalyser -----------------------------
+// Class ResonanceAnalyser
+//
+//  Purpose: Detection runs in parallel across detectors, then the Lorentzian
+//           fits in parallel across all resonances found. Per-detector work
+//           buffers are kept between calls, so analysing every sweep of a
+//           ScanEngine does not allocate. One analyse() call at a time.
+//
+//  Detection: the spectrum is smoothed and compared with the lower of its
+//           maxima (dips) or the higher of its minima (peaks) over
+//           dBaselineWindow / 2 either side; a resonance is a run where the
+//           depth exceeds dMinDepth (ending below half of it). Extinction, FWHM (at half depth in linear
+//           power) and Q are measured around the extremum; resonances whose
+//           half depth points are not within dBaselineWindow / 2 of it are
+//           skipped.
+//------------------------------------------------------------------------------
+class ResonanceAnalyser
+{
+public:
+	// uiThreads = 0: one per hardware thread
+	explicit ResonanceAnalyser(size_t uiThreads = 0);
+
+	// Returns the number of resonances, -1 otherwise
+	int32_t analyse(const double *pdWavelength, const rDetector *peDetectors, const double *const *ppdRows,
+		size_t uiDetectors, size_t uiPoints, const rResonanceSettings &settings, std::vector<rResonance> &out);
+	int32_t analyse(const ScanBuffer &sweep, const rResonanceSettings &settings, std::vector<rResonance> &out);
+
+private:
+	struct Work
+	{
+		AlignedVector linear;   // row in mW (or linear ratio)
+		AlignedVector smooth;   // smoothed dB, negated when looking for peaks
+		AlignedVector envelope; // lower of the running maxima behind and ahead
+		AlignedVector ahead;
+		std::vector<rResonance> found;
+	};
+
+	void detect(const double *pdWavelength, rDetector eDetector, const double *pdRow, size_t uiPoints,
+		const rResonanceSettings &settings, Work &work);
+	void fit(const double *pdWavelength, const double *pdLinear, size_t uiPoints,
+		const rResonanceSettings &settings, rResonance &resonance) const;
+
+	ThreadPool m_pool;
+	std::vector<Work> m_work;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
@@ -0,0 +1,135 @@
+//------------------------------------------------------------------------------
+// CT400_retrieve.cpp
+//
+// Whole-sweep retrieval: the wavelength axis is read once per sweep and every
+// detector array is written straight into its row of the destination block,
+// so there are no intermediate arrays between the DLL and the caller.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_retrieve.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+// Fills dWavelength and dPower (if given) and one row of iStride values per
+// detector
+int32_t fetchResampled(uint64_t uiHandle, const rDetector eDetectors[], int32_t iNbDetectors,
+	double dWavelength[], double dPower[], double dBlock[], size_t uiStride, int32_t iArraySize)
+{
+	int32_t iPoints = CT400_GetNbDataPointsResampled(uiHandle);
+	if (iPoints < 0 || iNbDetectors < 0 || (iNbDetectors > 0 && dBlock == nullptr))
+		return -1;
+	iPoints = std::min(iPoints, iArraySize);
+	if (dWavelength && CT400_ScanGetWavelengthResampledArray(uiHandle, dWavelength, iPoints) != iPoints)
+		return -1;
+	if (dPower && CT400_ScanGetPowerResampledArray(uiHandle, dPower, iPoints) != iPoints)
+		return -1;
+	for (int32_t i = 0; i < iNbDetectors; i++)
+		if (CT400_ScanGetDetectorResampledArray(uiHandle, eDetectors[i], dBlock + i * uiStride, iPoints) != iPoints)
+			return -1;
+	return iPoints;
+}
+
+// Reads the whole sync arrays (discarded points included) into a scratch
+// buffer and keeps the valid part in dWavelength, dPower and the block rows
+int32_t fetchSync(uint64_t uiHandle, const rDetector eDetectors[], int32_t iNbDetectors,
+	double dWavelength[], double dPower[], double dBlock[], size_t uiStride, int32_t iArraySize)
+{
+	thread_local std::vector<double> scratch;
+	int32_t iTotal = 0, iDiscard = 0;
+	if (CT400_GetNbDataPoints(uiHandle, &iTotal, &iDiscard) < 0 || iTotal < 0 || iDiscard < 0
+		|| iDiscard > iTotal || iNbDetectors < 0 || (iNbDetectors > 0 && dBlock == nullptr))
+		return -1;
+	int32_t iPoints = std::min(iTotal - iDiscard, iArraySize);
+	scratch.resize(std::max(iTotal, 1));
+	auto keep = [&](int32_t iRead, double *pDest) {
+		if (iRead != iTotal)
+			return false;
+		std::memcpy(pDest, scratch.data() + iDiscard, iPoints * sizeof(double));
+		return true;
+	};
+	if (dWavelength && !keep(CT400_ScanGetWavelengthSyncArray(uiHandle, scratch.data(), iTotal), dWavelength))
+		return -1;
+	if (dPower && !keep(CT400_ScanGetPowerSyncArray(uiHandle, scratch.data(), iTotal), dPower))
+		return -1;
+	for (int32_t i = 0; i < iNbDetectors; i++)
+		if (!keep(CT400_ScanGetDetectorArray(uiHandle, eDetectors[i], scratch.data(), iTotal), dBlock + i * uiStride))
+			return -1;
+	return iPoints;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ScanGetResampledBlock(uint64_t uiHandle,
+const rDetector eDetectors[], int32_t iNbDetectors, double dWavelength[],
+double dBlock[], int32_t iArraySize)
+{
+	if (iArraySize < 0)
+		return -1;
+	return fetchResampled(uiHandle, eDetectors, iNbDetectors, dWavelength, nullptr, dBlock, iArraySize, iArraySize);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_ScanGetSyncBlock(uint64_t uiHandle,
+const rDetector eDetectors[], int32_t iNbDetectors, double dWavelength[],
+double dPower[], double dBlock[], int32_t iArraySize)
+{
+	if (iArraySize < 0)
+		return -1;
+	return fetchSync(uiHandle, eDetectors, iNbDetectors, dWavelength, dPower, dBlock, iArraySize, iArraySize);
+}
+
+}
+
+
+namespace ct400
+{
+
+int32_t ScanBuffer::fetchResampled(uint64_t uiHandle, const std::vector<rDetector> &detectors, bool bPower)
+{
+	int32_t iPoints = CT400_GetNbDataPointsResampled(uiHandle);
+	if (iPoints < 0)
+		return -1;
+	resize(detectors.size(), iPoints, bPower);
+	m_detectors = detectors;
+	iPoints = ::fetchResampled(uiHandle, detectors.data(), (int32_t)detectors.size(), wavelength(),
+		power(), row(0), m_uiStride, iPoints);
+	if (iPoints < 0)
+		m_uiPoints = 0;
+	return iPoints;
+}
+
+int32_t ScanBuffer::fetchSync(uint64_t uiHandle, const std::vector<rDetector> &detectors, bool bPower)
+{
+	int32_t iTotal = 0, iDiscard = 0;
+	if (CT400_GetNbDataPoints(uiHandle, &iTotal, &iDiscard) < 0 || iDiscard > iTotal)
+		return -1;
+	resize(detectors.size(), iTotal - iDiscard, bPower);
+	m_detectors = detectors;
+	int32_t iPoints = ::fetchSync(uiHandle, detectors.data(), (int32_t)detectors.size(), wavelength(),
+		power(), row(0), m_uiStride, (int32_t)m_uiPoints);
+	if (iPoints < 0)
+		m_uiPoints = 0;
+	return iPoints;
+}
+
+void ScanBuffer::resize(size_t uiDetectors, size_t uiPoints, bool bPower)
+{
+	m_uiPoints = uiPoints;
+	m_uiStride = alignedStride(uiPoints);
+	m_bPower = bPower;
+	size_t uiSize = (uiDetectors + 1 + (bPower ? 1 : 0)) * m_uiStride;
+	if (m_data.size() < uiSize)
+		m_data.resize(uiSize);
+	if (m_detectors.size() != uiDetectors)
+		m_detectors.resize(uiDetectors, DE_1);
+}
+
+} // namespace ct400
@@ -0,0 +1,115 @@
+/******************************************************************************/
+/* Header file for CT400_retrieve.cpp                                         */
+/*                                                                            */
+/* Retrieval of a whole sweep (wavelength axis plus any number of detectors)  */
+/* into one contiguous, caller-owned (detectors x points) block.              */
+/******************************************************************************/
+
+#ifndef CT400_RETRIEVE_H
+#define CT400_RETRIEVE_H
+
+#include "CT400_ext.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//------------------------------ CT400_ScanGetResampledBlock -------------------
+// Function CT400_ScanGetResampledBlock
+//
+//  Purpose: Returns the resampled wavelength array once and the resampled
+//           arrays of several detectors in a single row-major block
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN eDetectors: detectors to retrieve, one block row each
+//              IN iNbDetectors: number of detectors
+//              IN/OUT dWavelength: pointer over an initialized array of
+//                                  iArraySize values, or NULL to skip it
+//              IN/OUT dBlock: pointer over an initialized array of
+//                             iNbDetectors * iArraySize values
+//              IN iArraySize: size of one block row
+//  Returns:  number of points written in each row, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ScanGetResampledBlock(uint64_t uiHandle,
+const rDetector eDetectors[], int32_t iNbDetectors, double dWavelength[],
+double dBlock[], int32_t iArraySize);
+
+//------------------------------ CT400_ScanGetSyncBlock ------------------------
+// Function CT400_ScanGetSyncBlock
+//
+//  Purpose: Same as CT400_ScanGetResampledBlock for the raw (sync) arrays,
+//           without the first iDiscardPoints of CT400_GetNbDataPoints
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN eDetectors: detectors to retrieve, one block row each
+//              IN iNbDetectors: number of detectors
+//              IN/OUT dWavelength: pointer over an initialized array of
+//                                  iArraySize values, or NULL to skip it
+//              IN/OUT dPower: pointer over an initialized array of
+//                             iArraySize values (Pout), or NULL to skip it
+//              IN/OUT dBlock: pointer over an initialized array of
+//                             iNbDetectors * iArraySize values
+//              IN iArraySize: size of one block row
+//  Returns:  number of valid points written in each row, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_ScanGetSyncBlock(uint64_t uiHandle,
+const rDetector eDetectors[], int32_t iNbDetectors, double dWavelength[],
+double dPower[], double dBlock[], int32_t iArraySize);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+
+namespace ct400
+{
+
+//------------------------------ ScanBuffer ------------------------------------
+// Class ScanBuffer
+//
+//  Purpose: Reusable sweep storage. The wavelength axis and one row per
+//           detector (then Pout, if requested) live in aligned rows of
+//           stride() values; memory is only reallocated when a sweep is
+//           larger than any before it.
+//------------------------------------------------------------------------------
+class ScanBuffer
+{
+public:
+	// Retrieves the resampled arrays of the last sweep (and Pout if bPower).
+	// Returns the number of points, -1 otherwise
+	int32_t fetchResampled(uint64_t uiHandle, const std::vector<rDetector> &detectors, bool bPower = false);
+	// Retrieves the valid part of the sync arrays of the last sweep (and Pout
+	// if bPower). Returns the number of points, -1 otherwise
+	int32_t fetchSync(uint64_t uiHandle, const std::vector<rDetector> &detectors, bool bPower = false);
+
+	// Sizes the buffer without retrieving anything (for data from other sources)
+	void resize(size_t uiDetectors, size_t uiPoints, bool bPower = false);
+
+	size_t points() const { return m_uiPoints; }
+	size_t stride() const { return m_uiStride; }
+	const std::vector<rDetector> &detectors() const { return m_detectors; }
+	void setDetectors(const std::vector<rDetector> &detectors) { m_detectors = detectors; }
+
+	double *wavelength() { return m_data.data(); }
+	const double *wavelength() const { return m_data.data(); }
+	double *row(size_t uiRow) { return m_data.data() + (uiRow + 1) * m_uiStride; }
+	const double *row(size_t uiRow) const { return m_data.data() + (uiRow + 1) * m_uiStride; }
+	// Pout row, nullptr if the buffer has none
+	double *power() { return m_bPower ? row(m_detectors.size()) : nullptr; }
+	const double *power() const { return m_bPower ? row(m_detectors.size()) : nullptr; }
+
+private:
+	AlignedVector m_data;
+	std::vector<rDetector> m_detectors;
+	size_t m_uiPoints = 0;
+	size_t m_uiStride = 0;
+	bool m_bPower = false;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
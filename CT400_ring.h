@@ -0,0 +1,107 @@
+/******************************************************************************/
+/* Lock-free sample ring shared by the native CT400 extensions                */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef CT400_RING_H
+#define CT400_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+namespace ct400
+{
+
+//------------------------------ SampleRing ------------------------------------
+// Class SampleRing
+//
+//  Purpose: Fixed-size ring written by one producer thread and read by any
+//           number of readers without locks. The producer never waits: the
+//           oldest items are overwritten. Each slot carries a sequence number
+//           (seqlock) so a reader detects an item overwritten while it was
+//           being copied and drops it instead of returning torn data.
+//------------------------------------------------------------------------------
+template <class T>
+class SampleRing
+{
+	static_assert(std::is_trivially_copyable<T>::value, "SampleRing items are copied with memcpy semantics");
+
+public:
+	// uiCapacity is rounded up to a power of two
+	explicit SampleRing(size_t uiCapacity)
+	{
+		m_uiCapacity = 1;
+		while (m_uiCapacity < uiCapacity)
+			m_uiCapacity <<= 1;
+		m_slots.reset(new Slot[m_uiCapacity]);
+		for (size_t i = 0; i < m_uiCapacity; i++)
+			m_slots[i].seq.store(0, std::memory_order_relaxed);
+	}
+
+	size_t capacity() const { return m_uiCapacity; }
+
+	// Total number of items pushed; the newest item has index written() - 1
+	uint64_t written() const { return m_uiHead.load(std::memory_order_acquire); }
+
+	// Producer only
+	void push(const T &value)
+	{
+		uint64_t uiIndex = m_uiHead.load(std::memory_order_relaxed);
+		Slot &slot = m_slots[uiIndex & (m_uiCapacity - 1)];
+		slot.seq.store(2 * uiIndex + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.value = value;
+		slot.seq.store(2 * uiIndex + 2, std::memory_order_release);
+		m_uiHead.store(uiIndex + 1, std::memory_order_release);
+	}
+
+	// Copies item uiIndex. Returns false if it is not written yet or has
+	// been overwritten.
+	bool read(uint64_t uiIndex, T &value) const
+	{
+		const Slot &slot = m_slots[uiIndex & (m_uiCapacity - 1)];
+		uint64_t uiSeq = slot.seq.load(std::memory_order_acquire);
+		if (uiSeq != 2 * uiIndex + 2)
+			return false;
+		value = slot.value;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return slot.seq.load(std::memory_order_relaxed) == uiSeq;
+	}
+
+	// Copies up to uiCount items ending at the newest one, taking every
+	// uiStep-th item, oldest first. Returns the number of items copied.
+	size_t readLatest(T *out, size_t uiCount, size_t uiStep = 1) const
+	{
+		if (uiStep == 0)
+			uiStep = 1;
+		uint64_t uiHead = written();
+		if (uiHead == 0 || uiCount == 0)
+			return 0;
+		uint64_t uiSpan = (uint64_t)(uiCount - 1) * uiStep;
+		uint64_t uiFirst = uiHead - 1 >= uiSpan ? uiHead - 1 - uiSpan : (uiHead - 1) % uiStep;
+		size_t n = 0;
+		for (uint64_t i = uiFirst; i < uiHead && n < uiCount; i += uiStep)
+			if (read(i, out[n]))
+				n++;
+		return n;
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<uint64_t> seq;
+		T value;
+	};
+
+	size_t m_uiCapacity;
+	std::unique_ptr<Slot[]> m_slots;
+	alignas(64) std::atomic<uint64_t> m_uiHead{ 0 };
+};
+
+} // namespace ct400
+
+
+#endif
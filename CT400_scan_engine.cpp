@@ -0,0 +1,260 @@
+//------------------------------------------------------------------------------
+// CT400_scan_engine.cpp
+//
+// Acquisition / processing pipeline for repeated sweeps. The only work done
+// between two sweeps is the bulk copy of the arrays (ScanBuffer); retrieval
+// into the caller's structures, calibration and analysis happen on the
+// worker pool while the instrument is already sweeping again.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_scan_engine.h"
+#include "CT400_device.h"
+#include "CT400_span.h"
+
+namespace ct400
+{
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds(Clock::time_point tFrom, Clock::time_point tTo)
+{
+	return std::chrono::duration<double>(tTo - tFrom).count();
+}
+
+} // namespace
+
+ScanEngine::ScanEngine(uint64_t uiHandle, const std::vector<rDetector> &detectors,
+	size_t uiWorkers, size_t uiQueueDepth)
+	: m_device(Device::forHandle(uiHandle)), m_detectors(detectors), m_pool(std::make_shared<BufferPool>()),
+	m_workers(std::max<size_t>(uiWorkers, 1), std::max<size_t>(uiQueueDepth, 1))
+{
+	m_acquisition = std::thread([this] { acquire(); });
+}
+
+ScanEngine::~ScanEngine()
+{
+	cancel();
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_bStop = true;
+	}
+	m_cvJob.notify_all();
+	m_acquisition.join();
+	m_workers.waitIdle();
+	std::lock_guard<std::mutex> lock(m_pool->mtx);
+	m_pool->bClosed = true;
+	for (ScanBuffer *buffer : m_pool->free)
+		delete buffer;
+	m_pool->free.clear();
+}
+
+std::future<SweepResult> ScanEngine::submit(SweepProcessor process, SweepSetup setup)
+{
+	Job job;
+	job.setup = std::move(setup);
+	job.process = std::move(process);
+	job.promise = std::make_shared<std::promise<SweepResult> >();
+	std::future<SweepResult> future = job.promise->get_future();
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		job.uiSequence = m_uiNextSequence++;
+		m_uiOutstanding++;
+		m_jobs.push_back(std::move(job));
+	}
+	m_cvJob.notify_one();
+	return future;
+}
+
+void ScanEngine::cancel()
+{
+	std::deque<Job> cancelled;
+	bool bScanning;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		cancelled.swap(m_jobs);
+		m_uiCancelBefore = m_uiNextSequence;
+		bScanning = m_bScanning;
+	}
+	// the sweep in progress ends with an error from CT400_ScanWaitEnd
+	if (bScanning)
+		m_device->stop();
+	for (Job &job : cancelled) {
+		SweepResult result;
+		result.uiSequence = job.uiSequence;
+		result.iError = -1;
+		result.strError = "Sweep cancelled";
+		finish(job, result);
+	}
+}
+
+void ScanEngine::waitIdle()
+{
+	std::unique_lock<std::mutex> lock(m_mtx);
+	m_cvIdle.wait(lock, [this] { return m_uiOutstanding == 0; });
+}
+
+uint64_t ScanEngine::sweepsCompleted() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_uiCompleted;
+}
+
+double ScanEngine::busyTime() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_dBusy;
+}
+
+double ScanEngine::utilisation() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	if (!m_bStarted)
+		return 0.0;
+	double dElapsed = seconds(m_tFirst, Clock::now());
+	return dElapsed > 0.0 ? std::min(m_dBusy / dElapsed, 1.0) : 0.0;
+}
+
+void ScanEngine::acquire()
+{
+	char tcError[1024];
+	for (;;) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_mtx);
+			m_cvJob.wait(lock, [this] { return m_bStop || !m_jobs.empty(); });
+			if (m_jobs.empty())
+				return;
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+
+		SweepResult result;
+		result.uiSequence = job.uiSequence;
+		if (job.setup) {
+			ScopedSpan span(m_device->handle(), "configure");
+			result.iError = m_device->call(job.setup);
+		}
+		if (result.iError != 0) {
+			result.strError = "Sweep setup failed";
+			finish(job, result);
+			continue;
+		}
+
+		Clock::time_point tStart = Clock::now();
+		bool bCancelled;
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			bCancelled = job.uiSequence < m_uiCancelBefore;
+			if (!bCancelled && !m_bStarted) {
+				m_bStarted = true;
+				m_tFirst = tStart;
+			}
+			m_bScanning = !bCancelled;
+		}
+		if (bCancelled) {
+			result.iError = -1;
+			result.strError = "Sweep cancelled";
+			finish(job, result);
+			continue;
+		}
+		// the handle stays locked from CT400_ScanStart until the arrays are
+		// copied, so no other component can start a sweep over them
+		Clock::time_point tEnd;
+		m_device->call([&](uint64_t uiHandle) {
+			tStart = Clock::now();
+			if (CT400_ScanStart(uiHandle) != 0) {
+				result.iError = -1;
+				result.strError = "CT400_ScanStart failed";
+			}
+			else {
+				// a cancel() since m_bScanning was set may have stopped the
+				// instrument before the sweep started: stop it now
+				bool bCancelledMeanwhile;
+				{
+					std::lock_guard<std::mutex> lock(m_mtx);
+					bCancelledMeanwhile = job.uiSequence < m_uiCancelBefore;
+				}
+				if (bCancelledMeanwhile)
+					CT400_ScanStop(uiHandle);
+				tcError[0] = '\0';
+				result.iError = CT400_ScanWaitEnd(uiHandle, tcError);
+				result.strError = tcError;
+			}
+			// the instrument state is unknown after a failed sweep
+			if (result.iError != 0)
+				m_device->configCache().invalidate();
+			tEnd = Clock::now();
+			{
+				std::lock_guard<std::mutex> lock(m_mtx);
+				m_bScanning = false;
+				m_dBusy += seconds(tStart, tEnd);
+			}
+			result.dScanTime = seconds(tStart, tEnd);
+			recordSpan(uiHandle, "sweep", result.dScanTime);
+
+			if (result.iError == 0) {
+				result.data = takeBuffer();
+				if (result.data->fetchResampled(uiHandle, m_detectors) < 0) {
+					result.iError = -1;
+					result.strError = "Sweep retrieval failed";
+					result.data.reset();
+				}
+				result.dFetchTime = seconds(tEnd, Clock::now());
+				recordSpan(uiHandle, "fetch", result.dFetchTime);
+			}
+		});
+
+		// blocks while uiQueueDepth sweeps are already waiting for a worker
+		auto shared = std::make_shared<std::pair<Job, SweepResult> >(std::move(job), std::move(result));
+		m_workers.post([this, shared] {
+			SweepResult &result = shared->second;
+			if (result.iError == 0 && shared->first.process) {
+				Clock::time_point t = Clock::now();
+				shared->first.process(result);
+				result.dProcessTime = seconds(t, Clock::now());
+				recordSpan(m_device->handle(), "analyse", result.dProcessTime);
+			}
+			finish(shared->first, result);
+		});
+	}
+}
+
+std::shared_ptr<ScanBuffer> ScanEngine::takeBuffer()
+{
+	ScanBuffer *buffer = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_pool->mtx);
+		if (!m_pool->free.empty()) {
+			buffer = m_pool->free.back();
+			m_pool->free.pop_back();
+		}
+	}
+	if (buffer == nullptr)
+		buffer = new ScanBuffer();
+	std::shared_ptr<BufferPool> pool = m_pool;
+	return std::shared_ptr<ScanBuffer>(buffer, [pool](ScanBuffer *p) {
+		std::lock_guard<std::mutex> lock(pool->mtx);
+		if (pool->bClosed)
+			delete p;
+		else
+			pool->free.push_back(p);
+	});
+}
+
+void ScanEngine::finish(Job &job, SweepResult &result)
+{
+	if (result.iError == 0) {
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_uiCompleted++;
+	}
+	job.promise->set_value(std::move(result));
+	std::lock_guard<std::mutex> lock(m_mtx);
+	if (--m_uiOutstanding == 0)
+		m_cvIdle.notify_all();
+}
+
+} // namespace ct400
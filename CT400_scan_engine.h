@@ -0,0 +1,136 @@
+/******************************************************************************/
+/* Header file for CT400_scan_engine.cpp                                      */
+/*                                                                            */
+/* Pipelined sweeps: the acquisition thread keeps the instrument sweeping     */
+/* while a worker pool processes the sweeps already taken.                    */
+/******************************************************************************/
+
+#ifndef CT400_SCAN_ENGINE_H
+#define CT400_SCAN_ENGINE_H
+
+#include "CT400_retrieve.h"
+#include "CT400_thread_pool.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ct400
+{
+
+class Device;
+
+//------------------------------ SweepResult -----------------------------------
+// Outcome of one sweep. data holds the resampled arrays and goes back to the
+// engine's buffer pool when the last copy of the result is released.
+//------------------------------------------------------------------------------
+struct SweepResult
+{
+	uint64_t uiSequence = 0;
+	int32_t iError = 0;             // CT400_ScanWaitEnd error, -1 on call failure
+	std::string strError;
+	std::shared_ptr<ScanBuffer> data;
+	double dScanTime = 0.0;         // s from CT400_ScanStart to end of sweep
+	double dFetchTime = 0.0;        // s to retrieve the arrays
+	double dProcessTime = 0.0;      // s in the processing callback
+};
+
+// Runs on the acquisition thread before CT400_ScanStart (e.g. CT400_SetScan);
+// a non-zero return fails the sweep without starting it
+typedef std::function<int32_t(uint64_t uiHandle)> SweepSetup;
+// Runs on a worker thread with the retrieved sweep (calibration, analysis...)
+typedef std::function<void(SweepResult &result)> SweepProcessor;
+
+//------------------------------ ScanEngine ------------------------------------
+// Class ScanEngine
+//
+//  Purpose: Runs queued sweeps back to back on one handle. After each sweep
+//           the acquisition thread copies the arrays out of the DLL into a
+//           recycled buffer (they are overwritten by the next
+//           CT400_ScanStart), hands the copy to the worker pool and starts
+//           the next sweep. At most uiQueueDepth completed sweeps wait for a
+//           worker; beyond that acquisition pauses until processing catches
+//           up.
+//
+//  Calls on the handle go through its Device lock, so other components may
+//  share the handle; they wait while a sweep is in progress.
+//------------------------------------------------------------------------------
+class ScanEngine
+{
+public:
+	ScanEngine(uint64_t uiHandle, const std::vector<rDetector> &detectors,
+		size_t uiWorkers = 2, size_t uiQueueDepth = 4);
+	~ScanEngine();
+
+	ScanEngine(const ScanEngine &) = delete;
+	ScanEngine &operator=(const ScanEngine &) = delete;
+
+	// Queues a sweep. The future is ready once process (if any) has run.
+	std::future<SweepResult> submit(SweepProcessor process = nullptr, SweepSetup setup = nullptr);
+
+	// Fails every queued sweep and stops the current one with CT400_ScanStop
+	void cancel();
+
+	// Blocks until every submitted sweep has been processed
+	void waitIdle();
+
+	// Sweeps processed without error
+	uint64_t sweepsCompleted() const;
+	// Fraction of the time since the first sweep spent sweeping
+	double utilisation() const;
+	// s spent sweeping since construction
+	double busyTime() const;
+
+private:
+	struct Job
+	{
+		uint64_t uiSequence;
+		SweepSetup setup;
+		SweepProcessor process;
+		std::shared_ptr<std::promise<SweepResult> > promise;
+	};
+
+	void acquire();
+	std::shared_ptr<ScanBuffer> takeBuffer();
+	void finish(Job &job, SweepResult &result);
+
+	std::shared_ptr<Device> m_device;
+	std::vector<rDetector> m_detectors;
+
+	mutable std::mutex m_mtx;
+	std::condition_variable m_cvJob, m_cvIdle;
+	std::deque<Job> m_jobs;
+	uint64_t m_uiNextSequence = 0;
+	uint64_t m_uiOutstanding = 0;
+	uint64_t m_uiCompleted = 0;
+	uint64_t m_uiCancelBefore = 0;  // jobs with a lower sequence are cancelled
+	bool m_bStarted = false;
+	bool m_bScanning = false;
+	bool m_bStop = false;
+	std::chrono::steady_clock::time_point m_tFirst;
+	double m_dBusy = 0.0;
+
+	// released sweep buffers, shared with the deleters of handed-out buffers
+	struct BufferPool
+	{
+		std::mutex mtx;
+		std::vector<ScanBuffer *> free;
+		bool bClosed = false;
+	};
+	std::shared_ptr<BufferPool> m_pool;
+
+	ThreadPool m_workers;
+	std::thread m_acquisition;
+};
+
+} // namespace ct400
+
+
+#endif
@@ -0,0 +1,69 @@
+/******************************************************************************/
+/* Loading of the real CT400_lib by the shims that export CT400_lib.h         */
+/* (CT400_metrics_shim.cpp, CT400_trace_shim.cpp)                             */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef CT400_SHIM_H
+#define CT400_SHIM_H
+
+#include <cstdlib>
+#include <string>
+
+#if defined (_WIN32)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace ct400
+{
+
+// Loads the library a shim forwards to: the one named by CT400_REAL_LIB, or
+// else libCT400_lib.so from the directory of the shim holding pAnchor
+// (CT400_lib.dll on Windows). Returns nullptr if it cannot be loaded.
+inline void *openRealLibrary(void *pAnchor)
+{
+	std::string strPath;
+	const char *pcPath = std::getenv("CT400_REAL_LIB");
+	if (pcPath && pcPath[0] != '\0')
+		strPath = pcPath;
+#if defined (_WIN32)
+	(void)pAnchor;
+	if (strPath.empty())
+		strPath = "CT400_lib.dll";
+	return (void *)LoadLibraryA(strPath.c_str());
+#else
+	if (strPath.empty()) {
+		Dl_info info;
+		strPath = "libCT400_lib.so";
+		if (dladdr(pAnchor, &info) && info.dli_fname) {
+			std::string strSelf = info.dli_fname;
+			size_t uiSlash = strSelf.rfind('/');
+			if (uiSlash != std::string::npos)
+				strPath = strSelf.substr(0, uiSlash + 1) + strPath;
+		}
+	}
+	// local, so that the extensions keep binding to the shim's symbols
+	return dlopen(strPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+// Address of a function of the real library, nullptr if missing or if it
+// resolves back to the shim's own definition pSelf
+inline void *realSymbol(void *hLib, const char *pcName, void *pSelf)
+{
+	if (hLib == nullptr)
+		return nullptr;
+#if defined (_WIN32)
+	void *p = (void *)GetProcAddress((HMODULE)hLib, pcName);
+#else
+	void *p = dlsym(hLib, pcName);
+#endif
+	return p == pSelf ? nullptr : p;
+}
+
+} // namespace ct400
+
+
+#endif
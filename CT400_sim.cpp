@@ -0,0 +1,980 @@
+//------------------------------------------------------------------------------
+// CT400_sim.cpp
+//
+// Software model of the CT400 implementing every function of CT400_lib.h, so
+// CT400_control.py and the native tools can run without an instrument.
+// Built as libCT400_lib.so (see README.md) it is loaded in place of
+// CT400_lib.dll.
+//
+// Each handle from CT400_Init is an independent device. A sweep is generated
+// when CT400_ScanWaitEnd is called and the call then waits until the sweep
+// would have ended on a real CT400 (span / speed + overhead), scaled by
+// rSimConfig.dTimeScale. The detectors see a grating coupler envelope and:
+//   DE_1: ring resonator through port (dips)
+//   DE_2: ring resonator drop port (peaks)
+//   DE_3: Bragg grating stop band
+//   DE_4: second ring with a longer FSR
+//   DE_5: BNC C input (voltage, or power when enabled with CT400_SetBNC)
+//------------------------------------------------------------------------------
+
+#define CT400_LIB_EXPORT
+#include "CT400_sim.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+const int32_t NB_INPUTS = 4;
+const int32_t NB_DETECTORS = 4;
+const double PI = 3.14159265358979323846;
+
+// xoshiro256** - fast enough to put noise on millions of points per sweep
+class Rng
+{
+public:
+	void seed(uint64_t uiSeed)
+	{
+		for (int i = 0; i < 4; i++) {
+			uiSeed += 0x9E3779B97F4A7C15ULL;
+			uint64_t z = uiSeed;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			s[i] = z ^ (z >> 31);
+		}
+	}
+
+	uint64_t next()
+	{
+		const uint64_t result = rotl(s[1] * 5, 7) * 9;
+		const uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return result;
+	}
+
+	double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+	// Irwin-Hall approximation of a unit normal variate
+	double gauss()
+	{
+		return (uniform() + uniform() + uniform() + uniform() - 2.0) * 1.7320508075688772;
+	}
+
+private:
+	static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+	uint64_t s[4];
+};
+
+struct Laser
+{
+	bool bConfigured = false;
+	rEnable eEnable = DISABLE;
+	int32_t iGPIBAdress = 0;
+	rLaserSource eType = LS_TunicsT100s_HP;
+	double dMinWavelength = 0.0;
+	double dMaxWavelength = 0.0;
+	int32_t iSpeed = 0;
+	// CT400_CmdLaser state: the output moves from (dFrom*) towards (dCmd*)
+	rEnable eCmdEnable = DISABLE;
+	double dCmdWavelength = 1550.0;
+	double dCmdPower = 1.0;
+	double dFromWavelength = 1550.0;
+	double dFromPower = 1.0;
+	Clock::time_point tCmd;
+};
+
+enum rScanState
+{
+	SCAN_IDLE = 0,
+	SCAN_RUNNING,
+	SCAN_DONE
+};
+
+struct Device
+{
+	std::mutex mtx;
+	std::condition_variable cv;
+	rSimConfig config;
+	Rng rng;
+
+	Laser lasers[NB_INPUTS];
+	rLaserInput eInput = LI_1;
+	double dScanPower = 1.0;
+	double dScanMin = 1500.0;
+	double dScanMax = 1630.0;
+	uint32_t uiResolution = 250;
+	bool bDetector[NB_DETECTORS] = { true, false, false, false };
+	bool bExt = false;
+	rEnable eBNC = DISABLE;
+	double dAlpha = 0.0;
+	double dBeta = 0.0;
+	rUnit eBNCUnit = Unit_mW;
+	rEnable eExtSync = DISABLE;
+	rEnable eExtSyncIN = DISABLE;
+
+	rScanState eState = SCAN_IDLE;
+	bool bStop = false;
+	Clock::time_point tStart;
+	double dDuration = 0.0;
+	uint64_t uiScanCount = 0;
+	int32_t iInjectedError = 0;
+	std::string strInjectedError;
+
+	int32_t iDiscardPoints = 0;
+	std::vector<double> wavelengthSync, powerSync, detectorSync[NB_DETECTORS + 1];
+	std::vector<double> wavelengthResampled, powerResampled, detectorResampled[NB_DETECTORS + 1];
+	std::vector<double> lines;
+
+	// CT400_UpdateCalibration references (DE_1 to DE_4) on the resampled grid
+	std::vector<double> calibWavelength[NB_DETECTORS], calibValue[NB_DETECTORS];
+};
+
+std::mutex g_mtx;
+std::map<uint64_t, std::shared_ptr<Device>> g_devices;
+uint64_t g_uiNextHandle = 1;
+
+double envDouble(const char *pcName, double dDefault)
+{
+	const char *pcValue = std::getenv(pcName);
+	return pcValue ? std::atof(pcValue) : dDefault;
+}
+
+rSimConfig makeDefaultConfig()
+{
+	rSimConfig c;
+	c.dTimeScale = envDouble("CT400_SIM_TIMESCALE", 1.0);
+	c.dSampleRate = 100e3;
+	c.dScanOverhead = 1.0;
+	c.dUsbLatency = 1e-3;
+	c.dGpibLatency = 20e-3;
+	c.dSwitchTime = 50e-3;
+	c.dSettleTime = 30e-3;
+	c.iDiscardPoints = 13;
+	c.dNoise = envDouble("CT400_SIM_NOISE", 0.02);
+	c.dNoiseFloor = -75.0;
+	c.dPowerRipple = 0.1;
+	c.dCouplerCentre = 1550.0;
+	c.dCouplerBandwidth = 40.0;
+	c.dCouplerLoss = 5.0;
+	c.dRingResonance = 1550.2;
+	c.dRingFsr = 4.0;
+	c.dRingQ = 20000.0;
+	c.dRingExtinction = 25.0;
+	c.dBraggCentre = 1565.0;
+	c.dBraggWidth = 2.0;
+	c.dBraggDepth = 30.0;
+	c.dVext = 0.0;
+	c.iNbLines = 0;
+	c.dLineFirst = 1550.0;
+	c.dLineSpacing = 0.8;
+	c.dLineDrift = 0.0;
+	c.dLineJitter = 0.0005;
+	c.dErrorProbability = envDouble("CT400_SIM_ERROR_RATE", 0.0);
+	c.iErrorCode = 3;
+	c.uiSeed = (uint64_t)envDouble("CT400_SIM_SEED", 400.0);
+	return c;
+}
+
+rSimConfig &defaultConfig()
+{
+	static rSimConfig config = makeDefaultConfig();
+	return config;
+}
+
+std::shared_ptr<Device> findDevice(uint64_t uiHandle)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	auto it = g_devices.find(uiHandle);
+	return it == g_devices.end() ? nullptr : it->second;
+}
+
+// Sleeps for a duration of the modelled instrument
+void pace(const rSimConfig &config, double dSeconds)
+{
+	if (config.dTimeScale > 0.0 && dSeconds > 0.0)
+		std::this_thread::sleep_for(std::chrono::duration<double>(dSeconds * config.dTimeScale));
+}
+
+double mWtodBm(double dPower) { return 10.0 * std::log10(std::max(dPower, 1e-12)); }
+
+// Lorentzian distance term of the ring resonance nearest to dWavelength
+double ringLorentzian(double dWavelength, double dResonance, double dFsr, double dQ)
+{
+	double dOrder = (dWavelength - dResonance) / dFsr;
+	double dDelta = (dOrder - std::floor(dOrder + 0.5)) * dFsr;
+	double dHalfWidth = 0.5 * dWavelength / dQ;
+	double x = dDelta / dHalfWidth;
+	return 1.0 / (1.0 + x * x);
+}
+
+// Noise-free transmission of DE_1 to DE_4 in dB
+double transmissiondB(const rSimConfig &c, int iDetector, double dWavelength)
+{
+	double x = (dWavelength - c.dCouplerCentre) / (0.5 * c.dCouplerBandwidth);
+	double dEnvelope = -c.dCouplerLoss - 3.0 * x * x;
+	double dDepth = 1.0 - std::pow(10.0, -c.dRingExtinction / 10.0);
+	double t = 1.0;
+	switch (iDetector) {
+	case 0:
+		t = 1.0 - dDepth * ringLorentzian(dWavelength, c.dRingResonance, c.dRingFsr, c.dRingQ);
+		break;
+	case 1:
+		t = dDepth * ringLorentzian(dWavelength, c.dRingResonance, c.dRingFsr, c.dRingQ) + 1e-3;
+		break;
+	case 2: {
+		double y = 2.0 * (dWavelength - c.dBraggCentre) / c.dBraggWidth;
+		double dSide = std::fabs(y) > 1e-9 ? std::sin(PI * y) / (PI * y) : 1.0;
+		double dReflect = std::exp(-y * y * y * y * y * y) + 0.1 * dSide * dSide;
+		t = 1.0 - (1.0 - std::pow(10.0, -c.dBraggDepth / 10.0)) * std::min(dReflect, 1.0);
+		break;
+	}
+	case 3:
+		t = 1.0 - 0.8 * dDepth * ringLorentzian(dWavelength, c.dRingResonance + 0.37 * c.dRingFsr,
+			1.37 * c.dRingFsr, 0.5 * c.dRingQ);
+		break;
+	}
+	return std::max(dEnvelope, -60.0) + 10.0 * std::log10(t);
+}
+
+// Detector reading in dBm for a given laser power in dBm
+double detectordBm(Device &dev, int iDetector, double dWavelength, double dLaserdBm)
+{
+	const rSimConfig &c = dev.config;
+	double dSignal = dLaserdBm + transmissiondB(c, iDetector, dWavelength);
+	double dTotal = std::pow(10.0, dSignal / 10.0) + std::pow(10.0, c.dNoiseFloor / 10.0);
+	return 10.0 * std::log10(dTotal) + c.dNoise * dev.rng.gauss();
+}
+
+double poutdBm(Device &dev, double dWavelength, double dLaserdBm)
+{
+	const rSimConfig &c = dev.config;
+	return dLaserdBm + 0.5 * c.dPowerRipple * std::sin(2.0 * PI * (dWavelength - 1500.0) / 7.3)
+		+ 0.2 * c.dNoise * dev.rng.gauss();
+}
+
+double extValue(Device &dev)
+{
+	double dVolt = dev.config.dVext + 1e-4 * dev.rng.gauss();
+	if (dev.eBNC == DISABLE)
+		return dVolt;
+	double dPower = dev.dAlpha * dVolt + dev.dBeta;
+	return dev.eBNCUnit == Unit_dBm ? dPower : std::max(dPower, 0.0);
+}
+
+double interpolate(const std::vector<double> &x, const std::vector<double> &y, double dX)
+{
+	if (x.empty())
+		return 0.0;
+	auto it = std::lower_bound(x.begin(), x.end(), dX);
+	if (it == x.begin())
+		return y.front();
+	if (it == x.end())
+		return y.back();
+	size_t i = it - x.begin();
+	double t = (dX - x[i - 1]) / std::max(x[i] - x[i - 1], 1e-15);
+	return y[i - 1] + t * (y[i] - y[i - 1]);
+}
+
+// Linear resampling of the valid part of a sync array onto the uniform grid
+void resample(const std::vector<double> &wavelength, const std::vector<double> &value,
+	int32_t iFirst, const std::vector<double> &grid, std::vector<double> &out)
+{
+	out.resize(grid.size());
+	size_t j = iFirst;
+	for (size_t i = 0; i < grid.size(); i++) {
+		while (j + 2 < wavelength.size() && wavelength[j + 1] < grid[i])
+			j++;
+		double dSpan = wavelength[j + 1] - wavelength[j];
+		double t = dSpan > 0.0 ? (grid[i] - wavelength[j]) / dSpan : 0.0;
+		t = std::min(std::max(t, 0.0), 1.0);
+		out[i] = value[j] + t * (value[j + 1] - value[j]);
+	}
+}
+
+void clearScanData(Device &dev)
+{
+	dev.iDiscardPoints = 0;
+	dev.wavelengthSync.clear();
+	dev.powerSync.clear();
+	dev.wavelengthResampled.clear();
+	dev.powerResampled.clear();
+	for (int d = 0; d <= NB_DETECTORS; d++) {
+		dev.detectorSync[d].clear();
+		dev.detectorResampled[d].clear();
+	}
+	dev.lines.clear();
+}
+
+// Fills the sync, resampled and line arrays of the sweep that was started
+void generateScan(Device &dev)
+{
+	const rSimConfig &c = dev.config;
+	const Laser &laser = dev.lasers[dev.eInput - 1];
+	double dStep = laser.iSpeed / c.dSampleRate;
+	int32_t iDiscard = std::max(c.iDiscardPoints, 0);
+	int32_t iValid = (int32_t)std::floor((dev.dScanMax - dev.dScanMin) / dStep) + 1;
+	int32_t iPoints = iDiscard + std::max(iValid, 2);
+	double dLaserdBm = mWtodBm(dev.dScanPower);
+
+	clearScanData(dev);
+	dev.iDiscardPoints = iDiscard;
+	dev.wavelengthSync.resize(iPoints);
+	dev.powerSync.resize(iPoints);
+	for (int32_t i = 0; i < iPoints; i++) {
+		double dWavelength = dev.dScanMin + (i - iDiscard) * dStep + 0.02 * dStep * dev.rng.gauss();
+		if (i > 0)
+			dWavelength = std::max(dWavelength, dev.wavelengthSync[i - 1]);
+		dev.wavelengthSync[i] = dWavelength;
+		dev.powerSync[i] = poutdBm(dev, dWavelength, dLaserdBm);
+	}
+	for (int d = 0; d < NB_DETECTORS; d++) {
+		if (!dev.bDetector[d])
+			continue;
+		std::vector<double> &out = dev.detectorSync[d];
+		out.resize(iPoints);
+		for (int32_t i = 0; i < iPoints; i++)
+			out[i] = detectordBm(dev, d, dev.wavelengthSync[i], dev.powerSync[i]);
+		if (!dev.calibWavelength[d].empty())
+			for (int32_t i = 0; i < iPoints; i++)
+				out[i] -= interpolate(dev.calibWavelength[d], dev.calibValue[d], dev.wavelengthSync[i]);
+	}
+	if (dev.bExt) {
+		dev.detectorSync[NB_DETECTORS].resize(iPoints);
+		for (int32_t i = 0; i < iPoints; i++)
+			dev.detectorSync[NB_DETECTORS][i] = extValue(dev);
+	}
+
+	int32_t iResampled = (int32_t)std::floor((dev.dScanMax - dev.dScanMin) * 1000.0 / dev.uiResolution + 1e-6) + 1;
+	dev.wavelengthResampled.resize(iResampled);
+	for (int32_t i = 0; i < iResampled; i++)
+		dev.wavelengthResampled[i] = dev.dScanMin + i * dev.uiResolution * 1e-3;
+	resample(dev.wavelengthSync, dev.powerSync, iDiscard, dev.wavelengthResampled, dev.powerResampled);
+	for (int d = 0; d <= NB_DETECTORS; d++)
+		if (!dev.detectorSync[d].empty())
+			resample(dev.wavelengthSync, dev.detectorSync[d], iDiscard, dev.wavelengthResampled,
+				dev.detectorResampled[d]);
+
+	for (int32_t i = 0; i < c.iNbLines; i++) {
+		double dLine = c.dLineFirst + i * c.dLineSpacing + dev.uiScanCount * c.dLineDrift
+			+ c.dLineJitter * dev.rng.gauss();
+		if (dLine >= dev.dScanMin && dLine <= dev.dScanMax)
+			dev.lines.push_back(dLine);
+	}
+}
+
+// Current output of a laser moving after CT400_CmdLaser
+void laserOutput(const Device &dev, const Laser &laser, double &dWavelength, double &dPower)
+{
+	double dTau = dev.config.dSettleTime * dev.config.dTimeScale;
+	double dDecay = 0.0;
+	if (dTau > 0.0) {
+		double dElapsed = std::chrono::duration<double>(Clock::now() - laser.tCmd).count();
+		dDecay = std::exp(-dElapsed / dTau);
+	}
+	dWavelength = laser.dCmdWavelength + (laser.dFromWavelength - laser.dCmdWavelength) * dDecay;
+	dPower = laser.dCmdPower + (laser.dFromPower - laser.dCmdPower) * dDecay;
+}
+
+int32_t copyArray(const std::vector<double> &src, double dArray[], int32_t iArraySize)
+{
+	if (src.empty() || dArray == nullptr || iArraySize < 0)
+		return -1;
+	int32_t iCount = std::min<int32_t>(iArraySize, (int32_t)src.size());
+	std::memcpy(dArray, src.data(), iCount * sizeof(double));
+	return iCount;
+}
+
+int32_t saveArray(const std::vector<double> &src, const char *pcPath, const char *pcFormat)
+{
+	if (src.empty() || pcPath == nullptr)
+		return -1;
+	FILE *pFile = std::fopen(pcPath, "w");
+	if (pFile == nullptr)
+		return -1;
+	for (double dValue : src)
+		std::fprintf(pFile, pcFormat, dValue);
+	return std::fclose(pFile) == 0 ? 0 : -1;
+}
+
+const std::vector<double> *detectorArray(Device &dev, rDetector eDetector, bool bResampled)
+{
+	if (eDetector < DE_1 || eDetector > DE_5)
+		return nullptr;
+	return bResampled ? &dev.detectorResampled[eDetector - 1] : &dev.detectorSync[eDetector - 1];
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_DECLSPEC uint64_t __stdcall CT400_Init(int32_t *iError)
+{
+	auto dev = std::make_shared<Device>();
+	uint64_t uiHandle;
+	{
+		std::lock_guard<std::mutex> lock(g_mtx);
+		uiHandle = g_uiNextHandle++;
+		dev->config = defaultConfig();
+		g_devices[uiHandle] = dev;
+	}
+	dev->rng.seed(dev->config.uiSeed + uiHandle);
+	for (Laser &laser : dev->lasers)
+		laser.tCmd = Clock::now();
+	pace(dev->config, 10 * dev->config.dUsbLatency);
+	if (iError)
+		*iError = 0;
+	return uiHandle;
+}
+
+_DECLSPEC int32_t __stdcall CT400_CheckConnected(uint64_t uiHandle)
+{
+	return findDevice(uiHandle) ? 1 : 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_GetNbInputs(uint64_t uiHandle)
+{
+	return findDevice(uiHandle) ? NB_INPUTS : -1;
+}
+
+_DECLSPEC int32_t __stdcall CT400_GetNbDetectors(uint64_t uiHandle)
+{
+	return findDevice(uiHandle) ? NB_DETECTORS : -1;
+}
+
+_DECLSPEC int32_t __stdcall CT400_GetCT400Type(uint64_t uiHandle)
+{
+	return findDevice(uiHandle) ? 0 : -1;
+}
+
+_DECLSPEC int32_t __stdcall CT400_SetLaser(uint64_t uiHandle,
+rLaserInput eLaser, rEnable eEnable, int32_t iGPIBAdress,
+rLaserSource eLaserType, double dMinWavelength,
+double dMaxWavelength, int32_t Speed)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev || eLaser < LI_1 || eLaser > LI_4 || eLaserType < LS_TunicsPlus || eLaserType >= NB_SOURCE
+		|| dMinWavelength >= dMaxWavelength || Speed < 10 || Speed > 100)
+		return -1;
+	pace(dev->config, dev->config.dGpibLatency);
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	Laser &laser = dev->lasers[eLaser - 1];
+	laser.bConfigured = true;
+	laser.eEnable = eEnable;
+	laser.iGPIBAdress = iGPIBAdress;
+	laser.eType = eLaserType;
+	laser.dMinWavelength = dMinWavelength;
+	laser.dMaxWavelength = dMaxWavelength;
+	laser.iSpeed = Speed;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_SetSamplingResolution(uint64_t uiHandle,
+uint32_t uiResolution)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev || uiResolution < 1 || uiResolution > 250)
+		return -1;
+	pace(dev->config, dev->config.dUsbLatency);
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	dev->uiResolution = uiResolution;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_SetScan(uint64_t uiHandle, double dLaserPower,
+double dMinWavelength, double dMaxWavelength)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev || dLaserPower <= 0.0 || dMinWavelength >= dMaxWavelength)
+		return -1;
+	pace(dev->config, dev->config.dUsbLatency);
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	dev->dScanPower = dLaserPower;
+	dev->dScanMin = dMinWavelength;
+	dev->dScanMax = dMaxWavelength;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_SetDetectorArray(uint64_t uiHandle,
+rEnable eDect2, rEnable eDect3, rEnable eDect4, rEnable eExt)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	pace(dev->config, dev->config.dUsbLatency);
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	dev->bDetector[1] = eDect2 == ENABLE;
+	dev->bDetector[2] = eDect3 == ENABLE;
+	dev->bDetector[3] = eDect4 == ENABLE;
+	dev->bExt = eExt == ENABLE;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_SetBNC(uint64_t uiHandle, rEnable eEnable,
+double dAlpha, double dBeta, rUnit eUnit)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	pace(dev->config, dev->config.dUsbLatency);
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	dev->eBNC = eEnable;
+	dev->dAlpha = dAlpha;
+	dev->dBeta = dBeta;
+	dev->eBNCUnit = eUnit;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_SetExternalSynchronization(uint64_t uiHandle,
+rEnable eEnable)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	pace(dev->config, dev->config.dUsbLatency);
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	dev->eExtSync = eEnable;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall
+CT400_SetExternalSynchronizationIN(uint64_t uiHandle, rEnable eEnable)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	pace(dev->config, dev->config.dUsbLatency);
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	dev->eExtSyncIN = eEnable;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_ScanStart(uint64_t uiHandle)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	pace(dev->config, dev->config.dUsbLatency);
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	const Laser &laser = dev->lasers[dev->eInput - 1];
+	if (dev->eState == SCAN_RUNNING || !laser.bConfigured || laser.eEnable != ENABLE
+		|| dev->dScanMin < laser.dMinWavelength || dev->dScanMax > laser.dMaxWavelength)
+		return -1;
+	clearScanData(*dev);
+	dev->eState = SCAN_RUNNING;
+	dev->bStop = false;
+	dev->tStart = Clock::now();
+	dev->dDuration = (dev->dScanMax - dev->dScanMin) / laser.iSpeed + dev->config.dScanOverhead;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_ScanStop(uint64_t uiHandle)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	dev->bStop = true;
+	dev->cv.notify_all();
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_ScanWaitEnd(uint64_t uiHandle,
+char tcError[1024])
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::unique_lock<std::mutex> lock(dev->mtx);
+	if (dev->eState != SCAN_RUNNING) {
+		if (tcError)
+			std::snprintf(tcError, 1024, "No scan in progress");
+		return -1;
+	}
+	generateScan(*dev);
+	auto tEnd = dev->tStart + std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(dev->dDuration * dev->config.dTimeScale));
+	dev->cv.wait_until(lock, tEnd, [&] { return dev->bStop; });
+	dev->uiScanCount++;
+
+	int32_t iError = 0;
+	std::string strError;
+	if (dev->bStop) {
+		iError = 1;
+		strError = "Scan stopped";
+	}
+	else if (dev->iInjectedError != 0) {
+		iError = dev->iInjectedError;
+		strError = dev->strInjectedError;
+		dev->iInjectedError = 0;
+	}
+	else if (dev->rng.uniform() < dev->config.dErrorProbability) {
+		iError = dev->config.iErrorCode;
+		strError = "Simulated sweep failure";
+	}
+	if (tcError)
+		std::snprintf(tcError, 1024, "%s", strError.c_str());
+	if (iError != 0) {
+		clearScanData(*dev);
+		dev->eState = SCAN_IDLE;
+	}
+	else {
+		dev->eState = SCAN_DONE;
+	}
+	return iError;
+}
+
+_DECLSPEC int32_t __stdcall CT400_GetNbDataPoints (uint64_t uiHandle,
+int32_t *iDataPoints, int32_t *iDiscardPoints)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	if (dev->eState != SCAN_DONE)
+		return -1;
+	if (iDataPoints)
+		*iDataPoints = (int32_t)dev->wavelengthSync.size();
+	if (iDiscardPoints)
+		*iDiscardPoints = dev->iDiscardPoints;
+	return (int32_t)dev->wavelengthSync.size();
+}
+
+_DECLSPEC int32_t __stdcall CT400_GetNbDataPointsResampled (uint64_t uiHandle)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	return dev->eState == SCAN_DONE ? (int32_t)dev->wavelengthResampled.size() : -1;
+}
+
+_DECLSPEC int32_t __stdcall CT400_GetNbLinesDetected (uint64_t uiHandle)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	return dev->eState == SCAN_DONE ? (int32_t)dev->lines.size() : -1;
+}
+
+_DECLSPEC int32_t __stdcall CT400_ScanGetLinesDetectionArray (uint64_t uiHandle,
+double dArray[], int32_t iArraySize)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	if (dev->eState != SCAN_DONE || dArray == nullptr)
+		return -1;
+	int32_t iCount = std::min<int32_t>(iArraySize, (int32_t)dev->lines.size());
+	std::copy(dev->lines.begin(), dev->lines.begin() + std::max(iCount, 0), dArray);
+	return iCount;
+}
+
+_DECLSPEC int32_t __stdcall CT400_ScanGetWavelengthSyncArray(uint64_t uiHandle,
+double dArray[], int32_t iArraySize)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	return copyArray(dev->wavelengthSync, dArray, iArraySize);
+}
+
+_DECLSPEC int32_t __stdcall
+CT400_ScanGetWavelengthResampledArray(uint64_t uiHandle,
+double dArray[], int32_t iArraySize)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	return copyArray(dev->wavelengthResampled, dArray, iArraySize);
+}
+
+_DECLSPEC int32_t __stdcall CT400_ScanGetPowerSyncArray(uint64_t uiHandle,
+double dArray[], int32_t iArraySize)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	return copyArray(dev->powerSync, dArray, iArraySize);
+}
+
+_DECLSPEC int32_t __stdcall CT400_ScanGetPowerResampledArray(uint64_t uiHandle,
+double dArray[], int32_t iArraySize)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	return copyArray(dev->powerResampled, dArray, iArraySize);
+}
+
+_DECLSPEC int32_t __stdcall CT400_ScanGetDetectorArray(uint64_t uiHandle,
+rDetector eDetector, double dArray[], int32_t iArraySize)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	const std::vector<double> *src = detectorArray(*dev, eDetector, false);
+	return src ? copyArray(*src, dArray, iArraySize) : -1;
+}
+
+_DECLSPEC int32_t __stdcall
+CT400_ScanGetDetectorResampledArray(uint64_t uiHandle, rDetector eDetector,
+double dArray[], int32_t iArraySize)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	const std::vector<double> *src = detectorArray(*dev, eDetector, true);
+	return src ? copyArray(*src, dArray, iArraySize) : -1;
+}
+
+_DECLSPEC int32_t __stdcall
+CT400_ScanSaveWavelengthSyncFile(uint64_t uiHandle, char *pcPath)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	return saveArray(dev->wavelengthSync, pcPath, "%.4f\n");
+}
+
+_DECLSPEC int32_t __stdcall
+CT400_ScanSaveWavelengthResampledFile(uint64_t uiHandle, char *pcPath)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	return saveArray(dev->wavelengthResampled, pcPath, "%.4f\n");
+}
+
+_DECLSPEC int32_t __stdcall
+CT400_ScanSavePowerSyncFile(uint64_t uiHandle, char *pcPath)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	return saveArray(dev->powerSync, pcPath, "%.3f\n");
+}
+
+_DECLSPEC int32_t __stdcall
+CT400_ScanSavePowerResampledFile(uint64_t uiHandle, char *pcPath)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	return saveArray(dev->powerResampled, pcPath, "%.3f\n");
+}
+
+_DECLSPEC int32_t __stdcall
+CT400_ScanSaveDetectorFile(uint64_t uiHandle, rDetector eDetector, char *pcPath)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	const std::vector<double> *src = detectorArray(*dev, eDetector, false);
+	return src ? saveArray(*src, pcPath, "%.3f\n") : -1;
+}
+
+_DECLSPEC int32_t __stdcall
+CT400_ScanSaveDetectorResampledFile(uint64_t uiHandle, rDetector eDetector,
+char *pcPath)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	const std::vector<double> *src = detectorArray(*dev, eDetector, true);
+	return src ? saveArray(*src, pcPath, "%.3f\n") : -1;
+}
+
+_DECLSPEC int32_t __stdcall CT400_UpdateCalibration(uint64_t uiHandle,
+rDetector eDetector)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev || eDetector < DE_1 || eDetector > DE_4)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	int d = eDetector - 1;
+	if (dev->eState != SCAN_DONE || dev->detectorResampled[d].empty())
+		return -1;
+	// the stored reference is the uncalibrated reading of the last sweep
+	std::vector<double> value = dev->detectorResampled[d];
+	if (!dev->calibWavelength[d].empty())
+		for (size_t i = 0; i < value.size(); i++)
+			value[i] += interpolate(dev->calibWavelength[d], dev->calibValue[d], dev->wavelengthResampled[i]);
+	dev->calibWavelength[d] = dev->wavelengthResampled;
+	dev->calibValue[d] = value;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_ResetCalibration(uint64_t uiHandle)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	for (int d = 0; d < NB_DETECTORS; d++) {
+		dev->calibWavelength[d].clear();
+		dev->calibValue[d].clear();
+	}
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_SwitchInput(uint64_t uiHandle,
+rLaserInput eLaser)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev || eLaser < LI_1 || eLaser > LI_4)
+		return -1;
+	pace(dev->config, dev->config.dSwitchTime);
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	if (dev->eState == SCAN_RUNNING)
+		return -1;
+	dev->eInput = eLaser;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall
+CT400_ReadPowerDetectors(uint64_t uiHandle, double *Pout, double *P1,
+double *P2, double *P3, double *P4, double *Vext)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	pace(dev->config, dev->config.dUsbLatency);
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	const Laser &laser = dev->lasers[dev->eInput - 1];
+	double dWavelength, dPower;
+	laserOutput(*dev, laser, dWavelength, dPower);
+	bool bOn = laser.eCmdEnable == ENABLE;
+	double dLaserdBm = bOn ? mWtodBm(dPower) : dev->config.dNoiseFloor - 20.0;
+	double dOut = bOn ? poutdBm(*dev, dWavelength, dLaserdBm) : dev->config.dNoiseFloor;
+	double *pdDetector[NB_DETECTORS] = { P1, P2, P3, P4 };
+	for (int d = 0; d < NB_DETECTORS; d++)
+		if (pdDetector[d])
+			*pdDetector[d] = detectordBm(*dev, d, dWavelength, dLaserdBm);
+	if (Pout)
+		*Pout = dOut;
+	if (Vext)
+		*Vext = extValue(*dev);
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_CmdLaser(uint64_t uiHandle, rLaserInput eLaser, rEnable eEnable, double dWavelength, double dPower)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev || eLaser < LI_1 || eLaser > LI_4 || dPower <= 0.0)
+		return -1;
+	pace(dev->config, dev->config.dGpibLatency);
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	Laser &laser = dev->lasers[eLaser - 1];
+	if (!laser.bConfigured || dWavelength < laser.dMinWavelength || dWavelength > laser.dMaxWavelength)
+		return -1;
+	laserOutput(*dev, laser, laser.dFromWavelength, laser.dFromPower);
+	laser.eCmdEnable = eEnable;
+	laser.dCmdWavelength = dWavelength;
+	laser.dCmdPower = dPower;
+	laser.tCmd = Clock::now();
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_Close(uint64_t uiHandle)
+{
+	std::shared_ptr<Device> dev;
+	{
+		std::lock_guard<std::mutex> lock(g_mtx);
+		auto it = g_devices.find(uiHandle);
+		if (it == g_devices.end())
+			return -1;
+		dev = it->second;
+		g_devices.erase(it);
+	}
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	dev->bStop = true;
+	dev->cv.notify_all();
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_SimGetConfig(uint64_t uiHandle,
+rSimConfig *pConfig)
+{
+	if (pConfig == nullptr)
+		return -1;
+	if (uiHandle == 0) {
+		std::lock_guard<std::mutex> lock(g_mtx);
+		*pConfig = defaultConfig();
+		return 0;
+	}
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	*pConfig = dev->config;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_SimSetConfig(uint64_t uiHandle,
+const rSimConfig *pConfig)
+{
+	if (pConfig == nullptr || pConfig->dSampleRate <= 0.0 || pConfig->dTimeScale < 0.0)
+		return -1;
+	if (uiHandle == 0) {
+		std::lock_guard<std::mutex> lock(g_mtx);
+		defaultConfig() = *pConfig;
+		return 0;
+	}
+	auto dev = findDevice(uiHandle);
+	if (!dev)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	if (pConfig->uiSeed != dev->config.uiSeed)
+		dev->rng.seed(pConfig->uiSeed + uiHandle);
+	dev->config = *pConfig;
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_SimInjectScanError(uint64_t uiHandle,
+int32_t iError, const char *pcMessage)
+{
+	auto dev = findDevice(uiHandle);
+	if (!dev || iError == 0)
+		return -1;
+	std::lock_guard<std::mutex> lock(dev->mtx);
+	dev->iInjectedError = iError;
+	dev->strInjectedError = pcMessage ? pcMessage : "";
+	return 0;
+}
+
+}
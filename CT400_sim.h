@@ -0,0 +1,101 @@
+/******************************************************************************/
+/* Header file for the CT400 simulator (CT400_sim.cpp)                        */
+/*                                                                            */
+/* The simulator exports the full CT400_lib.h interface plus the functions    */
+/* below, which tune the synthetic device model.                              */
+/******************************************************************************/
+
+#ifndef CT400_SIM_H
+#define CT400_SIM_H
+
+#include "CT400_lib.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef struct
+  {
+	// pacing
+	double dTimeScale;          // 1.0 = real time, 0.1 = 10x faster, 0 = no waits
+	double dSampleRate;         // sync samples per second during a sweep
+	double dScanOverhead;       // s added to every sweep (laser repositioning)
+	double dUsbLatency;         // s per configuration/read call
+	double dGpibLatency;        // s per call that goes through to the laser
+	double dSwitchTime;         // s for CT400_SwitchInput
+	double dSettleTime;         // s, time constant of the laser after CT400_CmdLaser
+	int32_t iDiscardPoints;     // sync points before the first valid top-pulse
+	// detector model
+	double dNoise;              // detector noise standard deviation in dB
+	double dNoiseFloor;         // detector noise floor in dBm
+	double dPowerRipple;        // peak-to-peak Pout ripple in dB
+	double dCouplerCentre;      // grating coupler envelope centre in nm
+	double dCouplerBandwidth;   // grating coupler 3 dB bandwidth in nm
+	double dCouplerLoss;        // grating coupler peak loss in dB
+	double dRingResonance;      // wavelength of one ring resonance in nm
+	double dRingFsr;            // ring free spectral range in nm
+	double dRingQ;              // ring loaded Q
+	double dRingExtinction;     // ring extinction ratio in dB
+	double dBraggCentre;        // Bragg grating stop band centre in nm
+	double dBraggWidth;         // Bragg grating stop band width in nm
+	double dBraggDepth;         // Bragg grating stop band depth in dB
+	double dVext;               // voltage seen on the BNC C input
+	// heterodyne lines
+	int32_t iNbLines;           // number of lines reported (0 = none)
+	double dLineFirst;          // wavelength of the first line in nm
+	double dLineSpacing;        // spacing between lines in nm
+	double dLineDrift;          // drift of every line per sweep in nm
+	double dLineJitter;         // standard deviation of line positions in nm
+	// error injection
+	double dErrorProbability;   // chance of CT400_ScanWaitEnd failing
+	int32_t iErrorCode;         // error number returned on failure
+	uint64_t uiSeed;            // random seed (handles use uiSeed + handle)
+  } rSimConfig;
+
+//------------------------------ CT400_SimGetConfig ----------------------------
+// Function CT400_SimGetConfig
+//
+//  Purpose: Returns the simulator configuration of a handle
+//
+//  Parameters: IN uiHandle: from CT400_Init, or 0 for the defaults used by
+//                           subsequent CT400_Init calls
+//              IN/OUT pConfig: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_DECLSPEC int32_t __stdcall CT400_SimGetConfig(uint64_t uiHandle,
+rSimConfig *pConfig);
+
+//------------------------------ CT400_SimSetConfig ----------------------------
+// Function CT400_SimSetConfig
+//
+//  Purpose: Replaces the simulator configuration of a handle. Takes effect
+//           from the next sweep or power reading.
+//
+//  Parameters: IN uiHandle: from CT400_Init, or 0 for the defaults used by
+//                           subsequent CT400_Init calls
+//              IN pConfig: new configuration
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_DECLSPEC int32_t __stdcall CT400_SimSetConfig(uint64_t uiHandle,
+const rSimConfig *pConfig);
+
+//------------------------------ CT400_SimInjectScanError ----------------------
+// Function CT400_SimInjectScanError
+//
+//  Purpose: Makes the next CT400_ScanWaitEnd fail with the given error
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN iError: error number to return (non zero)
+//              IN pcMessage: error description copied to tcError
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_DECLSPEC int32_t __stdcall CT400_SimInjectScanError(uint64_t uiHandle,
+int32_t iError, const char *pcMessage);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,73 @@
+/******************************************************************************/
+/* SIMD support for the native CT400 extensions                               */
+/*                                                                            */
+/* Kernels are compiled for AVX2/AVX-512 with function target attributes and  */
+/* selected at run time, so the library runs on any x86-64 (and elsewhere)    */
+/* with the scalar versions.                                                  */
+/******************************************************************************/
+
+#ifndef CT400_SIMD_H
+#define CT400_SIMD_H
+
+#include <cstdlib>
+#include <cstring>
+
+#if (defined (__GNUC__) || defined (__clang__)) && (defined (__x86_64__) || defined (__i386__))
+#   define CT400_SIMD_X86 1
+#   include <immintrin.h>
+#   define CT400_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#   define CT400_TARGET_AVX512 __attribute__((target("avx512f,avx512dq")))
+#else
+#   define CT400_SIMD_X86 0
+#endif
+
+namespace ct400
+{
+
+enum SimdLevel
+{
+	SIMD_SCALAR = 0,
+	SIMD_AVX2,
+	SIMD_AVX512
+};
+
+// Best instruction set of this CPU. CT400_SIMD=scalar|avx2|avx512 in the
+// environment caps it (to compare kernels or work around a platform issue).
+inline SimdLevel simdLevel()
+{
+	static const SimdLevel level = [] {
+		SimdLevel detected = SIMD_SCALAR;
+#if CT400_SIMD_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			detected = SIMD_AVX2;
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+			detected = SIMD_AVX512;
+#endif
+		const char *pcCap = std::getenv("CT400_SIMD");
+		SimdLevel cap = SIMD_AVX512;
+		if (pcCap && std::strcmp(pcCap, "scalar") == 0)
+			cap = SIMD_SCALAR;
+		else if (pcCap && std::strcmp(pcCap, "avx2") == 0)
+			cap = SIMD_AVX2;
+		return detected < cap ? detected : cap;
+	}();
+	return level;
+}
+
+inline const char *simdName(SimdLevel level)
+{
+	switch (level) {
+	case SIMD_AVX2:
+		return "avx2";
+	case SIMD_AVX512:
+		return "avx512";
+	default:
+		return "scalar";
+	}
+}
+
+} // namespace ct400
+
+
+#endif
@@ -0,0 +1,47 @@
+//------------------------------------------------------------------------------
+// CT400_span.cpp
+//
+// The extensions do not link the metrics shim: CT400_MetricsRecordSpan is
+// looked up once among the loaded libraries, so they run unchanged over the
+// plain CT400_lib.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_span.h"
+
+#if defined (_WIN32)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace ct400
+{
+
+namespace
+{
+
+typedef int32_t (__stdcall *RecordSpanFn)(uint64_t uiHandle, const char *pcName, double dSeconds);
+
+RecordSpanFn recorder()
+{
+	static const RecordSpanFn fn = [] {
+#if defined (_WIN32)
+		HMODULE hShim = GetModuleHandleA("CT400_metrics.dll");
+		return hShim ? (RecordSpanFn)GetProcAddress(hShim, "CT400_MetricsRecordSpan") : (RecordSpanFn)nullptr;
+#else
+		return (RecordSpanFn)dlsym(RTLD_DEFAULT, "CT400_MetricsRecordSpan");
+#endif
+	}();
+	return fn;
+}
+
+} // namespace
+
+void recordSpan(uint64_t uiHandle, const char *pcName, double dSeconds)
+{
+	if (RecordSpanFn fn = recorder())
+		fn(uiHandle, pcName, dSeconds);
+}
+
+} // namespace ct400
@@ -0,0 +1,50 @@
+/******************************************************************************/
+/* Header file for CT400_span.cpp                                             */
+/*                                                                            */
+/* Phase timing for the native extensions, recorded by the metrics shim      */
+/* (CT400_metrics.h) when it is the loaded CT400_lib, and ignored otherwise. */
+/******************************************************************************/
+
+#ifndef CT400_SPAN_H
+#define CT400_SPAN_H
+
+#include "CT400_ext.h"
+
+#include <chrono>
+
+namespace ct400
+{
+
+// Records a phase through CT400_MetricsRecordSpan if the shim is loaded
+void recordSpan(uint64_t uiHandle, const char *pcName, double dSeconds);
+
+//------------------------------ ScopedSpan ------------------------------------
+// Class ScopedSpan
+//
+//  Purpose: Records the time from its construction to its destruction as a
+//           phase of uiHandle. pcName must outlive it (a literal).
+//------------------------------------------------------------------------------
+class ScopedSpan
+{
+public:
+	ScopedSpan(uint64_t uiHandle, const char *pcName)
+		: m_uiHandle(uiHandle), m_pcName(pcName), m_tStart(std::chrono::steady_clock::now()) {}
+	~ScopedSpan()
+	{
+		recordSpan(m_uiHandle, m_pcName,
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - m_tStart).count());
+	}
+
+	ScopedSpan(const ScopedSpan &) = delete;
+	ScopedSpan &operator=(const ScopedSpan &) = delete;
+
+private:
+	uint64_t m_uiHandle;
+	const char *m_pcName;
+	std::chrono::steady_clock::time_point m_tStart;
+};
+
+} // namespace ct400
+
+
+#endif
@@ -0,0 +1,162 @@
+//------------------------------------------------------------------------------
+// CT400_step_scan.cpp
+//
+// Step-and-measure sequences. A point costs the CmdLaser move, the readings
+// needed for the settle test to pass and the averaged readings; the test
+// refits a short line on each reading, which is negligible next to one USB
+// round trip.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_step_scan.h"
+#include "CT400_device.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+extern "C"
+{
+
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultStepSettings(
+rStepSettings *pSettings)
+{
+	if (pSettings == nullptr)
+		return -1;
+	std::memset(pSettings, 0, sizeof(*pSettings));
+	pSettings->eInput = LI_1;
+	pSettings->iAverages = 4;
+	pSettings->iWindow = 32;
+	pSettings->iMaxReadings = 500;
+	pSettings->uiSettleChannels = SC_POUT | SC_P1;
+	pSettings->dPower = 1.0;
+	pSettings->dTolerance = 0.01;
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_StepScan(uint64_t uiHandle,
+const rStepSettings *pSettings, const double dWavelength[], int32_t iPoints,
+double dResult[], int32_t iReadings[])
+{
+	if (iPoints < 0 || (iPoints > 0 && (dWavelength == nullptr || dResult == nullptr)))
+		return -1;
+	rStepSettings settings;
+	if (pSettings)
+		settings = *pSettings;
+	else
+		CT400_DefaultStepSettings(&settings);
+	ct400::StepScan scan(uiHandle, settings);
+	return scan.run(dWavelength, iPoints, dResult, iPoints, iReadings);
+}
+
+}
+
+
+namespace ct400
+{
+
+SettleDetector::SettleDetector(size_t uiWindow, double dTolerance)
+	: m_window(std::max<size_t>(uiWindow, 3)), m_dTolerance(dTolerance)
+{
+}
+
+void SettleDetector::add(double dValue)
+{
+	m_window[m_uiCount % m_window.size()] = dValue;
+	m_uiCount++;
+}
+
+bool SettleDetector::settled() const
+{
+	const size_t n = m_window.size();
+	if (m_uiCount < n)
+		return false;
+	// x = 0..n-1 from the oldest reading
+	const size_t uiOldest = m_uiCount % n;
+	double dMeanX = 0.5 * (n - 1), dSy = 0.0, dSxy = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		double y = m_window[(uiOldest + i) % n];
+		dSy += y;
+		dSxy += (i - dMeanX) * y;
+	}
+	const double dSxx = n * ((double)n * n - 1.0) / 12.0;
+	const double dSlope = dSxy / dSxx;
+	const double dMean = dSy / n;
+	double dResidual = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		double e = m_window[(uiOldest + i) % n] - dMean - dSlope * (i - dMeanX);
+		dResidual += e * e;
+	}
+	const double dSlopeError = std::sqrt(dResidual / (n - 2) / dSxx);
+	return std::fabs(dSlope) <= std::max(m_dTolerance, 2.0 * dSlopeError * (n - 1)) / (n - 1);
+}
+
+StepScan::StepScan(uint64_t uiHandle, const rStepSettings &settings)
+	: m_device(Device::forHandle(uiHandle)), m_settings(settings)
+{
+}
+
+int32_t StepScan::run(const double *pdWavelength, size_t uiPoints, double *pdResult, size_t uiStride,
+	int32_t *piReadings)
+{
+	const rStepSettings &s = m_settings;
+	if ((uiPoints > 0 && (pdWavelength == nullptr || pdResult == nullptr)) || uiStride < uiPoints
+		|| s.iAverages < 1 || s.iWindow < 3 || s.iMaxReadings < s.iWindow || !(s.dPower > 0.0))
+		return -1;
+	m_bCancel.store(false);
+
+	std::vector<SettleDetector> detectors(NB_POWER_CHANNELS, SettleDetector(s.iWindow, s.dTolerance));
+	size_t uiDone = 0;
+	for (; uiDone < uiPoints && !m_bCancel.load(); uiDone++) {
+		bool bFailed = false;
+		int32_t iSettle = m_device->call([&](uint64_t uiHandle) -> int32_t {
+			double v[NB_POWER_CHANNELS];
+			auto read = [&] { return CT400_ReadPowerDetectors(uiHandle, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 0; };
+			if (CT400_CmdLaser(uiHandle, s.eInput, ENABLE, pdWavelength[uiDone], s.dPower) != 0) {
+				bFailed = true;
+				return -1;
+			}
+
+			int32_t iRead = 0;
+			bool bSettled = s.uiSettleChannels == 0;
+			for (SettleDetector &detector : detectors)
+				detector.reset();
+			while (!bSettled && iRead < s.iMaxReadings) {
+				if (!read()) {
+					bFailed = true;
+					return -1;
+				}
+				iRead++;
+				bSettled = true;
+				for (int c = 0; c < NB_POWER_CHANNELS; c++)
+					if (s.uiSettleChannels & (1u << c)) {
+						detectors[c].add(v[c]);
+						bSettled = bSettled && detectors[c].settled();
+					}
+			}
+
+			// powers averaged in mW, Vext as read
+			double dSum[NB_POWER_CHANNELS] = { 0.0 };
+			for (int32_t a = 0; a < s.iAverages; a++) {
+				if (!read()) {
+					bFailed = true;
+					return -1;
+				}
+				for (int c = 0; c < NB_POWER_CHANNELS - 1; c++)
+					dSum[c] += std::pow(10.0, v[c] / 10.0);
+				dSum[NB_POWER_CHANNELS - 1] += v[NB_POWER_CHANNELS - 1];
+			}
+			for (int c = 0; c < NB_POWER_CHANNELS - 1; c++)
+				pdResult[c * uiStride + uiDone] = 10.0 * std::log10(dSum[c] / s.iAverages);
+			pdResult[(NB_POWER_CHANNELS - 1) * uiStride + uiDone] = dSum[NB_POWER_CHANNELS - 1] / s.iAverages;
+			return bSettled ? iRead : -1;
+		});
+		if (bFailed)
+			break;
+		if (piReadings)
+			piReadings[uiDone] = iSettle;
+	}
+	return (int32_t)uiDone;
+}
+
+} // namespace ct400
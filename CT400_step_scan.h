@@ -0,0 +1,149 @@
+/******************************************************************************/
+/* Header file for CT400_step_scan.cpp                                        */
+/*                                                                            */
+/* Step-and-measure mode: the laser is moved with CT400_CmdLaser and each     */
+/* point read with CT400_ReadPowerDetectors once the readings have settled.   */
+/******************************************************************************/
+
+#ifndef CT400_STEP_SCAN_H
+#define CT400_STEP_SCAN_H
+
+#include "CT400_power_monitor.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Channels of the settle test (uiSettleChannels)
+  typedef enum
+  {
+	SC_POUT = 1,
+	SC_P1 = 2,
+	SC_P2 = 4,
+	SC_P3 = 8,
+	SC_P4 = 16,
+	SC_VEXT = 32
+  } rSettleChannel;
+
+  typedef struct
+  {
+	rLaserInput eInput;
+	int32_t iAverages;              // readings averaged per point once settled
+	int32_t iWindow;                // consecutive readings of the settle test,
+	                                // spanning about the laser settling time
+	int32_t iMaxReadings;           // per point before measuring unsettled
+	uint32_t uiSettleChannels;      // rSettleChannel mask
+	int32_t iReserved;
+	double dPower;                  // mW
+	double dTolerance;              // drift allowed over the window, dB (V for Vext)
+  } rStepSettings;
+
+//------------------------------ CT400_DefaultStepSettings ---------------------
+// Function CT400_DefaultStepSettings
+//
+//  Purpose: LI_1 at 1 mW, settled when Pout and P1 drift by less than
+//           0.01 dB over 32 readings (within 500), then 4 readings averaged
+//
+//  Parameters: IN/OUT pSettings: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultStepSettings(
+rStepSettings *pSettings);
+
+//------------------------------ CT400_StepScan --------------------------------
+// Function CT400_StepScan
+//
+//  Purpose: Moves the laser to each wavelength in turn and measures every
+//           channel there, without fixed delays: a point is measured as soon
+//           as the readings of the settle channels stop drifting. The laser
+//           must be configured (CT400_SetLaser) and is left on at the last
+//           wavelength.
+//
+//  Parameters: IN uiHandle: from CT400_Init
+//              IN pSettings: step settings, or NULL for the defaults
+//              IN dWavelength: wavelengths to measure, iPoints values
+//              IN iPoints: number of wavelengths
+//              IN/OUT dResult: pointer over an initialized array of
+//                              6 * iPoints values, one row of iPoints per
+//                              channel: Pout, P1, P2, P3, P4 (dBm, averaged
+//                              in mW) and Vext
+//              IN/OUT iReadings: pointer over an initialized array of iPoints
+//                                values (readings taken before each point
+//                                settled, -1 if it did not), or NULL
+//  Returns:  number of points measured (stops at the first failed call),
+//            -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_StepScan(uint64_t uiHandle,
+const rStepSettings *pSettings, const double dWavelength[], int32_t iPoints,
+double dResult[], int32_t iReadings[]);
+
+#ifdef __cplusplus
+}
+
+#include <atomic>
+#include <vector>
+
+namespace ct400
+{
+
+//------------------------------ SettleDetector --------------------------------
+// Class SettleDetector
+//
+//  Purpose: Least-squares line through the last uiWindow readings of one
+//           channel. The channel has settled when the drift of the line over
+//           the window is within dTolerance, or within twice its own
+//           standard error: with noisy readings a smaller drift could not be
+//           told apart from noise, and would vanish in the average anyway.
+//           What remains of an exponential approach is about its slope times
+//           its time constant, so the window should span that time constant:
+//           a shorter one passes while the reading is still moving.
+//------------------------------------------------------------------------------
+class SettleDetector
+{
+public:
+	SettleDetector(size_t uiWindow, double dTolerance);
+
+	void reset() { m_uiCount = 0; }
+	void add(double dValue);
+	bool settled() const;
+
+private:
+	std::vector<double> m_window;   // circular
+	size_t m_uiCount = 0;
+	double m_dTolerance;
+};
+
+//------------------------------ StepScan --------------------------------------
+// Class StepScan
+//
+//  Purpose: Runs step-and-measure sequences on one handle. Each point holds
+//           the Device lock from CT400_CmdLaser to its last reading; other
+//           components (e.g. a PowerMonitor) run between points.
+//------------------------------------------------------------------------------
+class StepScan
+{
+public:
+	StepScan(uint64_t uiHandle, const rStepSettings &settings);
+
+	// pdResult: NB_POWER_CHANNELS rows of uiStride values (uiStride >=
+	// uiPoints); piReadings may be nullptr.
+	// Returns the number of points measured, -1 otherwise
+	int32_t run(const double *pdWavelength, size_t uiPoints, double *pdResult, size_t uiStride,
+		int32_t *piReadings = nullptr);
+
+	// Ends a run() in progress after its current point (from any thread)
+	void cancel() { m_bCancel.store(true); }
+
+private:
+	std::shared_ptr<Device> m_device;
+	rStepSettings m_settings;
+	std::atomic<bool> m_bCancel{ false };
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
@@ -0,0 +1,347 @@
+//------------------------------------------------------------------------------
+// CT400_sweep_file.cpp
+//
+// Binary sweep container replacing the one-text-file-per-array exports of
+// CT400_ScanSave*File. Writing is a few fwrite calls per sweep and reading
+// maps the file, so batch analysis is bound by I/O rather than by parsing.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_sweep_file.h"
+#include "CT400_xor_rle.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+#if defined (_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace ct400
+{
+
+static_assert(sizeof(rSweepFileHeader) == 64, "rSweepFileHeader layout");
+static_assert(sizeof(rSweepRecordHeader) == 160, "rSweepRecordHeader layout");
+static_assert(sizeof(rSweepColumn) == 32, "rSweepColumn layout");
+
+namespace
+{
+
+const uint64_t ALIGN = 64;
+
+uint64_t alignUp(uint64_t uiValue)
+{
+	return (uiValue + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+size_t sampleWidth(uint8_t uiType)
+{
+	return uiType == SAMPLE_F32 ? sizeof(float) : sizeof(double);
+}
+
+int64_t nowMicroseconds()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Cuts the file back to uiSize and moves the write position there.
+// Returns 0 if success, -1 otherwise
+int32_t truncateTo(FILE *pFile, uint64_t uiSize)
+{
+	std::clearerr(pFile);
+	if (std::fflush(pFile) != 0)
+		return -1;
+#if defined (_WIN32)
+	return _chsize_s(_fileno(pFile), (__int64)uiSize) == 0 && _fseeki64(pFile, (__int64)uiSize, SEEK_SET) == 0
+		? 0 : -1;
+#else
+	return ftruncate(fileno(pFile), (off_t)uiSize) == 0 && fseeko(pFile, (off_t)uiSize, SEEK_SET) == 0 ? 0 : -1;
+#endif
+}
+
+} // namespace
+
+
+//------------------------------ SweepFileWriter -------------------------------
+
+int32_t SweepFileWriter::open(const std::string &strPath)
+{
+	close();
+	std::error_code ec;
+	uint64_t uiExisting = std::filesystem::exists(strPath, ec) ? std::filesystem::file_size(strPath, ec) : 0;
+	if (ec)
+		return -1;
+
+	if (uiExisting == 0) {
+		m_pFile = std::fopen(strPath.c_str(), "wb");
+		if (m_pFile == nullptr)
+			return -1;
+		rSweepFileHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.acMagic, SWEEP_FILE_MAGIC, sizeof(header.acMagic));
+		header.uiVersion = SWEEP_FILE_VERSION;
+		header.uiHeaderSize = sizeof(header);
+		if (std::fwrite(&header, sizeof(header), 1, m_pFile) != 1) {
+			close();
+			return -1;
+		}
+		m_uiSize = sizeof(header);
+		m_uiRecords = 0;
+		return 0;
+	}
+
+	uint64_t uiValid;
+	{
+		SweepFileReader reader;
+		if (reader.open(strPath) != 0)
+			return -1;
+		uiValid = reader.validSize();
+		m_uiRecords = reader.size();
+	}
+	// drop a partial record left by an interrupted append
+	if (uiValid < uiExisting) {
+		std::filesystem::resize_file(strPath, uiValid, ec);
+		if (ec)
+			return -1;
+	}
+	m_pFile = std::fopen(strPath.c_str(), "r+b");
+	if (m_pFile == nullptr || std::fseek(m_pFile, 0, SEEK_END) != 0) {
+		close();
+		return -1;
+	}
+	m_uiSize = uiValid;
+	return 0;
+}
+
+void SweepFileWriter::close()
+{
+	if (m_pFile)
+		std::fclose(m_pFile);
+	m_pFile = nullptr;
+	m_bFailed = false;
+}
+
+int64_t SweepFileWriter::append(const SweepInfo &info, const std::vector<SweepColumnData> &columns,
+	size_t uiPoints, rSampleType eType, rEncoding eEncoding)
+{
+	if (m_pFile == nullptr || m_bFailed || uiPoints > UINT32_MAX)
+		return -1;
+	const size_t uiWidth = sampleWidth(eType);
+	const size_t uiColumns = columns.size();
+
+	// encode every column into the scratch buffer, recording their extents
+	std::vector<rSweepColumn> table(uiColumns);
+	std::vector<size_t> start(uiColumns);
+	std::vector<uint8_t> encoded, converted;
+	m_scratch.clear();
+	uint64_t uiHeaderSize = sizeof(rSweepRecordHeader) + uiColumns * sizeof(rSweepColumn);
+	uint64_t uiOffset = alignUp(uiHeaderSize);
+	for (size_t c = 0; c < uiColumns; c++) {
+		const uint8_t *pData = reinterpret_cast<const uint8_t *>(columns[c].pdData);
+		if (eType == SAMPLE_F32) {
+			converted.resize(uiPoints * sizeof(float));
+			for (size_t i = 0; i < uiPoints; i++) {
+				float f = (float)columns[c].pdData[i];
+				std::memcpy(converted.data() + i * sizeof(float), &f, sizeof(f));
+			}
+			pData = converted.data();
+		}
+		size_t uiStored = uiPoints * uiWidth;
+		if (eEncoding == ENCODING_XOR_RLE) {
+			encodeXorRle(pData, uiPoints, uiWidth, encoded);
+			pData = encoded.data();
+			uiStored = encoded.size();
+		}
+		start[c] = m_scratch.size();
+		m_scratch.insert(m_scratch.end(), pData, pData + uiStored);
+
+		rSweepColumn &column = table[c];
+		std::memset(&column, 0, sizeof(column));
+		column.iColumn = columns[c].iColumn;
+		column.uiType = (uint8_t)eType;
+		column.uiEncoding = (uint8_t)eEncoding;
+		column.uiOffset = uiOffset;
+		column.uiStoredSize = uiStored;
+		uiOffset = alignUp(uiOffset + uiStored);
+	}
+
+	rSweepRecordHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.acMagic, SWEEP_RECORD_MAGIC, sizeof(header.acMagic));
+	header.uiHeaderSize = (uint32_t)uiHeaderSize;
+	header.uiRecordSize = uiOffset;
+	header.uiSequence = m_uiRecords;
+	header.iTimestamp = info.iTimestamp != 0 ? info.iTimestamp : nowMicroseconds();
+	header.config = info.config;
+	header.iDataPoints = info.iDataPoints;
+	header.iDiscardPoints = info.iDiscardPoints;
+	header.uiPoints = (uint32_t)uiPoints;
+	header.uiColumns = (uint32_t)uiColumns;
+
+	static const uint8_t zeros[ALIGN] = { 0 };
+	bool bOk = std::fwrite(&header, sizeof(header), 1, m_pFile) == 1
+		&& (uiColumns == 0 || std::fwrite(table.data(), sizeof(rSweepColumn), uiColumns, m_pFile) == uiColumns);
+	uint64_t uiPosition = uiHeaderSize;
+	for (size_t c = 0; bOk && c < uiColumns; c++) {
+		bOk = std::fwrite(zeros, 1, table[c].uiOffset - uiPosition, m_pFile) == table[c].uiOffset - uiPosition
+			&& std::fwrite(m_scratch.data() + start[c], 1, table[c].uiStoredSize, m_pFile) == table[c].uiStoredSize;
+		uiPosition = table[c].uiOffset + table[c].uiStoredSize;
+	}
+	bOk = bOk && std::fwrite(zeros, 1, uiOffset - uiPosition, m_pFile) == uiOffset - uiPosition;
+	if (!bOk) {
+		// whatever part of the record reached the file would hide every
+		// later record from readers; if it cannot be cut off, stop appending
+		if (truncateTo(m_pFile, m_uiSize) != 0)
+			m_bFailed = true;
+		return -1;
+	}
+	m_uiSize += uiOffset;
+	return (int64_t)m_uiRecords++;
+}
+
+int64_t SweepFileWriter::append(const SweepInfo &info, const ScanBuffer &buffer, const double *pdPower,
+	rSampleType eType, rEncoding eEncoding)
+{
+	std::vector<SweepColumnData> columns;
+	columns.push_back(SweepColumnData{ COL_WAVELENGTH, buffer.wavelength() });
+	if (pdPower == nullptr)
+		pdPower = buffer.power();
+	if (pdPower)
+		columns.push_back(SweepColumnData{ COL_POWER, pdPower });
+	for (size_t d = 0; d < buffer.detectors().size(); d++)
+		columns.push_back(SweepColumnData{ (int32_t)buffer.detectors()[d], buffer.row(d) });
+	return append(info, columns, buffer.points(), eType, eEncoding);
+}
+
+int32_t SweepFileWriter::flush(bool bSync)
+{
+	if (m_pFile == nullptr || std::fflush(m_pFile) != 0)
+		return -1;
+	(void)bSync;
+#if !defined (_WIN32)
+	if (bSync && fsync(fileno(m_pFile)) != 0)
+		return -1;
+#endif
+	return 0;
+}
+
+
+//------------------------------ SweepFileReader -------------------------------
+
+int32_t SweepFileReader::open(const std::string &strPath)
+{
+	close();
+	if (m_file.open(strPath) != 0)
+		return -1;
+	const uint8_t *pBase = m_file.data();
+	const uint64_t uiSize = m_file.size();
+	if (uiSize < sizeof(rSweepFileHeader))
+		return -1;
+	const rSweepFileHeader *pFileHeader = reinterpret_cast<const rSweepFileHeader *>(pBase);
+	if (std::memcmp(pFileHeader->acMagic, SWEEP_FILE_MAGIC, sizeof(SWEEP_FILE_MAGIC)) != 0
+		|| pFileHeader->uiVersion != SWEEP_FILE_VERSION)
+		return -1;
+
+	uint64_t uiOffset = alignUp(pFileHeader->uiHeaderSize);
+	while (uiOffset + sizeof(rSweepRecordHeader) <= uiSize) {
+		const rSweepRecordHeader *pHeader = reinterpret_cast<const rSweepRecordHeader *>(pBase + uiOffset);
+		if (std::memcmp(pHeader->acMagic, SWEEP_RECORD_MAGIC, sizeof(SWEEP_RECORD_MAGIC)) != 0
+			|| pHeader->uiHeaderSize < sizeof(rSweepRecordHeader) + (uint64_t)pHeader->uiColumns * sizeof(rSweepColumn)
+			|| pHeader->uiRecordSize < pHeader->uiHeaderSize || pHeader->uiRecordSize > uiSize - uiOffset)
+			break;
+		const rSweepColumn *pColumns = reinterpret_cast<const rSweepColumn *>(pHeader + 1);
+		bool bValid = true;
+		for (uint32_t c = 0; c < pHeader->uiColumns && bValid; c++)
+			bValid = pColumns[c].uiOffset >= pHeader->uiHeaderSize
+				&& pColumns[c].uiStoredSize <= pHeader->uiRecordSize - pColumns[c].uiOffset
+				&& pColumns[c].uiOffset <= pHeader->uiRecordSize;
+		if (!bValid)
+			break;
+		m_records.push_back(Record{ pHeader, pColumns });
+		uiOffset += pHeader->uiRecordSize;
+	}
+	m_uiValidSize = std::min(uiOffset, uiSize);
+	return 0;
+}
+
+void SweepFileReader::close()
+{
+	m_records.clear();
+	m_file.close();
+	m_uiValidSize = 0;
+}
+
+const rSweepColumn *SweepFileReader::column(size_t uiRecord, int32_t iColumn) const
+{
+	if (uiRecord >= m_records.size())
+		return nullptr;
+	const Record &record = m_records[uiRecord];
+	for (uint32_t c = 0; c < record.pHeader->uiColumns; c++)
+		if (record.pColumns[c].iColumn == iColumn)
+			return &record.pColumns[c];
+	return nullptr;
+}
+
+const void *SweepFileReader::block(size_t uiRecord, int32_t iColumn, rSampleType eType) const
+{
+	const rSweepColumn *pColumn = column(uiRecord, iColumn);
+	// open() checked that the column lies within its record; it must also
+	// hold every point of the record
+	if (pColumn == nullptr || pColumn->uiType != eType || pColumn->uiEncoding != ENCODING_RAW
+		|| pColumn->uiStoredSize < (uint64_t)header(uiRecord).uiPoints * sampleWidth(eType))
+		return nullptr;
+	return reinterpret_cast<const uint8_t *>(m_records[uiRecord].pHeader) + pColumn->uiOffset;
+}
+
+Span<const double> SweepFileReader::spanF64(size_t uiRecord, int32_t iColumn) const
+{
+	const void *p = block(uiRecord, iColumn, SAMPLE_F64);
+	return p ? Span<const double>(static_cast<const double *>(p), header(uiRecord).uiPoints) : Span<const double>();
+}
+
+Span<const float> SweepFileReader::spanF32(size_t uiRecord, int32_t iColumn) const
+{
+	const void *p = block(uiRecord, iColumn, SAMPLE_F32);
+	return p ? Span<const float>(static_cast<const float *>(p), header(uiRecord).uiPoints) : Span<const float>();
+}
+
+int64_t SweepFileReader::read(size_t uiRecord, int32_t iColumn, std::vector<double> &out) const
+{
+	const rSweepColumn *pColumn = column(uiRecord, iColumn);
+	if (pColumn == nullptr)
+		return -1;
+	const size_t uiPoints = header(uiRecord).uiPoints;
+	const size_t uiWidth = sampleWidth(pColumn->uiType);
+	const uint8_t *pData = reinterpret_cast<const uint8_t *>(m_records[uiRecord].pHeader) + pColumn->uiOffset;
+
+	std::vector<uint8_t> decoded;
+	if (pColumn->uiEncoding == ENCODING_XOR_RLE) {
+		decoded.resize(uiPoints * uiWidth);
+		if (!decodeXorRle(pData, pColumn->uiStoredSize, uiPoints, uiWidth, decoded.data()))
+			return -1;
+		pData = decoded.data();
+	}
+	else if (pColumn->uiEncoding != ENCODING_RAW || pColumn->uiStoredSize < uiPoints * uiWidth) {
+		return -1;
+	}
+
+	out.resize(uiPoints);
+	if (pColumn->uiType == SAMPLE_F32) {
+		for (size_t i = 0; i < uiPoints; i++) {
+			float f;
+			std::memcpy(&f, pData + i * sizeof(float), sizeof(f));
+			out[i] = f;
+		}
+	}
+	else {
+		std::memcpy(out.data(), pData, uiPoints * sizeof(double));
+	}
+	return (int64_t)uiPoints;
+}
+
+} // namespace ct400
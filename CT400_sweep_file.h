@@ -0,0 +1,187 @@
+/******************************************************************************/
+/* Header file for CT400_sweep_file.cpp                                       */
+/*                                                                            */
+/* Binary sweep container: any number of sweeps appended to one file, each    */
+/* with its scan configuration and one aligned block per column (wavelength,  */
+/* Pout, detectors), stored as float64 or float32, optionally compressed.     */
+/******************************************************************************/
+
+#ifndef CT400_SWEEP_FILE_H
+#define CT400_SWEEP_FILE_H
+
+#include "CT400_config.h"
+#include "CT400_mmap.h"
+#include "CT400_retrieve.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace ct400
+{
+
+// File layout (little endian):
+//   rSweepFileHeader
+//   record 0: rSweepRecordHeader, rSweepColumn[uiColumns], padding, blocks
+//   record 1: ...
+// Records and blocks start on 64 byte boundaries, so a mapped float64 or
+// float32 block can be used in place.
+
+const char SWEEP_FILE_MAGIC[8] = { 'C', 'T', '4', '0', '0', 'S', 'W', 'P' };
+const char SWEEP_RECORD_MAGIC[4] = { 'S', 'W', 'P', '1' };
+const uint32_t SWEEP_FILE_VERSION = 1;
+
+// Column identifiers: DE_1 to DE_5 use their rDetector value
+const int32_t COL_WAVELENGTH = 0;
+const int32_t COL_POWER = 6;
+
+enum rSampleType
+{
+	SAMPLE_F64 = 0,
+	SAMPLE_F32
+};
+
+enum rEncoding
+{
+	ENCODING_RAW = 0,
+	ENCODING_XOR_RLE        // XOR with previous sample, byte planes, zero-run RLE
+};
+
+struct rSweepFileHeader
+{
+	char acMagic[8];
+	uint32_t uiVersion;
+	uint32_t uiHeaderSize;
+	uint8_t aReserved[48];
+};
+
+struct rSweepRecordHeader
+{
+	char acMagic[4];
+	uint32_t uiHeaderSize;          // record header + column table
+	uint64_t uiRecordSize;          // whole record including blocks and padding
+	uint64_t uiSequence;            // index of the record in the file
+	int64_t iTimestamp;             // microseconds since 1970-01-01 UTC
+	rScanConfig config;
+	int32_t iDataPoints;            // from CT400_GetNbDataPoints
+	int32_t iDiscardPoints;
+	uint32_t uiPoints;              // values per column
+	uint32_t uiColumns;
+};
+
+struct rSweepColumn
+{
+	int32_t iColumn;                // COL_WAVELENGTH, DE_1..DE_5, COL_POWER
+	uint8_t uiType;                 // rSampleType
+	uint8_t uiEncoding;             // rEncoding
+	uint16_t uiReserved;
+	uint64_t uiOffset;              // from the start of the record
+	uint64_t uiStoredSize;          // bytes in the file
+	uint64_t uiReserved2;
+};
+
+// Metadata of a sweep to append
+struct SweepInfo
+{
+	rScanConfig config;
+	int32_t iDataPoints = 0;
+	int32_t iDiscardPoints = 0;
+	int64_t iTimestamp = 0;         // 0 = now
+};
+
+// Column to append, as uiPoints doubles
+struct SweepColumnData
+{
+	int32_t iColumn;
+	const double *pdData;
+};
+
+//------------------------------ SweepFileWriter -------------------------------
+// Class SweepFileWriter
+//
+//  Purpose: Appends sweeps to a sweep file. Opening an existing file drops
+//           a record left incomplete by a crash; a failed append is cut off
+//           the same way, or if that fails too, no more appends are taken.
+//------------------------------------------------------------------------------
+class SweepFileWriter
+{
+public:
+	SweepFileWriter() {}
+	~SweepFileWriter() { close(); }
+
+	SweepFileWriter(const SweepFileWriter &) = delete;
+	SweepFileWriter &operator=(const SweepFileWriter &) = delete;
+
+	// Returns 0 if success, -1 otherwise
+	int32_t open(const std::string &strPath);
+	void close();
+	// Flushes written records to the operating system (and to disk if bSync)
+	int32_t flush(bool bSync = false);
+
+	// Returns the sequence number of the record, -1 otherwise
+	int64_t append(const SweepInfo &info, const std::vector<SweepColumnData> &columns, size_t uiPoints,
+		rSampleType eType = SAMPLE_F64, rEncoding eEncoding = ENCODING_RAW);
+	// Wavelength plus every detector row of a ScanBuffer, and Pout (pdPower,
+	// or else the Pout row of the buffer if it has one)
+	int64_t append(const SweepInfo &info, const ScanBuffer &buffer, const double *pdPower = nullptr,
+		rSampleType eType = SAMPLE_F64, rEncoding eEncoding = ENCODING_RAW);
+
+	uint64_t records() const { return m_uiRecords; }
+	// File size after the last complete record
+	uint64_t size() const { return m_uiSize; }
+
+private:
+	FILE *m_pFile = nullptr;
+	bool m_bFailed = false;         // a failed append could not be undone
+	uint64_t m_uiRecords = 0;
+	uint64_t m_uiSize = 0;
+	std::vector<uint8_t> m_scratch;
+};
+
+//------------------------------ SweepFileReader -------------------------------
+// Class SweepFileReader
+//
+//  Purpose: Maps a sweep file and indexes its records. Raw blocks are
+//           returned as spans into the mapping (no copy); encoded blocks are
+//           decoded by read().
+//------------------------------------------------------------------------------
+class SweepFileReader
+{
+public:
+	// Returns 0 if success, -1 otherwise
+	int32_t open(const std::string &strPath);
+	void close();
+
+	size_t size() const { return m_records.size(); }
+	const rSweepRecordHeader &header(size_t uiRecord) const { return *m_records[uiRecord].pHeader; }
+	const rSweepColumn *column(size_t uiRecord, int32_t iColumn) const;
+	// End of the last complete record
+	uint64_t validSize() const { return m_uiValidSize; }
+
+	// Zero-copy views of raw blocks; empty if the column is missing, encoded
+	// or of the other sample type
+	Span<const double> spanF64(size_t uiRecord, int32_t iColumn) const;
+	Span<const float> spanF32(size_t uiRecord, int32_t iColumn) const;
+
+	// Copies a column as doubles whatever its storage.
+	// Returns the number of values, -1 otherwise
+	int64_t read(size_t uiRecord, int32_t iColumn, std::vector<double> &out) const;
+
+private:
+	struct Record
+	{
+		const rSweepRecordHeader *pHeader;
+		const rSweepColumn *pColumns;
+	};
+
+	const void *block(size_t uiRecord, int32_t iColumn, rSampleType eType) const;
+
+	MappedFile m_file;
+	std::vector<Record> m_records;
+	uint64_t m_uiValidSize = 0;
+};
+
+} // namespace ct400
+
+
+#endif
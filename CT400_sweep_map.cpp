@@ -0,0 +1,618 @@
+//------------------------------------------------------------------------------
+// CT400_sweep_map.cpp
+//
+// File layout: a header page, the wavelength axis (page aligned), then bands
+// in the order the rows reached them. A band is a page holding its level,
+// its index and, at level 0, the parameters of its rows, followed by its
+// tiles: one plane at level 0, the min plane then the max plane above.
+// Readers rebuild the band index by walking the band pages, which are few
+// (one per TILE_ROWS rows at level 0, as many or fewer at the other levels).
+// Pyramid cells are set from the first row reaching them and widened by
+// the next ones, so a band never needs to be initialised.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_sweep_map.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+
+namespace ct400
+{
+
+namespace
+{
+
+const char MAP_MAGIC[8] = { 'C', 'T', '4', 'M', 'A', 'P', '\0', '\0' };
+const char BAND_MAGIC[4] = { 'B', 'A', 'N', 'D' };
+const uint32_t MAP_VERSION = 1;
+const size_t PAGE = 4096;
+const size_t TILE_BYTES = SweepMap::TILE_ROWS * SweepMap::TILE_COLUMNS * sizeof(float);
+
+size_t alignTo(size_t uiValue, size_t uiAlign)
+{
+	return (uiValue + uiAlign - 1) / uiAlign * uiAlign;
+}
+
+// min and max leaving NaN out (NaN only if both are)
+inline float minOf(float a, float b)
+{
+	return b < a || a != a ? b : a;
+}
+
+inline float maxOf(float a, float b)
+{
+	return b > a || a != a ? b : a;
+}
+
+} // namespace
+
+struct SweepMap::Header
+{
+	char tcMagic[8];
+	uint32_t uiVersion;
+	uint32_t uiLevels;
+	uint64_t uiColumns;
+	uint32_t uiTileRows;
+	uint32_t uiTileColumns;
+	uint8_t ucRowShift[MAX_LEVELS];
+	uint8_t ucColumnShift[MAX_LEVELS];
+	uint64_t uiAxisOffset;
+	uint64_t uiDataOffset;
+	double dMinValue;
+	double dMaxValue;
+	double dMinParameter;
+	double dMaxParameter;
+	alignas(64) std::atomic<uint64_t> uiRows;
+	std::atomic<uint64_t> uiEnd;            // end of the last band
+};
+
+struct SweepMap::BandHeader
+{
+	char tcMagic[4];
+	uint32_t uiLevel;
+	uint64_t uiIndex;
+	uint8_t reserved[48];
+	double dParameter[TILE_ROWS];           // level 0
+};
+
+size_t SweepMap::columns() const
+{
+	return isOpen() ? (size_t)header()->uiColumns : 0;
+}
+
+size_t SweepMap::levels() const
+{
+	return isOpen() ? header()->uiLevels : 0;
+}
+
+const double *SweepMap::wavelength() const
+{
+	return isOpen() ? reinterpret_cast<const double *>(base() + header()->uiAxisOffset) : nullptr;
+}
+
+double SweepMap::parameter(size_t uiRow) const
+{
+	const BandHeader *pBand = reinterpret_cast<const BandHeader *>(base() + m_bands[0][uiRow / TILE_ROWS]);
+	return pBand->dParameter[uiRow % TILE_ROWS];
+}
+
+size_t SweepMap::rowShift(size_t uiLevel) const
+{
+	return header()->ucRowShift[uiLevel];
+}
+
+size_t SweepMap::columnShift(size_t uiLevel) const
+{
+	return header()->ucColumnShift[uiLevel];
+}
+
+size_t SweepMap::width(size_t uiLevel) const
+{
+	const size_t uiShift = columnShift(uiLevel);
+	return (columns() + ((size_t)1 << uiShift) - 1) >> uiShift;
+}
+
+size_t SweepMap::tilesAcross(size_t uiLevel) const
+{
+	return (width(uiLevel) + TILE_COLUMNS - 1) / TILE_COLUMNS;
+}
+
+size_t SweepMap::bandBytes(size_t uiLevel) const
+{
+	return PAGE + (uiLevel == 0 ? 1 : 2) * tilesAcross(uiLevel) * TILE_BYTES;
+}
+
+const float *SweepMap::cells(size_t uiLevel, size_t uiPlane, size_t uiRow, size_t uiTile) const
+{
+	const size_t uiPlaneIndex = uiLevel == 0 ? 0 : uiPlane;
+	return reinterpret_cast<const float *>(base() + m_bands[uiLevel][uiRow / TILE_ROWS] + PAGE
+		+ (uiPlaneIndex * tilesAcross(uiLevel) + uiTile) * TILE_BYTES) + uiRow % TILE_ROWS * TILE_COLUMNS;
+}
+
+float *SweepMap::cells(size_t uiLevel, size_t uiPlane, size_t uiRow, size_t uiTile)
+{
+	return const_cast<float *>(static_cast<const SweepMap *>(this)->cells(uiLevel, uiPlane, uiRow, uiTile));
+}
+
+int32_t SweepMap::create(const std::string &strPath, const double *pdWavelength, size_t uiColumns)
+{
+	static_assert(sizeof(BandHeader) <= PAGE, "band header fits its page");
+	close();
+	if (pdWavelength == nullptr || uiColumns == 0 || uiColumns > (1u << 26))
+		return -1;
+	// level 0, the column levels (by 4) down to 64 columns, then the square
+	// levels down to one column
+	std::vector<std::pair<uint8_t, uint8_t> > shifts(1, std::make_pair(0, 0));
+	for (uint8_t cs = 2; (uiColumns >> cs) >= 64; cs += 2)
+		shifts.push_back(std::make_pair(0, cs));
+	for (uint8_t k = 1; shifts.size() < MAX_LEVELS && ((uiColumns - 1) >> (k - 1)) > 0; k++)
+		shifts.push_back(std::make_pair(k, k));
+	const size_t uiLevels = shifts.size();
+	const size_t uiAxisOffset = PAGE;
+	const size_t uiDataOffset = alignTo(uiAxisOffset + uiColumns * sizeof(double), PAGE);
+	if (m_writer.create(strPath, uiDataOffset) != 0)
+		return -1;
+	m_bWriter = true;
+	m_strPath = strPath;
+
+	Header *pHeader = new (m_writer.data()) Header();
+	pHeader->uiVersion = MAP_VERSION;
+	pHeader->uiLevels = (uint32_t)uiLevels;
+	pHeader->uiColumns = uiColumns;
+	pHeader->uiTileRows = TILE_ROWS;
+	pHeader->uiTileColumns = TILE_COLUMNS;
+	for (size_t k = 0; k < uiLevels; k++) {
+		pHeader->ucRowShift[k] = shifts[k].first;
+		pHeader->ucColumnShift[k] = shifts[k].second;
+	}
+	pHeader->uiAxisOffset = uiAxisOffset;
+	pHeader->uiDataOffset = uiDataOffset;
+	pHeader->dMinValue = std::numeric_limits<double>::quiet_NaN();
+	pHeader->dMaxValue = pHeader->dMinValue;
+	pHeader->dMinParameter = pHeader->dMinValue;
+	pHeader->dMaxParameter = pHeader->dMinValue;
+	pHeader->uiRows.store(0, std::memory_order_relaxed);
+	pHeader->uiEnd.store(uiDataOffset, std::memory_order_relaxed);
+	std::memcpy(m_writer.data() + uiAxisOffset, pdWavelength, uiColumns * sizeof(double));
+	std::memcpy(pHeader->tcMagic, MAP_MAGIC, sizeof(MAP_MAGIC));
+
+	m_bands.assign(uiLevels, std::vector<uint64_t>());
+	m_uiIndexed = uiDataOffset;
+	size_t uiMaxShift = 0;
+	for (size_t k = 0; k < uiLevels; k++)
+		uiMaxShift = std::max<size_t>(uiMaxShift, shifts[k].second);
+	m_min.resize(uiMaxShift + 1);
+	m_max.resize(uiMaxShift + 1);
+	for (size_t cs = 0; cs <= uiMaxShift; cs++) {
+		m_min[cs].resize((uiColumns + ((size_t)1 << cs) - 1) >> cs);
+		m_max[cs].resize(m_min[cs].size());
+	}
+	return 0;
+}
+
+int32_t SweepMap::open(const std::string &strPath)
+{
+	close();
+	if (m_reader.open(strPath) != 0)
+		return -1;
+	m_strPath = strPath;
+	const Header *pHeader = header();
+	if (m_reader.size() < PAGE || std::memcmp(pHeader->tcMagic, MAP_MAGIC, sizeof(MAP_MAGIC)) != 0
+		|| pHeader->uiVersion != MAP_VERSION || pHeader->uiLevels == 0 || pHeader->uiLevels > MAX_LEVELS
+		|| pHeader->uiTileRows != TILE_ROWS || pHeader->uiTileColumns != TILE_COLUMNS
+		|| pHeader->uiAxisOffset + pHeader->uiColumns * sizeof(double) > pHeader->uiDataOffset
+		|| pHeader->uiDataOffset > m_reader.size()) {
+		close();
+		return -1;
+	}
+	m_bands.assign(pHeader->uiLevels, std::vector<uint64_t>());
+	m_uiIndexed = pHeader->uiDataOffset;
+	if (refresh() < 0) {
+		close();
+		return -1;
+	}
+	return 0;
+}
+
+void SweepMap::close()
+{
+	if (m_bWriter && m_writer.data()) {
+		// drop the room left for growth
+		m_writer.resize((size_t)writerHeader()->uiEnd.load(std::memory_order_relaxed));
+	}
+	m_writer.close();
+	m_reader.close();
+	m_strPath.clear();
+	m_bWriter = false;
+	m_uiRows = 0;
+	m_uiIndexed = 0;
+	m_bands.clear();
+}
+
+int32_t SweepMap::flush(bool bSync)
+{
+	return m_bWriter ? m_writer.flush(bSync) : -1;
+}
+
+int32_t SweepMap::index()
+{
+	const uint64_t uiEnd = header()->uiEnd.load(std::memory_order_acquire);
+	if (uiEnd > mappedSize())
+		return -1;
+	while (m_uiIndexed < uiEnd) {
+		const BandHeader *pBand = reinterpret_cast<const BandHeader *>(base() + m_uiIndexed);
+		if (m_uiIndexed + PAGE > uiEnd || std::memcmp(pBand->tcMagic, BAND_MAGIC, sizeof(BAND_MAGIC)) != 0
+			|| pBand->uiLevel >= m_bands.size() || pBand->uiIndex != m_bands[pBand->uiLevel].size()
+			|| m_uiIndexed + bandBytes(pBand->uiLevel) > uiEnd)
+			return -1;
+		m_bands[pBand->uiLevel].push_back(m_uiIndexed);
+		m_uiIndexed += bandBytes(pBand->uiLevel);
+	}
+	return 0;
+}
+
+int64_t SweepMap::refresh()
+{
+	if (!isOpen())
+		return -1;
+	if (m_bWriter)
+		return (int64_t)m_uiRows;
+	// rows first: the bands they need were written before them
+	const uint64_t uiRows = header()->uiRows.load(std::memory_order_acquire);
+	if (header()->uiEnd.load(std::memory_order_acquire) > m_reader.size()) {
+		// the writer has grown the file since it was mapped
+		const std::string strPath = m_strPath;
+		const uint64_t uiIndexed = m_uiIndexed;
+		std::vector<std::vector<uint64_t> > bands;
+		bands.swap(m_bands);
+		if (m_reader.open(strPath) != 0)
+			return -1;
+		m_bands.swap(bands);
+		m_uiIndexed = uiIndexed;
+	}
+	if (index() != 0)
+		return -1;
+	// every level needs its band for the last row
+	size_t uiVisible = (size_t)uiRows;
+	for (size_t k = 0; k < m_bands.size(); k++)
+		if (uiVisible > 0 && ((uiVisible - 1) >> rowShift(k)) / TILE_ROWS >= m_bands[k].size())
+			return -1;
+	m_uiRows = uiVisible;
+	return (int64_t)m_uiRows;
+}
+
+int32_t SweepMap::reserve(size_t uiLevel, size_t uiRow)
+{
+	const size_t uiBand = uiRow / TILE_ROWS;
+	if (uiBand < m_bands[uiLevel].size())
+		return 0;
+	const uint64_t uiOffset = writerHeader()->uiEnd.load(std::memory_order_relaxed);
+	const uint64_t uiEnd = uiOffset + bandBytes(uiLevel);
+	if (uiEnd > m_writer.size() && m_writer.resize(std::max<size_t>((size_t)uiEnd, 2 * m_writer.size())) != 0)
+		return -1;
+	BandHeader *pBand = reinterpret_cast<BandHeader *>(m_writer.data() + uiOffset);
+	std::memcpy(pBand->tcMagic, BAND_MAGIC, sizeof(BAND_MAGIC));
+	pBand->uiLevel = (uint32_t)uiLevel;
+	pBand->uiIndex = uiBand;
+	m_bands[uiLevel].push_back(uiOffset);
+	m_uiIndexed = uiEnd;
+	writerHeader()->uiEnd.store(uiEnd, std::memory_order_release);
+	return 0;
+}
+
+int64_t SweepMap::append(double dParameter, const double *pdRow, size_t uiCount)
+{
+	if (!m_bWriter || !isOpen() || (pdRow == nullptr && uiCount > 0))
+		return -1;
+	const size_t r = m_uiRows;
+	const size_t uiColumns = columns();
+	const size_t uiLevels = levels();
+	for (size_t k = 0; k < uiLevels; k++)
+		if (reserve(k, r >> rowShift(k)) != 0)
+			return -1;
+
+	// the row as float32, min and max of the row on the way, then halved
+	// once per column shift
+	const float fNaN = std::numeric_limits<float>::quiet_NaN();
+	float fMin = fNaN, fMax = fNaN;
+	for (size_t c = 0; c < uiColumns; c++) {
+		const float f = c < uiCount ? (float)pdRow[c] : fNaN;
+		m_min[0][c] = f;
+		fMin = minOf(fMin, f);
+		fMax = maxOf(fMax, f);
+	}
+	m_max[0] = m_min[0];
+	for (size_t cs = 1; cs < m_min.size(); cs++) {
+		const std::vector<float> &previousMin = m_min[cs - 1], &previousMax = m_max[cs - 1];
+		for (size_t c = 0; c < m_min[cs].size(); c++) {
+			const size_t c1 = std::min(2 * c + 1, previousMin.size() - 1);
+			m_min[cs][c] = minOf(previousMin[2 * c], previousMin[c1]);
+			m_max[cs][c] = maxOf(previousMax[2 * c], previousMax[c1]);
+		}
+	}
+
+	// each level sets (first row of the cell row) or widens its cells
+	for (size_t k = 0; k < uiLevels; k++) {
+		const std::vector<float> &rowMin = m_min[columnShift(k)], &rowMax = m_max[columnShift(k)];
+		const size_t uiWidth = rowMin.size();
+		const size_t uiRow = r >> rowShift(k);
+		const bool bFirst = (r & (((size_t)1 << rowShift(k)) - 1)) == 0;
+		for (size_t t = 0; t < tilesAcross(k); t++) {
+			const size_t c0 = t * TILE_COLUMNS;
+			const size_t n = std::min(uiWidth, c0 + TILE_COLUMNS) - c0;
+			float *pfMin = cells(k, 0, uiRow, t);
+			float *pfMax = cells(k, 1, uiRow, t);
+			if (k == 0 || bFirst) {
+				std::memcpy(pfMin, rowMin.data() + c0, n * sizeof(float));
+				if (k > 0)
+					std::memcpy(pfMax, rowMax.data() + c0, n * sizeof(float));
+				continue;
+			}
+			for (size_t i = 0; i < n; i++) {
+				pfMin[i] = minOf(pfMin[i], rowMin[c0 + i]);
+				pfMax[i] = maxOf(pfMax[i], rowMax[c0 + i]);
+			}
+		}
+	}
+
+	Header *pHeader = writerHeader();
+	BandHeader *pBand = reinterpret_cast<BandHeader *>(m_writer.data() + m_bands[0][r / TILE_ROWS]);
+	pBand->dParameter[r % TILE_ROWS] = dParameter;
+	pHeader->dMinValue = minOf((float)pHeader->dMinValue, fMin);
+	pHeader->dMaxValue = maxOf((float)pHeader->dMaxValue, fMax);
+	if (r == 0 || dParameter < pHeader->dMinParameter)
+		pHeader->dMinParameter = dParameter;
+	if (r == 0 || dParameter > pHeader->dMaxParameter)
+		pHeader->dMaxParameter = dParameter;
+	m_uiRows = r + 1;
+	pHeader->uiRows.store(m_uiRows, std::memory_order_release);
+	return (int64_t)m_uiRows;
+}
+
+rMapInfo SweepMap::info() const
+{
+	rMapInfo info;
+	std::memset(&info, 0, sizeof(info));
+	if (!isOpen())
+		return info;
+	const Header *pHeader = header();
+	info.iRows = (int32_t)m_uiRows;
+	info.iColumns = (int32_t)pHeader->uiColumns;
+	info.iLevels = (int32_t)pHeader->uiLevels;
+	info.iTileRows = (int32_t)TILE_ROWS;
+	info.iTileColumns = (int32_t)TILE_COLUMNS;
+	info.dMinParameter = pHeader->dMinParameter;
+	info.dMaxParameter = pHeader->dMaxParameter;
+	info.dMinWavelength = wavelength()[0];
+	info.dMaxWavelength = wavelength()[pHeader->uiColumns - 1];
+	info.dMinValue = pHeader->dMinValue;
+	info.dMaxValue = pHeader->dMaxValue;
+	return info;
+}
+
+int32_t SweepMap::readRow(size_t uiRow, double *pdRow) const
+{
+	if (!isOpen() || uiRow >= m_uiRows || pdRow == nullptr)
+		return -1;
+	const size_t uiColumns = columns();
+	for (size_t t = 0; t < tilesAcross(0); t++) {
+		const float *pf = cells(0, 0, uiRow, t);
+		const size_t c0 = t * TILE_COLUMNS;
+		const size_t n = std::min(uiColumns, c0 + TILE_COLUMNS) - c0;
+		for (size_t i = 0; i < n; i++)
+			pdRow[c0 + i] = pf[i];
+	}
+	return 0;
+}
+
+int32_t SweepMap::view(size_t uiFirstRow, size_t uiRows, size_t uiFirstColumn, size_t uiColumns, size_t uiHeight,
+	size_t uiWidth, double *pdMin, double *pdMax) const
+{
+	if (!isOpen() || uiHeight == 0 || uiWidth == 0 || pdMin == nullptr)
+		return -1;
+	const double dNaN = std::numeric_limits<double>::quiet_NaN();
+	std::fill(pdMin, pdMin + uiHeight * uiWidth, dNaN);
+	if (pdMax)
+		std::fill(pdMax, pdMax + uiHeight * uiWidth, dNaN);
+	uiFirstRow = std::min(uiFirstRow, m_uiRows);
+	uiRows = std::min(uiRows, m_uiRows - uiFirstRow);
+	uiFirstColumn = std::min(uiFirstColumn, columns());
+	uiColumns = std::min(uiColumns, columns() - uiFirstColumn);
+	if (uiRows == 0 || uiColumns == 0)
+		return 0;
+
+	// of the levels with at least one cell per view cell both ways, the one
+	// with the fewest cells under the region
+	size_t k = 0, uiCells = SIZE_MAX;
+	for (size_t l = 0; l < levels(); l++) {
+		const size_t rs = rowShift(l), cs = columnShift(l);
+		if (((size_t)1 << rs) > std::max<size_t>(1, uiRows / uiHeight)
+			|| ((size_t)1 << cs) > std::max<size_t>(1, uiColumns / uiWidth))
+			continue;
+		const size_t n = ((uiRows >> rs) + 1) * ((uiColumns >> cs) + 1);
+		if (n < uiCells) {
+			k = l;
+			uiCells = n;
+		}
+	}
+	const size_t uiRowShift = rowShift(k), uiColumnShift = columnShift(k);
+
+	// level cells under each view column, [first, last]
+	std::vector<size_t> first(uiWidth), last(uiWidth);
+	for (size_t j = 0; j < uiWidth; j++) {
+		const size_t a = uiFirstColumn + j * uiColumns / uiWidth;
+		const size_t b = std::max(a + 1, uiFirstColumn + (j + 1) * uiColumns / uiWidth);
+		first[j] = a >> uiColumnShift;
+		last[j] = (b - 1) >> uiColumnShift;
+	}
+	const size_t t0 = first[0] / TILE_COLUMNS, t1 = last[uiWidth - 1] / TILE_COLUMNS;
+	std::vector<float> rowMin(uiWidth), rowMax(uiWidth);
+	std::vector<const float *> tileMin(t1 - t0 + 1), tileMax(t1 - t0 + 1);
+	for (size_t i = 0; i < uiHeight; i++) {
+		const size_t a = uiFirstRow + i * uiRows / uiHeight;
+		const size_t b = std::max(a + 1, uiFirstRow + (i + 1) * uiRows / uiHeight);
+		const float fNaN = std::numeric_limits<float>::quiet_NaN();
+		std::fill(rowMin.begin(), rowMin.end(), fNaN);
+		std::fill(rowMax.begin(), rowMax.end(), fNaN);
+		for (size_t uiRow = a >> uiRowShift; uiRow <= (b - 1) >> uiRowShift; uiRow++) {
+			for (size_t t = t0; t <= t1; t++) {
+				tileMin[t - t0] = cells(k, 0, uiRow, t);
+				tileMax[t - t0] = cells(k, 1, uiRow, t);
+			}
+			for (size_t j = 0; j < uiWidth; j++)
+				for (size_t c = first[j]; c <= last[j]; c++) {
+					const size_t t = c / TILE_COLUMNS - t0;
+					rowMin[j] = minOf(rowMin[j], tileMin[t][c % TILE_COLUMNS]);
+					rowMax[j] = maxOf(rowMax[j], tileMax[t][c % TILE_COLUMNS]);
+				}
+		}
+		for (size_t j = 0; j < uiWidth; j++) {
+			pdMin[i * uiWidth + j] = rowMin[j];
+			if (pdMax)
+				pdMax[i * uiWidth + j] = rowMax[j];
+		}
+	}
+	return (int32_t)k;
+}
+
+} // namespace ct400
+
+
+namespace
+{
+
+std::mutex g_mtx;
+std::map<uint64_t, std::shared_ptr<ct400::SweepMap> > g_maps;
+uint64_t g_uiNextMap = 1;
+
+uint64_t addMap(const std::shared_ptr<ct400::SweepMap> &map)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	uint64_t uiMap = g_uiNextMap++;
+	g_maps[uiMap] = map;
+	return uiMap;
+}
+
+std::shared_ptr<ct400::SweepMap> findMap(uint64_t uiMap)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	auto it = g_maps.find(uiMap);
+	return it == g_maps.end() ? nullptr : it->second;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC uint64_t __stdcall CT400_MapCreate(const char *pcPath,
+const double dWavelength[], int32_t iColumns)
+{
+	if (pcPath == nullptr || iColumns <= 0)
+		return 0;
+	auto map = std::make_shared<ct400::SweepMap>();
+	if (map->create(pcPath, dWavelength, (size_t)iColumns) != 0)
+		return 0;
+	return addMap(map);
+}
+
+_EXT_DECLSPEC uint64_t __stdcall CT400_MapOpen(const char *pcPath)
+{
+	if (pcPath == nullptr)
+		return 0;
+	auto map = std::make_shared<ct400::SweepMap>();
+	if (map->open(pcPath) != 0)
+		return 0;
+	return addMap(map);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_MapAppend(uint64_t uiMap,
+double dParameter, const double dRow[], int32_t iArraySize)
+{
+	auto map = findMap(uiMap);
+	if (!map || iArraySize < 0)
+		return -1;
+	return (int32_t)map->append(dParameter, dRow, (size_t)iArraySize);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_MapRefresh(uint64_t uiMap)
+{
+	auto map = findMap(uiMap);
+	return map ? (int32_t)map->refresh() : -1;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_MapGetInfo(uint64_t uiMap,
+rMapInfo *pInfo)
+{
+	auto map = findMap(uiMap);
+	if (!map || pInfo == nullptr)
+		return -1;
+	*pInfo = map->info();
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_MapGetAxes(uint64_t uiMap,
+double dWavelength[], double dParameter[], int32_t iColumns, int32_t iRows)
+{
+	auto map = findMap(uiMap);
+	if (!map || iColumns < 0 || iRows < 0)
+		return -1;
+	if (dWavelength)
+		std::copy(map->wavelength(), map->wavelength() + std::min<size_t>(iColumns, map->columns()), dWavelength);
+	if (dParameter)
+		for (size_t r = 0; r < std::min<size_t>(iRows, map->rows()); r++)
+			dParameter[r] = map->parameter(r);
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_MapGetRow(uint64_t uiMap, int32_t iRow,
+double dRow[], int32_t iArraySize)
+{
+	auto map = findMap(uiMap);
+	if (!map || iRow < 0 || iArraySize < 0 || dRow == nullptr)
+		return -1;
+	const size_t uiColumns = map->columns();
+	if ((size_t)iArraySize >= uiColumns)
+		return map->readRow((size_t)iRow, dRow) == 0 ? (int32_t)uiColumns : -1;
+	std::vector<double> row(uiColumns);
+	if (map->readRow((size_t)iRow, row.data()) != 0)
+		return -1;
+	std::copy(row.begin(), row.begin() + iArraySize, dRow);
+	return iArraySize;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_MapView(uint64_t uiMap,
+int32_t iFirstRow, int32_t iRows, int32_t iFirstColumn, int32_t iColumns,
+int32_t iHeight, int32_t iWidth, double dMin[], double dMax[])
+{
+	auto map = findMap(uiMap);
+	if (!map || iFirstRow < 0 || iRows < 0 || iFirstColumn < 0 || iColumns < 0 || iHeight <= 0 || iWidth <= 0)
+		return -1;
+	return map->view((size_t)iFirstRow, (size_t)iRows, (size_t)iFirstColumn, (size_t)iColumns, (size_t)iHeight,
+		(size_t)iWidth, dMin, dMax);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_MapClose(uint64_t uiMap)
+{
+	std::shared_ptr<ct400::SweepMap> map;
+	{
+		std::lock_guard<std::mutex> lock(g_mtx);
+		auto it = g_maps.find(uiMap);
+		if (it == g_maps.end())
+			return -1;
+		map = it->second;
+		g_maps.erase(it);
+	}
+	map->close();
+	return 0;
+}
+
+}
@@ -0,0 +1,281 @@
+/******************************************************************************/
+/* Header file for CT400_sweep_map.cpp                                        */
+/*                                                                            */
+/* Wavelength x parameter maps (one sweep per row, e.g. while stepping a      */
+/* temperature or a voltage) built row by row in a tiled memory-mapped file,  */
+/* with a min/max pyramid kept up to date so that any region of a map larger  */
+/* than memory can be viewed at any zoom without reading all of it.           */
+/******************************************************************************/
+
+#ifndef CT400_SWEEP_MAP_H
+#define CT400_SWEEP_MAP_H
+
+#include "CT400_ext.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef struct
+  {
+	int32_t iRows;                  // sweeps appended
+	int32_t iColumns;               // points of each row
+	int32_t iLevels;                // of the pyramid, level 0 being the map
+	int32_t iTileRows;
+	int32_t iTileColumns;
+	int32_t iReserved;
+	double dMinParameter;           // of the rows appended
+	double dMaxParameter;
+	double dMinWavelength;
+	double dMaxWavelength;
+	double dMinValue;               // over the whole map, NaN values left out
+	double dMaxValue;
+  } rMapInfo;
+
+//------------------------------ CT400_MapCreate -------------------------------
+// Function CT400_MapCreate
+//
+//  Purpose: Creates an empty map file (replacing any file of that name) on
+//           the wavelength axis of its rows
+//
+//  Parameters: IN pcPath: file name
+//              IN dWavelength: wavelength axis, iColumns values
+//              IN iColumns: points of each row
+//  Returns:  uiMap for use in the other CT400_Map functions, 0 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC uint64_t __stdcall CT400_MapCreate(const char *pcPath,
+const double dWavelength[], int32_t iColumns);
+
+//------------------------------ CT400_MapOpen ---------------------------------
+// Function CT400_MapOpen
+//
+//  Purpose: Opens a map read-only, possibly while another process still
+//           appends to it (see CT400_MapRefresh)
+//
+//  Parameters: IN pcPath: file name
+//  Returns:  uiMap for use in the other CT400_Map functions, 0 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC uint64_t __stdcall CT400_MapOpen(const char *pcPath);
+
+//------------------------------ CT400_MapAppend -------------------------------
+// Function CT400_MapAppend
+//
+//  Purpose: Appends a sweep as the next row and updates the pyramid
+//
+//  Parameters: IN uiMap: from CT400_MapCreate
+//              IN dParameter: parameter of the row (temperature, Vext, ...)
+//              IN dRow: iArraySize values on the axis of the map (points
+//                       beyond iArraySize are NaN, values beyond iColumns
+//                       are ignored)
+//              IN iArraySize: size of dRow
+//  Returns:  number of rows, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_MapAppend(uint64_t uiMap,
+double dParameter, const double dRow[], int32_t iArraySize);
+
+//------------------------------ CT400_MapRefresh ------------------------------
+// Function CT400_MapRefresh
+//
+//  Purpose: Takes in the rows appended since CT400_MapOpen or the last call
+//           (maps opened with CT400_MapCreate are always up to date)
+//
+//  Parameters: IN uiMap: from CT400_MapCreate or CT400_MapOpen
+//  Returns:  number of rows, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_MapRefresh(uint64_t uiMap);
+
+//------------------------------ CT400_MapGetInfo ------------------------------
+// Function CT400_MapGetInfo
+//
+//  Parameters: IN uiMap: from CT400_MapCreate or CT400_MapOpen
+//              IN/OUT pInfo: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_MapGetInfo(uint64_t uiMap,
+rMapInfo *pInfo);
+
+//------------------------------ CT400_MapGetAxes ------------------------------
+// Function CT400_MapGetAxes
+//
+//  Purpose: Copies the wavelength axis and the parameter of every row
+//
+//  Parameters: IN uiMap: from CT400_MapCreate or CT400_MapOpen
+//              IN/OUT dWavelength: pointer over an initialized array of
+//                                  iColumns values, or NULL
+//              IN/OUT dParameter: pointer over an initialized array of iRows
+//                                 values, or NULL
+//              IN iColumns: size of dWavelength
+//              IN iRows: size of dParameter
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_MapGetAxes(uint64_t uiMap,
+double dWavelength[], double dParameter[], int32_t iColumns, int32_t iRows);
+
+//------------------------------ CT400_MapGetRow -------------------------------
+// Function CT400_MapGetRow
+//
+//  Purpose: Copies one row at full resolution
+//
+//  Parameters: IN uiMap: from CT400_MapCreate or CT400_MapOpen
+//              IN iRow: row
+//              IN/OUT dRow: pointer over an initialized array of iArraySize
+//                           values
+//              IN iArraySize: size of dRow
+//  Returns:  number of values written, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_MapGetRow(uint64_t uiMap, int32_t iRow,
+double dRow[], int32_t iArraySize);
+
+//------------------------------ CT400_MapView ---------------------------------
+// Function CT400_MapView
+//
+//  Purpose: Renders a region of the map as iHeight x iWidth cells holding
+//           the min and the max of the values under each cell, read from the
+//           coarsest pyramid level that still has a value per cell. Cells
+//           straddling two level cells take both, so the envelope is never
+//           narrower than the data.
+//
+//  Parameters: IN uiMap: from CT400_MapCreate or CT400_MapOpen
+//              IN iFirstRow, iRows: rows of the region (clipped to the map)
+//              IN iFirstColumn, iColumns: columns of the region (clipped)
+//              IN iHeight, iWidth: cells of the view
+//              IN/OUT dMin: pointer over an initialized array of
+//                           iHeight * iWidth values (row-major), NaN where
+//                           the region holds no value
+//              IN/OUT dMax: the same, or NULL
+//  Returns:  pyramid level read, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_MapView(uint64_t uiMap,
+int32_t iFirstRow, int32_t iRows, int32_t iFirstColumn, int32_t iColumns,
+int32_t iHeight, int32_t iWidth, double dMin[], double dMax[]);
+
+//------------------------------ CT400_MapClose --------------------------------
+// Function CT400_MapClose
+//
+//  Purpose: Closes the map; a created map is cut to its used size
+//
+//  Parameters: IN uiMap: from CT400_MapCreate or CT400_MapOpen
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_MapClose(uint64_t uiMap);
+
+#ifdef __cplusplus
+}
+
+#include "CT400_mmap.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace ct400
+{
+
+//------------------------------ SweepMap --------------------------------------
+// Class SweepMap
+//
+//  Purpose: Map file of float32 values. Level 0 is the map itself; the
+//           other levels hold the min and the max of blocks of it: 4^j
+//           columns of one row (down to 64 columns), and 2^k x 2^k blocks.
+//           The wide maps of a few thousand sweeps of some 100k points are
+//           mostly viewed with every sweep on screen, which square blocks
+//           alone would serve from the full map; view() reads the level with
+//           the fewest cells under the region that still has one per view
+//           cell. Every level is stored in bands of TILE_ROWS rows, each band
+//           a row of TILE_ROWS x TILE_COLUMNS tiles, allocated as the rows
+//           reach it, so a view touches only the tiles under its region
+//           whatever the size of the map. append() writes a row into level 0
+//           and folds it into one row of every level, about two passes over
+//           the row; the levels take about 1.3 times the map again on disk.
+//           The file grows by doubling and is cut to its used size by
+//           close(). A single process appends; readers in other processes
+//           open() the file and refresh() to see new rows. Not thread safe.
+//------------------------------------------------------------------------------
+class SweepMap
+{
+public:
+	static const size_t TILE_ROWS = 64;
+	static const size_t TILE_COLUMNS = 256;
+	static const size_t MAX_LEVELS = 32;
+
+	SweepMap() {}
+	~SweepMap() { close(); }
+
+	SweepMap(const SweepMap &) = delete;
+	SweepMap &operator=(const SweepMap &) = delete;
+
+	// Writer: returns 0 if success, -1 otherwise
+	int32_t create(const std::string &strPath, const double *pdWavelength, size_t uiColumns);
+	// Reader: returns 0 if success, -1 otherwise
+	int32_t open(const std::string &strPath);
+	void close();
+	// Writer: returns 0 if success, -1 otherwise
+	int32_t flush(bool bSync = false);
+
+	bool isOpen() const { return base() != nullptr; }
+	bool isWriter() const { return m_bWriter; }
+
+	// Writer: returns the number of rows, -1 otherwise
+	int64_t append(double dParameter, const double *pdRow, size_t uiCount);
+	// Reader: maps the rows appended meanwhile. Returns the number of rows,
+	// -1 otherwise
+	int64_t refresh();
+
+	size_t rows() const { return m_uiRows; }
+	size_t columns() const;
+	size_t levels() const;
+	const double *wavelength() const;
+	double parameter(size_t uiRow) const;
+	rMapInfo info() const;
+	// Cells of level uiLevel span 2^rowShift rows and 2^columnShift columns
+	size_t rowShift(size_t uiLevel) const;
+	size_t columnShift(size_t uiLevel) const;
+
+	// Copies row uiRow (columns() values). Returns 0 if success, -1
+	// otherwise
+	int32_t readRow(size_t uiRow, double *pdRow) const;
+	// See CT400_MapView. Returns the level read, -1 otherwise
+	int32_t view(size_t uiFirstRow, size_t uiRows, size_t uiFirstColumn, size_t uiColumns, size_t uiHeight,
+		size_t uiWidth, double *pdMin, double *pdMax) const;
+
+private:
+	struct Header;
+	struct BandHeader;
+
+	const uint8_t *base() const { return m_bWriter ? m_writer.data() : m_reader.data(); }
+	size_t mappedSize() const { return m_bWriter ? m_writer.size() : m_reader.size(); }
+	const Header *header() const { return reinterpret_cast<const Header *>(base()); }
+	Header *writerHeader() { return reinterpret_cast<Header *>(m_writer.data()); }
+
+	size_t width(size_t uiLevel) const;
+	size_t tilesAcross(size_t uiLevel) const;
+	size_t bandBytes(size_t uiLevel) const;
+	// First value of row uiRow of level uiLevel in tile uiTile of plane
+	// uiPlane (0: min, 1: max, the same plane at level 0)
+	const float *cells(size_t uiLevel, size_t uiPlane, size_t uiRow, size_t uiTile) const;
+	float *cells(size_t uiLevel, size_t uiPlane, size_t uiRow, size_t uiTile);
+	// Writer: makes sure the band holding row uiRow of uiLevel exists.
+	// Returns 0 if success, -1 otherwise
+	int32_t reserve(size_t uiLevel, size_t uiRow);
+	// Indexes the bands between m_uiIndexed and the end of the file.
+	// Returns 0 if success, -1 otherwise
+	int32_t index();
+
+	WritableMappedFile m_writer;
+	MappedFile m_reader;
+	std::string m_strPath;
+	bool m_bWriter = false;
+	size_t m_uiRows = 0;
+	uint64_t m_uiIndexed = 0;
+	std::vector<std::vector<uint64_t> > m_bands;    // band offsets per level
+	// writer: the row being appended, then halved once per column shift
+	std::vector<std::vector<float> > m_min, m_max;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
@@ -0,0 +1,271 @@
+//------------------------------------------------------------------------------
+// CT400_sweep_ring.cpp
+//
+// Shared memory layout of the sweep ring: a header page, the slot
+// descriptors (one cache line of sequence number, then rSweepInfo), then the
+// rows of every slot, 64-byte aligned. Slot rows are only touched by the
+// sweeps written into them, so a ring sized for the widest sweep costs
+// memory in proportion to the sweeps actually taken.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_sweep_ring.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#if !defined (_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ct400
+{
+
+static_assert(sizeof(rSweepInfo) == 440, "rSweepInfo layout");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring is shared between processes");
+
+namespace
+{
+
+const char RING_MAGIC[8] = { 'C', 'T', '4', 'R', 'I', 'N', 'G', '\0' };
+const uint32_t RING_VERSION = 1;
+const size_t PAGE = 4096;
+
+size_t alignTo(size_t uiValue, size_t uiAlign)
+{
+	return (uiValue + uiAlign - 1) / uiAlign * uiAlign;
+}
+
+} // namespace
+
+struct SweepRing::Header
+{
+	char tcMagic[8];
+	uint32_t uiVersion;
+	uint32_t uiSlots;
+	uint64_t uiStride;                      // values per row
+	uint64_t uiSlotBytes;
+	uint64_t uiSlotsOffset;
+	uint64_t uiDataOffset;
+	int64_t iWriterPid;
+	alignas(64) std::atomic<uint64_t> uiPublished;
+};
+
+struct SweepRing::Slot
+{
+	// 2n + 1 while sweep n is written, 2n + 2 once published
+	alignas(64) std::atomic<uint64_t> uiSeq;
+	rSweepInfo info;
+};
+
+int32_t SweepRing::create(const std::string &strName, size_t uiSlots, size_t uiMaxPoints)
+{
+	close();
+#if defined (_WIN32)
+	(void)strName;
+	(void)uiSlots;
+	(void)uiMaxPoints;
+	return -1;
+#else
+	if (uiSlots < 2 || uiSlots > 1024 || uiMaxPoints == 0 || uiMaxPoints > (1u << 26))
+		return -1;
+	const size_t uiStride = alignedStride(uiMaxPoints);
+	const size_t uiSlotBytes = alignTo(MAX_ROWS * uiStride * sizeof(double), PAGE);
+	const size_t uiSlotsOffset = alignTo(sizeof(Header), PAGE);
+	const size_t uiDataOffset = alignTo(uiSlotsOffset + uiSlots * sizeof(Slot), PAGE);
+	const size_t uiSize = uiDataOffset + uiSlots * uiSlotBytes;
+
+	shm_unlink(strName.c_str());
+	int fd = shm_open(strName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, (off_t)uiSize) != 0) {
+		::close(fd);
+		shm_unlink(strName.c_str());
+		return -1;
+	}
+	void *p = mmap(nullptr, uiSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) {
+		shm_unlink(strName.c_str());
+		return -1;
+	}
+	m_pBase = p;
+	m_uiSize = uiSize;
+	m_strName = strName;
+	m_bWriter = true;
+
+	// the object is zero-filled: every slot has sequence 0 (empty)
+	Header *pHeader = new (p) Header();
+	pHeader->uiVersion = RING_VERSION;
+	pHeader->uiSlots = (uint32_t)uiSlots;
+	pHeader->uiStride = uiStride;
+	pHeader->uiSlotBytes = uiSlotBytes;
+	pHeader->uiSlotsOffset = uiSlotsOffset;
+	pHeader->uiDataOffset = uiDataOffset;
+	pHeader->iWriterPid = (int64_t)getpid();
+	pHeader->uiPublished.store(0, std::memory_order_relaxed);
+	for (size_t i = 0; i < uiSlots; i++)
+		new (static_cast<uint8_t *>(p) + uiSlotsOffset + i * sizeof(Slot)) Slot();
+	// the magic last: a reader opening the ring meanwhile sees no ring
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memcpy(pHeader->tcMagic, RING_MAGIC, sizeof(RING_MAGIC));
+	return 0;
+#endif
+}
+
+int32_t SweepRing::open(const std::string &strName)
+{
+	close();
+#if defined (_WIN32)
+	(void)strName;
+	return -1;
+#else
+	int fd = shm_open(strName.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+		::close(fd);
+		return -1;
+	}
+	void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+		return -1;
+	m_pBase = p;
+	m_uiSize = (size_t)st.st_size;
+	m_strName = strName;
+	m_bWriter = false;
+
+	const Header *pHeader = static_cast<const Header *>(p);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (std::memcmp(pHeader->tcMagic, RING_MAGIC, sizeof(RING_MAGIC)) != 0 || pHeader->uiVersion != RING_VERSION
+		|| pHeader->uiDataOffset + (uint64_t)pHeader->uiSlots * pHeader->uiSlotBytes > m_uiSize
+		|| pHeader->uiStride * MAX_ROWS * sizeof(double) > pHeader->uiSlotBytes) {
+		close();
+		return -1;
+	}
+	return 0;
+#endif
+}
+
+void SweepRing::close()
+{
+#if !defined (_WIN32)
+	if (m_pBase) {
+		munmap(m_pBase, m_uiSize);
+		if (m_bWriter)
+			shm_unlink(m_strName.c_str());
+	}
+#endif
+	m_pBase = nullptr;
+	m_uiSize = 0;
+	m_strName.clear();
+	m_bWriter = false;
+}
+
+size_t SweepRing::slots() const
+{
+	return m_pBase ? static_cast<const Header *>(m_pBase)->uiSlots : 0;
+}
+
+size_t SweepRing::stride() const
+{
+	return m_pBase ? (size_t)static_cast<const Header *>(m_pBase)->uiStride : 0;
+}
+
+uint64_t SweepRing::published() const
+{
+	return m_pBase ? static_cast<const Header *>(m_pBase)->uiPublished.load(std::memory_order_acquire) : 0;
+}
+
+SweepRing::Slot *SweepRing::slot(uint64_t n) const
+{
+	const Header *pHeader = static_cast<const Header *>(m_pBase);
+	return reinterpret_cast<Slot *>(static_cast<uint8_t *>(m_pBase) + pHeader->uiSlotsOffset)
+		+ n % pHeader->uiSlots;
+}
+
+double *SweepRing::data(uint64_t n) const
+{
+	const Header *pHeader = static_cast<const Header *>(m_pBase);
+	return reinterpret_cast<double *>(static_cast<uint8_t *>(m_pBase) + pHeader->uiDataOffset
+		+ n % pHeader->uiSlots * pHeader->uiSlotBytes);
+}
+
+rSweepInfo &SweepRing::begin()
+{
+	const uint64_t n = published();
+	Slot *pSlot = slot(n);
+	pSlot->uiSeq.store(2 * n + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memset(&pSlot->info, 0, sizeof(pSlot->info));
+	pSlot->info.uiSequence = n;
+	return pSlot->info;
+}
+
+double *SweepRing::row(size_t uiRow)
+{
+	return data(published()) + uiRow * stride();
+}
+
+void SweepRing::publish()
+{
+	Header *pHeader = static_cast<Header *>(m_pBase);
+	const uint64_t n = pHeader->uiPublished.load(std::memory_order_relaxed);
+	slot(n)->uiSeq.store(2 * n + 2, std::memory_order_release);
+	pHeader->uiPublished.store(n + 1, std::memory_order_release);
+}
+
+const rSweepInfo *SweepRing::info(uint64_t n) const
+{
+	if (m_pBase == nullptr || !valid(n))
+		return nullptr;
+	return &slot(n)->info;
+}
+
+const double *SweepRing::row(uint64_t n, size_t uiRow) const
+{
+	if (m_pBase == nullptr || uiRow >= MAX_ROWS || !valid(n))
+		return nullptr;
+	return data(n) + uiRow * stride();
+}
+
+bool SweepRing::valid(uint64_t n) const
+{
+	if (m_pBase == nullptr)
+		return false;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot(n)->uiSeq.load(std::memory_order_acquire) == 2 * n + 2;
+}
+
+int32_t SweepRing::copy(uint64_t n, rSweepInfo *pInfo, double *pdWavelength, double *pdBlock, double *pdPower,
+	size_t uiArraySize) const
+{
+	if (!valid(n))
+		return -1;
+	const Slot *pSlot = slot(n);
+	rSweepInfo info = pSlot->info;
+	const size_t uiRows = (size_t)std::min(std::max(info.iNbDetectors, 0), 5);
+	const size_t uiPoints = std::min((size_t)std::max(info.iPoints, 0), std::min(uiArraySize, stride()));
+	const double *pdData = data(n);
+	if (pdWavelength)
+		std::memcpy(pdWavelength, pdData, uiPoints * sizeof(double));
+	if (pdBlock)
+		for (size_t r = 0; r < uiRows; r++)
+			std::memcpy(pdBlock + r * uiArraySize, pdData + (r + 1) * stride(), uiPoints * sizeof(double));
+	if (pdPower && info.iPower)
+		std::memcpy(pdPower, pdData + (uiRows + 1) * stride(), uiPoints * sizeof(double));
+	if (!valid(n))
+		return -1;
+	if (pInfo)
+		*pInfo = info;
+	return (int32_t)uiPoints;
+}
+
+} // namespace ct400
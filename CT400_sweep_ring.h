@@ -0,0 +1,127 @@
+/******************************************************************************/
+/* Header file for CT400_sweep_ring.cpp                                       */
+/*                                                                            */
+/* Ring of whole sweeps in named shared memory, written by the instrument    */
+/* daemon (CT400_daemon.cpp) and mapped read-only by any number of local     */
+/* reader processes. POSIX only: on Windows create() and open() fail.        */
+/******************************************************************************/
+
+#ifndef CT400_SWEEP_RING_H
+#define CT400_SWEEP_RING_H
+
+#include "CT400_config.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  // Description of one sweep of the ring (fixed layout, 440 bytes)
+  typedef struct
+  {
+	uint64_t uiSequence;            // 0 for the first sweep published by the daemon
+	int64_t iTimestamp;             // end of sweep, us since 1970
+	int32_t iError;                 // CT400_ScanWaitEnd error, -1 on call failure
+	int32_t iPoints;                // points of each row
+	int32_t iTotalPoints;           // points of the sweep (more than iPoints if truncated to the ring rows)
+	int32_t iNbDetectors;           // block rows
+	int32_t eDetectors[5];          // rDetector of each block row
+	int32_t iPower;                 // 1 if a Pout row follows the detectors
+	double dScanTime;               // s from CT400_ScanStart to end of sweep
+	double dFetchTime;              // s to retrieve the arrays
+	rScanConfig config;             // configuration of the sweep
+	char tcError[256];              // CT400_ScanWaitEnd error text
+  } rSweepInfo;
+
+#ifdef __cplusplus
+}
+
+#include <atomic>
+#include <string>
+
+namespace ct400
+{
+
+//------------------------------ SweepRing -------------------------------------
+// Class SweepRing
+//
+//  Purpose: Fixed number of sweep slots in a shared memory object (shm_open
+//           name), each holding its rSweepInfo and rows of stride() values:
+//           the wavelength axis, up to 5 detectors, then Pout. The writer
+//           fetches a sweep straight into the slot of sweep n (slot
+//           n % slots()) and publishes it; readers use it in place. Each slot
+//           carries a sequence number (seqlock, as SampleRing): a reader
+//           checks valid(n) after using a sweep, which fails if the writer
+//           has started to overwrite it in the meantime. The writer never
+//           waits for readers, so with slots() sweeps in the ring a reader
+//           has at least slots() - 1 sweep durations to finish with one.
+//------------------------------------------------------------------------------
+class SweepRing
+{
+public:
+	static const size_t MAX_ROWS = 7;       // wavelength, 5 detectors, Pout
+
+	SweepRing() {}
+	~SweepRing() { close(); }
+
+	SweepRing(const SweepRing &) = delete;
+	SweepRing &operator=(const SweepRing &) = delete;
+
+	// Writer: creates the object strName (replacing any left by a previous
+	// writer), with uiSlots slots of up to uiMaxPoints points.
+	// Returns 0 if success, -1 otherwise
+	int32_t create(const std::string &strName, size_t uiSlots, size_t uiMaxPoints);
+	// Reader: maps an existing ring read-only. Returns 0 if success, -1
+	// otherwise
+	int32_t open(const std::string &strName);
+	// The writer also removes the name
+	void close();
+
+	bool isOpen() const { return m_pBase != nullptr; }
+	const std::string &name() const { return m_strName; }
+	size_t slots() const;
+	size_t stride() const;
+	size_t maxPoints() const { return stride(); }
+
+	// Sweeps published so far; the newest is published() - 1
+	uint64_t published() const;
+
+	// Writer: marks the slot of sweep published() as being written and
+	// returns its info and rows (row 0: wavelength)
+	rSweepInfo &begin();
+	double *row(size_t uiRow);
+	// Writer: makes the sweep of begin() visible to readers
+	void publish();
+
+	// Reader: info and rows of sweep n, nullptr if it is not published or
+	// was overwritten. The data stays in the ring: check valid(n) after use.
+	const rSweepInfo *info(uint64_t n) const;
+	const double *row(uint64_t n, size_t uiRow) const;
+	bool valid(uint64_t n) const;
+
+	// Reader: copies sweep n (wavelength, iNbDetectors rows of uiArraySize
+	// values, Pout) into the arrays given (any may be nullptr). Returns the
+	// number of points, -1 if the sweep is not available or was overwritten
+	// during the copy
+	int32_t copy(uint64_t n, rSweepInfo *pInfo, double *pdWavelength, double *pdBlock, double *pdPower,
+		size_t uiArraySize) const;
+
+private:
+	struct Header;
+	struct Slot;
+
+	Slot *slot(uint64_t n) const;
+	double *data(uint64_t n) const;
+
+	void *m_pBase = nullptr;
+	size_t m_uiSize = 0;
+	std::string m_strName;
+	bool m_bWriter = false;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
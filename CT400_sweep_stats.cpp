@@ -0,0 +1,564 @@
+//------------------------------------------------------------------------------
+// CT400_sweep_stats.cpp
+//
+// Streaming per-point statistics. Every sweep of a run shares the sweep
+// count, so the Welford update of a whole block is one multiply by 1/n and a
+// few adds per value, run over all detector rows at once when they are
+// contiguous. Sigma clipping keeps a count per point (the values it rejected
+// differ from point to point) and tests against the squared deviation, so it
+// needs no square root; the only division is the per-point 1/count.
+//------------------------------------------------------------------------------
+
+#define CT400_EXT_EXPORT
+#include "CT400_sweep_stats.h"
+#include "CT400_simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace
+{
+
+void welfordScalar(const double *pdX, double *pdMean, double *pdM2, double *pdMin, double *pdMax, double dInvN,
+	size_t k0, size_t k1)
+{
+	for (size_t k = k0; k < k1; k++) {
+		double x = pdX[k];
+		double delta = x - pdMean[k];
+		pdMean[k] += delta * dInvN;
+		pdM2[k] += delta * (x - pdMean[k]);
+		pdMin[k] = std::min(pdMin[k], x);
+		pdMax[k] = std::max(pdMax[k], x);
+	}
+}
+
+// Values further than sqrt(dK2) deviations from the clipped mean are
+// rejected once dMinCount values were kept. Squared distances up to pdFloor
+// (sqrt(dK2) quantisation steps) are always kept, and so is everything while
+// the kept values are all equal, so a point without spread is never frozen.
+void clipScalar(const double *pdX, const double *pdFloor, double *pdMean, double *pdM2, double *pdCount, double dK2,
+	double dMinCount, size_t k0, size_t k1)
+{
+	for (size_t k = k0; k < k1; k++) {
+		double x = pdX[k];
+		double c = pdCount[k];
+		double delta = x - pdMean[k];
+		if (c < dMinCount || pdM2[k] <= 0.0 || delta * delta <= pdFloor[k]
+			|| delta * delta * (c - 1.0) <= dK2 * pdM2[k]) {
+			pdCount[k] = c + 1.0;
+			pdMean[k] += delta / (c + 1.0);
+			pdM2[k] += delta * (x - pdMean[k]);
+		}
+	}
+}
+
+void meanScalar(const double *pdX, double *pdMean, double dInvN, size_t k0, size_t k1)
+{
+	for (size_t k = k0; k < k1; k++)
+		pdMean[k] += (pdX[k] - pdMean[k]) * dInvN;
+}
+
+#if CT400_SIMD_X86
+
+//------------------------------ AVX2 ------------------------------------------
+
+CT400_TARGET_AVX2 void welfordAvx2(const double *pdX, double *pdMean, double *pdM2, double *pdMin, double *pdMax,
+	double dInvN, size_t k0, size_t k1)
+{
+	const __m256d vInvN = _mm256_set1_pd(dInvN);
+	size_t k = k0;
+	for (; k + 4 <= k1; k += 4) {
+		__m256d x = _mm256_loadu_pd(pdX + k);
+		__m256d mean = _mm256_loadu_pd(pdMean + k);
+		__m256d delta = _mm256_sub_pd(x, mean);
+		mean = _mm256_fmadd_pd(delta, vInvN, mean);
+		_mm256_storeu_pd(pdMean + k, mean);
+		_mm256_storeu_pd(pdM2 + k, _mm256_fmadd_pd(delta, _mm256_sub_pd(x, mean), _mm256_loadu_pd(pdM2 + k)));
+		_mm256_storeu_pd(pdMin + k, _mm256_min_pd(_mm256_loadu_pd(pdMin + k), x));
+		_mm256_storeu_pd(pdMax + k, _mm256_max_pd(_mm256_loadu_pd(pdMax + k), x));
+	}
+	welfordScalar(pdX, pdMean, pdM2, pdMin, pdMax, dInvN, k, k1);
+}
+
+CT400_TARGET_AVX2 void clipAvx2(const double *pdX, const double *pdFloor, double *pdMean, double *pdM2,
+	double *pdCount, double dK2, double dMinCount, size_t k0, size_t k1)
+{
+	const __m256d vZero = _mm256_setzero_pd();
+	const __m256d vOne = _mm256_set1_pd(1.0);
+	const __m256d vK2 = _mm256_set1_pd(dK2);
+	const __m256d vMinCount = _mm256_set1_pd(dMinCount);
+	size_t k = k0;
+	for (; k + 4 <= k1; k += 4) {
+		__m256d x = _mm256_loadu_pd(pdX + k);
+		__m256d c = _mm256_loadu_pd(pdCount + k);
+		__m256d mean = _mm256_loadu_pd(pdMean + k);
+		__m256d m2 = _mm256_loadu_pd(pdM2 + k);
+		__m256d delta = _mm256_sub_pd(x, mean);
+		__m256d vDelta2 = _mm256_mul_pd(delta, delta);
+		__m256d vSpread = _mm256_mul_pd(vDelta2, _mm256_sub_pd(c, vOne));
+		__m256d vKeep = _mm256_or_pd(_mm256_or_pd(_mm256_cmp_pd(c, vMinCount, _CMP_LT_OQ),
+			_mm256_cmp_pd(m2, vZero, _CMP_LE_OQ)), _mm256_or_pd(
+			_mm256_cmp_pd(vDelta2, _mm256_loadu_pd(pdFloor + k), _CMP_LE_OQ),
+			_mm256_cmp_pd(vSpread, _mm256_mul_pd(vK2, m2), _CMP_LE_OQ)));
+		c = _mm256_add_pd(c, _mm256_and_pd(vKeep, vOne));
+		mean = _mm256_add_pd(mean, _mm256_and_pd(vKeep, _mm256_div_pd(delta, c)));
+		m2 = _mm256_add_pd(m2, _mm256_and_pd(vKeep, _mm256_mul_pd(delta, _mm256_sub_pd(x, mean))));
+		_mm256_storeu_pd(pdCount + k, c);
+		_mm256_storeu_pd(pdMean + k, mean);
+		_mm256_storeu_pd(pdM2 + k, m2);
+	}
+	clipScalar(pdX, pdFloor, pdMean, pdM2, pdCount, dK2, dMinCount, k, k1);
+}
+
+CT400_TARGET_AVX2 void meanAvx2(const double *pdX, double *pdMean, double dInvN, size_t k0, size_t k1)
+{
+	const __m256d vInvN = _mm256_set1_pd(dInvN);
+	size_t k = k0;
+	for (; k + 4 <= k1; k += 4) {
+		__m256d mean = _mm256_loadu_pd(pdMean + k);
+		_mm256_storeu_pd(pdMean + k, _mm256_fmadd_pd(_mm256_sub_pd(_mm256_loadu_pd(pdX + k), mean), vInvN, mean));
+	}
+	meanScalar(pdX, pdMean, dInvN, k, k1);
+}
+
+//------------------------------ AVX-512 ---------------------------------------
+
+// GCC 12 reports the _mm512_undefined_pd() inside several intrinsics as
+// uninitialised
+#if defined (__GNUC__) && !defined (__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+CT400_TARGET_AVX512 void welfordAvx512(const double *pdX, double *pdMean, double *pdM2, double *pdMin,
+	double *pdMax, double dInvN, size_t k0, size_t k1)
+{
+	const __m512d vInvN = _mm512_set1_pd(dInvN);
+	size_t k = k0;
+	for (; k + 8 <= k1; k += 8) {
+		__m512d x = _mm512_loadu_pd(pdX + k);
+		__m512d mean = _mm512_loadu_pd(pdMean + k);
+		__m512d delta = _mm512_sub_pd(x, mean);
+		mean = _mm512_fmadd_pd(delta, vInvN, mean);
+		_mm512_storeu_pd(pdMean + k, mean);
+		_mm512_storeu_pd(pdM2 + k, _mm512_fmadd_pd(delta, _mm512_sub_pd(x, mean), _mm512_loadu_pd(pdM2 + k)));
+		_mm512_storeu_pd(pdMin + k, _mm512_min_pd(_mm512_loadu_pd(pdMin + k), x));
+		_mm512_storeu_pd(pdMax + k, _mm512_max_pd(_mm512_loadu_pd(pdMax + k), x));
+	}
+	welfordScalar(pdX, pdMean, pdM2, pdMin, pdMax, dInvN, k, k1);
+}
+
+CT400_TARGET_AVX512 void clipAvx512(const double *pdX, const double *pdFloor, double *pdMean, double *pdM2,
+	double *pdCount, double dK2, double dMinCount, size_t k0, size_t k1)
+{
+	const __m512d vOne = _mm512_set1_pd(1.0);
+	const __m512d vK2 = _mm512_set1_pd(dK2);
+	const __m512d vMinCount = _mm512_set1_pd(dMinCount);
+	size_t k = k0;
+	for (; k + 8 <= k1; k += 8) {
+		__m512d x = _mm512_loadu_pd(pdX + k);
+		__m512d c = _mm512_loadu_pd(pdCount + k);
+		__m512d mean = _mm512_loadu_pd(pdMean + k);
+		__m512d m2 = _mm512_loadu_pd(pdM2 + k);
+		__m512d delta = _mm512_sub_pd(x, mean);
+		__m512d vDelta2 = _mm512_mul_pd(delta, delta);
+		__m512d vSpread = _mm512_mul_pd(vDelta2, _mm512_sub_pd(c, vOne));
+		__mmask8 keep = _mm512_cmp_pd_mask(c, vMinCount, _CMP_LT_OQ)
+			| _mm512_cmp_pd_mask(m2, _mm512_setzero_pd(), _CMP_LE_OQ)
+			| _mm512_cmp_pd_mask(vDelta2, _mm512_loadu_pd(pdFloor + k), _CMP_LE_OQ)
+			| _mm512_cmp_pd_mask(vSpread, _mm512_mul_pd(vK2, m2), _CMP_LE_OQ);
+		c = _mm512_mask_add_pd(c, keep, c, vOne);
+		mean = _mm512_mask_add_pd(mean, keep, mean, _mm512_div_pd(delta, c));
+		m2 = _mm512_mask3_fmadd_pd(delta, _mm512_sub_pd(x, mean), m2, keep);
+		_mm512_storeu_pd(pdCount + k, c);
+		_mm512_storeu_pd(pdMean + k, mean);
+		_mm512_storeu_pd(pdM2 + k, m2);
+	}
+	clipScalar(pdX, pdFloor, pdMean, pdM2, pdCount, dK2, dMinCount, k, k1);
+}
+
+CT400_TARGET_AVX512 void meanAvx512(const double *pdX, double *pdMean, double dInvN, size_t k0, size_t k1)
+{
+	const __m512d vInvN = _mm512_set1_pd(dInvN);
+	size_t k = k0;
+	for (; k + 8 <= k1; k += 8) {
+		__m512d mean = _mm512_loadu_pd(pdMean + k);
+		_mm512_storeu_pd(pdMean + k, _mm512_fmadd_pd(_mm512_sub_pd(_mm512_loadu_pd(pdX + k), mean), vInvN, mean));
+	}
+	meanScalar(pdX, pdMean, dInvN, k, k1);
+}
+
+#if defined (__GNUC__) && !defined (__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+typedef void (*WelfordKernel)(const double *, double *, double *, double *, double *, double, size_t, size_t);
+typedef void (*ClipKernel)(const double *, const double *, double *, double *, double *, double, double, size_t,
+	size_t);
+typedef void (*MeanKernel)(const double *, double *, double, size_t, size_t);
+
+WelfordKernel selectWelford()
+{
+#if CT400_SIMD_X86
+	switch (ct400::simdLevel()) {
+	case ct400::SIMD_AVX512:
+		return welfordAvx512;
+	case ct400::SIMD_AVX2:
+		return welfordAvx2;
+	default:
+		break;
+	}
+#endif
+	return welfordScalar;
+}
+
+ClipKernel selectClip()
+{
+#if CT400_SIMD_X86
+	switch (ct400::simdLevel()) {
+	case ct400::SIMD_AVX512:
+		return clipAvx512;
+	case ct400::SIMD_AVX2:
+		return clipAvx2;
+	default:
+		break;
+	}
+#endif
+	return clipScalar;
+}
+
+MeanKernel selectMean()
+{
+#if CT400_SIMD_X86
+	switch (ct400::simdLevel()) {
+	case ct400::SIMD_AVX512:
+		return meanAvx512;
+	case ct400::SIMD_AVX2:
+		return meanAvx2;
+	default:
+		break;
+	}
+#endif
+	return meanScalar;
+}
+
+bool validSettings(const rStatsSettings &s)
+{
+	switch (s.eRobust) {
+	case SR_NONE:
+		return true;
+	case SR_SIGMA_CLIP:
+		// below about 1.8 deviations the clipped deviation shrinks towards 0
+		return s.dClipSigma >= 2.0 && s.iWarmup >= 3 && s.iWarmup <= 1000;
+	case SR_MEDIAN_OF_MEANS:
+		return s.iGroups >= 1 && s.iGroups <= 1024;
+	default:
+		return false;
+	}
+}
+
+std::mutex g_mtx;
+std::map<uint64_t, std::shared_ptr<ct400::SweepStats> > g_stats;
+uint64_t g_uiNextStats = 1;
+
+std::shared_ptr<ct400::SweepStats> findStats(uint64_t uiStats)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	auto it = g_stats.find(uiStats);
+	return it == g_stats.end() ? nullptr : it->second;
+}
+
+} // namespace
+
+
+extern "C"
+{
+
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultStatsSettings(
+rStatsSettings *pSettings)
+{
+	if (pSettings == nullptr)
+		return -1;
+	std::memset(pSettings, 0, sizeof(*pSettings));
+	pSettings->eRobust = SR_SIGMA_CLIP;
+	pSettings->iGroups = 8;
+	pSettings->dClipSigma = 3.0;
+	pSettings->iWarmup = 10;
+	return 0;
+}
+
+_EXT_DECLSPEC uint64_t __stdcall CT400_StatsCreate(int32_t iNbDetectors,
+const rStatsSettings *pSettings)
+{
+	rStatsSettings settings;
+	if (pSettings)
+		settings = *pSettings;
+	else
+		CT400_DefaultStatsSettings(&settings);
+	if (iNbDetectors <= 0 || !validSettings(settings))
+		return 0;
+	auto stats = std::make_shared<ct400::SweepStats>(iNbDetectors, settings);
+	std::lock_guard<std::mutex> lock(g_mtx);
+	uint64_t uiStats = g_uiNextStats++;
+	g_stats[uiStats] = stats;
+	return uiStats;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_StatsAdd(uint64_t uiStats,
+const double dWavelength[], const double dBlock[], int32_t iArraySize)
+{
+	auto stats = findStats(uiStats);
+	if (!stats || dWavelength == nullptr || dBlock == nullptr || iArraySize <= 0)
+		return -1;
+	std::vector<const double *> rows(stats->detectors());
+	for (size_t d = 0; d < rows.size(); d++)
+		rows[d] = dBlock + d * iArraySize;
+	return stats->add(dWavelength, rows.data(), iArraySize);
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_StatsGet(uint64_t uiStats,
+rSweepStat eStat, double dWavelength[], double dBlock[], int32_t iArraySize)
+{
+	auto stats = findStats(uiStats);
+	if (!stats || stats->count() == 0 || dBlock == nullptr || iArraySize < 0)
+		return -1;
+	const size_t uiPoints = stats->points();
+	const size_t uiCopy = std::min<size_t>(uiPoints, iArraySize);
+	// straight into the caller's block when its rows are the right size
+	ct400::AlignedVector buffer;
+	const bool bDirect = uiCopy == uiPoints;
+	if (!bDirect)
+		buffer.resize(stats->detectors() * uiPoints);
+	std::vector<double *> rows(stats->detectors());
+	for (size_t d = 0; d < rows.size(); d++)
+		rows[d] = bDirect ? dBlock + d * iArraySize : buffer.data() + d * uiPoints;
+	if (stats->get(eStat, rows.data()) != 0)
+		return -1;
+	if (!bDirect)
+		for (size_t d = 0; d < rows.size(); d++)
+			std::copy(rows[d], rows[d] + uiCopy, dBlock + d * iArraySize);
+	if (dWavelength)
+		std::copy(stats->wavelength(), stats->wavelength() + uiCopy, dWavelength);
+	return (int32_t)uiPoints;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_StatsReset(uint64_t uiStats)
+{
+	auto stats = findStats(uiStats);
+	if (!stats)
+		return -1;
+	stats->reset();
+	return 0;
+}
+
+_EXT_DECLSPEC int32_t __stdcall CT400_StatsDestroy(uint64_t uiStats)
+{
+	std::lock_guard<std::mutex> lock(g_mtx);
+	return g_stats.erase(uiStats) ? 0 : -1;
+}
+
+}
+
+
+namespace ct400
+{
+
+SweepStats::SweepStats(size_t uiDetectors, const rStatsSettings &settings)
+	: m_uiDetectors(uiDetectors), m_settings(settings)
+{
+}
+
+void SweepStats::reset()
+{
+	m_uiPoints = 0;
+	m_uiCount = 0;
+	m_wavelength.clear();
+	m_warmup.clear();
+	m_groupCount.clear();
+}
+
+int32_t SweepStats::add(const ScanBuffer &sweep)
+{
+	if (sweep.detectors().size() != m_uiDetectors)
+		return -1;
+	std::vector<const double *> rows(m_uiDetectors);
+	for (size_t d = 0; d < m_uiDetectors; d++)
+		rows[d] = sweep.row(d);
+	return add(sweep.wavelength(), rows.data(), sweep.points());
+}
+
+int32_t SweepStats::add(const double *pdWavelength, const double *const *ppdRows, size_t uiPoints)
+{
+	static const WelfordKernel welford = selectWelford();
+	static const ClipKernel clip = selectClip();
+	static const MeanKernel mean = selectMean();
+
+	if (pdWavelength == nullptr || ppdRows == nullptr || uiPoints == 0)
+		return -1;
+	if (m_uiCount == 0) {
+		const size_t uiValues = m_uiDetectors * uiPoints;
+		m_uiPoints = uiPoints;
+		m_wavelength.assign(pdWavelength, pdWavelength + uiPoints);
+		m_mean.assign(uiValues, 0.0);
+		m_m2.assign(uiValues, 0.0);
+		m_min.assign(uiValues, std::numeric_limits<double>::infinity());
+		m_max.assign(uiValues, -std::numeric_limits<double>::infinity());
+		if (m_settings.eRobust == SR_SIGMA_CLIP) {
+			m_clipMean.assign(uiValues, 0.0);
+			m_clipM2.assign(uiValues, 0.0);
+			m_clipCount.assign(uiValues, 0.0);
+			m_clipFloor.assign(uiValues, 0.0);
+			m_warmup.assign(m_settings.iWarmup * uiValues, 0.0);
+		}
+		else if (m_settings.eRobust == SR_MEDIAN_OF_MEANS) {
+			m_groupMean.assign(m_settings.iGroups * uiValues, 0.0);
+			m_groupCount.assign(m_settings.iGroups, 0);
+		}
+	}
+	// the grid is the key of every statistic
+	else if (uiPoints != m_uiPoints || std::memcmp(pdWavelength, m_wavelength.data(), uiPoints * sizeof(double)) != 0)
+		return -1;
+
+	m_uiCount++;
+	const double dInvN = 1.0 / (double)m_uiCount;
+	const double dK2 = m_settings.dClipSigma * m_settings.dClipSigma;
+	const size_t uiGroup = (size_t)((m_uiCount - 1) % (uint64_t)std::max(m_settings.iGroups, 1));
+	double dGroupInvN = 0.0;
+	if (m_settings.eRobust == SR_MEDIAN_OF_MEANS)
+		dGroupInvN = 1.0 / (double)++m_groupCount[uiGroup];
+
+	// a block of contiguous rows is one pass over all detectors
+	size_t d = 0;
+	while (d < m_uiDetectors) {
+		size_t uiRows = 1;
+		while (d + uiRows < m_uiDetectors && ppdRows[d + uiRows] == ppdRows[d] + uiRows * uiPoints)
+			uiRows++;
+		const double *pdX = ppdRows[d];
+		const size_t uiValues = uiRows * uiPoints;
+		welford(pdX, slice(m_mean, d), slice(m_m2, d), slice(m_min, d), slice(m_max, d), dInvN, 0, uiValues);
+		if (m_settings.eRobust == SR_SIGMA_CLIP && m_uiCount <= (uint64_t)m_settings.iWarmup)
+			std::copy(pdX, pdX + uiValues, m_warmup.data() + ((m_uiCount - 1) * m_uiDetectors + d) * uiPoints);
+		else if (m_settings.eRobust == SR_SIGMA_CLIP)
+			clip(pdX, slice(m_clipFloor, d), slice(m_clipMean, d), slice(m_clipM2, d), slice(m_clipCount, d), dK2, 2.0,
+				0, uiValues);
+		else if (m_settings.eRobust == SR_MEDIAN_OF_MEANS)
+			mean(pdX, m_groupMean.data() + (uiGroup * m_uiDetectors + d) * uiPoints, dGroupInvN, 0, uiValues);
+		d += uiRows;
+	}
+	if (m_settings.eRobust == SR_SIGMA_CLIP && m_uiCount == (uint64_t)m_settings.iWarmup)
+		seedClip();
+	return (int32_t)std::min<uint64_t>(m_uiCount, INT32_MAX);
+}
+
+void SweepStats::seedClip()
+{
+	// 1.4826 MAD estimates the standard deviation of normal noise
+	const size_t uiValues = m_uiDetectors * m_uiPoints;
+	const size_t uiWarmup = m_settings.iWarmup;
+	const double dLimit = m_settings.dClipSigma * 1.4826;
+	std::vector<double> values(uiWarmup), spread(uiWarmup);
+	for (size_t i = 0; i < uiValues; i++) {
+		for (size_t n = 0; n < uiWarmup; n++)
+			values[n] = m_warmup[n * uiValues + i];
+		std::vector<double> sorted = values;
+		std::nth_element(sorted.begin(), sorted.begin() + uiWarmup / 2, sorted.end());
+		const double dMedian = sorted[uiWarmup / 2];
+		// the smallest non-zero distance to the median stands for the
+		// quantisation step: with most values equal the MAD is 0, and a
+		// deviation below one step would reject every other level for good
+		double dStep = std::numeric_limits<double>::infinity();
+		for (size_t n = 0; n < uiWarmup; n++) {
+			spread[n] = std::fabs(values[n] - dMedian);
+			if (spread[n] > 0.0)
+				dStep = std::min(dStep, spread[n]);
+		}
+		if (dStep == std::numeric_limits<double>::infinity())
+			dStep = 0.0;
+		std::nth_element(spread.begin(), spread.begin() + uiWarmup / 2, spread.end());
+		const double dMaxDeviation = std::max(dLimit * spread[uiWarmup / 2], m_settings.dClipSigma * dStep);
+		m_clipFloor[i] = m_settings.dClipSigma * m_settings.dClipSigma * dStep * dStep;
+		double dCount = 0.0, dMean = 0.0, dM2 = 0.0;
+		for (double x : values)
+			if (std::fabs(x - dMedian) <= dMaxDeviation) {
+				dCount += 1.0;
+				double delta = x - dMean;
+				dMean += delta / dCount;
+				dM2 += delta * (x - dMean);
+			}
+		m_clipCount[i] = dCount;
+		m_clipMean[i] = dMean;
+		m_clipM2[i] = dM2;
+	}
+	m_warmup.clear();
+	m_warmup.shrink_to_fit();
+}
+
+int32_t SweepStats::get(rSweepStat eStat, double *const *ppdRows) const
+{
+	if (m_uiCount == 0 || ppdRows == nullptr)
+		return -1;
+	const size_t uiValues = m_uiDetectors * m_uiPoints;
+	for (size_t d = 0; d < m_uiDetectors; d++) {
+		double *pdOut = ppdRows[d];
+		switch (eStat) {
+		case SS_MEAN:
+			std::copy(slice(m_mean, d), slice(m_mean, d) + m_uiPoints, pdOut);
+			break;
+		case SS_STD: {
+			const double *pdM2 = slice(m_m2, d);
+			const double dInv = m_uiCount > 1 ? 1.0 / (double)(m_uiCount - 1) : 0.0;
+			for (size_t k = 0; k < m_uiPoints; k++)
+				pdOut[k] = std::sqrt(std::max(pdM2[k], 0.0) * dInv);
+			break;
+		}
+		case SS_MIN:
+			std::copy(slice(m_min, d), slice(m_min, d) + m_uiPoints, pdOut);
+			break;
+		case SS_MAX:
+			std::copy(slice(m_max, d), slice(m_max, d) + m_uiPoints, pdOut);
+			break;
+		case SS_ROBUST:
+			if (m_settings.eRobust == SR_SIGMA_CLIP && !m_warmup.empty())
+				std::copy(slice(m_mean, d), slice(m_mean, d) + m_uiPoints, pdOut);
+			else if (m_settings.eRobust == SR_SIGMA_CLIP)
+				std::copy(slice(m_clipMean, d), slice(m_clipMean, d) + m_uiPoints, pdOut);
+			else if (m_settings.eRobust == SR_MEDIAN_OF_MEANS) {
+				// groups fill in turn, so the first ones are those in use
+				const size_t uiGroups = (size_t)std::min<uint64_t>(m_uiCount, m_settings.iGroups);
+				double dMeans[1024];
+				for (size_t k = 0; k < m_uiPoints; k++) {
+					for (size_t g = 0; g < uiGroups; g++)
+						dMeans[g] = m_groupMean[g * uiValues + d * m_uiPoints + k];
+					const size_t uiMid = uiGroups / 2;
+					std::nth_element(dMeans, dMeans + uiMid, dMeans + uiGroups);
+					double dMedian = dMeans[uiMid];
+					if (uiGroups % 2 == 0)
+						dMedian = 0.5 * (dMedian + *std::max_element(dMeans, dMeans + uiMid));
+					pdOut[k] = dMedian;
+				}
+			}
+			else
+				std::copy(slice(m_mean, d), slice(m_mean, d) + m_uiPoints, pdOut);
+			break;
+		case SS_ACCEPTED:
+			if (m_settings.eRobust == SR_SIGMA_CLIP && m_warmup.empty())
+				std::copy(slice(m_clipCount, d), slice(m_clipCount, d) + m_uiPoints, pdOut);
+			else
+				std::fill(pdOut, pdOut + m_uiPoints, (double)m_uiCount);
+			break;
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+} // namespace ct400
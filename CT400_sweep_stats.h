@@ -0,0 +1,193 @@
+/******************************************************************************/
+/* Header file for CT400_sweep_stats.cpp                                      */
+/*                                                                            */
+/* Statistics of repeated sweeps, point by point on their resampled grid,    */
+/* updated in place as each sweep arrives: memory does not grow with the     */
+/* number of repeats.                                                         */
+/******************************************************************************/
+
+#ifndef CT400_SWEEP_STATS_H
+#define CT400_SWEEP_STATS_H
+
+#include "CT400_retrieve.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef enum
+  {
+	SR_NONE = 0,                    // mean, standard deviation, min and max only
+	SR_SIGMA_CLIP,                  // mean of the values within dClipSigma of it
+	SR_MEDIAN_OF_MEANS              // median of the means of iGroups interleaved groups
+  } rRobustMethod;
+
+  typedef enum
+  {
+	SS_MEAN = 0,
+	SS_STD,                         // sample standard deviation, 0 below two sweeps
+	SS_MIN,
+	SS_MAX,
+	SS_ROBUST,                      // robust mean (SS_MEAN with SR_NONE or until iWarmup sweeps)
+	SS_ACCEPTED                     // sweeps kept per point by SR_SIGMA_CLIP (else all)
+  } rSweepStat;
+
+  typedef struct
+  {
+	int32_t eRobust;                // rRobustMethod
+	int32_t iGroups;                // SR_MEDIAN_OF_MEANS: sweep i goes to group i % iGroups
+	double dClipSigma;              // SR_SIGMA_CLIP: rejection threshold, standard deviations
+	int32_t iWarmup;                // SR_SIGMA_CLIP: sweeps seeding the clipped statistics (>= 3)
+	int32_t iReserved;
+  } rStatsSettings;
+
+//------------------------------ CT400_DefaultStatsSettings --------------------
+// Function CT400_DefaultStatsSettings
+//
+//  Purpose: Sigma clipping at 3 standard deviations after 10 sweeps
+//           (median of means over 8 groups if selected)
+//
+//  Parameters: IN/OUT pSettings: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_DefaultStatsSettings(
+rStatsSettings *pSettings);
+
+//------------------------------ CT400_StatsCreate -----------------------------
+// Function CT400_StatsCreate
+//
+//  Purpose: Creates an empty accumulator; its grid is that of the first sweep
+//
+//  Parameters: IN iNbDetectors: rows of each sweep
+//              IN pSettings: robust estimate, or NULL for the defaults
+//  Returns:  uiStats for use in the other CT400_Stats functions, 0 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC uint64_t __stdcall CT400_StatsCreate(int32_t iNbDetectors,
+const rStatsSettings *pSettings);
+
+//------------------------------ CT400_StatsAdd --------------------------------
+// Function CT400_StatsAdd
+//
+//  Purpose: Adds one sweep to the statistics of every point
+//
+//  Parameters: IN uiStats: from CT400_StatsCreate
+//              IN dWavelength: wavelength axis, iArraySize values, the same
+//                              as that of the first sweep (resample other
+//                              axes first, see CT400_ResampleBlock)
+//              IN dBlock: iNbDetectors rows of iArraySize values
+//              IN iArraySize: size of the axis and of one block row
+//  Returns:  number of sweeps accumulated, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_StatsAdd(uint64_t uiStats,
+const double dWavelength[], const double dBlock[], int32_t iArraySize);
+
+//------------------------------ CT400_StatsGet --------------------------------
+// Function CT400_StatsGet
+//
+//  Purpose: Copies one statistic of every point
+//
+//  Parameters: IN uiStats: from CT400_StatsCreate
+//              IN eStat: statistic
+//              IN/OUT dWavelength: pointer over an initialized array of
+//                                  iArraySize values, or NULL
+//              IN/OUT dBlock: pointer over an initialized array of
+//                             iArraySize values per detector
+//              IN iArraySize: size of one block row
+//  Returns:  number of points (only the first iArraySize are written),
+//            -1 otherwise (e.g. no sweep yet)
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_StatsGet(uint64_t uiStats,
+rSweepStat eStat, double dWavelength[], double dBlock[], int32_t iArraySize);
+
+//------------------------------ CT400_StatsReset ------------------------------
+// Function CT400_StatsReset
+//
+//  Purpose: Forgets every sweep and the grid
+//
+//  Parameters: IN uiStats: from CT400_StatsCreate
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_StatsReset(uint64_t uiStats);
+
+//------------------------------ CT400_StatsDestroy ----------------------------
+// Function CT400_StatsDestroy
+//
+//  Parameters: IN uiStats: from CT400_StatsCreate
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_EXT_DECLSPEC int32_t __stdcall CT400_StatsDestroy(uint64_t uiStats);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+
+namespace ct400
+{
+
+//------------------------------ SweepStats ------------------------------------
+// Class SweepStats
+//
+//  Purpose: Welford mean and variance, min, max and a robust mean of each
+//           point of each detector row over any number of sweeps. All state
+//           is a few arrays the size of one sweep (iGroups more with
+//           SR_MEDIAN_OF_MEANS, iWarmup more for the first sweeps with
+//           SR_SIGMA_CLIP), updated by one vectorised pass per row.
+//           Sigma clipping tests each value against the clipped mean and
+//           deviation so far, so an outlier never enters them. They are
+//           seeded from the first iWarmup sweeps, kept until then, with the
+//           values within dClipSigma of their median (deviation from the
+//           median absolute deviation), so outliers among those are left
+//           out too. The deviation never goes below the quantisation step
+//           seen in the warmup sweeps (the MAD of quantised values is often
+//           0), and points whose kept values are all equal are not clipped.
+//           add() must not run concurrently with itself or get().
+//------------------------------------------------------------------------------
+class SweepStats
+{
+public:
+	SweepStats(size_t uiDetectors, const rStatsSettings &settings);
+
+	// Returns the number of sweeps accumulated, -1 otherwise
+	int32_t add(const double *pdWavelength, const double *const *ppdRows, size_t uiPoints);
+	int32_t add(const ScanBuffer &sweep);
+
+	// Fills uiDetectors rows of points() values. Returns 0 if success, -1
+	// otherwise
+	int32_t get(rSweepStat eStat, double *const *ppdRows) const;
+
+	void reset();
+
+	size_t detectors() const { return m_uiDetectors; }
+	size_t points() const { return m_uiPoints; }
+	uint64_t count() const { return m_uiCount; }
+	const double *wavelength() const { return m_wavelength.data(); }
+
+private:
+	// Clipped statistics from the warmup sweeps
+	void seedClip();
+
+	double *slice(AlignedVector &v, size_t d) { return v.data() + d * m_uiPoints; }
+	const double *slice(const AlignedVector &v, size_t d) const { return v.data() + d * m_uiPoints; }
+
+	size_t m_uiDetectors;
+	rStatsSettings m_settings;
+	size_t m_uiPoints = 0;
+	uint64_t m_uiCount = 0;
+	AlignedVector m_wavelength;
+	// detector-major, points() values per detector
+	AlignedVector m_mean, m_m2, m_min, m_max;
+	AlignedVector m_clipMean, m_clipM2, m_clipCount;        // SR_SIGMA_CLIP
+	AlignedVector m_clipFloor;                              // squared distance always kept
+	AlignedVector m_warmup;                                 // until iWarmup sweeps, sweep-major
+	AlignedVector m_groupMean;                              // SR_MEDIAN_OF_MEANS, group-major
+	std::vector<uint64_t> m_groupCount;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
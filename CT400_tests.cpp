@@ -0,0 +1,856 @@
+//------------------------------------------------------------------------------
+// CT400_tests.cpp
+//
+// Tests of the native extensions, run against the simulator (CT400_sim.cpp)
+// with a fixed seed and no waits. Each case prints the checks that failed and
+// its result; the exit status is the number of failed cases.
+//
+//  CT400_tests [--filter=regex] [--seed=n] [--tmp=dir] [--trace-lib=path]
+//              [--list]
+//
+// Cases:
+//   archive/query        queries against a scan of every feature, with keys
+//                        repeated across index leaves, from the index and
+//                        from memory
+//   archive/truncated    reopening after sweeps.dat lost its last records
+//   archive/failed_merge index that cannot be written by flush and close
+//   runner/resume        journal cut in the middle of a record
+//   runner/lost_result   result the results file no longer holds
+//   runner/retry         failed sweeps: retries, backoff, reinitialisation
+//   trace/round_trip     record then strict replay of simulated sweeps
+//   trace/truncated      replay of a trace cut short
+//
+// The trace cases load copies of the trace shim (--trace-lib, default
+// ./libCT400_trace.so), one per mode, and are skipped without it (POSIX
+// only).
+//------------------------------------------------------------------------------
+
+#include "CT400_archive.h"
+#include "CT400_config.h"
+#include "CT400_device.h"
+#include "CT400_job_runner.h"
+#include "CT400_retrieve.h"
+#include "CT400_sim.h"
+#include "CT400_trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#if !defined (_WIN32)
+#include <dlfcn.h>
+#endif
+
+namespace
+{
+
+struct Options
+{
+	std::string strFilter = ".*";
+	uint64_t uiSeed = 400;
+	std::string strTmp = "/tmp";
+	std::string strTraceLib = "./libCT400_trace.so";
+	bool bList = false;
+};
+
+Options g_options;
+
+// Failed checks of the running case, and why it was skipped
+size_t g_uiFailed = 0;
+std::string g_strSkipped;
+
+bool check(bool bOk, const char *pcWhat, int iLine)
+{
+	if (!bOk) {
+		std::printf("  line %d: %s\n", iLine, pcWhat);
+		g_uiFailed++;
+	}
+	return bOk;
+}
+
+#define CHECK(c) check((c), #c, __LINE__)
+
+// Empty directory of a case under --tmp
+std::string caseDirectory(const std::string &strName)
+{
+	namespace fs = std::filesystem;
+	const fs::path path = fs::path(g_options.strTmp) / ("ct400_tests_" + strName);
+	std::error_code ec;
+	fs::remove_all(path, ec);
+	fs::create_directories(path, ec);
+	return path.string();
+}
+
+// Opens a simulated CT400 without waits, seeded with --seed. Handles opened
+// later (e.g. on reinitialisation) fail sweeps with the same probability.
+// Returns the handle, 0 otherwise
+uint64_t openSim(double dErrorProbability)
+{
+	rSimConfig c;
+	CT400_SimGetConfig(0, &c);
+	c.dTimeScale = 0.0;
+	c.dErrorProbability = dErrorProbability;
+	CT400_SimSetConfig(0, &c);
+	int32_t iError = 0;
+	const uint64_t uiHandle = CT400_Init(&iError);
+	// handles are seeded with uiSeed + handle: the same noise whichever
+	// cases ran before
+	if (uiHandle && CT400_SimGetConfig(uiHandle, &c) == 0) {
+		c.uiSeed = g_options.uiSeed - uiHandle;
+		CT400_SimSetConfig(uiHandle, &c);
+	}
+	return uiHandle;
+}
+
+void closeSim(uint64_t uiHandle)
+{
+	if (uiHandle) {
+		ct400::Device::release(uiHandle);
+		CT400_Close(uiHandle);
+	}
+}
+
+//------------------------------ Sim -------------------------------------------
+// A simulated CT400 without errors
+//------------------------------------------------------------------------------
+class Sim
+{
+public:
+	Sim() : m_uiHandle(openSim(0.0)) {}
+
+	~Sim() { closeSim(m_uiHandle); }
+
+	uint64_t handle() const { return m_uiHandle; }
+
+	// Sweeps config once into wavelength and block (a row per detector).
+	// Returns 0 if success, -1 otherwise
+	int32_t sweep(const rScanConfig &config, std::vector<double> &wavelength, std::vector<double> &block)
+	{
+		const std::vector<rDetector> detectors = ct400::enabledDetectors(config);
+		char tcError[1024];
+		if (!m_uiHandle || CT400_ApplyScanConfig(m_uiHandle, &config) != 0 || CT400_ScanStart(m_uiHandle) != 0
+			|| CT400_ScanWaitEnd(m_uiHandle, tcError) != 0)
+			return -1;
+		const int32_t iPoints = CT400_GetNbDataPointsResampled(m_uiHandle);
+		if (iPoints <= 0)
+			return -1;
+		wavelength.resize((size_t)iPoints);
+		block.resize(detectors.size() * (size_t)iPoints);
+		return CT400_ScanGetResampledBlock(m_uiHandle, detectors.data(), (int32_t)detectors.size(),
+			wavelength.data(), block.data(), iPoints) == iPoints ? 0 : -1;
+	}
+
+private:
+	uint64_t m_uiHandle = 0;
+};
+
+//------------------------------ archive ---------------------------------------
+
+// A simulated sweep as ingested into an archive
+struct ArchiveSweep
+{
+	rScanConfig config;
+	std::vector<rDetector> detectors;
+	std::vector<double> wavelength;
+	std::vector<double> block;
+
+	int64_t ingest(ct400::SpectralArchive &archive, int64_t iTimestamp) const
+	{
+		std::vector<const double *> rows;
+		for (size_t r = 0; r < detectors.size(); r++)
+			rows.push_back(block.data() + r * wavelength.size());
+		return archive.ingest(config, iTimestamp, "test", wavelength.data(), detectors.data(), rows.data(),
+			detectors.size(), wavelength.size());
+	}
+};
+
+// Sweeps 1520 to 1600 nm at 10 pm on DE_1 and DE_2: about 20 resonances per
+// detector, with new noise on every sweep
+std::vector<ArchiveSweep> archiveSweeps(size_t uiSweeps)
+{
+	Sim sim;
+	std::vector<ArchiveSweep> sweeps(uiSweeps);
+	for (ArchiveSweep &s : sweeps) {
+		CT400_DefaultScanConfig(&s.config);
+		s.config.dMinWavelength = 1520.0;
+		s.config.dMaxWavelength = 1600.0;
+		s.config.uiResolution = 10;
+		s.config.eDect2 = ENABLE;
+		s.detectors = ct400::enabledDetectors(s.config);
+		if (sim.sweep(s.config, s.wavelength, s.block) != 0)
+			return std::vector<ArchiveSweep>();
+	}
+	return sweeps;
+}
+
+// Features of a query found by reading every feature
+std::vector<uint64_t> scanArchive(const ct400::SpectralArchive &archive, const rArchiveQuery &query)
+{
+	auto in = [](double d, double dLo, double dHi) {
+		return (dLo == -std::numeric_limits<double>::infinity() && dHi == std::numeric_limits<double>::infinity())
+			|| (d >= dLo && d <= dHi);
+	};
+	std::vector<uint64_t> found;
+	for (size_t i = 0; i < archive.features(); i++) {
+		rArchiveFeature f;
+		if (archive.feature(i, f) != 0)
+			break;
+		if (in(f.dWavelength, query.dMinWavelength, query.dMaxWavelength)
+			&& in(f.dExtinction, query.dMinExtinction, query.dMaxExtinction)
+			&& in(f.dFwhm, query.dMinFwhm, query.dMaxFwhm) && in(f.dQ, query.dMinQ, query.dMaxQ)
+			&& f.iTimestamp >= query.iMinTimestamp && f.iTimestamp <= query.iMaxTimestamp
+			&& (query.eInput == 0 || f.eInput == query.eInput)
+			&& (query.eDetector == 0 || f.eDetector == query.eDetector)
+			&& (query.iKinds == 0 || (f.iKind & query.iKinds) != 0))
+			found.push_back(i);
+	}
+	return found;
+}
+
+// Number of queries whose result differs from scanArchive: exact keys of
+// the first sweep (repeated by every copy of it) and random ranges
+size_t checkQueries(const ct400::SpectralArchive &archive, size_t uiRandom)
+{
+	std::vector<rArchiveQuery> queries;
+	rArchiveQuery all;
+	CT400_DefaultArchiveQuery(&all);
+	queries.push_back(all);
+	rArchiveSweep first;
+	if (archive.sweep(0, first) == 0)
+		for (int32_t i = 0; i < first.iFeatures; i++) {
+			rArchiveFeature f;
+			archive.feature(first.uiFirstFeature + i, f);
+			rArchiveQuery q = all;
+			q.dMinWavelength = q.dMaxWavelength = f.dWavelength;
+			queries.push_back(q);
+			q = all;
+			q.dMinQ = q.dMaxQ = f.dQ;
+			q.eDetector = f.eDetector;
+			queries.push_back(q);
+		}
+	std::mt19937_64 rng(g_options.uiSeed);
+	std::uniform_real_distribution<double> wavelength(1515.0, 1605.0), extinction(0.0, 30.0), q(5e3, 5e4);
+	for (size_t i = 0; i < uiRandom; i++) {
+		rArchiveQuery r = all;
+		double d0 = wavelength(rng), d1 = wavelength(rng);
+		r.dMinWavelength = std::min(d0, d1);
+		r.dMaxWavelength = std::max(d0, d1);
+		if (i % 2) {
+			r.dMinExtinction = extinction(rng);
+			r.dMaxExtinction = r.dMinExtinction + 10.0;
+		}
+		if (i % 3 == 0) {
+			r.dMinQ = q(rng);
+			r.dMaxQ = std::numeric_limits<double>::infinity();
+			r.iKinds = RK_DIP;
+		}
+		queries.push_back(r);
+	}
+
+	size_t uiWrong = 0;
+	for (const rArchiveQuery &query : queries) {
+		std::vector<uint64_t> found;
+		if (archive.query(query, found) < 0 || found != scanArchive(archive, query))
+			uiWrong++;
+	}
+	return uiWrong;
+}
+
+void archiveQuery()
+{
+	const std::string strDirectory = caseDirectory("archive_query");
+	const std::vector<ArchiveSweep> sweeps = archiveSweeps(3);
+	if (!CHECK(sweeps.size() == 3))
+		return;
+	ct400::SpectralArchive archive;
+	if (!CHECK(archive.open(strDirectory) == 0))
+		return;
+	// 600 copies of a sweep: every key of its features repeated beyond a leaf
+	for (int64_t i = 0; i < 600; i++)
+		CHECK(sweeps[i % 10 ? 0 : 1].ingest(archive, 1000 + i) == i);
+	CHECK(archive.features() > 0);
+	CHECK(checkQueries(archive, 200) == 0);
+	CHECK(archive.flush() == 0);
+	CHECK(archive.indexed() == archive.features());
+	CHECK(checkQueries(archive, 200) == 0);
+	// more copies in memory next to the index
+	for (int64_t i = 600; i < 700; i++)
+		CHECK(sweeps[i % 2 ? 0 : 2].ingest(archive, 1000 + i) == i);
+	CHECK(archive.indexed() < archive.features());
+	CHECK(checkQueries(archive, 200) == 0);
+	archive.close();
+	CHECK(archive.open(strDirectory) == 0);
+	CHECK(archive.sweeps() == 700);
+	CHECK(archive.indexed() == archive.features());
+	CHECK(checkQueries(archive, 200) == 0);
+}
+
+void archiveTruncated()
+{
+	namespace fs = std::filesystem;
+	const std::string strDirectory = caseDirectory("archive_truncated");
+	const std::vector<ArchiveSweep> sweeps = archiveSweeps(2);
+	if (!CHECK(sweeps.size() == 2))
+		return;
+	ct400::SpectralArchive archive;
+	if (!CHECK(archive.open(strDirectory) == 0))
+		return;
+	for (int64_t i = 0; i < 20; i++)
+		CHECK(sweeps[i % 2].ingest(archive, 1000 + i) == i);
+	rArchiveSweep kept;
+	CHECK(archive.sweep(11, kept) == 0);
+	archive.close();
+
+	// cut in the middle of the record of sweep 12: sweeps 12 and later go
+	const fs::path sweepsPath = fs::path(strDirectory) / "sweeps.dat";
+	std::error_code ec;
+	fs::resize_file(sweepsPath, 4096 + 12 * sizeof(rArchiveSweep) + 100, ec);
+	CHECK(!ec);
+	if (!CHECK(archive.open(strDirectory) == 0))
+		return;
+	CHECK(archive.sweeps() == 12);
+	CHECK(archive.features() == kept.uiFirstFeature + kept.iFeatures);
+	CHECK(checkQueries(archive, 50) == 0);
+	std::vector<double> wavelength, block;
+	CHECK(archive.readSweep(11, wavelength, block) == (int64_t)sweeps[1].wavelength.size());
+	CHECK(wavelength == sweeps[1].wavelength && block == sweeps[1].block);
+
+	// ingest goes on after the last complete sweep
+	CHECK(sweeps[0].ingest(archive, 2000) == 12);
+	CHECK(archive.readSweep(12, wavelength, block) == (int64_t)sweeps[0].wavelength.size());
+	CHECK(wavelength == sweeps[0].wavelength && block == sweeps[0].block);
+	archive.close();
+	CHECK(archive.open(strDirectory) == 0);
+	CHECK(archive.sweeps() == 13);
+	CHECK(checkQueries(archive, 50) == 0);
+}
+
+void archiveFailedMerge()
+{
+	namespace fs = std::filesystem;
+	const std::string strDirectory = caseDirectory("archive_failed_merge");
+	const std::vector<ArchiveSweep> sweeps = archiveSweeps(2);
+	if (!CHECK(sweeps.size() == 2))
+		return;
+	ct400::SpectralArchive archive;
+	if (!CHECK(archive.open(strDirectory) == 0))
+		return;
+	for (int64_t i = 0; i < 10; i++)
+		CHECK(sweeps[i % 2].ingest(archive, 1000 + i) == i);
+	CHECK(archive.flush() == 0);
+	const size_t uiIndexed = archive.indexed();
+	for (int64_t i = 10; i < 15; i++)
+		CHECK(sweeps[i % 2].ingest(archive, 1000 + i) == i);
+
+	// a directory in the way of the new index: the old one stays in use
+	const fs::path temp = fs::path(strDirectory) / "index.tmp";
+	std::error_code ec;
+	fs::create_directories(temp / "busy", ec);
+	CHECK(archive.flush() == -1);
+	CHECK(archive.indexed() == uiIndexed);
+	CHECK(checkQueries(archive, 50) == 0);
+	// close cannot merge either
+	const size_t uiFeatures = archive.features();
+	archive.close();
+	if (!CHECK(archive.open(strDirectory) == 0))
+		return;
+	CHECK(archive.sweeps() == 15);
+	CHECK(archive.features() == uiFeatures);
+	CHECK(checkQueries(archive, 50) == 0);
+
+	fs::remove_all(temp, ec);
+	CHECK(archive.flush() == 0);
+	CHECK(archive.indexed() == uiFeatures);
+	CHECK(checkQueries(archive, 50) == 0);
+}
+
+//------------------------------ runner ----------------------------------------
+
+// Two configurations, the second with two detectors
+std::vector<rScanConfig> runnerConfigs()
+{
+	std::vector<rScanConfig> configs(2);
+	for (size_t i = 0; i < configs.size(); i++) {
+		CT400_DefaultScanConfig(&configs[i]);
+		configs[i].dMinWavelength = 1540.0 + 10.0 * i;
+		configs[i].dMaxWavelength = 1560.0 + 10.0 * i;
+		configs[i].uiResolution = 10 * (uint32_t)(i + 1);
+		configs[i].eDect2 = i ? ENABLE : DISABLE;
+	}
+	return configs;
+}
+
+// Offset of every complete journal record, in order
+std::vector<uint64_t> journalRecords(const std::string &strPath)
+{
+	std::vector<uint64_t> offsets;
+	FILE *pFile = std::fopen(strPath.c_str(), "rb");
+	if (pFile == nullptr)
+		return offsets;
+	uint64_t uiOffset = 0;
+	ct400::JournalRecord record;
+	while (std::fread(&record, sizeof(record), 1, pFile) == 1 && std::fseek(pFile, record.uiSize, SEEK_CUR) == 0) {
+		offsets.push_back(uiOffset);
+		uiOffset += sizeof(record) + record.uiSize;
+	}
+	std::fclose(pFile);
+	return offsets;
+}
+
+// Number of jobs of runner in eState
+size_t jobsIn(const ct400::JobRunner &runner, int32_t eState)
+{
+	size_t n = 0;
+	rRunnerJob job;
+	for (size_t i = 0; runner.job(i, job) == 0; i++)
+		if (job.eState == eState)
+			n++;
+	return n;
+}
+
+// Jobs of runner whose result cannot be read
+size_t missingResults(ct400::JobRunner &runner)
+{
+	size_t n = 0;
+	rRunnerJob job;
+	std::vector<double> wavelength, block, power;
+	for (size_t i = 0; runner.job(i, job) == 0; i++)
+		if (runner.result(i, wavelength, block, power) <= 0
+			|| block.size() != wavelength.size() * (size_t)job.iNbDetectors)
+			n++;
+	return n;
+}
+
+void runnerResume()
+{
+	namespace fs = std::filesystem;
+	const std::string strDirectory = caseDirectory("runner_resume");
+	const std::string strJournal = strDirectory + "/jobs.jrn", strResults = strDirectory + "/results.swp";
+	const uint64_t uiHandle = openSim(0.0);
+	{
+		ct400::JobRunner runner(uiHandle);
+		if (!CHECK(runner.open(strJournal, strResults) == 0))
+			return;
+		CHECK(runner.setRecipe(3, {}, runnerConfigs()) == 6);
+		CHECK(runner.run() == 6);
+	}
+	// the recipe, then a result per job
+	const std::vector<uint64_t> records = journalRecords(strJournal);
+	if (!CHECK(records.size() == 7))
+		return;
+	// cut in the payload of the result of job 3
+	std::error_code ec;
+	fs::resize_file(strJournal, records[4] + sizeof(ct400::JournalRecord) + 10, ec);
+	CHECK(!ec);
+	ct400::JobRunner runner(uiHandle);
+	if (!CHECK(runner.open(strJournal, strResults) == 0))
+		return;
+	CHECK(fs::file_size(strJournal, ec) == records[4]);
+	CHECK(jobsIn(runner, JS_DONE) == 3);
+	rRunnerJob job;
+	CHECK(runner.job(3, job) == 0 && job.eState == JS_PENDING);
+	CHECK(runner.setRecipe(3, {}, runnerConfigs()) == 6);
+	rRunnerReport report;
+	CHECK(runner.run(&report) == 6);
+	CHECK(report.iSweeps == 3 && report.iRetries == 0);
+	CHECK(missingResults(runner) == 0);
+	runner.close();
+	closeSim(uiHandle);
+}
+
+void runnerLostResult()
+{
+	namespace fs = std::filesystem;
+	const std::string strDirectory = caseDirectory("runner_lost_result");
+	const std::string strJournal = strDirectory + "/jobs.jrn", strResults = strDirectory + "/results.swp";
+	const uint64_t uiHandle = openSim(0.0);
+	{
+		ct400::JobRunner runner(uiHandle);
+		if (!CHECK(runner.open(strJournal, strResults) == 0))
+			return;
+		CHECK(runner.setRecipe(3, {}, runnerConfigs()) == 6);
+		CHECK(runner.run() == 6);
+	}
+	// the results file loses the end of its last record, the result of job 5
+	std::error_code ec;
+	fs::resize_file(strResults, fs::file_size(strResults, ec) - 100, ec);
+	CHECK(!ec);
+	ct400::JobRunner runner(uiHandle);
+	if (!CHECK(runner.open(strJournal, strResults) == 0))
+		return;
+	CHECK(jobsIn(runner, JS_DONE) == 5);
+	rRunnerJob job;
+	CHECK(runner.job(5, job) == 0 && job.eState == JS_PENDING);
+	rRunnerReport report;
+	CHECK(runner.run(&report) == 6);
+	CHECK(report.iSweeps == 1);
+	CHECK(runner.job(5, job) == 0 && job.eState == JS_DONE && job.uiRecord == 5);
+	CHECK(missingResults(runner) == 0);
+	runner.close();
+	closeSim(uiHandle);
+}
+
+void runnerRetry()
+{
+	const std::string strDirectory = caseDirectory("runner_retry");
+	const uint64_t uiHandle = openSim(1.0);
+	ct400::JobRunner runner(uiHandle);
+	if (!CHECK(runner.open(strDirectory + "/jobs.jrn", strDirectory + "/results.swp") == 0))
+		return;
+	CHECK(runner.setRecipe(1, {}, runnerConfigs()) == 2);
+	rRunnerPolicy policy;
+	policy.iMaxAttempts = 4;
+	policy.iReinitAfter = 2;
+	policy.dBackoff = 0.001;
+	policy.dMaxBackoff = 0.002;
+	runner.setPolicy(policy);
+
+	// every sweep fails: each job is tried 4 times after 1, 2 and 2 ms, and
+	// the handle reopened after 2 failures in a row (once in job 0, twice
+	// in job 1 which starts after 2 failures)
+	rRunnerReport report;
+	CHECK(runner.run(&report) == 0);
+	CHECK(report.iSweeps == 8);
+	CHECK(report.iRetries == 6);
+	CHECK(report.iReinits == 3);
+	CHECK(report.iAbandoned == 2 && report.iDone == 0);
+	CHECK(std::fabs(report.dBackoffTime - 0.010) < 1e-9);
+	CHECK(report.uiHandle != 0 && report.uiHandle != uiHandle);
+	CHECK(runner.handle() == report.uiHandle);
+	rRunnerJob job;
+	CHECK(runner.job(1, job) == 0 && job.eState == JS_ABANDONED && job.iAttempts == 4);
+	rSimConfig sim;
+	CT400_SimGetConfig(report.uiHandle, &sim);
+	CHECK(job.iLastError == sim.iErrorCode && job.tcError[0] != '\0');
+
+	// the next run takes the abandoned jobs again
+	sim.dErrorProbability = 0.0;
+	CT400_SimSetConfig(report.uiHandle, &sim);
+	CHECK(runner.run(&report) == 2);
+	CHECK(report.iSweeps == 2 && report.iRetries == 0 && report.iReinits == 0);
+	CHECK(runner.job(1, job) == 0 && job.eState == JS_DONE && job.iAttempts == 5);
+	CHECK(missingResults(runner) == 0);
+	runner.close();
+	closeSim(report.uiHandle);
+}
+
+//------------------------------ trace -----------------------------------------
+
+// Calls of one sweep as a caller sees them
+struct TracedSweep
+{
+	int32_t iWait = 0;
+	std::string strError;
+	int32_t iPoints = 0;
+	std::vector<double> wavelength;
+	std::vector<double> block;                      // DE_1 then DE_2
+	int32_t iRead = 0;                              // array getters that succeeded
+
+	bool operator==(const TracedSweep &other) const
+	{
+		return iWait == other.iWait && strError == other.strError && iPoints == other.iPoints
+			&& wavelength == other.wavelength && block == other.block && iRead == other.iRead;
+	}
+};
+
+//------------------------------ TraceLib --------------------------------------
+// A copy of the trace shim loaded on its own, so that the recording and each
+// replay, whose mode is read from the environment on the first call, run in
+// one process. Its functions bind to its own definitions first (the
+// simulator is also loaded, linked to this program).
+//------------------------------------------------------------------------------
+class TraceLib
+{
+public:
+	// Copies the shim to strPath and loads it with the environment given.
+	// Returns 0 if success, -1 otherwise
+	int32_t open(const std::string &strPath, const char *pcVariable, const std::string &strTrace, bool bStrict)
+	{
+#if defined (_WIN32)
+		(void)strPath;
+		(void)pcVariable;
+		(void)strTrace;
+		(void)bStrict;
+		return -1;
+#else
+		std::error_code ec;
+		std::filesystem::copy_file(g_options.strTraceLib, strPath,
+			std::filesystem::copy_options::overwrite_existing, ec);
+		if (ec)
+			return -1;
+		m_hLib = dlopen(strPath.c_str(), RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
+		if (m_hLib == nullptr)
+			return -1;
+		// recording forwards to the simulator this program runs
+		Dl_info info;
+		if (!dladdr((void *)&CT400_Init, &info) || info.dli_fname == nullptr)
+			return -1;
+		setenv("CT400_REAL_LIB", info.dli_fname, 1);
+		unsetenv("CT400_TRACE_RECORD");
+		unsetenv("CT400_TRACE_REPLAY");
+		setenv(pcVariable, strTrace.c_str(), 1);
+		setenv("CT400_TRACE_STRICT", bStrict ? "1" : "0", 1);
+		m_init = (decltype(m_init))dlsym(m_hLib, "CT400_Init");
+		m_setLaser = (decltype(m_setLaser))dlsym(m_hLib, "CT400_SetLaser");
+		m_setScan = (decltype(m_setScan))dlsym(m_hLib, "CT400_SetScan");
+		m_setResolution = (decltype(m_setResolution))dlsym(m_hLib, "CT400_SetSamplingResolution");
+		m_setDetectors = (decltype(m_setDetectors))dlsym(m_hLib, "CT400_SetDetectorArray");
+		m_scanStart = (decltype(m_scanStart))dlsym(m_hLib, "CT400_ScanStart");
+		m_scanWaitEnd = (decltype(m_scanWaitEnd))dlsym(m_hLib, "CT400_ScanWaitEnd");
+		m_points = (decltype(m_points))dlsym(m_hLib, "CT400_GetNbDataPointsResampled");
+		m_wavelength = (decltype(m_wavelength))dlsym(m_hLib, "CT400_ScanGetWavelengthResampledArray");
+		m_detector = (decltype(m_detector))dlsym(m_hLib, "CT400_ScanGetDetectorResampledArray");
+		m_close = (decltype(m_close))dlsym(m_hLib, "CT400_Close");
+		m_stats = (decltype(m_stats))dlsym(m_hLib, "CT400_TraceGetStats");
+		if (!m_init || !m_setLaser || !m_setScan || !m_setResolution || !m_setDetectors || !m_scanStart || !m_scanWaitEnd
+			|| !m_points || !m_wavelength || !m_detector || !m_close || !m_stats)
+			return -1;
+		// the first call reads the environment
+		rTraceStats stats;
+		m_stats(&stats);
+		unsetenv(pcVariable);
+		unsetenv("CT400_TRACE_STRICT");
+		unsetenv("CT400_REAL_LIB");
+		return 0;
+#endif
+	}
+
+	// uiSweeps sweeps 1540 to 1560 nm at 10 pm on DE_1 and DE_2, then
+	// CT400_Close (which writes a recording out). before, if set, is called
+	// with the handle and the sweep number before each sweep.
+	std::vector<TracedSweep> session(size_t uiSweeps,
+		const std::function<void(uint64_t, size_t)> &before = nullptr)
+	{
+		std::vector<TracedSweep> sweeps;
+		rScanConfig c;
+		CT400_DefaultScanConfig(&c);
+		int32_t iError = 0;
+		const uint64_t uiHandle = m_init(&iError);
+		m_setLaser(uiHandle, c.eInput, c.eEnable, c.iGPIBAdress, c.eLaserType, c.dLaserMinWavelength,
+			c.dLaserMaxWavelength, c.iSpeed);
+		m_setScan(uiHandle, c.dPower, 1540.0, 1560.0);
+		m_setResolution(uiHandle, 10);
+		m_setDetectors(uiHandle, ENABLE, DISABLE, DISABLE, DISABLE);
+		for (size_t i = 0; i < uiSweeps; i++) {
+			TracedSweep sweep;
+			char tcError[1024] = "";
+			if (before)
+				before(uiHandle, i);
+			m_scanStart(uiHandle);
+			sweep.iWait = m_scanWaitEnd(uiHandle, tcError);
+			sweep.strError = tcError;
+			sweep.iPoints = m_points(uiHandle);
+			const int32_t iPoints = std::max(sweep.iPoints, 0);
+			sweep.wavelength.assign((size_t)iPoints, 0.0);
+			sweep.block.assign(2 * (size_t)iPoints, 0.0);
+			sweep.iRead += m_wavelength(uiHandle, sweep.wavelength.data(), iPoints) > 0;
+			sweep.iRead += m_detector(uiHandle, DE_1, sweep.block.data(), iPoints) > 0;
+			sweep.iRead += m_detector(uiHandle, DE_2, sweep.block.data() + iPoints, iPoints) > 0;
+			sweeps.push_back(sweep);
+		}
+		m_close(uiHandle);
+		return sweeps;
+	}
+
+	rTraceStats stats() const
+	{
+		rTraceStats stats;
+		std::memset(&stats, 0, sizeof(stats));
+		if (m_stats)
+			m_stats(&stats);
+		return stats;
+	}
+
+private:
+	void *m_hLib = nullptr;
+	uint64_t (__stdcall *m_init)(int32_t *) = nullptr;
+	int32_t (__stdcall *m_setLaser)(uint64_t, rLaserInput, rEnable, int32_t, rLaserSource, double, double,
+		int32_t) = nullptr;
+	int32_t (__stdcall *m_setScan)(uint64_t, double, double, double) = nullptr;
+	int32_t (__stdcall *m_setResolution)(uint64_t, uint32_t) = nullptr;
+	int32_t (__stdcall *m_setDetectors)(uint64_t, rEnable, rEnable, rEnable, rEnable) = nullptr;
+	int32_t (__stdcall *m_scanStart)(uint64_t) = nullptr;
+	int32_t (__stdcall *m_scanWaitEnd)(uint64_t, char *) = nullptr;
+	int32_t (__stdcall *m_points)(uint64_t) = nullptr;
+	int32_t (__stdcall *m_wavelength)(uint64_t, double *, int32_t) = nullptr;
+	int32_t (__stdcall *m_detector)(uint64_t, rDetector, double *, int32_t) = nullptr;
+	int32_t (__stdcall *m_close)(uint64_t) = nullptr;
+	int32_t (__stdcall *m_stats)(rTraceStats *) = nullptr;
+};
+
+// Records 9 sweeps, every third of which fails, into strTrace. Returns them,
+// none if the shim cannot be loaded (the case is then skipped)
+std::vector<TracedSweep> recordTrace(const std::string &strDirectory, const std::string &strTrace)
+{
+	std::error_code ec;
+	if (!std::filesystem::exists(g_options.strTraceLib, ec)) {
+		g_strSkipped = "no " + g_options.strTraceLib;
+		return std::vector<TracedSweep>();
+	}
+	rSimConfig c;
+	CT400_SimGetConfig(0, &c);
+	c.dTimeScale = 0.0;
+	c.dErrorProbability = 0.0;
+	CT400_SimSetConfig(0, &c);
+	TraceLib recorder;
+	std::vector<TracedSweep> sweeps;
+	if (CHECK(recorder.open(strDirectory + "/record.so", "CT400_TRACE_RECORD", strTrace, false) == 0)) {
+		// the shim forwards to the simulator of this program, tuned directly
+		sweeps = recorder.session(9, [](uint64_t uiHandle, size_t i) {
+			rSimConfig sim;
+			CT400_SimGetConfig(uiHandle, &sim);
+			sim.uiSeed = g_options.uiSeed - uiHandle;
+			sim.dErrorProbability = i % 3 == 2 ? 1.0 : 0.0;
+			CT400_SimSetConfig(uiHandle, &sim);
+		});
+		CHECK(recorder.stats().eMode == TM_RECORD);
+	}
+	return sweeps;
+}
+
+void traceRoundTrip()
+{
+	const std::string strDirectory = caseDirectory("trace_round_trip");
+	const std::string strTrace = strDirectory + "/session.trace";
+	const std::vector<TracedSweep> recorded = recordTrace(strDirectory, strTrace);
+	if (recorded.empty())
+		return;
+	for (size_t i = 0; i < recorded.size(); i++)
+		CHECK(i % 3 == 2 ? recorded[i].iWait != 0 && !recorded[i].strError.empty()
+			: recorded[i].iWait == 0 && recorded[i].iPoints == 2001 && recorded[i].iRead == 3);
+
+	TraceLib player;
+	if (!CHECK(player.open(strDirectory + "/replay.so", "CT400_TRACE_REPLAY", strTrace, true) == 0))
+		return;
+	const std::vector<TracedSweep> replayed = player.session(recorded.size());
+	CHECK(replayed.size() == recorded.size());
+	for (size_t i = 0; i < std::min(replayed.size(), recorded.size()); i++)
+		CHECK(replayed[i] == recorded[i]);
+	const rTraceStats stats = player.stats();
+	CHECK(stats.eMode == TM_REPLAY);
+	CHECK(stats.uiMismatches == 0 && stats.uiMissing == 0);
+	CHECK(stats.uiCalls == stats.uiRecords);
+}
+
+void traceTruncated()
+{
+	namespace fs = std::filesystem;
+	const std::string strDirectory = caseDirectory("trace_truncated");
+	const std::string strTrace = strDirectory + "/session.trace";
+	const std::vector<TracedSweep> recorded = recordTrace(strDirectory, strTrace);
+	if (recorded.empty())
+		return;
+	std::error_code ec;
+	const uint64_t uiSize = fs::file_size(strTrace, ec);
+	fs::resize_file(strTrace, uiSize / 2, ec);
+	CHECK(!ec);
+
+	// the calls before the cut are answered as recorded, the others fail
+	TraceLib player;
+	if (!CHECK(player.open(strDirectory + "/replay.so", "CT400_TRACE_REPLAY", strTrace, true) == 0))
+		return;
+	const std::vector<TracedSweep> replayed = player.session(recorded.size());
+	const rTraceStats stats = player.stats();
+	CHECK(stats.eMode == TM_REPLAY);
+	CHECK(stats.uiRecords > 0 && stats.uiBytes == uiSize / 2);
+	CHECK(stats.uiMissing > 0 && stats.uiMismatches == 0);
+	size_t uiSame = 0;
+	while (uiSame < replayed.size() && replayed[uiSame] == recorded[uiSame])
+		uiSame++;
+	CHECK(uiSame > 0 && uiSame < recorded.size());
+	for (size_t i = uiSame + 1; i < replayed.size(); i++)
+		CHECK(replayed[i].iRead == 0 && replayed[i].iPoints < 0);
+}
+
+struct Case
+{
+	std::string strName;
+	std::function<void()> fn;
+};
+
+std::vector<Case> cases()
+{
+	std::vector<Case> c;
+	c.push_back({ "archive/query", archiveQuery });
+	c.push_back({ "archive/truncated", archiveTruncated });
+	c.push_back({ "archive/failed_merge", archiveFailedMerge });
+	c.push_back({ "runner/resume", runnerResume });
+	c.push_back({ "runner/lost_result", runnerLostResult });
+	c.push_back({ "runner/retry", runnerRetry });
+	c.push_back({ "trace/round_trip", traceRoundTrip });
+	c.push_back({ "trace/truncated", traceTruncated });
+	return c;
+}
+
+bool parseOptions(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		std::string strArg = argv[i];
+		size_t uiEq = strArg.find('=');
+		std::string strKey = strArg.substr(0, uiEq);
+		std::string strValue = uiEq == std::string::npos ? std::string() : strArg.substr(uiEq + 1);
+		if (strKey == "--filter")
+			g_options.strFilter = strValue;
+		else if (strKey == "--seed")
+			g_options.uiSeed = std::strtoull(strValue.c_str(), nullptr, 10);
+		else if (strKey == "--tmp")
+			g_options.strTmp = strValue;
+		else if (strKey == "--trace-lib")
+			g_options.strTraceLib = strValue;
+		else if (strKey == "--list")
+			g_options.bList = true;
+		else {
+			std::fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	if (!parseOptions(argc, argv))
+		return 2;
+	std::regex filter;
+	try {
+		filter = std::regex(g_options.strFilter);
+	}
+	catch (const std::regex_error &) {
+		std::fprintf(stderr, "Invalid filter %s\n", g_options.strFilter.c_str());
+		return 2;
+	}
+
+	int iFailed = 0;
+	for (const Case &c : cases()) {
+		if (!std::regex_search(c.strName, filter))
+			continue;
+		if (g_options.bList) {
+			std::printf("%s\n", c.strName.c_str());
+			continue;
+		}
+		std::printf("%s\n", c.strName.c_str());
+		std::fflush(stdout);
+		g_uiFailed = 0;
+		g_strSkipped.clear();
+		c.fn();
+		if (!g_uiFailed && !g_strSkipped.empty())
+			std::printf("%-44s skipped: %s\n", c.strName.c_str(), g_strSkipped.c_str());
+		else
+			std::printf("%-44s %s\n", c.strName.c_str(), g_uiFailed ? "FAILED" : "ok");
+		std::fflush(stdout);
+		if (g_uiFailed)
+			iFailed++;
+	}
+	return iFailed;
+}
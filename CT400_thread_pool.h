@@ -0,0 +1,159 @@
+/******************************************************************************/
+/* Worker pool used by the native CT400 extensions                            */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef CT400_THREAD_POOL_H
+#define CT400_THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ct400
+{
+
+//------------------------------ ThreadPool ------------------------------------
+// Class ThreadPool
+//
+//  Purpose: Fixed set of worker threads fed from one task queue. With
+//           uiMaxPending > 0 the queue is bounded and post() blocks while it
+//           is full, which gives producers back-pressure.
+//------------------------------------------------------------------------------
+class ThreadPool
+{
+public:
+	explicit ThreadPool(size_t uiThreads = 0, size_t uiMaxPending = 0)
+		: m_uiMaxPending(uiMaxPending)
+	{
+		if (uiThreads == 0)
+			uiThreads = std::max(1u, std::thread::hardware_concurrency());
+		for (size_t i = 0; i < uiThreads; i++)
+			m_threads.emplace_back([this] { run(); });
+	}
+
+	// Runs the tasks already queued, then joins the workers
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_bStop = true;
+		}
+		m_cvTask.notify_all();
+		m_cvSpace.notify_all();
+		for (std::thread &thread : m_threads)
+			thread.join();
+	}
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	size_t size() const { return m_threads.size(); }
+
+	// Queues a task, waiting for space if the queue is bounded and full
+	void post(std::function<void()> task)
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_cvSpace.wait(lock, [this] { return m_bStop || m_uiMaxPending == 0 || m_tasks.size() < m_uiMaxPending; });
+		m_tasks.push_back(std::move(task));
+		lock.unlock();
+		m_cvTask.notify_one();
+	}
+
+	// Queues a task if there is space, returns false otherwise
+	bool tryPost(std::function<void()> task)
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		if (m_bStop || (m_uiMaxPending != 0 && m_tasks.size() >= m_uiMaxPending))
+			return false;
+		m_tasks.push_back(std::move(task));
+		lock.unlock();
+		m_cvTask.notify_one();
+		return true;
+	}
+
+	// Blocks until the queue is empty and no task is running
+	void waitIdle()
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_cvIdle.wait(lock, [this] { return m_tasks.empty() && m_uiRunning == 0; });
+	}
+
+	// Calls fn(i) for every i in [0, uiCount) on the pool and the calling
+	// thread, and returns once all calls are done. Safe to call from a task.
+	template <class Fn>
+	void parallelFor(size_t uiCount, Fn fn)
+	{
+		if (uiCount == 0)
+			return;
+		struct Shared
+		{
+			std::atomic<size_t> uiNext{ 0 };
+			std::atomic<size_t> uiDone{ 0 };
+			std::mutex mtx;
+			std::condition_variable cv;
+		};
+		auto shared = std::make_shared<Shared>();
+		auto work = [shared, uiCount, &fn] {
+			size_t i;
+			while ((i = shared->uiNext.fetch_add(1)) < uiCount) {
+				fn(i);
+				if (shared->uiDone.fetch_add(1) + 1 == uiCount) {
+					std::lock_guard<std::mutex> lock(shared->mtx);
+					shared->cv.notify_all();
+				}
+			}
+		};
+		size_t uiHelpers = std::min(uiCount - 1, m_threads.size());
+		for (size_t i = 0; i < uiHelpers; i++)
+			if (!tryPost(work))
+				break;
+		work();
+		std::unique_lock<std::mutex> lock(shared->mtx);
+		shared->cv.wait(lock, [&] { return shared->uiDone.load() == uiCount; });
+	}
+
+private:
+	void run()
+	{
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(m_mtx);
+				m_cvTask.wait(lock, [this] { return m_bStop || !m_tasks.empty(); });
+				if (m_tasks.empty())
+					return;
+				task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+				m_uiRunning++;
+			}
+			m_cvSpace.notify_one();
+			task();
+			{
+				std::lock_guard<std::mutex> lock(m_mtx);
+				m_uiRunning--;
+				if (m_tasks.empty() && m_uiRunning == 0)
+					m_cvIdle.notify_all();
+			}
+		}
+	}
+
+	std::mutex m_mtx;
+	std::condition_variable m_cvTask, m_cvSpace, m_cvIdle;
+	std::deque<std::function<void()> > m_tasks;
+	std::vector<std::thread> m_threads;
+	size_t m_uiMaxPending;
+	size_t m_uiRunning = 0;
+	bool m_bStop = false;
+};
+
+} // namespace ct400
+
+
+#endif
@@ -0,0 +1,368 @@
+//------------------------------------------------------------------------------
+// CT400_trace.cpp
+//
+// Trace file writer and reader. Built into libCT400_trace with
+// CT400_trace_shim.cpp (see README.md). Records are a few varints around the
+// call's own data, so a trace costs little more than the arrays it holds,
+// and those shrink to their XOR/RLE code or to a reference when repeated.
+//------------------------------------------------------------------------------
+
+#include "CT400_trace.h"
+#include "CT400_xor_rle.h"
+
+#include <cstring>
+
+namespace ct400
+{
+
+namespace
+{
+
+void putVarintTo(std::vector<uint8_t> &out, uint64_t uiValue)
+{
+	while (uiValue >= 0x80) {
+		out.push_back((uint8_t)(uiValue | 0x80));
+		uiValue >>= 7;
+	}
+	out.push_back((uint8_t)uiValue);
+}
+
+void putSignedTo(std::vector<uint8_t> &out, int64_t iValue)
+{
+	putVarintTo(out, ((uint64_t)iValue << 1) ^ (uint64_t)(iValue >> 63));
+}
+
+void putRawTo(std::vector<uint8_t> &out, const void *p, size_t uiSize)
+{
+	const uint8_t *pc = static_cast<const uint8_t *>(p);
+	out.insert(out.end(), pc, pc + uiSize);
+}
+
+int64_t microseconds(TraceWriter::Clock::duration d)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+} // namespace
+
+
+//------------------------------ TraceBuffer -----------------------------------
+
+void TraceBuffer::putVarint(uint64_t uiValue)
+{
+	putVarintTo(m_bytes, uiValue);
+}
+
+void TraceBuffer::putSigned(int64_t iValue)
+{
+	putSignedTo(m_bytes, iValue);
+}
+
+void TraceBuffer::putDouble(double dValue)
+{
+	putRawTo(m_bytes, &dValue, sizeof(dValue));
+}
+
+void TraceBuffer::putString(const char *pcValue)
+{
+	const size_t uiLength = pcValue ? std::strlen(pcValue) : 0;
+	putVarint(uiLength);
+	putRawTo(m_bytes, pcValue, uiLength);
+}
+
+void TraceBuffer::setArray(const double *pdValues, size_t uiCount, int64_t iKey)
+{
+	m_pdArray = pdValues;
+	m_uiArrayCount = uiCount;
+	m_iArrayKey = iKey;
+}
+
+
+//------------------------------ TraceCursor -----------------------------------
+
+uint64_t TraceCursor::getVarint()
+{
+	uint64_t uiValue = 0;
+	for (unsigned uiShift = 0; uiShift < 64; uiShift += 7) {
+		if (m_p == m_pEnd)
+			break;
+		const uint8_t c = *m_p++;
+		uiValue |= (uint64_t)(c & 0x7F) << uiShift;
+		if ((c & 0x80) == 0)
+			return uiValue;
+	}
+	m_bOk = false;
+	m_p = m_pEnd;
+	return 0;
+}
+
+int64_t TraceCursor::getSigned()
+{
+	const uint64_t uiValue = getVarint();
+	return (int64_t)(uiValue >> 1) ^ -(int64_t)(uiValue & 1);
+}
+
+double TraceCursor::getDouble()
+{
+	double dValue = 0.0;
+	Span<const uint8_t> bytes = getBytes(sizeof(dValue));
+	if (!bytes.empty())
+		std::memcpy(&dValue, bytes.data(), sizeof(dValue));
+	return dValue;
+}
+
+void TraceCursor::getString(char *pcValue, size_t uiSize)
+{
+	Span<const uint8_t> text = getBytes((size_t)getVarint());
+	if (pcValue == nullptr || uiSize == 0)
+		return;
+	const size_t uiLength = std::min(text.size(), uiSize - 1);
+	std::memcpy(pcValue, text.data(), uiLength);
+	pcValue[uiLength] = '\0';
+}
+
+Span<const uint8_t> TraceCursor::getBytes(size_t uiSize)
+{
+	if (!m_bOk || (size_t)(m_pEnd - m_p) < uiSize) {
+		m_bOk = false;
+		m_p = m_pEnd;
+		return Span<const uint8_t>();
+	}
+	Span<const uint8_t> bytes(m_p, uiSize);
+	m_p += uiSize;
+	return bytes;
+}
+
+
+//------------------------------ TraceWriter -----------------------------------
+
+int32_t TraceWriter::open(const std::string &strPath)
+{
+	close();
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_pFile = std::fopen(strPath.c_str(), "wb");
+	if (m_pFile == nullptr)
+		return -1;
+	m_buffer.resize(1 << 20);
+	std::setvbuf(m_pFile, m_buffer.data(), _IOFBF, m_buffer.size());
+	uint8_t header[TRACE_HEADER_SIZE] = {};
+	std::memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	std::memcpy(header + 8, &TRACE_VERSION, sizeof(TRACE_VERSION));
+	if (std::fwrite(header, sizeof(header), 1, m_pFile) != 1) {
+		std::fclose(m_pFile);
+		m_pFile = nullptr;
+		return -1;
+	}
+	m_uiOffset = sizeof(header);
+	m_uiRecords = 0;
+	m_lastArrays.clear();
+	return 0;
+}
+
+void TraceWriter::close()
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	if (m_pFile == nullptr)
+		return;
+	std::fclose(m_pFile);
+	m_pFile = nullptr;
+	m_lastArrays.clear();
+}
+
+int32_t TraceWriter::flush()
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_pFile && std::fflush(m_pFile) == 0 ? 0 : -1;
+}
+
+bool TraceWriter::isOpen() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_pFile != nullptr;
+}
+
+uint64_t TraceWriter::records() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_uiRecords;
+}
+
+uint64_t TraceWriter::bytes() const
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	return m_uiOffset;
+}
+
+void TraceWriter::encodeArray(ApiFunction eFunction, uint64_t uiHandle, const TraceBuffer &outputs,
+	LastArray *&pLast)
+{
+	const double *pdValues = outputs.array();
+	const size_t uiCount = outputs.arrayCount();
+	LastArray &last = m_lastArrays[std::make_tuple((int)eFunction, uiHandle, outputs.arrayKey())];
+	if (last.uiOffset != 0 && last.values.size() == uiCount
+		&& std::memcmp(last.values.data(), pdValues, uiCount * sizeof(double)) == 0) {
+		m_payload.push_back(TA_REPEAT);
+		putVarintTo(m_payload, last.uiOffset);
+		return;
+	}
+
+	const uint8_t *pData = reinterpret_cast<const uint8_t *>(pdValues);
+	const size_t uiRawSize = uiCount * sizeof(double);
+	encodeXorRle(pData, uiCount, sizeof(double), m_encoded);
+	const bool bRaw = m_encoded.size() >= uiRawSize;
+	m_payload.push_back(bRaw ? TA_RAW : TA_XOR_RLE);
+	putVarintTo(m_payload, uiCount);
+	if (bRaw) {
+		putVarintTo(m_payload, uiRawSize);
+		putRawTo(m_payload, pData, uiRawSize);
+	}
+	else {
+		putVarintTo(m_payload, m_encoded.size());
+		putRawTo(m_payload, m_encoded.data(), m_encoded.size());
+	}
+	last.values.assign(pdValues, pdValues + uiCount);
+	pLast = &last;
+}
+
+void TraceWriter::append(ApiFunction eFunction, uint64_t uiHandle, int64_t iResult, Clock::time_point tStart,
+	Clock::time_point tEnd, const TraceBuffer &inputs, const TraceBuffer &outputs)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	if (m_pFile == nullptr)
+		return;
+
+	LastArray *pLast = nullptr;
+	m_payload.clear();
+	if (outputs.array())
+		encodeArray(eFunction, uiHandle, outputs, pLast);
+
+	m_record.clear();
+	m_record.push_back((uint8_t)eFunction);
+	putSignedTo(m_record, m_uiRecords ? microseconds(tStart - m_tPrevious) : 0);
+	putVarintTo(m_record, (uint64_t)microseconds(tEnd - tStart));
+	putVarintTo(m_record, uiHandle);
+	putSignedTo(m_record, iResult);
+	putVarintTo(m_record, inputs.bytes().size());
+	putRawTo(m_record, inputs.bytes().data(), inputs.bytes().size());
+	putVarintTo(m_record, outputs.bytes().size() + m_payload.size());
+	putRawTo(m_record, outputs.bytes().data(), outputs.bytes().size());
+	const uint64_t uiArrayOffset = m_uiOffset + m_record.size();
+	putRawTo(m_record, m_payload.data(), m_payload.size());
+
+	if (std::fwrite(m_record.data(), m_record.size(), 1, m_pFile) != 1) {
+		// e.g. disk full: the trace ends with the last complete record
+		std::fclose(m_pFile);
+		m_pFile = nullptr;
+		return;
+	}
+	m_uiOffset += m_record.size();
+	m_uiRecords++;
+	m_tPrevious = tStart;
+	if (pLast)
+		pLast->uiOffset = uiArrayOffset;
+}
+
+
+//------------------------------ TraceReader -----------------------------------
+
+int32_t TraceReader::open(const std::string &strPath)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	m_records.clear();
+	m_queues.clear();
+	if (m_file.open(strPath) != 0)
+		return -1;
+	uint32_t uiVersion = 0;
+	if (m_file.size() < TRACE_HEADER_SIZE)
+		return -1;
+	std::memcpy(&uiVersion, m_file.data() + 8, sizeof(uiVersion));
+	if (std::memcmp(m_file.data(), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || uiVersion != TRACE_VERSION)
+		return -1;
+
+	TraceCursor cursor(m_file.data() + TRACE_HEADER_SIZE, m_file.size() - TRACE_HEADER_SIZE);
+	int64_t iStartUs = 0;
+	while (!cursor.atEnd()) {
+		Span<const uint8_t> function = cursor.getBytes(1);
+		TraceRecord r;
+		iStartUs += cursor.getSigned();
+		r.iStartUs = iStartUs;
+		r.uiDurationUs = cursor.getVarint();
+		r.uiHandle = cursor.getVarint();
+		r.iResult = cursor.getSigned();
+		r.inputs = cursor.getBytes((size_t)cursor.getVarint());
+		r.outputs = cursor.getBytes((size_t)cursor.getVarint());
+		if (!cursor.ok() || function[0] >= NB_API_FUNCTIONS)
+			break;
+		r.eFunction = (ApiFunction)function[0];
+		m_queues[std::make_pair(r.uiHandle, (int)r.eFunction)].records.push_back(m_records.size());
+		m_records.push_back(r);
+	}
+	return 0;
+}
+
+const TraceRecord *TraceReader::next(uint64_t uiHandle, ApiFunction eFunction)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	auto it = m_queues.find(std::make_pair(uiHandle, (int)eFunction));
+	if (it == m_queues.end() || it->second.uiNext == it->second.records.size())
+		return nullptr;
+	return &m_records[it->second.records[it->second.uiNext++]];
+}
+
+void TraceReader::rewind()
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	for (auto &queue : m_queues)
+		queue.second.uiNext = 0;
+}
+
+int64_t TraceReader::readArray(TraceCursor &cursor, double *pdValues, size_t uiSize) const
+{
+	Span<const uint8_t> encoding = cursor.getBytes(1);
+	if (!cursor.ok())
+		return -1;
+	TraceCursor referenced;
+	TraceCursor *pStored = &cursor;
+	if (encoding[0] == TA_REPEAT) {
+		const uint64_t uiOffset = cursor.getVarint();
+		if (!cursor.ok() || uiOffset < TRACE_HEADER_SIZE || uiOffset >= m_file.size())
+			return -1;
+		referenced = TraceCursor(m_file.data() + uiOffset, m_file.size() - (size_t)uiOffset);
+		pStored = &referenced;
+		encoding = referenced.getBytes(1);
+	}
+	const uint64_t uiCount = pStored->getVarint();
+	Span<const uint8_t> data = pStored->getBytes((size_t)pStored->getVarint());
+	if (!pStored->ok())
+		return -1;
+
+	const size_t uiCopy = (size_t)std::min<uint64_t>(uiCount, uiSize);
+	if (encoding[0] == TA_RAW) {
+		if (data.size() != uiCount * sizeof(double))
+			return -1;
+		if (uiCopy)
+			std::memcpy(pdValues, data.data(), uiCopy * sizeof(double));
+	}
+	else if (encoding[0] == TA_XOR_RLE) {
+		// a token expands to at most 128 bytes
+		if (uiCount * sizeof(double) > data.size() * 128)
+			return -1;
+		if (uiCopy == uiCount) {
+			if (!decodeXorRle(data.data(), data.size(), uiCount, sizeof(double), (uint8_t *)pdValues))
+				return -1;
+		}
+		else {
+			std::vector<double> values((size_t)uiCount);
+			if (!decodeXorRle(data.data(), data.size(), values.size(), sizeof(double), (uint8_t *)values.data()))
+				return -1;
+			if (uiCopy)
+				std::memcpy(pdValues, values.data(), uiCopy * sizeof(double));
+		}
+	}
+	else {
+		return -1;
+	}
+	return (int64_t)uiCount;
+}
+
+} // namespace ct400
@@ -0,0 +1,273 @@
+/******************************************************************************/
+/* Header file for CT400_trace.cpp and CT400_trace_shim.cpp                   */
+/*                                                                            */
+/* Call traces. libCT400_trace exports every function of CT400_lib.h; with   */
+/* CT400_TRACE_RECORD set it forwards each call to the real library and      */
+/* appends its arguments, result and outputs (CT400_ScanWaitEnd error text,  */
+/* array contents...) to a binary trace, with CT400_TRACE_REPLAY set it      */
+/* answers every call from such a trace, without a CT400 or CT400_lib.       */
+/******************************************************************************/
+
+#ifndef CT400_TRACE_H
+#define CT400_TRACE_H
+
+#include "CT400_api.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  typedef enum
+  {
+	TM_OFF = 0,                     // calls forwarded, not recorded
+	TM_RECORD,                      // calls forwarded and recorded
+	TM_REPLAY                       // calls answered from the trace
+  } rTraceMode;
+
+  typedef struct
+  {
+	int32_t eMode;                  // rTraceMode
+	int32_t iReserved;
+	uint64_t uiCalls;               // calls recorded, or answered from the trace
+	uint64_t uiMismatches;          // replay: calls whose inputs differ from the recorded ones
+	uint64_t uiMissing;             // replay: calls failed for lack of a recorded one
+	uint64_t uiRecords;             // replay: records of the trace
+	uint64_t uiBytes;               // size of the trace
+  } rTraceStats;
+
+//------------------------------ CT400_TraceGetStats ---------------------------
+// Function CT400_TraceGetStats
+//
+//  Purpose: Returns the counters of the recording or replay
+//
+//  Parameters: IN/OUT pStats: pointer over a variable
+//  Returns:  0 if success, -1 otherwise
+//------------------------------------------------------------------------------
+_DECLSPEC int32_t __stdcall CT400_TraceGetStats(rTraceStats *pStats);
+
+//------------------------------ CT400_TraceFlush ------------------------------
+// Function CT400_TraceFlush
+//
+//  Purpose: Writes the calls recorded so far to the trace file. This is also
+//           done after each CT400_Close and when the library is unloaded.
+//
+//  Returns:  0 if success, -1 otherwise (e.g. not recording)
+//------------------------------------------------------------------------------
+_DECLSPEC int32_t __stdcall CT400_TraceFlush();
+
+#ifdef __cplusplus
+}
+
+#include "CT400_mmap.h"
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace ct400
+{
+
+// Trace file layout, integers little-endian, varints LEB128 (zigzag for
+// signed values):
+//   header   "CT4TRACE", uint32 version, uint32 reserved
+//   record   uint8 function (ApiFunction)
+//            varint start, us after the start of the previous record (signed)
+//            varint duration, us
+//            varint handle
+//            varint result (signed)
+//            varint size, inputs: the arguments in order, integers as
+//                     varints, doubles as 8 bytes, strings as varint size and
+//                     characters; arguments the call writes are left out
+//            varint size, outputs: values the call wrote, as for the inputs,
+//                     then for the array getters the array:
+//   array    uint8 TA_RAW or TA_XOR_RLE, varint count, varint size, data
+//            or uint8 TA_REPEAT, varint file offset of an earlier array
+//            with the same contents
+const char TRACE_MAGIC[8] = { 'C', 'T', '4', 'T', 'R', 'A', 'C', 'E' };
+const uint32_t TRACE_VERSION = 1;
+const size_t TRACE_HEADER_SIZE = 16;
+
+enum TraceArray
+{
+	TA_RAW = 0,
+	TA_XOR_RLE,
+	TA_REPEAT
+};
+
+//------------------------------ TraceBuffer -----------------------------------
+// Inputs or outputs of one call, as they are written to the trace
+//------------------------------------------------------------------------------
+class TraceBuffer
+{
+public:
+	void putVarint(uint64_t uiValue);
+	void putSigned(int64_t iValue);
+	void putDouble(double dValue);
+	void putString(const char *pcValue);
+
+	// Array returned by the call, encoded after the other outputs by
+	// TraceWriter::append (not copied: it must outlive the append). iKey
+	// tells apart the arrays of one function on one handle (e.g. detector).
+	void setArray(const double *pdValues, size_t uiCount, int64_t iKey);
+
+	const std::vector<uint8_t> &bytes() const { return m_bytes; }
+	const double *array() const { return m_pdArray; }
+	size_t arrayCount() const { return m_uiArrayCount; }
+	int64_t arrayKey() const { return m_iArrayKey; }
+
+private:
+	std::vector<uint8_t> m_bytes;
+	const double *m_pdArray = nullptr;
+	size_t m_uiArrayCount = 0;
+	int64_t m_iArrayKey = 0;
+};
+
+//------------------------------ TraceCursor -----------------------------------
+// Reads the values of a TraceBuffer back; a read past the end returns 0 and
+// clears ok()
+//------------------------------------------------------------------------------
+class TraceCursor
+{
+public:
+	TraceCursor() {}
+	TraceCursor(const uint8_t *pData, size_t uiSize) : m_p(pData), m_pEnd(pData + uiSize) {}
+
+	uint64_t getVarint();
+	int64_t getSigned();
+	double getDouble();
+	// Copies a string into pcValue (at most uiSize characters with the 0)
+	void getString(char *pcValue, size_t uiSize);
+	Span<const uint8_t> getBytes(size_t uiSize);
+
+	bool ok() const { return m_bOk; }
+	bool atEnd() const { return m_p == m_pEnd; }
+	const uint8_t *position() const { return m_p; }
+
+private:
+	const uint8_t *m_p = nullptr;
+	const uint8_t *m_pEnd = nullptr;
+	bool m_bOk = true;
+};
+
+//------------------------------ TraceWriter -----------------------------------
+// Class TraceWriter
+//
+//  Purpose: Appends calls to a trace file through a 1 MB stdio buffer.
+//           Arrays are stored XOR/RLE coded (CT400_xor_rle.h) when that is
+//           smaller, and an array equal to the previous one of the same
+//           function, handle and key (e.g. the resampled wavelength axis of
+//           each sweep with unchanged settings) as a reference to it.
+//           append() may be called from any thread; records are in the order
+//           the calls returned.
+//------------------------------------------------------------------------------
+class TraceWriter
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	TraceWriter() {}
+	~TraceWriter() { close(); }
+
+	TraceWriter(const TraceWriter &) = delete;
+	TraceWriter &operator=(const TraceWriter &) = delete;
+
+	// Returns 0 if success, -1 otherwise (the file is replaced)
+	int32_t open(const std::string &strPath);
+	void close();
+	// Returns 0 if success, -1 otherwise
+	int32_t flush();
+
+	void append(ApiFunction eFunction, uint64_t uiHandle, int64_t iResult, Clock::time_point tStart,
+		Clock::time_point tEnd, const TraceBuffer &inputs, const TraceBuffer &outputs);
+
+	bool isOpen() const;
+	uint64_t records() const;
+	uint64_t bytes() const;
+
+private:
+	struct LastArray
+	{
+		std::vector<double> values;
+		uint64_t uiOffset = 0;
+	};
+
+	// Fills m_payload; pLast: entry to point at the new array once written
+	void encodeArray(ApiFunction eFunction, uint64_t uiHandle, const TraceBuffer &outputs,
+		LastArray *&pLast);
+
+	mutable std::mutex m_mtx;
+	FILE *m_pFile = nullptr;
+	std::vector<char> m_buffer;
+	uint64_t m_uiOffset = 0;
+	uint64_t m_uiRecords = 0;
+	Clock::time_point m_tPrevious;
+	std::map<std::tuple<int, uint64_t, int64_t>, LastArray> m_lastArrays;
+	std::vector<uint8_t> m_record, m_payload, m_encoded;
+};
+
+// One call of a trace
+struct TraceRecord
+{
+	ApiFunction eFunction;
+	uint64_t uiHandle;
+	int64_t iResult;
+	int64_t iStartUs;                       // since the first record
+	uint64_t uiDurationUs;
+	Span<const uint8_t> inputs;
+	Span<const uint8_t> outputs;
+};
+
+//------------------------------ TraceReader -----------------------------------
+// Class TraceReader
+//
+//  Purpose: Maps a trace and indexes its records by handle and function, so
+//           that calls are answered in their recorded order per function
+//           and handle whatever the interleaving of the threads making them.
+//           A trace cut short (e.g. a recording process that crashed) is
+//           read up to its last complete record. next() may be called from
+//           any thread.
+//------------------------------------------------------------------------------
+class TraceReader
+{
+public:
+	// Returns 0 if success, -1 otherwise (not a trace)
+	int32_t open(const std::string &strPath);
+
+	size_t records() const { return m_records.size(); }
+	const TraceRecord &record(size_t i) const { return m_records[i]; }
+	size_t size() const { return m_file.size(); }
+
+	// Next record of eFunction on uiHandle, nullptr once all were returned
+	const TraceRecord *next(uint64_t uiHandle, ApiFunction eFunction);
+	// Returns the records to next() again from the first
+	void rewind();
+
+	// Decodes the array at the cursor (after the other outputs of a record)
+	// into up to uiSize values of pdValues. Returns the number of values of
+	// the array, -1 if corrupt.
+	int64_t readArray(TraceCursor &cursor, double *pdValues, size_t uiSize) const;
+
+private:
+	struct Queue
+	{
+		std::vector<size_t> records;
+		size_t uiNext = 0;
+	};
+
+	MappedFile m_file;
+	std::vector<TraceRecord> m_records;
+	std::mutex m_mtx;
+	std::map<std::pair<uint64_t, int>, Queue> m_queues;
+};
+
+} // namespace ct400
+
+#endif
+
+
+#endif
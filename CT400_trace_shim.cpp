@@ -0,0 +1,400 @@
+//------------------------------------------------------------------------------
+// CT400_trace_shim.cpp
+//
+// Definitions of every CT400_lib.h function (CT400_api.h) that record or
+// replay the calls. Recording forwards to the real library, loaded as by the
+// metrics shim (CT400_shim.h), and costs the encoding of the call's
+// arguments and outputs; replaying answers from the mapped trace at once
+// (or at the recorded pace divided by CT400_TRACE_SPEED, if set).
+//
+// What each argument is (input, or output written by the call) is told by
+// the overloads of saveInputs, saveOutputs and loadOutputs below: by default
+// every argument is an input, and functions writing through their pointer
+// arguments have their own overloads.
+//------------------------------------------------------------------------------
+
+#define CT400_LIB_EXPORT
+#include "CT400_trace.h"
+#include "CT400_shim.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+namespace
+{
+
+using ct400::ApiFunction;
+using ct400::TraceBuffer;
+using ct400::TraceCursor;
+using ct400::TraceReader;
+
+typedef ct400::TraceWriter::Clock Clock;
+
+// Overload selector per function
+template <ApiFunction F>
+struct Call {};
+
+void putInput(TraceBuffer &b, uint64_t uiValue) { b.putVarint(uiValue); }
+void putInput(TraceBuffer &b, uint32_t uiValue) { b.putVarint(uiValue); }
+void putInput(TraceBuffer &b, int32_t iValue) { b.putSigned(iValue); }
+void putInput(TraceBuffer &b, double dValue) { b.putDouble(dValue); }
+void putInput(TraceBuffer &b, const char *pcValue) { b.putString(pcValue); }
+// written by the call, see saveOutputs
+void putInput(TraceBuffer &, int32_t *) {}
+void putInput(TraceBuffer &, double *) {}
+
+template <class E, class = typename std::enable_if<std::is_enum<E>::value>::type>
+void putInput(TraceBuffer &b, E eValue)
+{
+	b.putSigned((int64_t)eValue);
+}
+
+//------------------------------ Default ---------------------------------------
+
+template <ApiFunction F, class... A>
+void saveInputs(Call<F>, TraceBuffer &b, A... args)
+{
+	int unused[] = { 0, (putInput(b, args), 0)... };
+	(void)unused;
+}
+
+template <ApiFunction F, class... A>
+void saveOutputs(Call<F>, TraceBuffer &, int64_t, A...)
+{
+}
+
+template <ApiFunction F, class... A>
+void loadOutputs(Call<F>, const TraceReader &, TraceCursor &, int64_t, A...)
+{
+}
+
+//------------------------------ CT400_Init ------------------------------------
+
+template <ApiFunction F>
+void saveOutputs(Call<F>, TraceBuffer &b, int64_t, int32_t *piError)
+{
+	b.putSigned(piError ? *piError : 0);
+}
+
+template <ApiFunction F>
+void loadOutputs(Call<F>, const TraceReader &, TraceCursor &c, int64_t, int32_t *piError)
+{
+	const int64_t iError = c.getSigned();
+	if (piError)
+		*piError = (int32_t)iError;
+}
+
+//------------------------------ CT400_ScanWaitEnd -----------------------------
+// (same parameters as the CT400_ScanSave*File functions, whose path is an
+// input)
+
+void saveInputs(Call<ct400::API_CT400_ScanWaitEnd>, TraceBuffer &b, uint64_t uiHandle, char *)
+{
+	b.putVarint(uiHandle);
+}
+
+void saveOutputs(Call<ct400::API_CT400_ScanWaitEnd>, TraceBuffer &b, int64_t, uint64_t, char *pcError)
+{
+	b.putString(pcError);
+}
+
+void loadOutputs(Call<ct400::API_CT400_ScanWaitEnd>, const TraceReader &, TraceCursor &c, int64_t, uint64_t,
+	char *pcError)
+{
+	c.getString(pcError, 1024);
+}
+
+//------------------------------ CT400_GetNbDataPoints -------------------------
+
+template <ApiFunction F>
+void saveOutputs(Call<F>, TraceBuffer &b, int64_t, uint64_t, int32_t *piDataPoints, int32_t *piDiscardPoints)
+{
+	b.putSigned(piDataPoints ? *piDataPoints : 0);
+	b.putSigned(piDiscardPoints ? *piDiscardPoints : 0);
+}
+
+template <ApiFunction F>
+void loadOutputs(Call<F>, const TraceReader &, TraceCursor &c, int64_t, uint64_t, int32_t *piDataPoints,
+	int32_t *piDiscardPoints)
+{
+	const int64_t iDataPoints = c.getSigned();
+	const int64_t iDiscardPoints = c.getSigned();
+	if (piDataPoints)
+		*piDataPoints = (int32_t)iDataPoints;
+	if (piDiscardPoints)
+		*piDiscardPoints = (int32_t)iDiscardPoints;
+}
+
+//------------------------------ CT400_ScanGet*Array ---------------------------
+// The result is the number of values available, of which the first
+// iArraySize are written
+
+void saveArray(TraceBuffer &b, int64_t iResult, const double *pdArray, int32_t iArraySize, int64_t iKey)
+{
+	if (iResult > 0 && pdArray)
+		b.setArray(pdArray, (size_t)std::min<int64_t>(iResult, std::max(iArraySize, 0)), iKey);
+}
+
+void loadArray(const TraceReader &reader, TraceCursor &c, int64_t iResult, double *pdArray, int32_t iArraySize)
+{
+	if (iResult > 0 && pdArray)
+		reader.readArray(c, pdArray, (size_t)std::max(iArraySize, 0));
+}
+
+template <ApiFunction F>
+void saveOutputs(Call<F>, TraceBuffer &b, int64_t iResult, uint64_t, double *pdArray, int32_t iArraySize)
+{
+	saveArray(b, iResult, pdArray, iArraySize, 0);
+}
+
+template <ApiFunction F>
+void loadOutputs(Call<F>, const TraceReader &reader, TraceCursor &c, int64_t iResult, uint64_t, double *pdArray,
+	int32_t iArraySize)
+{
+	loadArray(reader, c, iResult, pdArray, iArraySize);
+}
+
+template <ApiFunction F>
+void saveOutputs(Call<F>, TraceBuffer &b, int64_t iResult, uint64_t, rDetector eDetector, double *pdArray,
+	int32_t iArraySize)
+{
+	saveArray(b, iResult, pdArray, iArraySize, eDetector);
+}
+
+template <ApiFunction F>
+void loadOutputs(Call<F>, const TraceReader &reader, TraceCursor &c, int64_t iResult, uint64_t, rDetector,
+	double *pdArray, int32_t iArraySize)
+{
+	loadArray(reader, c, iResult, pdArray, iArraySize);
+}
+
+//------------------------------ CT400_ReadPowerDetectors ----------------------
+// A mask of the pointers given, then their values
+
+template <ApiFunction F>
+void saveOutputs(Call<F>, TraceBuffer &b, int64_t, uint64_t, double *pdPout, double *pdP1, double *pdP2,
+	double *pdP3, double *pdP4, double *pdVext)
+{
+	const double *const pdValues[] = { pdPout, pdP1, pdP2, pdP3, pdP4, pdVext };
+	uint64_t uiMask = 0;
+	for (size_t i = 0; i < 6; i++)
+		uiMask |= pdValues[i] ? (uint64_t)1 << i : 0;
+	b.putVarint(uiMask);
+	for (size_t i = 0; i < 6; i++)
+		if (pdValues[i])
+			b.putDouble(*pdValues[i]);
+}
+
+template <ApiFunction F>
+void loadOutputs(Call<F>, const TraceReader &, TraceCursor &c, int64_t, uint64_t, double *pdPout, double *pdP1,
+	double *pdP2, double *pdP3, double *pdP4, double *pdVext)
+{
+	double *const pdValues[] = { pdPout, pdP1, pdP2, pdP3, pdP4, pdVext };
+	const uint64_t uiMask = c.getVarint();
+	for (size_t i = 0; i < 6; i++) {
+		if ((uiMask >> i & 1) == 0)
+			continue;
+		const double dValue = c.getDouble();
+		if (pdValues[i])
+			*pdValues[i] = dValue;
+	}
+}
+
+//------------------------------ Forwarding ------------------------------------
+// The argument list of CT400_API_LIST is parenthesised: these are applied to
+// it, e.g. InputSaver<F>{ b } (uiHandle, eDetector)
+//------------------------------------------------------------------------------
+
+template <ApiFunction F>
+struct InputSaver
+{
+	TraceBuffer &b;
+	template <class... A> void operator()(A... args) const { saveInputs(Call<F>(), b, args...); }
+};
+
+template <ApiFunction F>
+struct OutputSaver
+{
+	TraceBuffer &b;
+	int64_t iResult;
+	template <class... A> void operator()(A... args) const { saveOutputs(Call<F>(), b, iResult, args...); }
+};
+
+template <ApiFunction F>
+struct OutputLoader
+{
+	const TraceReader &reader;
+	TraceCursor &c;
+	int64_t iResult;
+	template <class... A> void operator()(A... args) const { loadOutputs(Call<F>(), reader, c, iResult, args...); }
+};
+
+int64_t failureResult(rCallResult eKind)
+{
+	return eKind == CR_HANDLE || eKind == CR_CONNECTED ? 0 : -1;
+}
+
+//------------------------------ Tracer ----------------------------------------
+// Mode and state of the library, from the environment on the first call:
+// CT400_TRACE_REPLAY names a trace to replay, else CT400_TRACE_RECORD one to
+// record; CT400_TRACE_STRICT=1 fails replayed calls whose inputs differ from
+// the recorded ones
+//------------------------------------------------------------------------------
+class Tracer
+{
+public:
+	static Tracer &instance()
+	{
+		static Tracer tracer;
+		return tracer;
+	}
+
+	rTraceMode mode() const { return m_eMode; }
+	TraceReader &reader() { return m_reader; }
+	ct400::TraceWriter &writer() { return m_writer; }
+
+	void *symbol(const char *pcName, void *pSelf)
+	{
+		return ct400::realSymbol(m_hLib, pcName, pSelf);
+	}
+
+	void record(ApiFunction eFunction, uint64_t uiHandle, int64_t iResult, Clock::time_point tStart,
+		Clock::time_point tEnd, const TraceBuffer &inputs, const TraceBuffer &outputs)
+	{
+		m_writer.append(eFunction, uiHandle, iResult, tStart, tEnd, inputs, outputs);
+		m_uiCalls.fetch_add(1, std::memory_order_relaxed);
+		if (eFunction == ct400::API_CT400_Close)
+			m_writer.flush();
+	}
+
+	// Next recorded call of eFunction on uiHandle: its result and a cursor
+	// over its outputs. Returns false if there is none (or, strict, if
+	// inputs differ from the recorded ones).
+	bool serve(ApiFunction eFunction, uint64_t uiHandle, const TraceBuffer &inputs, int64_t &iResult,
+		TraceCursor &outputs)
+	{
+		const ct400::TraceRecord *pRecord = m_reader.next(uiHandle, eFunction);
+		if (pRecord == nullptr) {
+			m_uiMissing.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		const std::vector<uint8_t> &bytes = inputs.bytes();
+		if (bytes.size() != pRecord->inputs.size()
+			|| !std::equal(bytes.begin(), bytes.end(), pRecord->inputs.begin())) {
+			m_uiMismatches.fetch_add(1, std::memory_order_relaxed);
+			if (m_bStrict)
+				return false;
+		}
+		if (m_dSpeed > 0.0)
+			std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(pRecord->uiDurationUs / m_dSpeed)));
+		m_uiCalls.fetch_add(1, std::memory_order_relaxed);
+		iResult = pRecord->iResult;
+		outputs = TraceCursor(pRecord->outputs.data(), pRecord->outputs.size());
+		return true;
+	}
+
+	void stats(rTraceStats &stats) const
+	{
+		std::memset(&stats, 0, sizeof(stats));
+		stats.eMode = m_eMode;
+		stats.uiCalls = m_uiCalls.load(std::memory_order_relaxed);
+		stats.uiMismatches = m_uiMismatches.load(std::memory_order_relaxed);
+		stats.uiMissing = m_uiMissing.load(std::memory_order_relaxed);
+		if (m_eMode == TM_REPLAY) {
+			stats.uiRecords = m_reader.records();
+			stats.uiBytes = m_reader.size();
+		}
+		else if (m_eMode == TM_RECORD) {
+			stats.uiBytes = m_writer.bytes();
+		}
+	}
+
+private:
+	Tracer()
+	{
+		const char *pcReplay = std::getenv("CT400_TRACE_REPLAY");
+		const char *pcRecord = std::getenv("CT400_TRACE_RECORD");
+		const char *pcStrict = std::getenv("CT400_TRACE_STRICT");
+		const char *pcSpeed = std::getenv("CT400_TRACE_SPEED");
+		m_bStrict = pcStrict && std::atoi(pcStrict) != 0;
+		m_dSpeed = pcSpeed ? std::atof(pcSpeed) : 0.0;
+		if (pcReplay && pcReplay[0] != '\0') {
+			// a trace that cannot be read leaves every call failing
+			m_eMode = TM_REPLAY;
+			m_reader.open(pcReplay);
+			return;
+		}
+		m_hLib = ct400::openRealLibrary((void *)&Tracer::instance);
+		if (pcRecord && pcRecord[0] != '\0' && m_writer.open(pcRecord) == 0)
+			m_eMode = TM_RECORD;
+	}
+
+	rTraceMode m_eMode = TM_OFF;
+	bool m_bStrict = false;
+	double m_dSpeed = 0.0;
+	void *m_hLib = nullptr;
+	TraceReader m_reader;
+	ct400::TraceWriter m_writer;
+	std::atomic<uint64_t> m_uiCalls{ 0 };
+	std::atomic<uint64_t> m_uiMismatches{ 0 };
+	std::atomic<uint64_t> m_uiMissing{ 0 };
+};
+
+} // namespace
+
+
+extern "C"
+{
+
+#define CT400_TRACE(ret, name, params, args, handle, kind) \
+_DECLSPEC ret __stdcall name params \
+{ \
+	typedef ret (__stdcall *Fn) params; \
+	const ApiFunction eFunction = ct400::API_##name; \
+	Tracer &tracer = Tracer::instance(); \
+	if (tracer.mode() == TM_REPLAY) { \
+		TraceBuffer inputs; \
+		InputSaver<ct400::API_##name>{ inputs } args; \
+		int64_t iResult = failureResult(kind); \
+		TraceCursor outputs; \
+		if (tracer.serve(eFunction, handle, inputs, iResult, outputs)) \
+			OutputLoader<ct400::API_##name>{ tracer.reader(), outputs, iResult } args; \
+		return (ret)iResult; \
+	} \
+	static const Fn fn = (Fn)tracer.symbol(#name, (void *)&name); \
+	if (fn == nullptr) \
+		return (ret)failureResult(kind); \
+	if (tracer.mode() != TM_RECORD) \
+		return fn args; \
+	TraceBuffer inputs, outputs; \
+	InputSaver<ct400::API_##name>{ inputs } args; \
+	const Clock::time_point tStart = Clock::now(); \
+	const ret result = fn args; \
+	const Clock::time_point tEnd = Clock::now(); \
+	OutputSaver<ct400::API_##name>{ outputs, (int64_t)result } args; \
+	tracer.record(eFunction, handle, (int64_t)result, tStart, tEnd, inputs, outputs); \
+	return result; \
+}
+
+CT400_API_LIST(CT400_TRACE)
+
+#undef CT400_TRACE
+
+_DECLSPEC int32_t __stdcall CT400_TraceGetStats(rTraceStats *pStats)
+{
+	if (pStats == nullptr)
+		return -1;
+	Tracer::instance().stats(*pStats);
+	return 0;
+}
+
+_DECLSPEC int32_t __stdcall CT400_TraceFlush()
+{
+	return Tracer::instance().writer().flush();
+}
+
+}
@@ -0,0 +1,117 @@
+/******************************************************************************/
+/* XOR/RLE codec of sample arrays                                             */
+/*                                                                            */
+/* Shared by the sweep file (CT400_sweep_file.cpp) and the call traces        */
+/* (CT400_trace.cpp).                                                         */
+/******************************************************************************/
+
+#ifndef CT400_XOR_RLE_H
+#define CT400_XOR_RLE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace ct400
+{
+
+inline uint64_t loadSample(const uint8_t *p, size_t uiWidth)
+{
+	if (uiWidth == sizeof(uint32_t)) {
+		uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+	uint64_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// XOR of consecutive samples leaves the sign, exponent and leading mantissa
+// bytes of smooth data at zero; grouping bytes by significance (planes)
+// turns those into long zero runs. uiWidth: 4 or 8 bytes
+inline void encodeXorRle(const uint8_t *pSrc, size_t uiCount, size_t uiWidth, std::vector<uint8_t> &out)
+{
+	std::vector<uint8_t> planes(uiCount * uiWidth);
+	uint64_t uiPrevious = 0;
+	for (size_t i = 0; i < uiCount; i++) {
+		uint64_t uiValue = loadSample(pSrc + i * uiWidth, uiWidth);
+		uint64_t x = uiValue ^ uiPrevious;
+		uiPrevious = uiValue;
+		for (size_t b = 0; b < uiWidth; b++)
+			planes[b * uiCount + i] = (uint8_t)(x >> (8 * b));
+	}
+
+	// token c < 128: c + 1 literal bytes follow; c >= 128: c - 127 zeros
+	out.clear();
+	size_t p = 0, n = planes.size();
+	while (p < n) {
+		size_t z = 0;
+		while (p + z < n && planes[p + z] == 0 && z < 128)
+			z++;
+		if (z >= 2 || (z == 1 && p + 1 == n)) {
+			out.push_back((uint8_t)(127 + z));
+			p += z;
+			continue;
+		}
+		size_t uiStart = p, uiLength = 0;
+		while (p < n && uiLength < 128) {
+			if (planes[p] == 0 && p + 1 < n && planes[p + 1] == 0)
+				break;
+			p++;
+			uiLength++;
+		}
+		out.push_back((uint8_t)(uiLength - 1));
+		out.insert(out.end(), planes.begin() + uiStart, planes.begin() + uiStart + uiLength);
+	}
+}
+
+// Decodes uiCount samples of uiWidth bytes (4 or 8) into pDst. Returns false
+// if pSrc is corrupt
+inline bool decodeXorRle(const uint8_t *pSrc, size_t uiSize, size_t uiCount, size_t uiWidth, uint8_t *pDst)
+{
+	std::vector<uint8_t> planes(uiCount * uiWidth);
+	size_t p = 0, q = 0, n = planes.size();
+	while (p < uiSize && q < n) {
+		uint8_t c = pSrc[p++];
+		if (c >= 128) {
+			size_t z = c - 127;
+			if (q + z > n)
+				return false;
+			std::fill(planes.begin() + q, planes.begin() + q + z, 0);
+			q += z;
+		}
+		else {
+			size_t uiLength = c + 1;
+			if (q + uiLength > n || p + uiLength > uiSize)
+				return false;
+			std::memcpy(planes.data() + q, pSrc + p, uiLength);
+			p += uiLength;
+			q += uiLength;
+		}
+	}
+	if (q != n)
+		return false;
+	uint64_t uiPrevious = 0;
+	for (size_t i = 0; i < uiCount; i++) {
+		uint64_t x = 0;
+		for (size_t b = 0; b < uiWidth; b++)
+			x |= (uint64_t)planes[b * uiCount + i] << (8 * b);
+		uiPrevious ^= x;
+		if (uiWidth == sizeof(uint32_t)) {
+			uint32_t v = (uint32_t)uiPrevious;
+			std::memcpy(pDst + i * uiWidth, &v, sizeof(v));
+		}
+		else {
+			std::memcpy(pDst + i * uiWidth, &uiPrevious, sizeof(uiPrevious));
+		}
+	}
+	return true;
+}
+
+} // namespace ct400
+
+
+#endif